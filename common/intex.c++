@@ -1,16 +1,26 @@
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
 #include <stdexcept>
 #include <sstream>
+#include <string>
 #include <chrono>
+#include <thread>
 
 #include <cerrno>
 #include <cstring>
 
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include <QDebug>
 #include <QDir>
+#include <QFile>
 #include <QFileInfo>
 #include <QStandardPaths>
 #include <QTextStream>
@@ -19,7 +29,13 @@
 #include "intex.h"
 
 
+using namespace std::literals::chrono_literals;
+
 namespace intex {
+
+/* file counters are written at most this often */
+static constexpr auto persist_interval = 2s;
+
 LogAdapter &LogAdapter::operator<<(const QString &msg) {
   Q_EMIT log(msg);
   return *this;
@@ -37,6 +53,8 @@ static QString subdirectory(const enum Subsystem subsys) {
     return "telemetry";
   case Subsystem::Log:
     return "log";
+  case Subsystem::Vna:
+    return "vna";
   }
 }
 
@@ -52,6 +70,8 @@ static QString suffix(const enum Subsystem subsys) {
     return "data";
   case Subsystem::Log:
     return "log";
+  case Subsystem::Vna:
+    return "s1p";
   }
 }
 
@@ -69,6 +89,8 @@ QString deviceName(const enum Subsystem subsys) {
     return "telementry";
   case Subsystem::Log:
     return "log";
+  case Subsystem::Vna:
+    return "vna";
   }
 
   throw std::runtime_error("deviceName for subsystem " +
@@ -85,9 +107,145 @@ static QFileInfo initializeDataDirectory(const enum Subsystem subsys) {
   return QFileInfo(path.arg(subdirectory(subsys)));
 }
 
-QString storageLocation(const enum Subsystem subsys, unsigned int *last) {
-  const unsigned max_files = 100000;
+static QString fileName(const enum Subsystem subsys, const unsigned fileno) {
   const unsigned reboot = 0;
+  return QString("%1-%2-%3.%4")
+      .arg(deviceName(subsys))
+      .arg(reboot, 3, 10, QChar('0'))
+      .arg(fileno, 5, 10, QChar('0'))
+      .arg(suffix(subsys));
+}
+
+QString stateDirectory() { return "/Volumes/Intex"; }
+
+namespace {
+/* Next file number of one subsystem. Recovered once from the persisted
+ * counter and a single directory listing, then handed out from memory. */
+struct FileCounter {
+  std::once_flag initialized;
+  std::atomic<unsigned> next{0};
+  QDir directory;
+};
+
+/* The file counters of all subsystems, one "device next" line each, in the
+ * counters file next to the flight state. Updates are written behind by a
+ * thread of their own, batched to one write per persist_interval, so
+ * allocating a name never waits for the file system. */
+class CounterFile {
+  const QString path;
+
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  std::map<QString, unsigned> counters;
+  bool dirty = false;
+  bool stopping = false;
+  std::thread thread;
+
+  void read() {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+      return;
+    QTextStream in(&file);
+    while (!in.atEnd()) {
+      const auto fields =
+          in.readLine().split(' ', QString::SkipEmptyParts);
+      bool ok;
+      const auto next = fields.size() == 2 ? fields[1].toUInt(&ok) : 0;
+      if (fields.size() == 2 && ok)
+        counters[fields[0]] = next;
+    }
+  }
+
+  /* best effort, the directory scan at start-up recovers a stale value */
+  void write(const std::map<QString, unsigned> &snapshot) {
+    std::string content;
+    for (const auto &counter : snapshot) {
+      content += counter.first.toStdString() + " " +
+                 std::to_string(counter.second) + "\n";
+    }
+
+    const auto temporary = (path + ".new").toLocal8Bit();
+    const int fd = open(temporary.constData(),
+                        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      qDebug() << "Could not persist file counters:" << strerror(errno);
+      return;
+    }
+    const auto written = ::write(fd, content.data(), content.size());
+    const bool ok = written == static_cast<ssize_t>(content.size()) &&
+                    fdatasync(fd) == 0;
+    close(fd);
+    if (!ok || rename(temporary.constData(), path.toLocal8Bit().constData()))
+      qDebug() << "Could not persist file counters:" << strerror(errno);
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      wakeup.wait(lock, [this] { return dirty || stopping; });
+      if (!dirty)
+        return;
+      dirty = false;
+      const auto snapshot = counters;
+      lock.unlock();
+      write(snapshot);
+      lock.lock();
+      wakeup.wait_for(lock, persist_interval, [this] { return stopping; });
+    }
+  }
+
+public:
+  explicit CounterFile(QString path_) : path(std::move(path_)) {
+    read();
+    thread = std::thread([this] { run(); });
+  }
+
+  /* Writes the last update */
+  ~CounterFile() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wakeup.notify_all();
+    thread.join();
+  }
+
+  unsigned load(const QString &device) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto counter = counters.find(device);
+    return counter == counters.end() ? 0 : counter->second;
+  }
+
+  void store(const QString &device, const unsigned next) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto &counter = counters[device];
+      /* names are handed out concurrently; keep the highest */
+      if (next <= counter)
+        return;
+      counter = next;
+      dirty = true;
+    }
+    wakeup.notify_all();
+  }
+};
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wexit-time-destructors"
+static FileCounter &fileCounter(const enum Subsystem subsys) {
+  static std::array<FileCounter, 7> counters;
+  return counters.at(static_cast<size_t>(subsys));
+}
+
+static CounterFile &counterFile() {
+  static CounterFile file(QDir(stateDirectory()).filePath("counters"));
+  return file;
+}
+#pragma clang diagnostic pop
+
+static void initializeCounter(const enum Subsystem subsys,
+                              FileCounter &counter) {
   QFileInfo basepath(initializeDataDirectory(subsys));
 
   if (!basepath.exists()) {
@@ -104,29 +262,58 @@ QString storageLocation(const enum Subsystem subsys, unsigned int *last) {
                              " is not a directory.");
   }
 
-  auto directory = QDir(basepath.filePath());
-  auto suffix_ = suffix(subsys);
-  auto devName = deviceName(subsys);
-  auto start = (last != nullptr) ? *last : 0;
-
-  for (auto fileno = start; fileno < max_files; ++fileno) {
-    auto file = directory.filePath(QString("%1-%2-%3.%4")
-                                       .arg(devName)
-                                       .arg(reboot, 3, 10, QChar('0'))
-                                       .arg(fileno, 5, 10, QChar('0'))
-                                       .arg(suffix_));
-    if (!QFileInfo::exists(file)) {
-      qDebug() << "Choosing file" << file;
-      if (last != nullptr)
-        *last = fileno;
-      return file;
-    } else {
-      qDebug() << "Skipping existing file" << file;
+  counter.directory = QDir(basepath.filePath());
+  unsigned next = counterFile().load(deviceName(subsys));
+
+  /* files may have been created after the counter was last written */
+  const QString prefix = QString("%1-%2-")
+                             .arg(deviceName(subsys))
+                             .arg(0, 3, 10, QChar('0'));
+  for (const auto &entry : counter.directory.entryList(
+           QStringList(prefix + "*." + suffix(subsys)), QDir::Files)) {
+    bool ok;
+    const auto fileno =
+        entry.mid(prefix.size(), entry.lastIndexOf('.') - prefix.size())
+            .toUInt(&ok);
+    if (ok && fileno >= next)
+      next = fileno + 1;
+  }
+
+  qDebug() << "Next" << deviceName(subsys) << "file number is" << next;
+  counter.next = next;
+}
+
+void initializeStorage() {
+  for (const auto subsys : {Subsystem::Video0, Subsystem::Video1,
+                            Subsystem::Audio0, Subsystem::Audio1,
+                            Subsystem::Telemetry, Subsystem::Log,
+                            Subsystem::Vna}) {
+    try {
+      auto &counter = fileCounter(subsys);
+      std::call_once(counter.initialized, initializeCounter, subsys,
+                     std::ref(counter));
+    } catch (const std::runtime_error &e) {
+      qCritical() << e.what();
     }
   }
+}
+
+QString storageLocation(const enum Subsystem subsys) {
+  const unsigned max_files = 100000;
+  auto &counter = fileCounter(subsys);
+  std::call_once(counter.initialized, initializeCounter, subsys,
+                 std::ref(counter));
+
+  const auto fileno = counter.next++;
+  if (fileno >= max_files) {
+    qDebug() << "Maximum number of files reached.";
+    throw std::runtime_error("Maximum number of files reached.");
+  }
 
-  qDebug() << "Maximum number of files reached.";
-  throw std::runtime_error("Maximum number of files reached.");
+  counterFile().store(deviceName(subsys), fileno + 1);
+  auto file = counter.directory.filePath(fileName(subsys, fileno));
+  qDebug() << "Choosing file" << file;
+  return file;
 }
 
 QByteArrayMessageReader::QByteArrayMessageReader(QByteArray &buffer_,
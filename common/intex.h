@@ -36,9 +36,15 @@ Q_SIGNALS:
   // clang-format on
 };
 
-enum class Subsystem { Video0, Video1, Audio0, Audio1, Telemetry, Log };
-QString storageLocation(const enum Subsystem subsys, unsigned int *last =
-    nullptr);
+enum class Subsystem { Video0, Video1, Audio0, Audio1, Telemetry, Log, Vna };
+/* Recover the file counters of all subsystems; otherwise this happens on the
+ * first storageLocation() call of each subsystem. */
+void initializeStorage();
+/* Name of the next file of a subsystem. Thread-safe and does not touch the
+ * file system; the counter is persisted behind the caller's back. */
+QString storageLocation(const enum Subsystem subsys);
+/* Holds the flight state and the file counters */
+QString stateDirectory();
 QString deviceName(const enum Subsystem subsys);
 
 static constexpr const char *to_string(const AutoAction action) {
@@ -0,0 +1,134 @@
+#include <stdexcept>
+#include <string>
+
+#include <QDebug>
+
+#include "pipeline-builder.h"
+
+namespace intex {
+
+static const char *leaky_name(const QueueLimits::Leaky leaky) {
+  switch (leaky) {
+  case QueueLimits::Leaky::No:
+    return "no";
+  case QueueLimits::Leaky::Upstream:
+    return "upstream";
+  case QueueLimits::Leaky::Downstream:
+    return "downstream";
+  }
+}
+
+static std::string element_name(const QGst::ElementPtr &element) {
+  return element->name().toStdString();
+}
+
+PipelineBuilder::PipelineBuilder(const char *name)
+    : pipeline_(QGst::Pipeline::create(name)) {}
+
+QGst::ElementPtr PipelineBuilder::make(const char *factory, const char *name,
+                                       Properties properties) {
+  auto element = QGst::ElementFactory::make(factory, name);
+  if (!element) {
+    throw std::runtime_error(std::string("Could not create element ") +
+                             factory);
+  }
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wold-style-cast"
+  auto object = G_OBJECT(static_cast<GstElement *>(element));
+  for (const auto &property : properties) {
+    if (!g_object_class_find_property(G_OBJECT_GET_CLASS(object),
+                                      property.first)) {
+      qWarning() << "Element" << factory << "has no property"
+                 << property.first;
+      continue;
+    }
+    gst_util_set_object_arg(object, property.first,
+                            property.second.toUtf8().constData());
+  }
+#pragma clang diagnostic pop
+
+  pipeline_->add(element);
+  return element;
+}
+
+QGst::ElementPtr PipelineBuilder::make(const char *factory,
+                                       Properties properties) {
+  return make(factory, nullptr, properties);
+}
+
+QGst::ElementPtr PipelineBuilder::queue(const QueueLimits &limits,
+                                        const char *name) {
+  using namespace std::chrono;
+  const auto time = static_cast<quint64>(nanoseconds(limits.time).count());
+  auto queue = make("queue", name, {{"leaky", leaky_name(limits.leaky)}});
+  queue->setProperty("max-size-buffers", limits.buffers);
+  queue->setProperty("max-size-bytes", limits.bytes);
+  queue->setProperty("max-size-time", time);
+  return queue;
+}
+
+QGst::ElementPtr PipelineBuilder::capsfilter(const char *caps) {
+  auto filter = make("capsfilter");
+  filter->setProperty("caps", QGst::Caps::fromString(caps));
+  return filter;
+}
+
+QGst::ElementPtr
+PipelineBuilder::chain(std::initializer_list<QGst::ElementPtr> elements) {
+  QGst::ElementPtr prev;
+  for (const auto &element : elements) {
+    if (prev && !prev->link(element)) {
+      throw std::runtime_error("Could not link " + element_name(prev) +
+                               " to " + element_name(element));
+    }
+    prev = element;
+  }
+  return prev;
+}
+
+void PipelineBuilder::link(const QGst::ElementPtr &src, const char *srcpad,
+                           const QGst::ElementPtr &sink,
+                           const char *sinkpad) {
+  if (!src->link(srcpad, sink, sinkpad)) {
+    throw std::runtime_error("Could not link " + element_name(src) + "." +
+                             srcpad + " to " + element_name(sink));
+  }
+}
+
+namespace {
+struct DynamicLink {
+  std::string prefix;
+  QGst::ElementPtr sink;
+};
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wold-style-cast"
+static void on_pad_added(GstElement *src, GstPad *pad, gpointer user_data) {
+  auto link = static_cast<DynamicLink *>(user_data);
+  gchar *name = gst_pad_get_name(pad);
+  const bool match = GST_PAD_IS_SRC(pad) &&
+                     g_str_has_prefix(name, link->prefix.c_str());
+
+  if (match && !gst_element_link_pads(
+                   src, name, static_cast<GstElement *>(link->sink), nullptr)) {
+    qWarning() << "Could not link" << name << "to" << link->sink->name();
+  }
+  g_free(name);
+}
+
+static void free_link(gpointer data, GClosure *) {
+  delete static_cast<DynamicLink *>(data);
+}
+
+void PipelineBuilder::linkDynamic(const QGst::ElementPtr &src,
+                                  const char *prefix,
+                                  const QGst::ElementPtr &sink) {
+  g_signal_connect_data(static_cast<GstElement *>(src), "pad-added",
+                        G_CALLBACK(on_pad_added),
+                        new DynamicLink{prefix, sink}, free_link,
+                        static_cast<GConnectFlags>(0));
+}
+#pragma clang diagnostic pop
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <initializer_list>
+#include <utility>
+
+#include <cstdint>
+
+#include <QString>
+
+#include "qgst.h"
+
+namespace intex {
+
+/* Size and drop policy of one queue. A zero limit is unlimited. */
+struct QueueLimits {
+  enum class Leaky : uint8_t { No, Upstream, Downstream };
+
+  unsigned buffers;
+  unsigned bytes;
+  std::chrono::milliseconds time;
+  Leaky leaky;
+};
+
+/* Builds a pipeline element by element instead of parsing a gst-launch
+ * description. The returned element handles stay valid for the lifetime of
+ * the pipeline, so properties are changed without looking elements up by
+ * name. All methods throw std::runtime_error if an element is missing or a
+ * link fails.
+ */
+class PipelineBuilder {
+  QGst::PipelinePtr pipeline_;
+
+public:
+  /* Property values are strings, converted like gst-launch does */
+  using Properties = std::initializer_list<std::pair<const char *, QString>>;
+
+  explicit PipelineBuilder(const char *name = nullptr);
+
+  QGst::ElementPtr make(const char *factory, const char *name = nullptr,
+                        Properties properties = {});
+  QGst::ElementPtr make(const char *factory, Properties properties);
+  QGst::ElementPtr queue(const QueueLimits &limits,
+                         const char *name = nullptr);
+  QGst::ElementPtr capsfilter(const char *caps);
+
+  /* Links each element to the next, requesting pads where necessary.
+   * Returns the last element. */
+  QGst::ElementPtr chain(std::initializer_list<QGst::ElementPtr> elements);
+  /* Links two pads by name; request pads are requested. A null sink pad name
+   * picks any compatible pad. */
+  void link(const QGst::ElementPtr &src, const char *srcpad,
+            const QGst::ElementPtr &sink, const char *sinkpad = nullptr);
+  /* Links the sometimes pad of src whose name starts with prefix to sink as
+   * soon as it appears */
+  void linkDynamic(const QGst::ElementPtr &src, const char *prefix,
+                   const QGst::ElementPtr &sink);
+
+  QGst::PipelinePtr pipeline() const { return pipeline_; }
+};
+}
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "pipeline-monitor.h"
+
+using namespace std::chrono;
+
+namespace intex {
+
+/* frames in flight inside an encoder */
+static constexpr size_t max_pending = 64;
+
+namespace {
+struct Encoder {
+  std::map<GstClockTime, steady_clock::time_point> pending; /* PTS */
+  uint64_t frames = 0;
+  nanoseconds total{0};
+  nanoseconds max{0};
+};
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wold-style-cast"
+static double fill_level(const QGst::ElementPtr &queue) {
+  guint buffers = 0, max_buffers = 0, bytes = 0, max_bytes = 0;
+  guint64 time = 0, max_time = 0;
+  g_object_get(static_cast<GstElement *>(queue), "current-level-buffers",
+               &buffers, "max-size-buffers", &max_buffers,
+               "current-level-bytes", &bytes, "max-size-bytes", &max_bytes,
+               "current-level-time", &time, "max-size-time", &max_time, NULL);
+
+  auto level = 0.0;
+  auto ratio = [&level](const double current, const double limit) {
+    if (limit > 0)
+      level = std::max(level, current / limit);
+  };
+  ratio(buffers, max_buffers);
+  ratio(bytes, max_bytes);
+  ratio(static_cast<double>(time), static_cast<double>(max_time));
+  return level;
+}
+
+struct PipelineMonitor::Impl {
+  std::mutex mutex;
+  std::deque<QGst::ElementPtr> queues;
+  std::deque<std::atomic<uint64_t>> overruns;
+  std::deque<Encoder> encoders;
+  std::deque<std::atomic<uint64_t>> bytes;
+  steady_clock::time_point last = steady_clock::now();
+
+  /* released by the monitor; the callbacks keep the state alive */
+  std::vector<std::pair<QGst::ElementPtr, gulong>> handlers;
+  std::vector<std::pair<QGst::PadPtr, gulong>> probes;
+
+  struct Hook {
+    std::shared_ptr<Impl> impl;
+    size_t index;
+  };
+
+  static void release(gpointer data) { delete static_cast<Hook *>(data); }
+  static void release_closure(gpointer data, GClosure *) { release(data); }
+
+  static void on_overrun(GstElement *, gpointer data) {
+    auto hook = static_cast<Hook *>(data);
+    ++hook->impl->overruns[hook->index];
+  }
+
+  static GstPadProbeReturn on_encoder_input(GstPad *, GstPadProbeInfo *info,
+                                            gpointer data) {
+    auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!GST_BUFFER_PTS_IS_VALID(buffer))
+      return GST_PAD_PROBE_OK;
+    const auto now = steady_clock::now();
+
+    auto hook = static_cast<Hook *>(data);
+    auto &impl = *hook->impl;
+    std::lock_guard<std::mutex> lock(impl.mutex);
+    auto &encoder = impl.encoders[hook->index];
+    encoder.pending[GST_BUFFER_PTS(buffer)] = now;
+    if (encoder.pending.size() > max_pending)
+      encoder.pending.erase(encoder.pending.begin());
+    return GST_PAD_PROBE_OK;
+  }
+
+  static GstPadProbeReturn on_encoder_output(GstPad *, GstPadProbeInfo *info,
+                                             gpointer data) {
+    auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!GST_BUFFER_PTS_IS_VALID(buffer))
+      return GST_PAD_PROBE_OK;
+    const auto now = steady_clock::now();
+
+    auto hook = static_cast<Hook *>(data);
+    auto &impl = *hook->impl;
+    std::lock_guard<std::mutex> lock(impl.mutex);
+    auto &encoder = impl.encoders[hook->index];
+    auto it = encoder.pending.find(GST_BUFFER_PTS(buffer));
+    if (it == encoder.pending.end())
+      return GST_PAD_PROBE_OK;
+    const auto elapsed = duration_cast<nanoseconds>(now - it->second);
+    ++encoder.frames;
+    encoder.total += elapsed;
+    encoder.max = std::max(encoder.max, elapsed);
+    /* frames the encoder dropped */
+    encoder.pending.erase(encoder.pending.begin(), ++it);
+    return GST_PAD_PROBE_OK;
+  }
+
+  static GstPadProbeReturn on_data(GstPad *, GstPadProbeInfo *info,
+                                   gpointer data) {
+    auto hook = static_cast<Hook *>(data);
+    uint64_t size = 0;
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+      size = gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info));
+    } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+      size = gst_buffer_list_calculate_size(
+          GST_PAD_PROBE_INFO_BUFFER_LIST(info));
+    }
+    hook->impl->bytes[hook->index] += size;
+    return GST_PAD_PROBE_OK;
+  }
+
+  void add_probe(const std::shared_ptr<Impl> &self, const QGst::PadPtr &pad,
+                 const GstPadProbeType type, GstPadProbeCallback callback,
+                 const size_t index) {
+    const auto id = gst_pad_add_probe(pad, type, callback,
+                                      new Hook{self, index}, release);
+    probes.emplace_back(pad, id);
+  }
+};
+
+PipelineMonitor::PipelineMonitor() : d(std::make_shared<Impl>()) {}
+
+PipelineMonitor::~PipelineMonitor() {
+  for (auto &handler : d->handlers)
+    g_signal_handler_disconnect(static_cast<GstElement *>(handler.first),
+                                handler.second);
+  for (auto &probe : d->probes)
+    gst_pad_remove_probe(probe.first, probe.second);
+  d->handlers.clear();
+  d->probes.clear();
+  std::lock_guard<std::mutex> lock(d->mutex);
+  d->queues.clear();
+}
+
+size_t PipelineMonitor::watchQueue(const QGst::ElementPtr &queue) {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  const auto index = d->queues.size();
+  d->queues.push_back(queue);
+  d->overruns.emplace_back(0);
+  const auto id = g_signal_connect_data(
+      static_cast<GstElement *>(queue), "overrun",
+      G_CALLBACK(Impl::on_overrun), new Impl::Hook{d, index},
+      Impl::release_closure, static_cast<GConnectFlags>(0));
+  d->handlers.emplace_back(queue, id);
+  return index;
+}
+
+size_t PipelineMonitor::watchEncoder(const QGst::ElementPtr &encoder) {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  const auto index = d->encoders.size();
+  d->encoders.emplace_back();
+  d->add_probe(d, encoder->getStaticPad("sink"), GST_PAD_PROBE_TYPE_BUFFER,
+               Impl::on_encoder_input, index);
+  d->add_probe(d, encoder->getStaticPad("src"), GST_PAD_PROBE_TYPE_BUFFER,
+               Impl::on_encoder_output, index);
+  return index;
+}
+
+size_t PipelineMonitor::watchRate(const QGst::PadPtr &pad) {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  const auto index = d->bytes.size();
+  d->bytes.emplace_back(0);
+  d->add_probe(d, pad,
+               static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER |
+                                            GST_PAD_PROBE_TYPE_BUFFER_LIST),
+               Impl::on_data, index);
+  return index;
+}
+#pragma clang diagnostic pop
+
+PipelineMonitor::Sample PipelineMonitor::sample() {
+  Sample sample;
+  std::lock_guard<std::mutex> lock(d->mutex);
+  const auto now = steady_clock::now();
+  const auto interval = duration_cast<duration<double>>(now - d->last);
+  d->last = now;
+
+  for (size_t i = 0; i < d->queues.size(); ++i) {
+    sample.queues.push_back(
+        {fill_level(d->queues[i]), d->overruns[i].exchange(0)});
+  }
+
+  for (auto &encoder : d->encoders) {
+    const auto frames = encoder.frames;
+    const auto mean =
+        frames ? encoder.total / static_cast<nanoseconds::rep>(frames)
+               : nanoseconds(0);
+    sample.encoders.push_back({frames, duration_cast<microseconds>(mean),
+                               duration_cast<microseconds>(encoder.max)});
+    encoder.frames = 0;
+    encoder.total = encoder.max = nanoseconds(0);
+  }
+
+  for (auto &bytes : d->bytes) {
+    const auto count = static_cast<double>(bytes.exchange(0));
+    sample.rates.push_back(interval.count() > 0 ? count / interval.count()
+                                                : 0.0);
+  }
+  return sample;
+}
+}
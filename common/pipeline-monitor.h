@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "qgst.h"
+
+namespace intex {
+
+struct QueueSample {
+  double level;      /* fill level against the tightest limit, 0 to 1 */
+  uint64_t overruns; /* times the queue ran full */
+};
+
+struct EncoderSample {
+  uint64_t frames;
+  std::chrono::microseconds mean; /* from entering to leaving the encoder */
+  std::chrono::microseconds max;
+};
+
+/* Instruments queues, encoders and pads of a running pipeline. Watches are
+ * added while the pipeline is built; sample() is thread-safe and returns the
+ * counters since its previous call, every watch at the index it was returned.
+ */
+class PipelineMonitor {
+  struct Impl;
+  std::shared_ptr<Impl> d;
+
+public:
+  struct Sample {
+    std::vector<QueueSample> queues;
+    std::vector<EncoderSample> encoders;
+    std::vector<double> rates; /* bytes per second */
+  };
+
+  PipelineMonitor();
+  ~PipelineMonitor();
+  PipelineMonitor(const PipelineMonitor &) = delete;
+  PipelineMonitor &operator=(const PipelineMonitor &) = delete;
+
+  size_t watchQueue(const QGst::ElementPtr &queue);
+  /* Frames are matched by timestamp between the sink and the src pad */
+  size_t watchEncoder(const QGst::ElementPtr &encoder);
+  /* Bytes passing pad */
+  size_t watchRate(const QGst::PadPtr &pad);
+  Sample sample();
+};
+}
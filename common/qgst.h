@@ -7,6 +7,7 @@
 #include <QGlib/Error>
 
 #include <QGst/Bus>
+#include <QGst/Caps>
 #include <QGst/Element>
 #include <QGst/ElementFactory>
 #include <QGst/Event>
@@ -17,6 +18,7 @@
 #include <QGst/Pad>
 #include <QGst/Parse>
 #include <QGst/Pipeline>
+#include <QGst/Query>
 #include <QGst/Structure>
 
 #include <gst/gst.h>
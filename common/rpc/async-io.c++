@@ -536,12 +536,18 @@ private:
   kj::WaitScope waitScope;
 };
 
-QtAsyncIoContext setupAsyncIo() {
+AsyncIoContext setupAsyncIo() {
   auto lowLevel = kj::heap<QtLowLevelAsyncIoProvider>();
   auto ioProvider = kj::newAsyncIoProvider(*lowLevel);
   auto &waitScope = lowLevel->getWaitScope();
   return {kj::mv(lowLevel), kj::mv(ioProvider), waitScope};
 }
+
+AsyncIoContext setupNativeAsyncIo() {
+  /* the wait scope lives in the low level provider */
+  auto io = kj::setupAsyncIo();
+  return {kj::mv(io.lowLevelProvider), kj::mv(io.provider), io.waitScope};
+}
 }
 }
 
@@ -6,12 +6,15 @@
 namespace intex {
 namespace rpc {
 
-struct QtAsyncIoContext {
+struct AsyncIoContext {
   kj::Own<kj::LowLevelAsyncIoProvider> lowLevelProvider;
   kj::Own<kj::AsyncIoProvider> provider;
   kj::WaitScope &waitScope;
 };
 
-QtAsyncIoContext setupAsyncIo();
+/* Event loop driven by the Qt event loop of the calling thread */
+AsyncIoContext setupAsyncIo();
+/* kj's own epoll event loop, for threads without a Qt event loop */
+AsyncIoContext setupNativeAsyncIo();
 }
 }
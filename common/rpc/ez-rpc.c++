@@ -21,14 +21,27 @@
 
 #include <map>
 #include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include <capnp/rpc-twoparty.h>
 #include <capnp/rpc.capnp.h>
 #include <kj/debug.h>
 #include <kj/threadlocal.h>
 
+#include <QCoreApplication>
 #include <QDebug>
+#include <QEvent>
 #include <QTimer>
 
 #include "async-io.h"
@@ -48,7 +61,10 @@ using namespace capnp::rpc;
 
 class EzRpcContext: public kj::Refcounted {
 public:
-  EzRpcContext(): ioContext(intex::rpc::setupAsyncIo()) {
+  EzRpcContext() : EzRpcContext(intex::rpc::setupAsyncIo(), false) {}
+
+  EzRpcContext(AsyncIoContext &&io, const bool native)
+      : ioContext(kj::mv(io)), native(native) {
     threadEzContext = this;
   }
 
@@ -72,6 +88,9 @@ public:
     return *ioContext.lowLevelProvider;
   }
 
+  // kj's own event loop, without Qt timers or socket notifiers.
+  bool isNative() const { return native; }
+
   static kj::Own<EzRpcContext> getThreadLocal() {
     EzRpcContext* existing = threadEzContext;
     if (existing != nullptr) {
@@ -82,7 +101,8 @@ public:
   }
 
 private:
-  QtAsyncIoContext ioContext;
+  AsyncIoContext ioContext;
+  bool native;
 };
 
 // =======================================================================================
@@ -140,7 +160,6 @@ public:
   };
 
   decltype(auto) connect() {
-    using namespace std::literals::chrono_literals;
     Q_EMIT disconnected();
     return context->getIoProvider()
         .getNetwork()
@@ -152,10 +171,7 @@ public:
             [this](kj::Own<kj::AsyncIoStream> &&stream) {
               auto ctx = kj::heap<ClientContext>(kj::mv(stream), readerOpts_);
               ctx->network.onDisconnect()
-                  .then([this]() {
-                    QTimer::singleShot((1000ms).count(), this,
-                                       &Impl::reconnect);
-                  })
+                  .then([this]() { reconnectLater(); })
                   .detach([](auto &&exception) {
                     qDebug() << exception.getDescription().cStr();
                   });
@@ -164,13 +180,29 @@ public:
             },
             [this](auto &&exception) {
               qDebug() << exception.getDescription().cStr();
-              QTimer::singleShot((1000ms).count(), this, &Impl::reconnect);
+              reconnectLater();
             })
         .fork();
   }
 
   void reconnect() { setupPromise = kj::heap(connect()); }
 
+  void reconnectLater() {
+    using namespace std::literals::chrono_literals;
+    if (!context->isNative()) {
+      QTimer::singleShot((1000ms).count(), this, &Impl::reconnect);
+      return;
+    }
+    // No Qt event loop runs timers on this thread.
+    reconnecting = context->getIoProvider()
+                       .getTimer()
+                       .afterDelay(1 * kj::SECONDS)
+                       .then([this]() { reconnect(); })
+                       .eagerlyEvaluate(nullptr);
+  }
+
+  kj::Promise<void> reconnecting = nullptr;
+
   kj::Own<kj::ForkedPromise<void>> setupPromise;
   kj::Maybe<kj::Own<ClientContext>> clientContext;
   // Filled in before `setupPromise` resolves.
@@ -352,6 +384,10 @@ EzRpcServer::EzRpcServer(Capability::Client mainInterface, kj::StringPtr bindAdd
                          uint defaultPort, ReaderOptions readerOpts)
     : impl(kj::heap<Impl>(kj::mv(mainInterface), bindAddress, defaultPort, readerOpts)) {}
 
+EzRpcServer::EzRpcServer(Capability::Client mainInterface, struct sockaddr* bindAddress,
+                         uint addrSize, ReaderOptions readerOpts)
+    : impl(kj::heap<Impl>(kj::mv(mainInterface), bindAddress, addrSize, readerOpts)) {}
+
 EzRpcServer::~EzRpcServer() noexcept(false) {}
 
 void EzRpcServer::exportCap(kj::StringPtr name, Capability::Client cap) {
@@ -375,6 +411,209 @@ kj::LowLevelAsyncIoProvider& EzRpcServer::getLowLevelIoProvider() {
   return impl->context->getLowLevelIoProvider();
 }
 
+// =======================================================================================
+
+static void runPosted(const std::function<void()> &function) noexcept {
+  try {
+    function();
+  } catch (const kj::Exception &e) {
+    qCritical() << e.getDescription().cStr();
+  } catch (const std::exception &e) {
+    qCritical() << e.what();
+  } catch (...) {
+    qCritical() << "Unkown error occured" << __LINE__ << __PRETTY_FUNCTION__;
+  }
+}
+
+namespace {
+class FunctionEvent final : public QEvent {
+public:
+  explicit FunctionEvent(std::function<void()> function)
+      : QEvent(eventType()), function(std::move(function)) {}
+
+  static QEvent::Type eventType() {
+    static const auto type =
+        static_cast<QEvent::Type>(QEvent::registerEventType());
+    return type;
+  }
+
+  std::function<void()> function;
+};
+
+}
+
+void QtExecutor::post(std::function<void()> function) {
+  QCoreApplication::postEvent(this, new FunctionEvent(std::move(function)));
+}
+
+bool QtExecutor::event(QEvent *event) {
+  if (event->type() != FunctionEvent::eventType()) {
+    return QObject::event(event);
+  }
+  runPosted(static_cast<FunctionEvent *>(event)->function);
+  return true;
+}
+
+struct EzRpcThread::Impl {
+  std::mutex mutex;
+  std::vector<std::function<void()>> posted;
+  bool stopping = false;
+  bool stopped = false;
+
+  // Counts posts, read by the RPC thread to wake up.
+  int wakeup;
+  uint64_t wakeups = 0;
+
+  QtExecutor executor;
+  std::thread thread;
+
+  struct Call {
+    kj::Own<kj::PromiseFulfiller<void>> fulfiller;
+    kj::Maybe<kj::Exception> exception;
+  };
+
+  Impl() : wakeup(eventfd(0, EFD_CLOEXEC)) {
+    if (wakeup < 0) {
+      throw std::runtime_error("Could not create the RPC thread's eventfd");
+    }
+    thread = std::thread([this] { run(); });
+  }
+
+  ~Impl() noexcept { close(wakeup); }
+
+  void wake() {
+    const uint64_t one = 1;
+    if (write(wakeup, &one, sizeof(one)) < 0) {
+      qCritical() << "Could not wake the RPC thread:" << strerror(errno);
+    }
+  }
+
+  void run() noexcept {
+    try {
+      auto context = kj::refcounted<EzRpcContext>(setupNativeAsyncIo(), true);
+      auto input = context->getLowLevelIoProvider().wrapInputFd(wakeup);
+      drain(*input).wait(context->getWaitScope());
+    } catch (const kj::Exception &e) {
+      qCritical() << "RPC thread failed:" << e.getDescription().cStr();
+    } catch (const std::exception &e) {
+      qCritical() << "RPC thread failed:" << e.what();
+    }
+
+    // Nothing posted from now on would run; calls waiting for it throw.
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = true;
+    posted.clear();
+  }
+
+  kj::Promise<void> drain(kj::AsyncInputStream &input) {
+    return input.tryRead(&wakeups, sizeof(wakeups), sizeof(wakeups))
+        .then([this, &input](size_t) -> kj::Promise<void> {
+          std::vector<std::function<void()>> functions;
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            functions.swap(posted);
+          }
+          for (const auto &function : functions) {
+            runPosted(function);
+          }
+
+          std::lock_guard<std::mutex> lock(mutex);
+          // Posted functions may have posted again; their wakeup is pending.
+          if (stopping && posted.empty()) {
+            return kj::READY_NOW;
+          }
+          return drain(input);
+        });
+  }
+};
+
+EzRpcThread::EzRpcThread() : impl(kj::heap<Impl>()) {}
+
+EzRpcThread::~EzRpcThread() noexcept try {
+  stop();
+} catch (const std::exception &e) {
+  qCritical() << e.what();
+}
+
+void EzRpcThread::post(std::function<void()> function) {
+  {
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    if (impl->stopped) {
+      return;
+    }
+    impl->posted.push_back(std::move(function));
+  }
+  impl->wake();
+}
+
+void EzRpcThread::call(std::function<void()> function) {
+  // Owned by the posted function: dropping it unrun breaks the promise.
+  auto done = std::make_shared<std::promise<void>>();
+  auto result = done->get_future();
+  post([done = std::move(done), function] {
+    try {
+      function();
+      done->set_value();
+    } catch (...) {
+      done->set_exception(std::current_exception());
+    }
+  });
+  result.get();
+}
+
+void EzRpcThread::postToQt(std::function<void()> function) {
+  impl->executor.post(std::move(function));
+}
+
+kj::Promise<void> EzRpcThread::callOnQt(std::function<void()> function) {
+  auto paf = kj::newPromiseAndFulfiller<void>();
+  auto call = std::make_shared<Impl::Call>();
+  call->fulfiller = kj::mv(paf.fulfiller);
+
+  postToQt([this, call, function] {
+    try {
+      function();
+    } catch (kj::Exception &e) {
+      call->exception = kj::mv(e);
+    } catch (const std::exception &e) {
+      call->exception = kj::Exception(kj::Exception::Type::FAILED, __FILE__,
+                                      __LINE__, kj::heapString(e.what()));
+    }
+
+    post([call] {
+      // The fulfiller belongs to the RPC thread's event loop.
+      auto fulfiller = kj::mv(call->fulfiller);
+      KJ_IF_MAYBE(exception, call->exception) {
+        fulfiller->reject(kj::mv(*exception));
+      } else {
+        fulfiller->fulfill();
+      }
+    });
+  });
+
+  return kj::mv(paf.promise);
+}
+
+kj::Promise<void> EzRpcThread::afterDelay(kj::Duration delay) {
+  KJ_REQUIRE(threadEzContext != nullptr, "not called on the RPC thread");
+  return threadEzContext->getIoProvider().getTimer().afterDelay(delay);
+}
+
+void EzRpcThread::stop() {
+  {
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    impl->stopping = true;
+  }
+  impl->wake();
+
+  if (impl->thread.joinable()) {
+    impl->thread.join();
+  }
+  std::lock_guard<std::mutex> lock(impl->mutex);
+  impl->stopped = true;
+  impl->posted.clear();
+}
+
 } // namespace rpc
 } // namespace intex
 
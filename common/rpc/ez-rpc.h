@@ -22,8 +22,11 @@
 #ifndef CAPNP_EZ_RPC_H_
 #define CAPNP_EZ_RPC_H_
 
+#include <functional>
+
 #include <capnp/rpc.h>
 #include <capnp/message.h>
+#include <kj/time.h>
 
 #include <QObject>
 
@@ -170,6 +173,11 @@ public:
   // your protocol to send large data blobs in multiple small chunks -- this is much better for
   // both security and performance. See `ReaderOptions` in `message.h` for more details.
 
+  EzRpcServer(capnp::Capability::Client mainInterface, struct sockaddr* bindAddress,
+              capnp::uint addrSize, capnp::ReaderOptions readerOpts = capnp::ReaderOptions());
+  // Like the above constructor, but binds to an already-resolved socket address, before it
+  // returns.  Throws if the address cannot be bound.
+
   ~EzRpcServer() noexcept(false);
 
   void exportCap(kj::StringPtr name, capnp::Capability::Client cap);
@@ -201,6 +209,59 @@ private:
   kj::Own<Impl> impl;
 };
 
+class QtExecutor : public QObject {
+  // Runs posted functions on the thread it was created on, from that
+  // thread's Qt event loop.
+
+public:
+  void post(std::function<void()> function);
+  // Thread-safe.
+
+protected:
+  bool event(QEvent *event) override;
+};
+
+class EzRpcThread {
+  // Runs a Cap'n Proto event loop on its own thread, on kj's epoll event port
+  // rather than the Qt event loop, so RPC latency does not depend on whatever
+  // keeps the Qt thread busy.  EzRpcClients and EzRpcServers created by a
+  // posted function run on that loop and must be destroyed by one, too.  The
+  // thread creating the EzRpcThread is its Qt thread, which postToQt() and
+  // callOnQt() hand work back to.
+
+public:
+  EzRpcThread();
+  ~EzRpcThread() noexcept;
+  EzRpcThread(const EzRpcThread &) = delete;
+  EzRpcThread &operator=(const EzRpcThread &) = delete;
+
+  void post(std::function<void()> function);
+  // Runs `function` on the RPC thread.  Thread-safe.
+
+  void call(std::function<void()> function);
+  // Runs `function` on the RPC thread and waits for it.  Rethrows what it threw, or throws if
+  // the thread is gone.  Not to be called from the RPC thread.
+
+  void postToQt(std::function<void()> function);
+  // Runs `function` on the Qt thread.  Thread-safe.
+
+  kj::Promise<void> callOnQt(std::function<void()> function);
+  // Called on the RPC thread: runs `function` on the Qt thread.  The promise
+  // resolves back on the RPC thread and is broken if `function` threw.
+
+  kj::Promise<void> afterDelay(kj::Duration delay);
+  // Called on the RPC thread: resolves after `delay`, on the timer of its
+  // event loop.
+
+  void stop();
+  // Runs what was posted so far and joins the thread.  Functions posted
+  // afterwards are dropped.
+
+private:
+  struct Impl;
+  kj::Own<Impl> impl;
+};
+
 // =======================================================================================
 // inline implementation details
 
@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "telemetry-archive.h"
+
+namespace intex {
+
+static constexpr capnp::byte magic[] = {'I', 'T', 'L', 'A'};
+
+/* All fields in host byte order, which is little endian on every target */
+struct file_header {
+  capnp::byte magic[4];
+  uint16_t version;
+  uint16_t reserved;
+};
+
+struct record_header {
+  uint32_t size;
+  uint32_t crc; /* CRC-32 of the frame, unused in version 1 */
+  int64_t timestamp;
+};
+
+static_assert(sizeof(file_header) == 8, "Unexpected archive header size");
+static_assert(sizeof(record_header) == 16, "Unexpected record header size");
+
+/* CRC-32 (IEEE 802.3), to detect a record torn by a power loss */
+static uint32_t crc32(kj::ArrayPtr<const capnp::byte> data) {
+  static const auto table = [] {
+    std::array<uint32_t, 256> t;
+    for (uint32_t i = 0; i < t.size(); ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k)
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      t[i] = c;
+    }
+    return t;
+  }();
+
+  uint32_t crc = 0xffffffffu;
+  for (const auto byte : data)
+    crc = table[(crc ^ byte) & 0xff] ^ (crc >> 8);
+  return crc ^ 0xffffffffu;
+}
+
+kj::Array<capnp::byte> telemetry_archive_header() {
+  file_header header;
+  memcpy(header.magic, magic, sizeof(magic));
+  header.version = telemetry_archive_version;
+  header.reserved = 0;
+
+  auto bytes = kj::heapArray<capnp::byte>(sizeof(header));
+  memcpy(bytes.begin(), &header, sizeof(header));
+  return bytes;
+}
+
+kj::Array<capnp::byte>
+telemetry_archive_record(const int64_t timestamp,
+                         kj::ArrayPtr<const capnp::byte> frame) {
+  record_header header;
+  header.size = static_cast<uint32_t>(frame.size());
+  header.crc = crc32(frame);
+  header.timestamp = timestamp;
+
+  auto bytes = kj::heapArray<capnp::byte>(sizeof(header) + frame.size());
+  memcpy(bytes.begin(), &header, sizeof(header));
+  memcpy(bytes.begin() + sizeof(header), frame.begin(), frame.size());
+  return bytes;
+}
+
+struct TelemetryArchive::Impl {
+  /* one index entry every index_stride records */
+  static constexpr size_t index_stride = 64;
+
+  const capnp::byte *map = nullptr;
+  size_t size = 0;
+  bool legacy = true;
+  uint16_t version = 0;
+  std::vector<std::pair<int64_t, size_t>> index;
+
+  explicit Impl(const std::string &path) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      throw std::runtime_error("Could not open file '" + path +
+                               "': " + strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      const auto err = errno;
+      close(fd);
+      throw std::runtime_error("Could not stat file '" + path +
+                               "': " + strerror(err));
+    }
+
+    size = static_cast<size_t>(st.st_size);
+    if (size > 0) {
+      void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr == MAP_FAILED) {
+        const auto err = errno;
+        close(fd);
+        throw std::runtime_error("Could not map file '" + path +
+                                 "': " + strerror(err));
+      }
+      map = static_cast<const capnp::byte *>(addr);
+      /* extraction reads the file front to back */
+      madvise(addr, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    file_header header;
+    if (size >= sizeof(header)) {
+      memcpy(&header, map, sizeof(header));
+      legacy = memcmp(header.magic, magic, sizeof(magic)) != 0;
+      version = header.version;
+      if (!legacy && version > telemetry_archive_version) {
+        unmap();
+        throw std::runtime_error("Unsupported telemetry archive version " +
+                                 std::to_string(header.version));
+      }
+    }
+  }
+
+  ~Impl() { unmap(); }
+
+  void unmap() {
+    if (map)
+      munmap(const_cast<capnp::byte *>(map), size);
+    map = nullptr;
+  }
+
+  bool next(size_t &offset, Record &record) const {
+    record_header header;
+    if (size - offset < sizeof(header))
+      return false;
+    memcpy(&header, map + offset, sizeof(header));
+    if (size - offset - sizeof(header) < header.size)
+      return false;
+
+    const auto frame = kj::arrayPtr(map + offset + sizeof(header), header.size);
+    if (version >= 2 && crc32(frame) != header.crc)
+      return false;
+
+    record.timestamp = header.timestamp;
+    record.frame = frame;
+    offset += sizeof(header) + header.size;
+    return true;
+  }
+
+  void build_index() {
+    if (legacy)
+      return;
+
+    Record record;
+    size_t offset = sizeof(file_header);
+    for (size_t n = 0;; ++n) {
+      const auto current = offset;
+      if (!next(offset, record))
+        break;
+      if (n % index_stride == 0)
+        index.emplace_back(record.timestamp, current);
+    }
+  }
+};
+
+TelemetryArchive::TelemetryArchive(const std::string &path)
+    : d(std::make_unique<Impl>(path)) {
+  d->build_index();
+}
+
+TelemetryArchive::~TelemetryArchive() = default;
+
+bool TelemetryArchive::legacy() const { return d->legacy; }
+
+kj::ArrayPtr<const capnp::byte> TelemetryArchive::data() const {
+  return kj::arrayPtr(d->map, d->size);
+}
+
+size_t TelemetryArchive::begin() const {
+  return d->legacy ? 0 : std::min(d->size, sizeof(file_header));
+}
+
+size_t TelemetryArchive::seek(const int64_t timestamp) const {
+  if (d->legacy)
+    return 0;
+
+  /* last indexed record before timestamp, then scan at most one stride */
+  auto it = std::lower_bound(
+      d->index.cbegin(), d->index.cend(), timestamp,
+      [](const std::pair<int64_t, size_t> &entry, const int64_t value) {
+        return entry.first < value;
+      });
+  size_t offset = it == d->index.cbegin() ? begin() : std::prev(it)->second;
+
+  Record record;
+  for (size_t current = offset; d->next(offset, record); current = offset) {
+    if (record.timestamp >= timestamp)
+      return current;
+  }
+  return offset;
+}
+
+bool TelemetryArchive::next(size_t &offset, Record &record) const {
+  if (d->legacy)
+    return false;
+  return d->next(offset, record);
+}
+}
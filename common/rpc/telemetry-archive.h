@@ -0,0 +1,56 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <kj/array.h>
+#include <capnp/common.h>
+
+namespace intex {
+
+static constexpr uint16_t telemetry_archive_version = 2;
+
+/* The on-board telemetry archive is a file header followed by one record per
+ * telemetry frame. Every record starts with its size, a CRC and its
+ * timestamp, so a reader can index a file without decoding a single frame and
+ * stops at a record torn by a power loss. */
+kj::Array<capnp::byte> telemetry_archive_header();
+kj::Array<capnp::byte>
+telemetry_archive_record(const int64_t timestamp,
+                         kj::ArrayPtr<const capnp::byte> frame);
+
+/* Read-only, memory-mapped view of an archive file. A sparse timestamp index
+ * is built when the file is opened; seeking is a binary search over it plus
+ * a short scan of record headers. Files written before the archive format
+ * existed are mapped as well, but are flagged legacy and not indexed. */
+class TelemetryArchive {
+  struct Impl;
+  std::unique_ptr<Impl> d;
+
+public:
+  struct Record {
+    int64_t timestamp;
+    kj::ArrayPtr<const capnp::byte> frame;
+  };
+
+  explicit TelemetryArchive(const std::string &path);
+  ~TelemetryArchive();
+  TelemetryArchive(const TelemetryArchive &) = delete;
+  TelemetryArchive &operator=(const TelemetryArchive &) = delete;
+
+  bool legacy() const;
+  /* Whole mapping, for sequential decoding of legacy files */
+  kj::ArrayPtr<const capnp::byte> data() const;
+  /* Offset of the first record */
+  size_t begin() const;
+  /* Offset of the first record with a timestamp not before timestamp;
+   * assumes timestamps do not decrease through the file. */
+  size_t seek(const int64_t timestamp) const;
+  /* Read the record at offset and advance offset past it. Returns false at
+   * the end of the file or at a truncated or corrupted record. */
+  bool next(size_t &offset, Record &record) const;
+};
+}
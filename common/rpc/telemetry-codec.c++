@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <cstring>
+
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+#include <capnp/serialize-packed.h>
+
+#include "telemetry-codec.h"
+
+namespace intex {
+
+static constexpr capnp::byte magic[] = {'I', 'T', 'L', 'M'};
+
+namespace {
+class VectorOutputStream : public kj::OutputStream {
+  std::vector<capnp::byte> &buffer;
+
+public:
+  explicit VectorOutputStream(std::vector<capnp::byte> &buffer_)
+      : buffer(buffer_) {}
+
+  void write(const void *data, size_t size) override {
+    const auto begin = static_cast<const capnp::byte *>(data);
+    buffer.insert(buffer.end(), begin, begin + size);
+  }
+};
+}
+
+const char *to_string(const TelemetryError error) {
+  switch (error) {
+  case TelemetryError::NONE:
+    return "No error";
+  case TelemetryError::NOT_SAMPLED:
+    return "No sample acquired yet";
+  case TelemetryError::BUSY:
+    return "Device busy";
+  case TelemetryError::READ_FAILED:
+    return "Reading failed";
+  }
+  return "Unknown error";
+}
+
+const char *to_string(const PipelineQueue queue) {
+  switch (queue) {
+  case PipelineQueue::VIDEO_RECORD:
+    return "Video recording";
+  case PipelineQueue::AUDIO_RECORD:
+    return "Audio recording";
+  case PipelineQueue::DOWNLINK:
+    return "Downlink";
+  }
+  return "Unknown queue";
+}
+
+static int32_t offset_ms(const int64_t timestamp, const int64_t base) {
+  const int64_t ms = (timestamp - base) / 1000000;
+  return static_cast<int32_t>(
+      std::max<int64_t>(std::numeric_limits<int32_t>::min(),
+                        std::min<int64_t>(std::numeric_limits<int32_t>::max(),
+                                          ms)));
+}
+
+static void write(CompactReading::Builder reading,
+                  const TelemetryChannel channel, const TelemetryValue &value,
+                  const int64_t timestamp, const bool detailed) {
+  reading.setChannel(channel);
+  reading.setError(value.valid ? TelemetryError::NONE : value.error);
+  reading.setOffset(offset_ms(value.timestamp, timestamp));
+  if (value.valid) {
+    reading.setValue(static_cast<float>(value.value));
+    reading.setStddev(static_cast<float>(value.stddev));
+  }
+  if (!detailed)
+    return;
+
+  auto detail = reading.initDetail();
+  detail.setTimestamp(value.timestamp);
+  if (value.valid) {
+    detail.setValue(value.value);
+    detail.setMin(value.min);
+    detail.setMax(value.max);
+    detail.setStddev(value.stddev);
+  } else {
+    detail.setReason(value.reason.c_str());
+  }
+}
+
+static void write(PipelineHealth::Builder pipeline,
+                  const CameraHealth &camera) {
+  pipeline.setFeed(camera.feed);
+  auto queues =
+      pipeline.initQueues(static_cast<unsigned>(camera.queues.size()));
+  for (unsigned i = 0; i < queues.size(); ++i) {
+    queues[i].setQueue(camera.queues[i].queue);
+    queues[i].setLevel(camera.queues[i].level);
+    queues[i].setOverruns(camera.queues[i].overruns);
+  }
+  pipeline.setEncodedFrames(camera.encoded_frames);
+  pipeline.setEncodeTime(camera.encode_time);
+  pipeline.setMaxEncodeTime(camera.max_encode_time);
+  pipeline.setRecordRate(camera.record_rate);
+  pipeline.setDownlinkRate(camera.downlink_rate);
+}
+
+static CameraHealth read(PipelineHealth::Reader pipeline) {
+  CameraHealth camera;
+  camera.feed = pipeline.getFeed();
+  for (const auto queue : pipeline.getQueues()) {
+    camera.queues.push_back(
+        {queue.getQueue(), queue.getLevel(), queue.getOverruns()});
+  }
+  camera.encoded_frames = pipeline.getEncodedFrames();
+  camera.encode_time = pipeline.getEncodeTime();
+  camera.max_encode_time = pipeline.getMaxEncodeTime();
+  camera.record_rate = pipeline.getRecordRate();
+  camera.downlink_rate = pipeline.getDownlinkRate();
+  return camera;
+}
+
+kj::Array<capnp::byte>
+TelemetryEncoder::encode(const TelemetryState &state, const int64_t timestamp,
+                         kj::ArrayPtr<const TelemetryReading> batch,
+                         kj::ArrayPtr<const CameraHealth> cameras) {
+  const uint32_t seq = ++sequence;
+
+  std::array<size_t, telemetry_channels> channels;
+  size_t count = 0;
+  for (size_t i = 0; i < telemetry_channels; ++i) {
+    if (state[i].updated)
+      channels[count++] = i;
+  }
+
+  capnp::MallocMessageBuilder message;
+  auto frame = message.initRoot<CompactTelemetry>();
+  frame.setVersion(compact_telemetry_version);
+  frame.setSequence(seq);
+  frame.setTimestamp(timestamp);
+
+  auto readings =
+      frame.initReadings(static_cast<unsigned>(batch.size() + count));
+  unsigned next = 0;
+  for (const auto &reading : batch) {
+    write(readings[next++], reading.channel, reading.value, timestamp,
+          detailed);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    write(readings[next++], static_cast<TelemetryChannel>(channels[i]),
+          state[channels[i]], timestamp, detailed);
+  }
+
+  if (cameras.size() > 0) {
+    auto pipelines =
+        frame.initPipelines(static_cast<unsigned>(cameras.size()));
+    for (unsigned i = 0; i < pipelines.size(); ++i)
+      write(pipelines[i], cameras[i]);
+  }
+
+  std::vector<capnp::byte> buffer(std::begin(magic), std::end(magic));
+  VectorOutputStream out(buffer);
+  capnp::writePackedMessage(out, message);
+  return kj::heapArray<capnp::byte>(buffer.data(), buffer.size());
+}
+
+static TelemetryError classify(const std::string &reason) {
+  if (reason == "No sample acquired yet")
+    return TelemetryError::NOT_SAMPLED;
+  if (reason == "NVA measurement running")
+    return TelemetryError::BUSY;
+  return TelemetryError::READ_FAILED;
+}
+
+template <typename Reader>
+static void assign(TelemetryValue &value, Reader reading) {
+  value.updated = true;
+  value.timestamp = reading.getTimestamp();
+  value.min = value.max = value.stddev = 0.0;
+  if (reading.isError()) {
+    value.valid = false;
+    value.reason = reading.getError().getReason().cStr();
+    value.error = classify(value.reason);
+  } else {
+    value.valid = true;
+    value.error = TelemetryError::NONE;
+    value.reason.clear();
+  }
+}
+
+static void assign(TelemetryValue &value,
+                   Reading<Temperature>::Reader reading) {
+  assign<Reading<Temperature>::Reader>(value, reading);
+  if (value.valid)
+    value.value = value.min = value.max = reading.getReading().getValue();
+}
+
+static void assign(TelemetryValue &value, Reading<Pressure>::Reader reading) {
+  assign<Reading<Pressure>::Reader>(value, reading);
+  if (value.valid) {
+    value.value = reading.getReading().getValue();
+    value.min = reading.getReading().getMin();
+    value.max = reading.getReading().getMax();
+    value.stddev = reading.getReading().getStddev();
+  }
+}
+
+static void assign(TelemetryValue &value, Reading<Status>::Reader reading) {
+  assign<Reading<Status>::Reader>(value, reading);
+  if (value.valid)
+    value.value = value.min = value.max =
+        reading.getReading().getValue() ? 1.0 : 0.0;
+}
+
+void TelemetryDecoder::decode(Telemetry::Reader telemetry) {
+#define INTEX_ASSIGN(field, channel)                                           \
+  if (telemetry.has##field()) {                                                \
+    auto &value = current[channel_index(TelemetryChannel::channel)];           \
+    assign(value, telemetry.get##field());                                     \
+    readings.push_back(TelemetryReading{TelemetryChannel::channel, value});    \
+  }
+
+  INTEX_ASSIGN(CpuTemperature, CPU_TEMPERATURE)
+  INTEX_ASSIGN(VnaTemperature, VNA_TEMPERATURE)
+  INTEX_ASSIGN(BoxTemperature, BOX_TEMPERATURE)
+  INTEX_ASSIGN(AntennaInnerTemperature, ANTENNA_INNER_TEMPERATURE)
+  INTEX_ASSIGN(AntennaOuterTemperature, ANTENNA_OUTER_TEMPERATURE)
+  INTEX_ASSIGN(AtmosphereTemperature, ATMOSPHERE_TEMPERATURE)
+  INTEX_ASSIGN(TankPressure, TANK_PRESSURE)
+  INTEX_ASSIGN(AntennaPressure, ANTENNA_PRESSURE)
+  INTEX_ASSIGN(AtmosphericPressure, ATMOSPHERIC_PRESSURE)
+  INTEX_ASSIGN(InnerHeater, INNER_HEATER)
+  INTEX_ASSIGN(OuterHeater, OUTER_HEATER)
+  INTEX_ASSIGN(TankValve, TANK_VALVE)
+  INTEX_ASSIGN(OutletValve, OUTLET_VALVE)
+  INTEX_ASSIGN(Burnwire, BURNWIRE)
+#undef INTEX_ASSIGN
+}
+
+void TelemetryDecoder::decode(CompactTelemetry::Reader frame) {
+  if (frame.getVersion() > compact_telemetry_version)
+    throw std::runtime_error("Unsupported telemetry frame version " +
+                             std::to_string(frame.getVersion()));
+
+  /* frames of old downlinks may be deltas; they are applied to the
+   * channels they carry like key frames */
+  const auto base = frame.getTimestamp();
+  for (const auto reading : frame.getReadings()) {
+    const auto channel = channel_index(reading.getChannel());
+    if (channel >= telemetry_channels)
+      continue;
+
+    auto &value = current[channel];
+    value.updated = true;
+    value.timestamp = base + int64_t{reading.getOffset()} * 1000000;
+    value.error = reading.getError();
+    value.valid = value.error == TelemetryError::NONE;
+    /* archived readings carry their full precision and error reason */
+    const bool detailed = reading.hasDetail();
+    const auto detail = reading.getDetail();
+    if (detailed)
+      value.timestamp = detail.getTimestamp();
+    if (value.valid && detailed) {
+      value.value = detail.getValue();
+      value.min = detail.getMin();
+      value.max = detail.getMax();
+      value.stddev = detail.getStddev();
+      value.reason.clear();
+    } else if (value.valid) {
+      value.value = value.min = value.max =
+          static_cast<double>(reading.getValue());
+      value.stddev = static_cast<double>(reading.getStddev());
+      value.reason.clear();
+    } else if (detailed && detail.hasReason()) {
+      value.reason = detail.getReason().cStr();
+    } else {
+      value.reason = to_string(value.error);
+    }
+    readings.push_back(TelemetryReading{reading.getChannel(), value});
+  }
+
+  for (const auto pipeline : frame.getPipelines())
+    health.push_back(read(pipeline));
+}
+
+bool TelemetryDecoder::decode(kj::BufferedInputStream &in) {
+  const auto buffer = in.tryGetReadBuffer();
+  if (buffer.size() == 0)
+    return false;
+
+  for (auto &value : current)
+    value.updated = false;
+  readings.clear();
+  health.clear();
+
+  if (buffer.size() >= sizeof(magic) &&
+      memcmp(buffer.begin(), magic, sizeof(magic)) == 0) {
+    in.skip(sizeof(magic));
+    capnp::PackedMessageReader reader(in);
+    decode(reader.getRoot<CompactTelemetry>());
+  } else {
+    capnp::InputStreamMessageReader reader(in);
+    decode(reader.getRoot<Telemetry>());
+  }
+  return true;
+}
+}
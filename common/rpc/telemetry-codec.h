@@ -0,0 +1,109 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <kj/array.h>
+#include <kj/io.h>
+#include <capnp/common.h>
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wweak-vtables"
+#pragma clang diagnostic ignored "-Wnon-virtual-dtor"
+#include "rpc/intex.capnp.h"
+#pragma clang diagnostic pop
+
+namespace intex {
+
+static constexpr size_t telemetry_channels = 19;
+static constexpr uint8_t compact_telemetry_version = 1;
+
+/* One telemetry channel, independent of the frame format it came in */
+struct TelemetryValue {
+  bool updated = false; /* carried by the last frame */
+  bool valid = false;   /* a reading, not an error */
+  int64_t timestamp = 0;
+  double value = 0.0;
+  double min = 0.0;
+  double max = 0.0;
+  double stddev = 0.0;
+  TelemetryError error = TelemetryError::NOT_SAMPLED;
+  std::string reason;
+};
+using TelemetryState = std::array<TelemetryValue, telemetry_channels>;
+
+/* One reading of a channel, as carried in a frame */
+struct TelemetryReading {
+  TelemetryChannel channel;
+  TelemetryValue value;
+};
+
+/* Instrumentation of one camera pipeline, as carried in a frame */
+struct CameraHealth {
+  struct Queue {
+    PipelineQueue queue;
+    float level;
+    uint32_t overruns;
+  };
+
+  InTexFeed feed = InTexFeed::FEED0;
+  std::vector<Queue> queues;
+  uint32_t encoded_frames = 0;
+  float encode_time = 0.0f;     /* mean ms per frame */
+  float max_encode_time = 0.0f; /* ms */
+  float record_rate = 0.0f;     /* bytes per second */
+  float downlink_rate = 0.0f;   /* bytes per second */
+};
+
+static inline size_t channel_index(const TelemetryChannel channel) {
+  return static_cast<size_t>(channel);
+}
+
+const char *to_string(const TelemetryError error);
+const char *to_string(const PipelineQueue queue);
+
+/* Builds compact key frames, numbered in sequence. A detailed encoder adds
+ * every reading at full precision, with its spread and error reason, for
+ * the on-board archive. */
+class TelemetryEncoder {
+  const bool detailed;
+  uint32_t sequence = 0;
+
+public:
+  explicit TelemetryEncoder(const bool detailed_ = false)
+      : detailed(detailed_) {}
+
+  /* Only channels with updated set are sent. batch holds earlier readings
+   * taken since the previous frame; they are always sent, ahead of state.
+   * cameras are always sent as well. */
+  kj::Array<capnp::byte>
+  encode(const TelemetryState &state, const int64_t timestamp,
+         kj::ArrayPtr<const TelemetryReading> batch = nullptr,
+         kj::ArrayPtr<const CameraHealth> cameras = nullptr);
+};
+
+/* Decodes plain Telemetry messages as well as compact frames */
+class TelemetryDecoder {
+  TelemetryState current;
+  std::vector<TelemetryReading> readings;
+  std::vector<CameraHealth> health;
+
+  void decode(Telemetry::Reader telemetry);
+  void decode(CompactTelemetry::Reader frame);
+
+public:
+  /* Decode one record. The read buffer of in must hold at least the first
+   * four bytes of the record. Returns false at the end of input. */
+  bool decode(kj::BufferedInputStream &in);
+  const TelemetryState &state() const { return current; }
+  /* Every reading of the last record in the order it was sent; a channel
+   * may appear several times in a batched frame. */
+  const std::vector<TelemetryReading> &samples() const { return readings; }
+  /* Camera pipelines reported by the last record */
+  const std::vector<CameraHealth> &cameras() const { return health; }
+};
+}
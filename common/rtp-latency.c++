@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+#include <cstring>
+
+#include <gst/rtp/gstrtpbuffer.h>
+
+#include "rtp-latency.h"
+
+using namespace std::chrono;
+
+namespace intex {
+
+static constexpr guint8 capture_time_id = 1;
+/* frames in flight between the rtp and the display pad */
+static constexpr size_t max_pending = 256;
+static constexpr size_t max_delays = 1 << 16;
+
+static gint64 wall_clock() { return g_get_real_time() * 1000; }
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wold-style-cast"
+static void write_capture_time(GstBuffer *buffer, const gint64 capture) {
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  if (!gst_rtp_buffer_map(buffer, GST_MAP_READWRITE, &rtp))
+    return;
+  const guint64 value = GUINT64_TO_BE(static_cast<guint64>(capture));
+  gst_rtp_buffer_add_extension_onebyte_header(&rtp, capture_time_id, &value,
+                                              sizeof(value));
+  gst_rtp_buffer_unmap(&rtp);
+}
+
+static bool read_capture_time(GstBuffer *buffer, gint64 &capture) {
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  if (!gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp))
+    return false;
+
+  gpointer data = nullptr;
+  guint size = 0;
+  const bool found = gst_rtp_buffer_get_extension_onebyte_header(
+                         &rtp, capture_time_id, 0, &data, &size) &&
+                     size == sizeof(guint64);
+  if (found) {
+    guint64 value;
+    memcpy(&value, data, sizeof(value));
+    capture = static_cast<gint64>(GUINT64_FROM_BE(value));
+  }
+  gst_rtp_buffer_unmap(&rtp);
+  return found;
+}
+
+static GstPadProbeReturn stamp_probe(GstPad *pad, GstPadProbeInfo *info,
+                                     gpointer) {
+  GstElement *element = gst_pad_get_parent_element(pad);
+  if (element == nullptr)
+    return GST_PAD_PROBE_OK;
+  GstClock *clock = gst_element_get_clock(element);
+  if (clock == nullptr) {
+    gst_object_unref(element);
+    return GST_PAD_PROBE_OK;
+  }
+
+  /* live sources start their segment at 0, so PTS is the running time of the
+   * capture */
+  const auto now = static_cast<gint64>(gst_clock_get_time(clock)) -
+                   static_cast<gint64>(gst_element_get_base_time(element));
+  const auto realtime = wall_clock();
+  gst_object_unref(clock);
+  gst_object_unref(element);
+
+  auto stamp = [now, realtime](GstBuffer *buffer) {
+    if (GST_BUFFER_PTS_IS_VALID(buffer)) {
+      const auto age = now - static_cast<gint64>(GST_BUFFER_PTS(buffer));
+      write_capture_time(buffer, realtime - age);
+    }
+  };
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    auto buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    stamp(buffer);
+  } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    auto list =
+        gst_buffer_list_make_writable(GST_PAD_PROBE_INFO_BUFFER_LIST(info));
+    GST_PAD_PROBE_INFO_DATA(info) = list;
+    const auto length = gst_buffer_list_length(list);
+    for (guint i = 0; i < length; ++i) {
+      auto buffer = gst_buffer_make_writable(
+          gst_buffer_ref(gst_buffer_list_get(list, i)));
+      stamp(buffer);
+      gst_buffer_list_remove(list, i, 1);
+      gst_buffer_list_insert(list, static_cast<gint>(i), buffer);
+    }
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+void stampCaptureTime(const QGst::PadPtr &pad) {
+  gst_pad_add_probe(pad, static_cast<GstPadProbeType>(
+                             GST_PAD_PROBE_TYPE_BUFFER |
+                             GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                    stamp_probe, nullptr, nullptr);
+}
+#pragma clang diagnostic pop
+
+static microseconds percentile(std::vector<gint64> &delays, const double p) {
+  if (delays.empty())
+    return microseconds(0);
+  const auto last = static_cast<double>(delays.size() - 1);
+  const auto n = static_cast<size_t>(p / 100.0 * last + 0.5);
+  std::nth_element(delays.begin(), delays.begin() + static_cast<long>(n),
+                   delays.end());
+  return duration_cast<microseconds>(nanoseconds(delays[n]));
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wold-style-cast"
+struct LatencyMeter::Impl {
+  const Report report;
+  const size_t window;
+
+  /* released by the meter; the probes keep the state alive */
+  QGst::PadPtr rtp;
+  QGst::PadPtr display;
+  gulong rtp_probe = 0;
+  gulong display_probe = 0;
+
+  mutable std::mutex mutex;
+  std::map<GstClockTime, gint64> pending; /* PTS -> capture time */
+  std::vector<gint64> delays;
+
+  Impl(Report report_, const size_t window_)
+      : report(std::move(report_)), window(window_) {}
+
+  LatencyStats stats_locked() const {
+    auto copy = delays;
+    const auto max = copy.empty()
+                         ? 0
+                         : *std::max_element(copy.begin(), copy.end());
+    return {copy.size(), percentile(copy, 50), percentile(copy, 99),
+            duration_cast<microseconds>(nanoseconds(max))};
+  }
+
+  void captured(GstBuffer *buffer) {
+    gint64 capture;
+    if (!GST_BUFFER_PTS_IS_VALID(buffer) || !read_capture_time(buffer, capture))
+      return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    /* all packets of a frame carry its capture time */
+    pending.emplace(GST_BUFFER_PTS(buffer), capture);
+    if (pending.size() > max_pending)
+      pending.erase(pending.begin());
+  }
+
+  void displayed(GstBuffer *buffer) {
+    if (!GST_BUFFER_PTS_IS_VALID(buffer))
+      return;
+    const auto now = wall_clock();
+
+    LatencyStats stats;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = pending.find(GST_BUFFER_PTS(buffer));
+      if (it == pending.end())
+        return;
+      if (delays.size() < max_delays)
+        delays.push_back(now - it->second);
+      /* frames that never made it to the display */
+      pending.erase(pending.begin(), ++it);
+
+      if (window == 0 || delays.size() < window || !report)
+        return;
+      stats = stats_locked();
+      delays.clear();
+    }
+    report(stats);
+  }
+
+  template <void (Impl::*handler)(GstBuffer *)>
+  static GstPadProbeReturn probe(GstPad *, GstPadProbeInfo *info,
+                                 gpointer user_data) {
+    auto &impl = **static_cast<std::shared_ptr<Impl> *>(user_data);
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+      (impl.*handler)(GST_PAD_PROBE_INFO_BUFFER(info));
+    } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+      auto list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+      const auto length = gst_buffer_list_length(list);
+      for (guint i = 0; i < length; ++i)
+        (impl.*handler)(gst_buffer_list_get(list, i));
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  static void release(gpointer data) {
+    delete static_cast<std::shared_ptr<Impl> *>(data);
+  }
+
+  /* The probe shares ownership of the state, so a probe still running while
+   * the meter is destroyed does not touch freed memory */
+  template <void (Impl::*handler)(GstBuffer *)>
+  static gulong add_probe(const QGst::PadPtr &pad,
+                          const std::shared_ptr<Impl> &impl) {
+    return gst_pad_add_probe(
+        pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER |
+                                          GST_PAD_PROBE_TYPE_BUFFER_LIST),
+        probe<handler>, new std::shared_ptr<Impl>(impl), release);
+  }
+};
+#pragma clang diagnostic pop
+
+LatencyMeter::LatencyMeter(const QGst::PadPtr &rtp, const QGst::PadPtr &display,
+                           Report report, const size_t window)
+    : d(std::make_shared<Impl>(std::move(report), window)) {
+  d->rtp = rtp;
+  d->display = display;
+  d->rtp_probe = Impl::add_probe<&Impl::captured>(rtp, d);
+  d->display_probe = Impl::add_probe<&Impl::displayed>(display, d);
+}
+
+LatencyMeter::~LatencyMeter() {
+  gst_pad_remove_probe(d->rtp, d->rtp_probe);
+  gst_pad_remove_probe(d->display, d->display_probe);
+  d->rtp.clear();
+  d->display.clear();
+}
+
+LatencyStats LatencyMeter::stats() const {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  return d->stats_locked();
+}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#include <cstddef>
+
+#include "qgst.h"
+
+namespace intex {
+
+/* Tuning of a low-latency video receiver */
+struct ReceiveProfile {
+  std::chrono::milliseconds jitter; /* rtpbin jitter buffer latency */
+  unsigned decoder_threads;         /* 0 uses one thread per core */
+};
+
+/* Adds the wall-clock capture time of its frame to every RTP packet leaving
+ * pad, as a one-byte RTP header extension */
+void stampCaptureTime(const QGst::PadPtr &pad);
+
+struct LatencyStats {
+  size_t frames;
+  std::chrono::microseconds p50;
+  std::chrono::microseconds p99;
+  std::chrono::microseconds max;
+};
+
+/* Glass-to-glass latency of a stream sent through stampCaptureTime(). The
+ * capture time of a frame is read from its RTP packets at the rtp pad; its
+ * delay is taken when it passes the display pad. Both hosts need
+ * synchronised clocks. Every window frames, report is called on the
+ * streaming thread with the statistics of that window.
+ */
+class LatencyMeter {
+  struct Impl;
+  std::shared_ptr<Impl> d;
+
+public:
+  using Report = std::function<void(const LatencyStats &stats)>;
+
+  LatencyMeter(const QGst::PadPtr &rtp, const QGst::PadPtr &display,
+               Report report = {}, const size_t window = 300);
+  ~LatencyMeter();
+  LatencyMeter(const LatencyMeter &) = delete;
+  LatencyMeter &operator=(const LatencyMeter &) = delete;
+
+  /* Statistics of the frames measured since the last report */
+  LatencyStats stats() const;
+};
+}
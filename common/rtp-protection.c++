@@ -0,0 +1,273 @@
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#include <QDebug>
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdocumentation"
+#pragma clang diagnostic ignored "-Wdocumentation-unknown-command"
+#pragma clang diagnostic ignored "-Wold-style-cast"
+#pragma clang diagnostic ignored "-Wshift-sign-overflow"
+#pragma clang diagnostic ignored "-Wcast-align"
+#pragma clang diagnostic ignored "-Wreserved-id-macro"
+#pragma clang diagnostic ignored "-Wconversion"
+#include <gst/video/video.h>
+#pragma clang diagnostic pop
+
+#include "rtp-protection.h"
+
+using namespace std::chrono;
+using namespace std::literals::chrono_literals;
+
+namespace intex {
+
+/* sent packets kept for retransmission, in ms */
+static constexpr guint rtx_history = 1000;
+/* received packets kept for FEC recovery */
+static constexpr auto fec_history = 250ms;
+/* a requested keyframe takes a while to arrive; requests in between would
+ * only load the lossy link with more keyframes */
+static constexpr auto keyframe_interval = 1s;
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wold-style-cast"
+static void set_arg(GstElement *element, const char *property,
+                    const char *value) {
+  if (g_object_class_find_property(G_OBJECT_GET_CLASS(element), property))
+    gst_util_set_object_arg(G_OBJECT(element), property, value);
+  else
+    qWarning() << "rtpbin has no property" << property;
+}
+
+static bool has_signal(GstElement *element, const char *signal) {
+  return g_signal_lookup(signal, G_OBJECT_TYPE(element)) != 0;
+}
+
+static bool have_factory(const char *factory) {
+  auto found = gst_element_factory_find(factory);
+  if (found)
+    gst_object_unref(found);
+  return found != nullptr;
+}
+
+/* Maps the video payload to its retransmission payload */
+static void set_rtx_map(GstElement *rtx) {
+  auto map = gst_structure_new("application/x-rtp-pt-map",
+                               std::to_string(video_payload).c_str(),
+                               G_TYPE_UINT, rtx_payload, nullptr);
+  g_object_set(rtx, "payload-type-map", map, nullptr);
+  gst_structure_free(map);
+}
+
+/* Wraps element in a bin with the pads rtpbin expects of an auxiliary
+ * element of session */
+static GstElement *aux_bin(GstElement *element, const guint session) {
+  auto bin = gst_bin_new(nullptr);
+  gst_bin_add(GST_BIN(bin), element);
+  for (const std::string direction : {"src", "sink"}) {
+    auto pad = gst_element_get_static_pad(element, direction.c_str());
+    const auto name = direction + "_" + std::to_string(session);
+    gst_element_add_pad(bin, gst_ghost_pad_new(name.c_str(), pad));
+    gst_object_unref(pad);
+  }
+  return bin;
+}
+
+static GstElement *request_aux_sender(GstElement *, guint session,
+                                      gpointer) {
+  auto rtx = gst_element_factory_make("rtprtxsend", nullptr);
+  if (!rtx)
+    return nullptr;
+  set_rtx_map(rtx);
+  g_object_set(rtx, "max-size-time", rtx_history, nullptr);
+  return aux_bin(rtx, session);
+}
+
+QGst::ElementPtr protectSender(PipelineBuilder &builder,
+                               const QGst::ElementPtr &rtpbin,
+                               const Protection &protection) {
+  GstElement *bin = rtpbin;
+  /* early feedback, so NACKs and keyframe requests are not held back to the
+   * regular RTCP interval */
+  set_arg(bin, "rtp-profile", "avpf");
+
+  if (protection.retransmission && have_factory("rtprtxsend")) {
+    g_signal_connect(bin, "request-aux-sender",
+                     G_CALLBACK(request_aux_sender), nullptr);
+  } else if (protection.retransmission) {
+    qWarning() << "No rtprtxsend, sending without retransmissions";
+  }
+
+  QGst::ElementPtr fec;
+  try {
+    fec = builder.make(
+        "rtpulpfecenc",
+        {{"pt", QString::number(fec_payload)},
+         {"percentage", QString::number(protection.fec_overhead)}});
+  } catch (const std::runtime_error &e) {
+    qWarning() << e.what() << "- sending without FEC";
+  }
+  return fec;
+}
+
+struct ProtectedReceiver::Impl {
+  QGst::ElementPtr rtpbin;
+  QGst::PadPtr pad;
+  gulong probe = 0;
+
+  mutable std::mutex mutex;
+  /* referenced once rtpbin asked for them */
+  GstElement *fec = nullptr;
+  GstElement *rtx = nullptr;
+  uint64_t lost = 0;
+  uint64_t keyframe_requests = 0;
+  steady_clock::time_point last_request;
+
+  ~Impl() {
+    if (fec)
+      gst_object_unref(fec);
+    if (rtx)
+      gst_object_unref(rtx);
+  }
+
+  static GstElement *request_aux_receiver(GstElement *, guint session,
+                                          gpointer user_data) {
+    auto self = static_cast<Impl *>(user_data);
+    auto rtx = gst_element_factory_make("rtprtxreceive", nullptr);
+    if (!rtx)
+      return nullptr;
+    set_rtx_map(rtx);
+    std::lock_guard<std::mutex> lock(self->mutex);
+    if (!self->rtx)
+      self->rtx = GST_ELEMENT(gst_object_ref(rtx));
+    return aux_bin(rtx, session);
+  }
+
+  static GstElement *request_fec_decoder(GstElement *rtpbin, guint session,
+                                         gpointer user_data) {
+    auto self = static_cast<Impl *>(user_data);
+    GObject *storage = nullptr;
+    g_signal_emit_by_name(rtpbin, "get-internal-storage", session, &storage);
+    auto fec = gst_element_factory_make("rtpulpfecdec", nullptr);
+    if (!fec || !storage) {
+      if (storage)
+        g_object_unref(storage);
+      return fec;
+    }
+    g_object_set(fec, "pt", fec_payload, "storage", storage, nullptr);
+    g_object_unref(storage);
+    std::lock_guard<std::mutex> lock(self->mutex);
+    if (!self->fec)
+      self->fec = GST_ELEMENT(gst_object_ref(fec));
+    return fec;
+  }
+
+  /* the storage keeps nothing by default */
+  static void new_storage(GstElement *, GstElement *storage, guint,
+                          gpointer) {
+    const guint64 history = static_cast<guint64>(
+        duration_cast<nanoseconds>(fec_history).count());
+    g_object_set(storage, "size-time", history, nullptr);
+  }
+
+  /* Retransmissions and FEC packets have payload types of their own */
+  static GstCaps *request_pt_map(GstElement *, guint, guint pt, gpointer) {
+    if (pt != rtx_payload && pt != fec_payload)
+      return nullptr;
+    return gst_caps_new_simple("application/x-rtp", "media", G_TYPE_STRING,
+                               "video", "clock-rate", G_TYPE_INT, 90000,
+                               "payload", G_TYPE_INT, static_cast<gint>(pt),
+                               nullptr);
+  }
+
+  /* Returns whether to request a keyframe */
+  bool packet_lost() {
+    const auto now = steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex);
+    ++lost;
+    if (keyframe_requests && now - last_request < keyframe_interval)
+      return false;
+    last_request = now;
+    ++keyframe_requests;
+    return true;
+  }
+
+  /* The jitter buffer reports packets it gave up on; FEC has had its try */
+  static GstPadProbeReturn lost_probe(GstPad *pad, GstPadProbeInfo *info,
+                                      gpointer user_data) {
+    auto event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) != GST_EVENT_CUSTOM_DOWNSTREAM ||
+        !gst_event_has_name(event, "GstRTPPacketLost"))
+      return GST_PAD_PROBE_OK;
+
+    auto &impl = **static_cast<std::shared_ptr<Impl> *>(user_data);
+    /* rtpbin turns the request into a PLI to the sender */
+    if (impl.packet_lost()) {
+      gst_pad_push_event(pad, gst_video_event_new_upstream_force_key_unit(
+                                  GST_CLOCK_TIME_NONE, TRUE, 0));
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  static void release(gpointer data) {
+    delete static_cast<std::shared_ptr<Impl> *>(data);
+  }
+};
+
+ProtectedReceiver::ProtectedReceiver(const QGst::ElementPtr &rtpbin,
+                                     const QGst::ElementPtr &depayloader)
+    : d(std::make_shared<Impl>()) {
+  d->rtpbin = rtpbin;
+  GstElement *bin = rtpbin;
+  set_arg(bin, "rtp-profile", "avpf");
+  set_arg(bin, "do-retransmission", "true");
+  /* lost packets are what the FEC decoder and the keyframe requests act on */
+  set_arg(bin, "do-lost", "true");
+
+  g_signal_connect(bin, "request-pt-map", G_CALLBACK(Impl::request_pt_map),
+                   d.get());
+  if (have_factory("rtprtxreceive")) {
+    g_signal_connect(bin, "request-aux-receiver",
+                     G_CALLBACK(Impl::request_aux_receiver), d.get());
+  } else {
+    qWarning() << "No rtprtxreceive, receiving without retransmissions";
+  }
+  if (has_signal(bin, "request-fec-decoder") &&
+      have_factory("rtpulpfecdec")) {
+    g_signal_connect(bin, "new-storage", G_CALLBACK(Impl::new_storage),
+                     d.get());
+    g_signal_connect(bin, "request-fec-decoder",
+                     G_CALLBACK(Impl::request_fec_decoder), d.get());
+  } else {
+    qWarning() << "No FEC decoder in rtpbin, receiving without FEC";
+  }
+
+  d->pad = depayloader->getStaticPad("sink");
+  d->probe = gst_pad_add_probe(d->pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                               Impl::lost_probe, new std::shared_ptr<Impl>(d),
+                               Impl::release);
+}
+
+ProtectedReceiver::~ProtectedReceiver() {
+  gst_pad_remove_probe(d->pad, d->probe);
+  g_signal_handlers_disconnect_matched(
+      static_cast<GstElement *>(d->rtpbin), G_SIGNAL_MATCH_DATA, 0, 0,
+      nullptr, nullptr, d.get());
+  d->pad.clear();
+  d->rtpbin.clear();
+}
+
+ProtectionStats ProtectedReceiver::stats() const {
+  guint recovered = 0;
+  guint retransmitted = 0;
+  std::lock_guard<std::mutex> lock(d->mutex);
+  if (d->fec)
+    g_object_get(d->fec, "recovered", &recovered, nullptr);
+  if (d->rtx)
+    g_object_get(d->rtx, "num-rtx-packets", &retransmitted, nullptr);
+  return {d->lost, recovered, retransmitted, d->keyframe_requests};
+}
+#pragma clang diagnostic pop
+}
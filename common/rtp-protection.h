@@ -0,0 +1,61 @@
+#pragma once
+
+#include <memory>
+
+#include <cstdint>
+
+#include "qgst.h"
+#include "pipeline-builder.h"
+
+namespace intex {
+
+/* Payload types of the protected video session */
+static constexpr unsigned video_payload = 96;
+static constexpr unsigned rtx_payload = 97; /* RFC 4588 retransmissions */
+static constexpr unsigned fec_payload = 122; /* RFC 5109 ULP FEC */
+
+/* Protection of a video RTP session against loss on the radio link */
+struct Protection {
+  unsigned fec_overhead; /* FEC packets per 100 media packets, 0 for none */
+  bool retransmission;   /* answer NACKs with RTX */
+};
+
+/* Sets up session 0 of rtpbin to send with protection; call before
+ * requesting its send_rtp_sink_0 pad. Keyframe requests of the receiver
+ * reach the encoder without help. Returns the FEC encoder to link in front
+ * of send_rtp_sink_0, whose "percentage" sets the overhead while playing, or
+ * a null element if this GStreamer has no FEC. */
+QGst::ElementPtr protectSender(PipelineBuilder &builder,
+                               const QGst::ElementPtr &rtpbin,
+                               const Protection &protection);
+
+/* Receive counters of a protected session, since it started */
+struct ProtectionStats {
+  uint64_t lost;              /* packets neither recovered nor resent */
+  uint64_t recovered;         /* by FEC */
+  uint64_t retransmitted;     /* RTX packets received */
+  uint64_t keyframe_requests; /* sent for lost packets */
+};
+
+/* Receives session 0 of rtpbin with FEC recovery and NACKs answered by RTX,
+ * and asks the sender for a keyframe when a packet is lost for good, instead
+ * of waiting for the next periodic one. Construct before requesting the
+ * session's recv_rtp_sink_0 pad; depayloader is the element behind the
+ * session's recv_rtp_src pad. The caps of the session must carry
+ * rtcp-fb-nack=(boolean)true and rtcp-fb-nack-pli=(boolean)true, or no
+ * feedback is sent. */
+class ProtectedReceiver {
+  struct Impl;
+  std::shared_ptr<Impl> d;
+
+public:
+  ProtectedReceiver(const QGst::ElementPtr &rtpbin,
+                    const QGst::ElementPtr &depayloader);
+  ~ProtectedReceiver();
+  ProtectedReceiver(const ProtectedReceiver &) = delete;
+  ProtectedReceiver &operator=(const ProtectedReceiver &) = delete;
+
+  /* Thread-safe */
+  ProtectionStats stats() const;
+};
+}
@@ -24,8 +24,10 @@
 #include <QMessageBox>
 #include <QFile>
 
+#include <array>
 #include <iostream>
 #include <chrono>
+#include <map>
 
 #include "Control.h"
 
@@ -37,6 +39,7 @@
 #include "IntexWidget.h"
 #include "IntexRpcClient.h"
 #include "intex.h"
+#include "rpc/telemetry-codec.h"
 
 static IntexWidget *log_instance = nullptr;
 
@@ -91,6 +94,7 @@ struct Control::Impl {
 
   QSlider *bitrateSlider;
   QSlider *splitSlider;
+  QSlider *fecSlider;
   QSlider *leftVolume;
   QSlider *rightVolume;
 
@@ -107,15 +111,24 @@ struct Control::Impl {
 
   IntexRpcClient client;
 
-  QUdpSocket telemetry_socket;
   QUdpSocket log_socket;
   QUdpSocket auto_socket;
 
   QFile telemetry_file;
   QFile log_file;
+  intex::TelemetryDecoder telemetry_decoder;
 
   QLabel *cpuTemperatureLabel;
   QLabel *vnaTemperatureLabel;
+  QLabel *edgeJitterLabel;
+
+  /* Pipeline conditions last logged, per feed */
+  struct PipelineState {
+    bool reporting = false;
+    bool behind = false;
+    std::map<PipelineQueue, bool> overflowing;
+  };
+  std::array<PipelineState, 2> pipelines;
 
   void handle_log_datagram(QByteArray &buffer) {
     const auto written = log_file.write(buffer);
@@ -127,96 +140,132 @@ struct Control::Impl {
     qDebug() << is.readLine();
   }
 
-  void handle_telemetry_datagram(QByteArray &buffer) {
-    const auto written = telemetry_file.write(buffer);
-    if (written != buffer.size()) {
-      qCritical() << "Could only write" << written << "bytes of"
-                  << buffer.size() << "bytes telemetry telegram";
-    }
-    auto reader = intex::QByteArrayMessageReader(buffer);
-    auto telemetry = reader.getRoot<Telemetry>();
-
-    auto cpu_temp = telemetry.getCpuTemperature();
-
-    if (cpu_temp.hasError()) {
-      qDebug() << cpu_temp.getError().getReason().cStr();
-    } else {
-      const auto temp = cpu_temp.getReading().getValue();
-      qDebug() << cpu_temp.getTimestamp() << temp;
-      cpuTemperatureLabel->setText(QString("%1 °C").arg(temp));
-    }
-
-    auto vna_temp = telemetry.getVnaTemperature();
-    if (vna_temp.hasError()) {
-      qDebug() << vna_temp.getError().getReason().cStr();
-    } else {
-      const auto temp = vna_temp.getReading().getValue();
-      qDebug() << vna_temp.getTimestamp() << temp;
-      vnaTemperatureLabel->setText(QString("%1 °C").arg(temp));
-    }
-
-    auto inner_temp = telemetry.getAntennaInnerTemperature();
-    if (inner_temp.hasError()) {
-      qDebug() << inner_temp.getError().getReason().cStr();
-    } else {
-      const auto temp = inner_temp.getReading().getValue();
-      qDebug() << inner_temp.getTimestamp() << temp;
-      intexWidget->setAntennaInnerTemperature(temp);
-    }
-
-    auto outer_temp = telemetry.getAntennaOuterTemperature();
-    if (outer_temp.hasError()) {
-      qDebug() << outer_temp.getError().getReason().cStr();
-    } else {
-      const auto temp = outer_temp.getReading().getValue();
-      qDebug() << outer_temp.getTimestamp() << temp;
-      intexWidget->setAntennaOuterTemperature(temp);
+  template <typename Display>
+  void show(const char *name, const TelemetryChannel channel,
+            Display &&display) {
+    const auto &value =
+        telemetry_decoder.state()[intex::channel_index(channel)];
+    if (!value.updated)
+      return;
+    if (!value.valid) {
+      qDebug() << name << value.reason.c_str();
+      return;
     }
+    qDebug() << name << value.timestamp << value.value << "sd" << value.stddev;
+    display(value.value);
+  }
 
-    auto atmosphere_temp = telemetry.getAntennaInnerTemperature();
-    if (atmosphere_temp.hasError()) {
-      qDebug() << atmosphere_temp.getError().getReason().cStr();
-    } else {
-      const auto temp = atmosphere_temp.getReading().getValue();
-      qDebug() << atmosphere_temp.getTimestamp() << temp;
-      intexWidget->setAtmosphereTemperature(temp);
+  /* Logs when a camera starts or stops reporting, and when its encoder or
+   * a branch of its pipeline falls behind or catches up again */
+  void show_pipelines() {
+    static constexpr float full = 0.8f;
+    /* a frame interval at 30 fps */
+    static constexpr float late = 33.3f;
+    std::array<bool, 2> reported{{false, false}};
+    for (const auto &camera : telemetry_decoder.cameras()) {
+      const size_t feed = camera.feed == InTexFeed::FEED0 ? 0 : 1;
+      auto &state = pipelines[feed];
+      reported[feed] = true;
+      if (!state.reporting) {
+        qDebug() << "Camera" << feed << "reporting: record"
+                 << camera.record_rate / 1000 << "kB/s, downlink"
+                 << camera.downlink_rate / 1000 << "kB/s";
+        state.reporting = true;
+      }
+
+      const bool behind = camera.max_encode_time > late;
+      if (behind != state.behind) {
+        state.behind = behind;
+        if (behind) {
+          qWarning() << "Camera" << feed << "encode" << camera.encode_time
+                     << "ms (max" << camera.max_encode_time << "ms)";
+        } else {
+          qDebug() << "Camera" << feed << "encoder keeps up again";
+        }
+      }
+
+      for (const auto &queue : camera.queues) {
+        const bool overflowing = queue.level >= full || queue.overruns > 0;
+        auto &was = state.overflowing[queue.queue];
+        if (overflowing == was)
+          continue;
+        was = overflowing;
+        if (overflowing) {
+          qWarning() << "Camera" << feed << intex::to_string(queue.queue)
+                     << "queue" << static_cast<int>(queue.level * 100)
+                     << "% full," << queue.overruns << "overruns";
+        } else {
+          qDebug() << "Camera" << feed << intex::to_string(queue.queue)
+                   << "queue drained";
+        }
+      }
     }
 
-    auto box_temp = telemetry.getBoxTemperature();
-    if (box_temp.hasError()) {
-      qDebug() << box_temp.getError().getReason().cStr();
-    } else {
-      const auto temp = box_temp.getReading().getValue();
-      qDebug() << box_temp.getTimestamp() << temp;
-      intexWidget->setHubTemperature(temp);
+    for (size_t feed = 0; feed < pipelines.size(); ++feed) {
+      if (reported[feed] || !pipelines[feed].reporting)
+        continue;
+      qDebug() << "Camera" << feed << "no longer reported";
+      pipelines[feed] = PipelineState{};
     }
+  }
 
-    auto tank = telemetry.getTankPressure();
-    if (tank.hasError()) {
-      qDebug() << tank.getError().getReason().cStr();
-    } else {
-      auto pressure = tank.getReading().getValue();
-      qDebug() << "Tank:" << tank.getTimestamp() << pressure;
-      intexWidget->setTankPressure(pressure);
+  /* Replayed frames are only archived; live ones follow right after */
+  void handle_telemetry(const QByteArray &frame, const bool replayed) {
+    const auto written = telemetry_file.write(frame);
+    if (written != frame.size()) {
+      qCritical() << "Could only write" << written << "bytes of"
+                  << frame.size() << "bytes telemetry frame";
     }
-
-    auto atmosphere = telemetry.getAtmosphericPressure();
-    if (atmosphere.hasError()) {
-      qDebug() << atmosphere.getError().getReason().cStr();
-    } else {
-      const auto pressure = atmosphere.getReading().getValue();
-      qDebug() << "Atmosphere:" << atmosphere.getTimestamp() << pressure;
-      intexWidget->setAtmosphericPressure(pressure);
+    if (replayed)
+      return;
+
+    kj::ArrayInputStream in(kj::ArrayPtr<const kj::byte>(
+        reinterpret_cast<const kj::byte *>(frame.constData()),
+        static_cast<size_t>(frame.size())));
+    try {
+      telemetry_decoder.decode(in);
+    } catch (const kj::Exception &e) {
+      qCritical() << "Invalid telemetry telegram:"
+                  << e.getDescription().cStr();
+      return;
+    } catch (const std::exception &e) {
+      qCritical() << "Invalid telemetry telegram:" << e.what();
+      return;
     }
 
-    auto antenna = telemetry.getAntennaPressure();
-    if (antenna.hasError()) {
-      qDebug() << antenna.getError().getReason().cStr();
-    } else {
-      const auto pressure = antenna.getReading().getValue();
-      qDebug() << "Antenna:" << antenna.getTimestamp() << pressure;
-      intexWidget->setAntennaPressure(pressure);
-    }
+    show("CPU:", TelemetryChannel::CPU_TEMPERATURE, [this](double temp) {
+      cpuTemperatureLabel->setText(QString("%1 °C").arg(temp));
+    });
+    show("VNA:", TelemetryChannel::VNA_TEMPERATURE, [this](double temp) {
+      vnaTemperatureLabel->setText(QString("%1 °C").arg(temp));
+    });
+    show("Inner ring:", TelemetryChannel::ANTENNA_INNER_TEMPERATURE,
+         [this](double temp) {
+           intexWidget->setAntennaInnerTemperature(temp);
+         });
+    show("Outer ring:", TelemetryChannel::ANTENNA_OUTER_TEMPERATURE,
+         [this](double temp) {
+           intexWidget->setAntennaOuterTemperature(temp);
+         });
+    show("Atmosphere:", TelemetryChannel::ATMOSPHERE_TEMPERATURE,
+         [this](double temp) { intexWidget->setAtmosphereTemperature(temp); });
+    show("Hub:", TelemetryChannel::BOX_TEMPERATURE,
+         [this](double temp) { intexWidget->setHubTemperature(temp); });
+    show("Tank:", TelemetryChannel::TANK_PRESSURE,
+         [this](double pressure) { intexWidget->setTankPressure(pressure); });
+    show("Atmosphere:", TelemetryChannel::ATMOSPHERIC_PRESSURE,
+         [this](double pressure) {
+           intexWidget->setAtmosphericPressure(pressure);
+         });
+    show("Antenna:", TelemetryChannel::ANTENNA_PRESSURE,
+         [this](double pressure) {
+           intexWidget->setAntennaPressure(pressure);
+         });
+    show("Edge jitter:", TelemetryChannel::ACTUATION_JITTER,
+         [this](double jitter) {
+           edgeJitterLabel->setText(QString("%1 ms").arg(jitter));
+         });
+    show_pipelines();
   }
 
   void handle_auto_datagram(QByteArray &buffer, QHostAddress &host,
@@ -257,11 +306,12 @@ struct Control::Impl {
   }
 
   Impl(QWidget *parent, QString host, const uint16_t control_port,
-       const bool debug = false)
+       const intex::ReceiveProfile &profile, const bool debug = false)
       : leftWindow(parent), rightWindow(parent),
         leftVideoWidget(new VideoWidget), rightVideoWidget(new VideoWidget),
         bitrateSlider(new QSlider(Qt::Horizontal)),
         splitSlider(new QSlider(Qt::Horizontal)),
+        fecSlider(new QSlider(Qt::Horizontal)),
         leftVolume(new QSlider(Qt::Horizontal)),
         rightVolume(new QSlider(Qt::Horizontal)), intexWidget(new IntexWidget),
         videoControl(*leftVideoWidget, *rightVideoWidget,
@@ -269,14 +319,16 @@ struct Control::Impl {
                      storageLocation(intex::Subsystem::Video0),
                      storageLocation(intex::Subsystem::Video1),
                      storageLocation(intex::Subsystem::Audio0),
-                     storageLocation(intex::Subsystem::Audio1), debug),
+                     storageLocation(intex::Subsystem::Audio1), host, profile,
+                     debug),
         switchWidgets_(tr("Ctrl+X"), parent, SLOT(switchWidgets())),
         switchWindows_(tr("Ctrl+Shift+X"), parent, SLOT(switchWindows())),
         showNormal_(tr("Esc"), parent, SLOT(showNormal())),
         client(host.toStdString(), control_port),
         telemetry_file(storageLocation(intex::Subsystem::Telemetry)),
         log_file(storageLocation(intex::Subsystem::Log)),
-        cpuTemperatureLabel(new QLabel()), vnaTemperatureLabel(new QLabel()) {
+        cpuTemperatureLabel(new QLabel()), vnaTemperatureLabel(new QLabel()),
+        edgeJitterLabel(new QLabel()) {
     connect(&adapter, &intex::LogAdapter::log, intexWidget, &IntexWidget::log);
     qInstallMessageHandler(output);
 
@@ -287,13 +339,10 @@ struct Control::Impl {
       qCritical() << "Could not open file" << log_file.fileName()
                   << "for writing";
 
-    connect(&telemetry_socket, &QAbstractSocket::readyRead, [this] {
-      intex::handle_datagram(telemetry_socket,
-                             [this](auto &&buffer, QHostAddress &, quint16) {
-                               handle_telemetry_datagram(buffer);
-                             });
-    });
-    intex::bind_socket(&telemetry_socket, 54431, "Telemetry");
+    connect(&client, &IntexRpcClient::telemetry,
+            [this](const QByteArray &frame, qint64, const bool replayed) {
+              handle_telemetry(frame, replayed);
+            });
 
     connect(&log_socket, &QAbstractSocket::readyRead, [this] {
       intex::handle_datagram(log_socket,
@@ -358,6 +407,11 @@ struct Control::Impl {
     };
     QObject::connect(bitrateSlider, &QSlider::valueChanged, setBitrateChanged);
     QObject::connect(splitSlider, &QSlider::valueChanged, setBitrateChanged);
+    QObject::connect(fecSlider, &QSlider::valueChanged, [this](int fec) {
+      const auto percentage = static_cast<unsigned>(fec);
+      client.setFecOverhead(InTexFeed::FEED0, percentage);
+      client.setFecOverhead(InTexFeed::FEED1, percentage);
+    });
 
     QObject::connect(&client, &IntexRpcClient::portChanged,
                      [this](const InTexService service, const uint16_t port) {
@@ -462,10 +516,12 @@ static QWidget *setupVideoControls(Reconnect &&reconnector, Idr &&idr,
   return videoControls;
 }
 
-Control::Control(QString host, const uint16_t control_port, const bool debug,
+Control::Control(QString host, const uint16_t control_port,
+                 const intex::ReceiveProfile &profile, const bool debug,
                  QWidget *parent)
     : QMainWindow(parent),
-      d_(std::make_unique<Control::Impl>(this, host, control_port, debug)) {
+      d_(std::make_unique<Control::Impl>(this, host, control_port, profile,
+                                         debug)) {
   setWindowTitle(QCoreApplication::applicationName());
 
   auto mainMenu = menuBar()->addMenu(tr("Menu"));
@@ -618,6 +674,26 @@ Control::Control(QString host, const uint16_t control_port, const bool debug,
   d_->splitSlider->setValue(50);
   d_->splitSlider->setTracking(false);
 
+  /* FEC costs downlink bitrate, but repairs loss without a round trip */
+  auto fecLabel = new QLabel;
+  fecLabel->setSizePolicy(QSizePolicy::Preferred, QSizePolicy::Fixed);
+
+  d_->fecSlider->setMinimum(0);
+  d_->fecSlider->setMaximum(100);
+  d_->fecSlider->setSingleStep(1);
+  d_->fecSlider->setPageStep(10);
+  d_->fecSlider->setSizePolicy(QSizePolicy::MinimumExpanding,
+                               QSizePolicy::Fixed);
+
+  auto fecUpdate = [fecLabel](int fec) {
+    fecLabel->setText(QString("FEC: %1 %").arg(fec));
+  };
+  connect(d_->fecSlider, &QSlider::sliderMoved, fecUpdate);
+  connect(d_->fecSlider, &QSlider::valueChanged, fecUpdate);
+
+  fecUpdate(0);
+  d_->fecSlider->setTracking(false);
+
   auto startButton = new QPushButton("Start Recording");
   connect(startButton, &QPushButton::clicked, [this] {
     d_->client.start(InTexFeed::FEED0);
@@ -640,6 +716,8 @@ Control::Control(QString host, const uint16_t control_port, const bool debug,
   controlLayout->addWidget(d_->bitrateSlider);
   controlLayout->addWidget(splitLabel);
   controlLayout->addWidget(d_->splitSlider);
+  controlLayout->addWidget(fecLabel);
+  controlLayout->addWidget(d_->fecSlider);
   controlLayout->addWidget(startButton);
   controlLayout->addWidget(stopButton);
   controlLayout->addWidget(newFileButton);
@@ -666,6 +744,8 @@ Control::Control(QString host, const uint16_t control_port, const bool debug,
   statusBar->addPermanentWidget(d_->cpuTemperatureLabel);
   statusBar->addPermanentWidget(new QLabel("VNA Temperature:"));
   statusBar->addPermanentWidget(d_->vnaTemperatureLabel);
+  statusBar->addPermanentWidget(new QLabel("Edge jitter:"));
+  statusBar->addPermanentWidget(d_->edgeJitterLabel);
   setStatusBar(statusBar);
 
   log_instance = d_->intexWidget;
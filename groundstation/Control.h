@@ -5,6 +5,10 @@
 #include <QMainWindow>
 #include <QString>
 
+namespace intex {
+struct ReceiveProfile;
+}
+
 class Control : public QMainWindow {
   Q_OBJECT
 
@@ -12,7 +16,8 @@ class Control : public QMainWindow {
   std::unique_ptr<Impl> d_;
 
 public:
-  explicit Control(QString host, const uint16_t port, const bool debug,
+  explicit Control(QString host, const uint16_t port,
+                   const intex::ReceiveProfile &profile, const bool debug,
                    QWidget *parent = nullptr);
   ~Control();
 
@@ -1,7 +1,35 @@
 #include "IntexRpcClient.h"
 
+#include <algorithm>
+
 #include <QDebug>
 
+/* Receives the frames of the telemetry subscription. Frames are handled
+ * before the push returns, which keeps the sender from getting ahead. */
+class IntexRpcClient::Sink final : public TelemetrySink::Server {
+  IntexRpcClient &client;
+
+public:
+  explicit Sink(IntexRpcClient &client_) : client(client_) {}
+
+  kj::Promise<void> push(PushContext context) override {
+    auto params = context.getParams();
+    if (params.getDropped())
+      qWarning() << "Experiment dropped" << params.getDropped()
+                 << "telemetry frames";
+    for (const auto frame : params.getFrames()) {
+      const auto data = frame.getFrame();
+      client.last_telemetry =
+          std::max(client.last_telemetry, frame.getTimestamp());
+      Q_EMIT client.telemetry(
+          QByteArray(reinterpret_cast<const char *>(data.begin()),
+                     static_cast<int>(data.size())),
+          frame.getTimestamp(), frame.getReplayed());
+    }
+    return kj::READY_NOW;
+  }
+};
+
 IntexRpcClient::IntexRpcClient(std::string host, const unsigned port)
     : host_(std::move(host)), client(host_.c_str(), port),
       intex(client.getMain<Command>()) {
@@ -24,8 +52,30 @@ IntexRpcClient::~IntexRpcClient() noexcept try {
   qCritical() << "Unkown error occured" << __LINE__ << __PRETTY_FUNCTION__;
 }
 
-void IntexRpcClient::onConnect() { intex = client.getMain<Command>(); }
-void IntexRpcClient::onDisconnect() { intex = client.getMain<Command>(); }
+void IntexRpcClient::onConnect() {
+  intex = client.getMain<Command>();
+  subscribeTelemetry();
+}
+
+void IntexRpcClient::onDisconnect() {
+  intex = client.getMain<Command>();
+  subscription = nullptr;
+}
+
+/* Every channel, every frame; frames since the last one received are
+ * replayed from the experiment's archive first. */
+void IntexRpcClient::subscribeTelemetry() {
+  auto request = intex.subscribeTelemetryRequest();
+  request.setSink(kj::heap<Sink>(*this));
+  request.setInterval(0);
+  request.setSince(last_telemetry);
+  auto response = request.send();
+  subscription = response.getSubscription();
+  response.detach([](auto &&exception) {
+    qCritical() << "Telemetry subscription failed:"
+                << exception.getDescription().cStr();
+  });
+}
 
 void IntexRpcClient::setPort(const InTexService service, const uint16_t port) {
   auto request = intex.setPortRequest();
@@ -49,9 +99,13 @@ void IntexRpcClient::setGPIO(const InTexHW hw, const bool state,
   request.setOn(state);
   request.send()
       .then(
-          [this, hw, success, state](auto &&) {
+          [this, hw, success, state](auto &&response) {
+            auto actuation = response.getActuation();
             success(true);
-            qDebug() << "Success";
+            qDebug() << "GPIO" << static_cast<int>(hw) << "set after"
+                     << actuation.getQueueDepth() << "queued commands,"
+                     << actuation.getWaitTime() << "us queued,"
+                     << actuation.getExecTime() << "us executing";
             Q_EMIT gpioChanged(hw, state);
           },
           [this, hw, state, success](auto &&e) {
@@ -74,6 +128,16 @@ void IntexRpcClient::setBitrate(const InTexFeed feed, const unsigned bitrate) {
   });
 }
 
+void IntexRpcClient::setFecOverhead(const InTexFeed feed,
+                                    const unsigned percentage) {
+  auto request = intex.setFecOverheadRequest();
+  request.setFeed(feed);
+  request.setPercentage(static_cast<uint8_t>(percentage));
+  request.send().detach([this](auto &&exception) {
+    qCritical() << exception.getDescription().cStr();
+  });
+}
+
 void IntexRpcClient::setVolume(const InTexFeed feed, const float volume) {
   auto request = intex.setVolumeRequest();
   request.setFeed(feed);
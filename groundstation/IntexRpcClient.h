@@ -3,6 +3,9 @@
 #include <string>
 #include <functional>
 
+#include <cstdint>
+
+#include <QByteArray>
 #include <QObject>
 #include <QString>
 
@@ -12,9 +15,16 @@
 class IntexRpcClient : public QObject {
   Q_OBJECT
 
+  class Sink;
+
   std::string host_;
   intex::rpc::EzRpcClient client;
   Command::Client intex;
+  TelemetrySubscription::Client subscription = nullptr;
+  /* of the newest frame received, to resume from after a reconnect */
+  int64_t last_telemetry = 0;
+
+  void subscribeTelemetry();
 
 public:
   IntexRpcClient(std::string host, const unsigned port);
@@ -26,6 +36,7 @@ public Q_SLOTS:
                std::function<void(bool)> succes);
   void setBitrate(const InTexFeed feed, const unsigned bitrate);
   void setVolume(const InTexFeed feed, const float volume);
+  void setFecOverhead(const InTexFeed feed, const unsigned percentage);
   void start(const InTexFeed feed);
   void stop(const InTexFeed feed);
   void next(const InTexFeed feed);
@@ -42,5 +53,8 @@ Q_SIGNALS:
   void portChanged(const InTexService service, uint16_t port);
   void connected();
   void disconnected();
+  /* A compact telemetry frame; replayed if it was sent while disconnected */
+  void telemetry(const QByteArray &frame, const qint64 timestamp,
+                 const bool replayed);
   // clang-format on
 };
@@ -0,0 +1,39 @@
+#include <chrono>
+#include <utility>
+
+#include "SinkSwitcher.h"
+
+using intex::QueueLimits;
+using namespace std::chrono_literals;
+
+/* Displays show the latest frame */
+static constexpr QueueLimits display_queue{2, 0, 0ms,
+                                           QueueLimits::Leaky::Downstream};
+
+static void activate(const QGst::ElementPtr &selector, const char *pad) {
+  selector->setProperty("active-pad", selector->getStaticPad(pad));
+}
+
+SinkSwitcher::SinkSwitcher(QGst::ElementPtr lhs, QGst::ElementPtr rhs)
+    : lhs_(std::move(lhs)), rhs_(std::move(rhs)) {}
+
+void SinkSwitcher::operator()() {
+  swapped = !swapped;
+  const auto pad = swapped ? "sink_1" : "sink_0";
+  activate(lhs_, pad);
+  activate(rhs_, pad);
+}
+
+QGst::ElementPtr make_sink_selector(intex::PipelineBuilder &builder,
+                                    const QGst::ElementPtr &first,
+                                    const QGst::ElementPtr &second,
+                                    const QGst::ElementPtr &sink) {
+  /* the inactive stream is dropped right away instead of being held back
+   * until its running time is reached */
+  auto selector = builder.make("input-selector", {{"sync-streams", "false"}});
+  builder.link(first, "src_%u", selector, "sink_0");
+  builder.link(second, "src_%u", selector, "sink_1");
+  builder.chain({selector, builder.queue(display_queue), sink});
+  activate(selector, "sink_0");
+  return selector;
+}
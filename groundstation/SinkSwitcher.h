@@ -0,0 +1,26 @@
+#pragma once
+
+#include "qgst.h"
+#include "pipeline-builder.h"
+
+/* Exchanges the streams shown by two sinks. Each sink has an input-selector
+ * in front of it with its own stream on sink_0 and the other one on sink_1;
+ * switching changes the active pads, so the renderers keep running.
+ */
+class SinkSwitcher {
+  QGst::ElementPtr lhs_;
+  QGst::ElementPtr rhs_;
+  bool swapped = false;
+
+public:
+  SinkSwitcher(QGst::ElementPtr lhs, QGst::ElementPtr rhs);
+  /* Not thread-safe; call from one thread */
+  void operator()();
+};
+
+/* Adds an input-selector showing first, and second after a switch, on sink.
+ * Returns the selector. */
+QGst::ElementPtr make_sink_selector(intex::PipelineBuilder &builder,
+                                    const QGst::ElementPtr &first,
+                                    const QGst::ElementPtr &second,
+                                    const QGst::ElementPtr &sink);
@@ -1,172 +1,122 @@
-#include <sstream>
-#include <stdexcept>
-#include <atomic>
+#include <chrono>
+#include <memory>
 #include <utility>
-#include <mutex>
 
 #include "VideoStreamControl.h"
-
-class SinkSwitcher {
-  QGst::BinPtr lhs_;
-  QGst::BinPtr rhs_;
-
-  std::string lname;
-  std::string rname;
-
-  QGst::ElementPtr lhsElem;
-  QGst::ElementPtr rhsElem;
-
-  std::pair<GstPad *, gulong> firstProbe;
-  std::mutex mutex;
-
-  std::atomic_flag switching{false};
-  bool first;
-
-  void exchange(std::pair<GstPad *, gulong> probe) {
-    std::unique_lock<std::mutex> lock(mutex);
-    if (first) {
-      first = false;
-      firstProbe = probe;
-      return;
-    }
-
-    auto lhsPrevPad = lhsElem->getStaticPad("sink")->peer();
-    auto rhsPrevPad = rhsElem->getStaticPad("sink")->peer();
-
-    if (lhsElem->setState(QGst::State::StateNull) == QGst::StateChangeFailure) {
-      qCritical() << "could not change state of" << lhsElem->name();
-    } else {
-      lhs_->remove(lhsElem);
-    }
-
-    if (rhsElem->setState(QGst::State::StateNull) == QGst::StateChangeFailure) {
-      qCritical() << "could not change state of" << rhsElem->name();
-    } else {
-      rhs_->remove(rhsElem);
-    }
-
-    lhs_->add(rhsElem);
-
-    lhsPrevPad->link(rhsElem->getStaticPad("sink"));
-
-    if (rhsElem->setState(QGst::State::StatePlaying) ==
-        QGst::StateChangeFailure) {
-      qCritical() << "could not change state of" << rhsElem->name();
-    }
-
-    rhs_->add(lhsElem);
-
-    rhsPrevPad->link(lhsElem->getStaticPad("sink"));
-
-    if (lhsElem->setState(QGst::State::StatePlaying) ==
-        QGst::StateChangeFailure) {
-      qCritical() << "could not change state of" << lhsElem->name();
-    }
-
-    gst_pad_remove_probe(probe.first, probe.second);
-    gst_pad_remove_probe(firstProbe.first, firstProbe.second);
-
-    std::swap(lname, rname);
-
-    switching.clear(std::memory_order_release);
-  }
-
-public:
-  SinkSwitcher(QGst::BinPtr lhs, QGst::BinPtr rhs, std::string lname_,
-               std::string rname_)
-      : lhs_(lhs), rhs_(rhs), lname(std::move(lname_)),
-        rname(std::move(rname_)) {}
-
-  void operator()() {
-    if (switching.test_and_set(std::memory_order_acquire))
-      return;
-
-    lhsElem = lhs_->getElementByName(lname.c_str());
-    rhsElem = rhs_->getElementByName(rname.c_str());
-
-    if (!lhsElem) {
-      std::ostringstream os;
-      os << "No element with name " << lname << " in "
-         << lhs_->name().toStdString();
-      throw std::runtime_error(os.str());
-    }
-    if (!rhsElem) {
-      std::ostringstream os;
-      os << "No element with name " << rname << " in "
-         << lhs_->name().toStdString();
-      throw std::runtime_error(os.str());
-    }
-
-    first = true;
-
-    auto blockCallBack = [](GstPad *pad, GstPadProbeInfo *info,
-                            gpointer user_data) -> GstPadProbeReturn {
-      auto this_ = static_cast<SinkSwitcher *>(user_data);
-      this_->exchange(std::make_pair(pad, GST_PAD_PROBE_INFO_ID(info)));
-      return GST_PAD_PROBE_OK;
-    };
-
-    auto blockPad = lhsElem->getStaticPad("sink")->peer();
-    if (!blockPad)
-      qCritical() << "No peer lhs";
-    gst_pad_add_probe(blockPad, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
-                      blockCallBack, this, nullptr);
-    blockPad = rhsElem->getStaticPad("sink")->peer();
-    if (!blockPad)
-      qCritical() << "No peer rhs";
-    gst_pad_add_probe(blockPad, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
-                      blockCallBack, this, nullptr);
-  }
-};
+#include "SinkSwitcher.h"
+#include "pipeline-builder.h"
 
 static const char caps[] =
     "application/x-rtp, media=(string)video, clock-rate=(int)90000, "
     "encoding-name=(string)RAW, sampling=(string)YCbCr-4:2:0, "
     "depth=(string)8, width=(string)640, height=(string)360, "
     "colorimetry=(string)BT601-5, payload=(int)96, ssrc=(uint)4055103255, "
-    "timestamp-offset=(uint)2574552406, seqnum-offset=(uint)23268";
+    "timestamp-offset=(uint)2574552406, seqnum-offset=(uint)23268, "
+    "rtcp-fb-nack=(boolean)true, rtcp-fb-nack-pli=(boolean)true";
 
 static const char h264caps[] =
     "application/x-rtp, media=(string)video, clock-rate=(int)90000, "
     "encoding-name=(string)H264, packetization-mode=(string)1, "
-    "payload=(int)96";
+    "payload=(int)96, rtcp-fb-nack=(boolean)true, "
+    "rtcp-fb-nack-pli=(boolean)true";
+
+using intex::PipelineBuilder;
+using intex::QueueLimits;
+using namespace std::chrono_literals;
+
+/* Recording must not lose data */
+static constexpr QueueLimits record_queue{0, 32 << 20, 0ms,
+                                          QueueLimits::Leaky::No};
+/* Late packets are useless, the jitter buffer conceals the loss */
+static constexpr QueueLimits packet_queue{0, 0, 100ms,
+                                          QueueLimits::Leaky::Downstream};
+/* Dropping encoded frames breaks decoding until the next IDR frame */
+static constexpr QueueLimits decode_queue{8, 0, 0ms, QueueLimits::Leaky::No};
+static constexpr QueueLimits thread_queue{200, 10 << 20, 1000ms,
+                                          QueueLimits::Leaky::No};
+
+static double ms(const std::chrono::microseconds us) {
+  return static_cast<double>(us.count()) / 1000.0;
+}
 
-static QGst::PipelinePtr makePipeline(const bool debug, const uint16_t port,
-                                      const QString &widgetName,
-                                      const QString &windowName,
-                                      const QString &loc) {
-  QString pipeline;
-  QTextStream s(&pipeline);
+static void log_latency(const uint16_t port, const intex::LatencyStats &stats,
+                        const intex::ProtectionStats &protection) {
+  qDebug() << "Video" << port << "latency over" << stats.frames
+           << "frames: p50" << ms(stats.p50) << "ms, p99" << ms(stats.p99)
+           << "ms, max" << ms(stats.max) << "ms; packets recovered"
+           << protection.recovered << "resent" << protection.retransmitted
+           << "lost" << protection.lost << "; keyframe requests"
+           << protection.keyframe_requests;
+}
 
-#ifdef RTPBIN
-  s << "rtpbin name=rtpbin";
-#endif
-  s << " udpsrc port=" << port << " caps=";
+static QGst::ElementPtr make_filesink(PipelineBuilder &builder,
+                                      const QString &loc) {
+  return builder.make("filesink", {{"sync", "false"},
+                                   {"async", "false"},
+                                   {"location", loc}});
+}
 
+/* Adds the receiver of one video stream to the pipeline */
+static VideoStreamControl::Receiver
+make_receiver(PipelineBuilder &builder, const bool debug, const QString &host,
+              const uint16_t port, const intex::ReceiveProfile &profile,
+              const QString &loc) {
+  /* the experiment adapts its bitrate to our RTCP receiver reports */
+  auto rtpbin = builder.make(
+      "rtpbin", {{"latency", QString::number(profile.jitter.count())},
+                 {"drop-on-latency", "true"}});
+  auto depay = builder.make(debug ? "rtpvrawdepay" : "rtph264depay");
+  /* FEC, retransmissions and keyframe requests on loss */
+  auto protection = std::make_shared<intex::ProtectedReceiver>(rtpbin, depay);
+  auto source = builder.make("udpsrc", {{"port", QString::number(port)}});
+  source->setProperty("caps", QGst::Caps::fromString(debug ? caps : h264caps));
+  builder.link(builder.chain({source, builder.queue(packet_queue)}), "src",
+               rtpbin, "recv_rtp_sink_0");
+
+  auto convert = builder.make("videoconvert");
+  builder.linkDynamic(rtpbin, "recv_rtp_src_0_", depay);
   if (debug) {
-    s << "\"" << caps << "\" ! queue ! rtpvrawdepay";
+    builder.chain({depay, convert});
   } else {
-    s << "\"" << h264caps << "\" ! queue";
-#ifdef RTPBIN
-    s << " ! rtpbin.recv_rtp_sink_0 rtpbin.";
-#endif
-    s << " ! rtph264depay ! queue ! tee name=h264" << port;
-    s << " ! queue ! h264parse ! avdec_h264";
+    /* slice threads add no frame delay, unlike frame threads */
+    auto decoder = builder.make(
+        "avdec_h264",
+        {{"max-threads", QString::number(profile.decoder_threads)},
+         {"thread-type", "slice"}});
+    auto h264 = builder.chain(
+        {depay, builder.queue(decode_queue), builder.make("tee")});
+    builder.chain({h264, builder.queue(decode_queue),
+                   builder.make("h264parse"), decoder, convert});
+
+    auto selector = builder.make(
+        "output-selector",
+        ("videoselector" + QString::number(port)).toUtf8().constData(),
+        {{"pad-negotiation-mode", "active"}});
+    builder.chain({h264, builder.queue(record_queue),
+                   builder.make("h264parse"), builder.make("mpegtsmux"),
+                   selector, make_filesink(builder, loc)});
   }
 
-  s << " ! videoconvert ! tee name=raw";
-  s << " raw. ! queue name=prev"
-    << " ! qt5glvideosink name=" << widgetName << " force-aspect-ratio=true "
-    << " raw. ! queue"
-    << " ! qt5glvideosink name=" << windowName << " force-aspect-ratio=true ";
-  s << " h264" << port << ". ! queue ! h264parse ! mpegtsmux";
-  s << " ! output-selector name=videoselector" << port
-    << " pad-negotiation-mode=active";
-  s << " ! filesink sync=false async=false location=" << loc;
-
-  qDebug() << pipeline;
-
-  return QGst::Parse::launch(pipeline).dynamicCast<QGst::Pipeline>();
+  /* decoded video for the displays */
+  auto raw = builder.chain({convert, builder.make("tee")});
+
+  auto rtcpsrc = builder.make("udpsrc", {{"port", QString::number(port + 1)}});
+  builder.link(rtcpsrc, "src", rtpbin, "recv_rtcp_sink_0");
+  builder.link(rtpbin, "send_rtcp_src_0",
+               builder.make("udpsink", {{"host", host},
+                                        {"port", QString::number(port + 5)},
+                                        {"sync", "false"},
+                                        {"async", "false"}}));
+
+  std::weak_ptr<intex::ProtectedReceiver> weak = protection;
+  auto latency = std::make_shared<intex::LatencyMeter>(
+      depay->getStaticPad("sink"), raw->getStaticPad("sink"),
+      [port, weak](const intex::LatencyStats &stats) {
+        if (auto protection = weak.lock())
+          log_latency(port, stats, protection->stats());
+      });
+
+  return {source, raw, latency, protection};
 }
 
 static const char opuscaps[] =
@@ -174,128 +124,101 @@ static const char opuscaps[] =
     "encoding-name=X-GST-OPUS-DRAFT-SPITTKA-00,"
     "sprop-maxcapturerate=24000,sprop-stereo=0,payload=96,encoding-params=2";
 
-static auto make_audio(const uint16_t port, const QString &loc) {
-  QString pipeline;
-  QTextStream s(&pipeline);
-
-  QString teename = QString("audio%1").arg(port);
-#ifdef RTPBIN
-  s << " udpsrc port=" << port + 1 << " ! rtpbin.recv_rtcp_sink_0";
-  s << " rtpbin.send_rtcp_src_0 ! udpsink port=" << port + 5
-    << " sync=false async=false";
-#endif
-  s << " udpsrc port=" << port + 2 << " caps=" << opuscaps;
-#ifdef RTPBIN
-  s << " ! rtpbin.recv_rtp_sink_1 rtpbin. ";
-#endif
-  s << " ! rtpopusdepay ! queue ! tee name=opus" << port;
-  s << " opus" << port << ". ! queue ! matroskamux";
-  s << " ! filesink sync=false async=false location=" << loc;
-  s << " opus" << port << ". ! queue ! opusdec";
-  s << " ! queue ! tee name=audio" << port;
-
-#ifdef RTPBIN
-  s << " udpsrc port=" << port + 3 << " ! rtpbin.recv_rtcp_sink_1";
-  s << " rtpbin.send_rtcp_src_1 ! udpsink port=" << port + 7
-    << " sync=false async=false";
-#endif
-
-  return pipeline;
+/* Receives and records one audio stream; returns the decoded audio tee */
+static QGst::ElementPtr make_audio(PipelineBuilder &builder,
+                                   const uint16_t port, const QString &loc) {
+  auto source =
+      builder.make("udpsrc", {{"port", QString::number(port + 2)}});
+  source->setProperty("caps", QGst::Caps::fromString(opuscaps));
+  auto opus = builder.chain({source, builder.make("rtpopusdepay"),
+                             builder.queue(thread_queue),
+                             builder.make("tee")});
+  builder.chain({opus, builder.queue(record_queue),
+                 builder.make("matroskamux"), make_filesink(builder, loc)});
+  return builder.chain({opus, builder.queue(thread_queue),
+                        builder.make("opusdec"), builder.queue(thread_queue),
+                        builder.make("tee")});
 }
 
 static auto make_audio_pipeline(const uint16_t port1, const uint16_t port2,
                                 const QString &leftLoc,
                                 const QString rightLoc) {
-  QString pipeline;
-  QTextStream s(&pipeline);
-
-  s << make_audio(port1, leftLoc);
-  s << make_audio(port2, rightLoc);
+  PipelineBuilder builder("audio");
 
-  //s << " interleave name=interleave ! osxaudiosink sync=false async=false ";
+  auto left = make_audio(builder, port1, leftLoc);
+  auto right = make_audio(builder, port2, rightLoc);
 
-  //s << " audio" << port1 << ". ! queue ! audioconvert ! interleave.";
-  //s << " audio" << port2 << ". ! queue ! audioconvert ! interleave.";
-  s << " audio" << port1 << ". ! queue ! audioconvert ! osxaudiosink sync=false async=false";
-  s << " audio" << port2 << ". ! queue ! fakesink sync=false async=false";
+  builder.chain({left, builder.queue(thread_queue),
+                 builder.make("audioconvert"),
+                 builder.make("osxaudiosink",
+                              {{"sync", "false"}, {"async", "false"}})});
+  builder.chain({right, builder.queue(thread_queue),
+                 builder.make("fakesink",
+                              {{"sync", "false"}, {"async", "false"}})});
 
-  qDebug() << pipeline;
+  return builder.pipeline();
+}
 
-  return QGst::Parse::launch(pipeline).dynamicCast<QGst::Pipeline>();
+static QGst::ElementPtr make_videosink(PipelineBuilder &builder,
+                                       const char *name) {
+  return builder.make("qt5glvideosink", name,
+                      {{"force-aspect-ratio", "true"}});
 }
 
 VideoStreamControl::VideoStreamControl(
     VideoWidget &leftWidget, VideoWidget &rightWidget,
     QGst::Ui::VideoWidget &leftWindow, QGst::Ui::VideoWidget &rightWindow,
     const QString &leftLocation, const QString &rightLocation,
-    const QString &leftAudioLoc, const QString &rightAudioLoc, const bool debug)
-    : pipeline0(makePipeline(debug, 5000, "lwidget", "lwindow", leftLocation)),
-      pipeline1(makePipeline(debug, 5010, "rwidget", "rwindow", rightLocation)),
-      audio(debug
-                ? QGst::PipelinePtr{}
-                : make_audio_pipeline(5000, 5010, leftAudioLoc, rightAudioLoc)),
-      widgetSwitcher(std::make_unique<SinkSwitcher>(pipeline0, pipeline1,
-                                                    "lwidget", "rwidget")),
-      windowSwitcher(std::make_unique<SinkSwitcher>(pipeline0, pipeline1,
-                                                    "lwindow", "rwindow")) {
-
-  leftWindow.setVideoSink(get(Type::Window, Stream::Left));
-  leftWidget.setVideoSink(get(Type::Widget, Stream::Left));
-  rightWindow.setVideoSink(get(Type::Window, Stream::Right));
-  rightWidget.setVideoSink(get(Type::Widget, Stream::Right));
-
-  pipeline0->setState(QGst::StatePlaying);
-  pipeline1->setState(QGst::StatePlaying);
+    const QString &leftAudioLoc, const QString &rightAudioLoc,
+    const QString &host, const intex::ReceiveProfile &profile,
+    const bool debug)
+    : audio(debug ? QGst::PipelinePtr{}
+                  : make_audio_pipeline(5000, 5010, leftAudioLoc,
+                                        rightAudioLoc)) {
+  /* Both streams share one pipeline, so every display can show either;
+   * restarting it after an error in one of them restarts both */
+  PipelineBuilder builder("video");
+  receiver0 = make_receiver(builder, debug, host, 5000, profile, leftLocation);
+  receiver1 =
+      make_receiver(builder, debug, host, 5010, profile, rightLocation);
+
+  auto lwidget = make_videosink(builder, "lwidget");
+  auto rwidget = make_videosink(builder, "rwidget");
+  auto lwindow = make_videosink(builder, "lwindow");
+  auto rwindow = make_videosink(builder, "rwindow");
+  const auto &left = receiver0.display;
+  const auto &right = receiver1.display;
+  widgetSwitcher = std::make_unique<SinkSwitcher>(
+      make_sink_selector(builder, left, right, lwidget),
+      make_sink_selector(builder, right, left, rwidget));
+  windowSwitcher = std::make_unique<SinkSwitcher>(
+      make_sink_selector(builder, left, right, lwindow),
+      make_sink_selector(builder, right, left, rwindow));
+  video = builder.pipeline();
+
+  leftWindow.setVideoSink(lwindow);
+  leftWidget.setVideoSink(lwidget);
+  rightWindow.setVideoSink(rwindow);
+  rightWidget.setVideoSink(rwidget);
+
+  video->setState(QGst::StatePlaying);
   if (audio)
     audio->setState(QGst::StatePlaying);
 }
 
 VideoStreamControl::~VideoStreamControl() {
-  pipeline0->setState(QGst::StateNull);
-  pipeline1->setState(QGst::StateNull);
+  video->setState(QGst::StateNull);
   if (audio)
     audio->setState(QGst::StateNull);
 }
 
-QGst::ElementPtr VideoStreamControl::get(enum Type type, enum Stream side) {
-  std::ostringstream os;
-  QGst::PipelinePtr pipeline;
-
-  switch (side) {
-  case Stream::Left:
-    os << "l";
-    pipeline = pipeline0;
-    break;
-  case Stream::Right:
-    os << "r";
-    pipeline = pipeline1;
-    break;
-  }
-
-  switch (type) {
-  case Type::Widget:
-    os << "widget";
-    break;
-  case Type::Window:
-    os << "window";
-    break;
-  }
-
-  auto sink = pipeline->getElementByName(os.str().c_str());
-  if (!sink) {
-    std::ostringstream os_;
-    os_ << "No element '" << os.str() << "' found.";
-    throw std::runtime_error(os_.str());
-  }
-  return sink;
-}
-
-QGst::PipelinePtr VideoStreamControl::get(const enum Stream side) {
+const VideoStreamControl::Receiver &
+VideoStreamControl::get(const enum Stream side) {
   switch (side) {
   case Stream::Left:
-    return pipeline0;
+    return receiver0;
   case Stream::Right:
-    return pipeline1;
+    return receiver1;
   }
 }
 
@@ -303,8 +226,9 @@ void VideoStreamControl::switchWidgets() { (*widgetSwitcher)(); }
 void VideoStreamControl::switchWindows() { (*windowSwitcher)(); }
 
 template <typename Func>
-static void modify_source(QGst::PipelinePtr pipeline, Func &&modification) {
-  auto src = pipeline->getElementByName("udpsrc0");
+static void modify_source(const VideoStreamControl::Receiver &receiver,
+                          Func &&modification) {
+  auto &src = receiver.source;
   auto ret = src->setState(QGst::StateNull);
   if (ret == QGst::StateChangeFailure)
     qCritical() << "Error changing state";
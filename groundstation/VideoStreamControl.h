@@ -6,11 +6,20 @@
 
 #include "qgst.h"
 #include "qgst_videowidget.h"
+#include "rtp-latency.h"
+#include "rtp-protection.h"
 
 #include "VideoWidget.h"
 
 class SinkSwitcher;
 
+/* Receives both video streams in one pipeline, so that every display can
+ * switch between them without stopping a renderer. The streams are not
+ * isolated from each other: they share the pipeline's bus, clock and state,
+ * so recovering from an error in either one, e.g. a decoder failing on
+ * corrupt input, means restarting both. Only the UDP sources change state
+ * on their own, see setPort and setAddress.
+ */
 class VideoStreamControl {
 public:
   enum class Stream {
@@ -18,18 +27,20 @@ public:
     Right,
   };
 
+  struct Receiver {
+    QGst::ElementPtr source;  /* RTP udpsrc */
+    QGst::ElementPtr display; /* tee of the decoded video */
+    std::shared_ptr<intex::LatencyMeter> latency;
+    std::shared_ptr<intex::ProtectedReceiver> protection;
+  };
+
 private:
-  QGst::PipelinePtr pipeline0;
-  QGst::PipelinePtr pipeline1;
+  QGst::PipelinePtr video;
+  Receiver receiver0;
+  Receiver receiver1;
   QGst::PipelinePtr audio;
 
-  enum class Type {
-    Widget,
-    Window,
-  };
-
-  QGst::ElementPtr get(enum Type, enum Stream);
-  QGst::PipelinePtr get(enum Stream);
+  const Receiver &get(enum Stream);
   std::unique_ptr<SinkSwitcher> widgetSwitcher;
   std::unique_ptr<SinkSwitcher> windowSwitcher;
 
@@ -38,7 +49,8 @@ public:
                      QGst::Ui::VideoWidget &leftWindow,
                      QGst::Ui::VideoWidget &rightWindow, const QString &leftLoc,
                      const QString &rightLoc, const QString &leftAudioLoc,
-                     const QString &rightAudioLoc, const bool debug);
+                     const QString &rightAudioLoc, const QString &host,
+                     const intex::ReceiveProfile &profile, const bool debug);
   ~VideoStreamControl();
 
   void switchWidgets();
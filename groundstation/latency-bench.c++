@@ -0,0 +1,151 @@
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <cstdlib>
+
+#include <QString>
+
+#include <boost/program_options.hpp>
+
+#include "pipeline-builder.h"
+#include "rtp-latency.h"
+
+/* Loopback glass-to-glass latency of the video downlink. A videotestsrc
+ * sender stamps its RTP packets like the experiment does; a receiver with the
+ * ground station's low-latency profile decodes them and measures the delay
+ * of every frame. */
+
+using namespace std::chrono;
+
+using intex::PipelineBuilder;
+using intex::QueueLimits;
+
+static constexpr QueueLimits packet_queue{0, 0, 100ms,
+                                          QueueLimits::Leaky::Downstream};
+static constexpr QueueLimits decode_queue{8, 0, 0ms, QueueLimits::Leaky::No};
+static constexpr QueueLimits display_queue{2, 0, 0ms,
+                                           QueueLimits::Leaky::Downstream};
+
+static const char h264caps[] =
+    "application/x-rtp, media=(string)video, clock-rate=(int)90000, "
+    "encoding-name=(string)H264, packetization-mode=(string)1, "
+    "payload=(int)96";
+
+static QGst::PipelinePtr make_sender(const uint16_t port,
+                                     const unsigned bitrate) {
+  PipelineBuilder builder("sender");
+  auto payloader = builder.chain(
+      {builder.make("videotestsrc", {{"is-live", "true"}, {"pattern", "ball"}}),
+       builder.capsfilter("video/x-raw,format=I420,width=640,height=360,"
+                          "framerate=30/1"),
+       builder.make("x264enc", {{"tune", "zerolatency"},
+                                {"speed-preset", "ultrafast"},
+                                {"bitrate", QString::number(bitrate)}}),
+       builder.make("rtph264pay", {{"config-interval", "1"}})});
+  intex::stampCaptureTime(payloader->getStaticPad("src"));
+  builder.chain({payloader,
+                 builder.make("udpsink", {{"host", "127.0.0.1"},
+                                          {"port", QString::number(port)},
+                                          {"sync", "false"},
+                                          {"async", "false"}})});
+  return builder.pipeline();
+}
+
+static QGst::PipelinePtr
+make_receiver(const uint16_t port, const intex::ReceiveProfile &profile,
+              std::unique_ptr<intex::LatencyMeter> &meter) {
+  PipelineBuilder builder("receiver");
+  auto rtpbin = builder.make(
+      "rtpbin", {{"latency", QString::number(profile.jitter.count())},
+                 {"drop-on-latency", "true"}});
+  auto source = builder.make("udpsrc", {{"port", QString::number(port)}});
+  source->setProperty("caps", QGst::Caps::fromString(h264caps));
+  builder.link(builder.chain({source, builder.queue(packet_queue)}), "src",
+               rtpbin, "recv_rtp_sink_0");
+
+  auto depay = builder.make("rtph264depay");
+  builder.linkDynamic(rtpbin, "recv_rtp_src_0_", depay);
+  auto display = builder.queue(display_queue);
+  builder.chain(
+      {depay, builder.queue(decode_queue), builder.make("h264parse"),
+       builder.make("avdec_h264",
+                    {{"max-threads", QString::number(profile.decoder_threads)},
+                     {"thread-type", "slice"}}),
+       builder.make("videoconvert"), display, builder.make("fakesink")});
+
+  meter = std::make_unique<intex::LatencyMeter>(
+      depay->getStaticPad("sink"), display->getStaticPad("src"),
+      intex::LatencyMeter::Report{}, 0);
+  return builder.pipeline();
+}
+
+static double ms(const microseconds us) {
+  return static_cast<double>(us.count()) / 1000.0;
+}
+
+int main(int argc, char *argv[]) {
+  QGst::init(&argc, &argv);
+
+  namespace po = boost::program_options;
+  po::options_description desc("Video latency benchmark options");
+  // clang-format off
+  desc.add_options()
+    ("help", "Print this help message")
+    ("seconds,s", po::value<unsigned>()->default_value(30),
+     "Measurement time")
+    ("port,p", po::value<uint16_t>()->default_value(5100),
+     "Loopback RTP port")
+    ("bitrate,b", po::value<unsigned>()->default_value(400),
+     "Video bitrate [kbit/s]")
+    ("latency", po::value<unsigned>()->default_value(50),
+     "Jitter buffer latency [ms]")
+    ("decoder-threads", po::value<unsigned>()->default_value(0),
+     "Video decoder threads, 0 for one per core");
+  // clang-format on
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  const auto port = vm["port"].as<uint16_t>();
+  const intex::ReceiveProfile profile{
+      milliseconds(vm["latency"].as<unsigned>()),
+      vm["decoder-threads"].as<unsigned>()};
+
+  try {
+    std::unique_ptr<intex::LatencyMeter> meter;
+    auto receiver = make_receiver(port, profile, meter);
+    auto sender = make_sender(port, vm["bitrate"].as<unsigned>());
+
+    if (receiver->setState(QGst::StatePlaying) == QGst::StateChangeFailure ||
+        sender->setState(QGst::StatePlaying) == QGst::StateChangeFailure)
+      throw std::runtime_error("Could not start the pipelines");
+
+    std::this_thread::sleep_for(seconds(vm["seconds"].as<unsigned>()));
+    const auto stats = meter->stats();
+
+    sender->setState(QGst::StateNull);
+    receiver->setState(QGst::StateNull);
+    meter.reset();
+
+    if (stats.frames == 0)
+      throw std::runtime_error("No frames received");
+    std::cout << stats.frames << " frames: p50 " << ms(stats.p50)
+              << " ms, p99 " << ms(stats.p99) << " ms, max " << ms(stats.max)
+              << " ms" << std::endl;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,191 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#include <cstdlib>
+
+#include <QString>
+
+#include <boost/program_options.hpp>
+
+#include "pipeline-builder.h"
+#include "rtp-protection.h"
+
+/* Loopback run of the protected video downlink over a lossy link. A
+ * videotestsrc sender protects its stream like the experiment does; the RTP
+ * packets, FEC and retransmissions included, are dropped at random on their
+ * way to a receiver with the ground station's protection, which counts what
+ * it repaired, what it lost and the frames it decoded. RTCP is not dropped.
+ */
+
+using namespace std::chrono;
+
+using intex::PipelineBuilder;
+using intex::QueueLimits;
+
+static constexpr QueueLimits packet_queue{0, 0, 100ms,
+                                          QueueLimits::Leaky::Downstream};
+static constexpr QueueLimits decode_queue{8, 0, 0ms, QueueLimits::Leaky::No};
+/* of the test video */
+static constexpr unsigned framerate = 30;
+
+static const char h264caps[] =
+    "application/x-rtp, media=(string)video, clock-rate=(int)90000, "
+    "encoding-name=(string)H264, packetization-mode=(string)1, "
+    "payload=(int)96, rtcp-fb-nack=(boolean)true, "
+    "rtcp-fb-nack-pli=(boolean)true";
+
+static QGst::ElementPtr make_udpsink(PipelineBuilder &builder,
+                                     const uint16_t port) {
+  return builder.make("udpsink", {{"host", "127.0.0.1"},
+                                  {"port", QString::number(port)},
+                                  {"sync", "false"},
+                                  {"async", "false"}});
+}
+
+static QGst::PipelinePtr make_sender(const uint16_t port,
+                                     const unsigned bitrate,
+                                     const double loss,
+                                     const intex::Protection &protection) {
+  PipelineBuilder builder("sender");
+  auto rtpbin = builder.make("rtpbin");
+  auto fec = intex::protectSender(builder, rtpbin, protection);
+  /* IDR frames as far apart as the experiment's encoder puts them */
+  auto payloader = builder.chain(
+      {builder.make("videotestsrc", {{"is-live", "true"}, {"pattern", "ball"}}),
+       builder.capsfilter("video/x-raw,format=I420,width=640,height=360,"
+                          "framerate=30/1"),
+       builder.make("x264enc", {{"tune", "zerolatency"},
+                                {"speed-preset", "ultrafast"},
+                                {"key-int-max", "250"},
+                                {"bitrate", QString::number(bitrate)}}),
+       builder.make("rtph264pay", {{"config-interval", "1"}})});
+  builder.link(fec ? builder.chain({payloader, fec}) : payloader, "src",
+               rtpbin, "send_rtp_sink_0");
+
+  auto lossy = builder.make(
+      "identity", {{"drop-probability", QString::number(loss / 100.0)}});
+  builder.link(rtpbin, "send_rtp_src_0", lossy);
+  builder.chain({lossy, make_udpsink(builder, port)});
+  builder.link(rtpbin, "send_rtcp_src_0", make_udpsink(builder, port + 1));
+  builder.link(
+      builder.make("udpsrc", {{"port", QString::number(port + 5)}}), "src",
+      rtpbin, "recv_rtcp_sink_0");
+  return builder.pipeline();
+}
+
+static QGst::PipelinePtr
+make_receiver(const uint16_t port, const unsigned latency,
+              std::unique_ptr<intex::ProtectedReceiver> &protection,
+              QGst::PadPtr &display) {
+  PipelineBuilder builder("receiver");
+  auto rtpbin = builder.make("rtpbin",
+                             {{"latency", QString::number(latency)},
+                              {"drop-on-latency", "true"}});
+  auto depay = builder.make("rtph264depay");
+  protection = std::make_unique<intex::ProtectedReceiver>(rtpbin, depay);
+
+  auto source = builder.make("udpsrc", {{"port", QString::number(port)}});
+  source->setProperty("caps", QGst::Caps::fromString(h264caps));
+  builder.link(builder.chain({source, builder.queue(packet_queue)}), "src",
+               rtpbin, "recv_rtp_sink_0");
+  builder.linkDynamic(rtpbin, "recv_rtp_src_0_", depay);
+  auto sink = builder.make("fakesink");
+  builder.chain({depay, builder.queue(decode_queue), builder.make("h264parse"),
+                 builder.make("avdec_h264"), sink});
+  display = sink->getStaticPad("sink");
+
+  builder.link(
+      builder.make("udpsrc", {{"port", QString::number(port + 1)}}), "src",
+      rtpbin, "recv_rtcp_sink_0");
+  builder.link(rtpbin, "send_rtcp_src_0", make_udpsink(builder, port + 5));
+  return builder.pipeline();
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wold-style-cast"
+static GstPadProbeReturn count_frame(GstPad *, GstPadProbeInfo *,
+                                     gpointer user_data) {
+  ++*static_cast<std::atomic<uint64_t> *>(user_data);
+  return GST_PAD_PROBE_OK;
+}
+#pragma clang diagnostic pop
+
+int main(int argc, char *argv[]) {
+  QGst::init(&argc, &argv);
+
+  namespace po = boost::program_options;
+  po::options_description desc("Video loss protection benchmark options");
+  // clang-format off
+  desc.add_options()
+    ("help", "Print this help message")
+    ("seconds,s", po::value<unsigned>()->default_value(30),
+     "Measurement time")
+    ("port,p", po::value<uint16_t>()->default_value(5200),
+     "Loopback RTP port")
+    ("bitrate,b", po::value<unsigned>()->default_value(400),
+     "Video bitrate [kbit/s]")
+    ("loss", po::value<double>()->default_value(2.0),
+     "RTP packets dropped [%]")
+    ("fec", po::value<unsigned>()->default_value(10),
+     "FEC packets per 100 media packets")
+    ("rtx", "Retransmit, as the experiment does with INTEX_RTX")
+    ("latency", po::value<unsigned>()->default_value(50),
+     "Jitter buffer latency [ms], as the ground station's --latency; "
+     "retransmissions must fit in it");
+  // clang-format on
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  const auto port = vm["port"].as<uint16_t>();
+  const auto seconds_ = vm["seconds"].as<unsigned>();
+  const intex::Protection protection{vm["fec"].as<unsigned>(),
+                                     vm.count("rtx") > 0};
+
+  try {
+    std::unique_ptr<intex::ProtectedReceiver> receiving;
+    QGst::PadPtr display;
+    auto receiver =
+        make_receiver(port, vm["latency"].as<unsigned>(), receiving, display);
+    auto sender = make_sender(port, vm["bitrate"].as<unsigned>(),
+                              vm["loss"].as<double>(), protection);
+
+    std::atomic<uint64_t> frames{0};
+    gst_pad_add_probe(display, GST_PAD_PROBE_TYPE_BUFFER, count_frame,
+                      &frames, nullptr);
+
+    if (receiver->setState(QGst::StatePlaying) == QGst::StateChangeFailure ||
+        sender->setState(QGst::StatePlaying) == QGst::StateChangeFailure)
+      throw std::runtime_error("Could not start the pipelines");
+
+    std::this_thread::sleep_for(seconds(seconds_));
+    const auto stats = receiving->stats();
+
+    sender->setState(QGst::StateNull);
+    receiver->setState(QGst::StateNull);
+    receiving.reset();
+
+    if (frames == 0)
+      throw std::runtime_error("No frames received");
+    std::cout << frames << " of " << seconds_ * framerate
+              << " frames decoded; packets recovered " << stats.recovered
+              << ", resent " << stats.retransmitted << ", lost " << stats.lost
+              << "; " << stats.keyframe_requests << " keyframe requests"
+              << std::endl;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
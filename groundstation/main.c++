@@ -1,3 +1,4 @@
+#include <chrono>
 #include <string>
 
 #include <QApplication>
@@ -7,6 +8,7 @@
 
 #include "intex.h"
 #include "qgst.h"
+#include "rtp-latency.h"
 #include "Control.h"
 
 int main(int argc, char *argv[]) {
@@ -25,15 +27,23 @@ int main(int argc, char *argv[]) {
     ("host", po::value<std::string>()->default_value(intex_host()),
      "InTex experiment host")
     ("port", po::value<uint16_t>()->default_value(intex_control_port()),
-     "InTex experiment control port");
+     "InTex experiment control port")
+    ("latency", po::value<unsigned>()->default_value(50),
+     "Video jitter buffer latency [ms]; must exceed the round trip for "
+     "the experiment's INTEX_RTX retransmissions to arrive in time")
+    ("decoder-threads", po::value<unsigned>()->default_value(0),
+     "Video decoder threads, 0 for one per core");
   // clang-format on
 
   po::variables_map vm;
   po::store(po::parse_command_line(argc, argv, desc), vm);
   po::notify(vm);
 
+  const intex::ReceiveProfile profile{
+      std::chrono::milliseconds(vm["latency"].as<unsigned>()),
+      vm["decoder-threads"].as<unsigned>()};
   Control control(QString::fromStdString(vm["host"].as<std::string>()),
-                  vm["port"].as<uint16_t>(), vm.count("debug") > 0);
+                  vm["port"].as<uint16_t>(), profile, vm.count("debug") > 0);
   control.show();
   return app.exec();
 }
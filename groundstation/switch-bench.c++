@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <cstdlib>
+
+#include <QString>
+
+#include <boost/program_options.hpp>
+
+#include "pipeline-builder.h"
+#include "SinkSwitcher.h"
+
+/* Switches two live test streams between two sinks the way the ground
+ * station swaps its displays, and measures the time until a sink shows the
+ * new stream, the frames the sinks lost and the longest gap between frames.
+ */
+
+using namespace std::chrono;
+
+using intex::PipelineBuilder;
+
+static constexpr unsigned framerate = 30;
+
+/* Frames seen by one sink; every buffer is tagged with its stream */
+struct SinkProbe {
+  std::mutex mutex;
+  guint64 expected = 0;
+  bool switching = false;
+  steady_clock::time_point switched;
+  steady_clock::time_point last;
+  std::vector<nanoseconds> latencies;
+  nanoseconds max_gap{0};
+  size_t frames = 0;
+
+  /* Counts from now on, leaving out the frames of the warm-up */
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    frames = 0;
+    max_gap = nanoseconds{0};
+  }
+
+  void switchTo(const guint64 stream) {
+    std::lock_guard<std::mutex> lock(mutex);
+    expected = stream;
+    switching = true;
+    switched = steady_clock::now();
+  }
+
+  void frame(const guint64 stream) {
+    const auto now = steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (frames++ > 0)
+      max_gap = std::max(max_gap, duration_cast<nanoseconds>(now - last));
+    last = now;
+    if (switching && stream == expected) {
+      latencies.push_back(now - switched);
+      switching = false;
+    }
+  }
+};
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wold-style-cast"
+static GstPadProbeReturn tag_probe(GstPad *, GstPadProbeInfo *info,
+                                   gpointer user_data) {
+  auto buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+  GST_PAD_PROBE_INFO_DATA(info) = buffer;
+  GST_BUFFER_OFFSET_END(buffer) = GPOINTER_TO_UINT(user_data);
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn sink_probe(GstPad *, GstPadProbeInfo *info,
+                                    gpointer user_data) {
+  static_cast<SinkProbe *>(user_data)->frame(
+      GST_BUFFER_OFFSET_END(GST_PAD_PROBE_INFO_BUFFER(info)));
+  return GST_PAD_PROBE_OK;
+}
+
+static QGst::ElementPtr make_stream(PipelineBuilder &builder,
+                                    const guint stream) {
+  auto source = builder.make(
+      "videotestsrc",
+      {{"is-live", "true"}, {"pattern", stream == 0 ? "ball" : "smpte"}});
+  gst_pad_add_probe(source->getStaticPad("src"), GST_PAD_PROBE_TYPE_BUFFER,
+                    tag_probe, GUINT_TO_POINTER(stream), nullptr);
+  return builder.chain(
+      {source,
+       builder.capsfilter(("video/x-raw,format=I420,width=640,height=360,"
+                           "framerate=" +
+                           QString::number(framerate) + "/1")
+                              .toUtf8()
+                              .constData()),
+       builder.make("tee")});
+}
+
+static QGst::ElementPtr make_sink(PipelineBuilder &builder, SinkProbe &probe) {
+  auto sink = builder.make("fakesink", {{"sync", "true"}});
+  gst_pad_add_probe(sink->getStaticPad("sink"), GST_PAD_PROBE_TYPE_BUFFER,
+                    sink_probe, &probe, nullptr);
+  return sink;
+}
+#pragma clang diagnostic pop
+
+static double ms(const nanoseconds ns) {
+  return static_cast<double>(ns.count()) / 1e6;
+}
+
+static void print(const char *name, SinkProbe &probe,
+                  const duration<double> run) {
+  std::lock_guard<std::mutex> lock(probe.mutex);
+  auto &latencies = probe.latencies;
+  std::sort(latencies.begin(), latencies.end());
+  auto at = [&latencies](const double p) {
+    const auto last = static_cast<double>(latencies.size() - 1);
+    return latencies[static_cast<size_t>(p * last + 0.5)];
+  };
+
+  const auto expected = static_cast<size_t>(run.count() * framerate + 0.5);
+  const auto dropped = expected > probe.frames ? expected - probe.frames : 0;
+  std::cout << name << ": " << latencies.size() << " switches, latency p50 "
+            << (latencies.empty() ? 0.0 : ms(at(0.5))) << " ms, p99 "
+            << (latencies.empty() ? 0.0 : ms(at(0.99))) << " ms; "
+            << probe.frames << " of " << expected << " frames, " << dropped
+            << " dropped, longest gap " << ms(probe.max_gap) << " ms"
+            << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  QGst::init(&argc, &argv);
+
+  namespace po = boost::program_options;
+  po::options_description desc("Display switching benchmark options");
+  // clang-format off
+  desc.add_options()
+    ("help", "Print this help message")
+    ("switches,n", po::value<unsigned>()->default_value(500),
+     "Number of switches")
+    ("interval,i", po::value<unsigned>()->default_value(100),
+     "Time between switches [ms]");
+  // clang-format on
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  const auto switches = vm["switches"].as<unsigned>();
+  const milliseconds interval(vm["interval"].as<unsigned>());
+
+  try {
+    PipelineBuilder builder("switch");
+    SinkProbe lhs, rhs;
+    auto stream0 = make_stream(builder, 0);
+    auto stream1 = make_stream(builder, 1);
+    SinkSwitcher switcher(
+        make_sink_selector(builder, stream0, stream1, make_sink(builder, lhs)),
+        make_sink_selector(builder, stream1, stream0, make_sink(builder, rhs)));
+
+    auto pipeline = builder.pipeline();
+    if (pipeline->setState(QGst::StatePlaying) == QGst::StateChangeFailure)
+      throw std::runtime_error("Could not start the pipeline");
+
+    std::this_thread::sleep_for(1s);
+    lhs.reset();
+    rhs.reset();
+    const auto start = steady_clock::now();
+    for (unsigned i = 0; i < switches; ++i) {
+      const guint64 lstream = (i + 1) % 2;
+      lhs.switchTo(lstream);
+      rhs.switchTo(1 - lstream);
+      switcher();
+      std::this_thread::sleep_for(interval);
+    }
+    const duration<double> run = steady_clock::now() - start;
+    pipeline->setState(QGst::StateNull);
+
+    print("lhs", lhs, run);
+    print("rhs", rhs, run);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -1,12 +1,14 @@
+#include <array>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <vector>
 
-#include <cerrno>
-#include <cstring>
 #include <cstdlib>
 
-#include <fcntl.h>
-
 #include <boost/program_options.hpp>
 #include <boost/algorithm/string.hpp>
 
@@ -19,6 +21,8 @@
 #pragma clang diagnostic ignored "-Wnon-virtual-dtor"
 #include "rpc/intex.capnp.h"
 #pragma clang diagnostic pop
+#include "rpc/telemetry-archive.h"
+#include "rpc/telemetry-codec.h"
 
 static int64_t base_time;
 static int64_t divisor = 1;
@@ -99,14 +103,97 @@ static std::istream &operator>>(std::istream &in, enum pressure &type) {
   return in;
 }
 
-static std::ostream &
-operator<<(std::ostream &os,
-           const typename Reading<Temperature>::Reader &measurement) {
-  os << measurement.getTimestamp() / divisor - base_time << " ";
-  if (measurement.hasError())
-    return os << "nan" << std::endl;
-  else
-    return os << measurement.getReading().getValue() << std::endl;
+static TelemetryChannel channel(const enum temperature t) {
+  switch (t) {
+  case temperature::CPU:
+    return TelemetryChannel::CPU_TEMPERATURE;
+  case temperature::VNA:
+    return TelemetryChannel::VNA_TEMPERATURE;
+  case temperature::INNER_HEATER:
+    return TelemetryChannel::ANTENNA_INNER_TEMPERATURE;
+  case temperature::OUTER_HEATER:
+    return TelemetryChannel::ANTENNA_OUTER_TEMPERATURE;
+  case temperature::ATMOSPHERE:
+    return TelemetryChannel::ATMOSPHERE_TEMPERATURE;
+  case temperature::HUB_PCB:
+    return TelemetryChannel::BOX_TEMPERATURE;
+  }
+}
+
+static TelemetryChannel channel(const enum pressure p) {
+  switch (p) {
+  case pressure::TANK:
+    return TelemetryChannel::TANK_PRESSURE;
+  case pressure::ATMOSPHERE:
+    return TelemetryChannel::ATMOSPHERIC_PRESSURE;
+  case pressure::ANTENNA:
+    return TelemetryChannel::ANTENNA_PRESSURE;
+  }
+}
+
+namespace {
+struct Selection {
+  TelemetryChannel channel;
+  std::string label;
+};
+
+/* Binary output is columnar, for loading into plotting tools directly:
+ * "ITLC", uint32 channel count, then per channel a uint32 label length, the
+ * label, a uint64 sample count n, n int64 timestamps and n doubles. Invalid
+ * readings are NaN. All values in host byte order. */
+class ColumnWriter {
+  struct Column {
+    std::vector<int64_t> time;
+    std::vector<double> value;
+  };
+  std::vector<Column> columns;
+
+  template <typename T> static void put(std::ostream &os, const T &value) {
+    os.write(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+
+public:
+  explicit ColumnWriter(const size_t channels) : columns(channels) {}
+
+  void add(const size_t column, const int64_t time, const double value) {
+    columns[column].time.push_back(time);
+    columns[column].value.push_back(value);
+  }
+
+  void write(std::ostream &os, const std::vector<Selection> &selection) const {
+    os.write("ITLC", 4);
+    put(os, static_cast<uint32_t>(columns.size()));
+    for (size_t i = 0; i < columns.size(); ++i) {
+      const auto &label = selection[i].label;
+      put(os, static_cast<uint32_t>(label.size()));
+      os.write(label.data(), static_cast<std::streamsize>(label.size()));
+      put(os, static_cast<uint64_t>(columns[i].time.size()));
+      os.write(reinterpret_cast<const char *>(columns[i].time.data()),
+               static_cast<std::streamsize>(columns[i].time.size() *
+                                            sizeof(int64_t)));
+      os.write(reinterpret_cast<const char *>(columns[i].value.data()),
+               static_cast<std::streamsize>(columns[i].value.size() *
+                                            sizeof(double)));
+    }
+  }
+};
+}
+
+template <typename T> static std::string label(const T &type) {
+  std::ostringstream os;
+  os << type;
+  return os.str();
+}
+
+/* A CSV field; error reasons may hold commas and quotes */
+static std::string csv_quote(const std::string &text) {
+  std::string quoted("\"");
+  for (const auto c : text) {
+    if (c == '"')
+      quoted += '"';
+    quoted += c;
+  }
+  return quoted + '"';
 }
 
 int main(int argc, char *argv[]) {
@@ -120,12 +207,21 @@ int main(int argc, char *argv[]) {
      "making it T-0 (default: 0). The unit is nanoseconds, except if the "
      "--milliseconds or --microseconds options is specified, then it's ms or "
      "us, respectively")
-    ("temperature,t", po::value<temperature>(),
-     "Temperature data to export. Valid options are:"
-     "cpu, vna, inner-heater-ring, outer-heater-ring, atmosphere, and hub")
-    ("pressure,p", po::value<pressure>(),
-     "Pressure data to export. Valid options are:"
-     "tank, atmopshere, antenna")
+    ("temperature,t", po::value<std::vector<temperature>>()->composing(),
+     "Temperature data to export, may be given several times. Valid options "
+     "are: cpu, vna, inner-heater-ring, outer-heater-ring, atmosphere, and "
+     "hub")
+    ("pressure,p", po::value<std::vector<pressure>>()->composing(),
+     "Pressure data to export, may be given several times. Valid options are: "
+     "tank, atmosphere, antenna. Without any temperature or pressure option, "
+     "all channels are exported")
+    ("from,f", po::value<int64_t>(),
+     "Export readings from this time on, in output time units")
+    ("to", po::value<int64_t>(),
+     "Export readings up to this time, in output time units")
+    ("binary", "Write binary columnar output instead of CSV")
+    ("output,o", po::value<std::string>(),
+     "Output file (default: standard output)")
     ("milliseconds,m", "Output timestamps in milliseconds.")
     ("microseconds,u", "Output timestamps in microseconds.")
     ("input-file,i", po::value<std::string>(),
@@ -148,84 +244,141 @@ int main(int argc, char *argv[]) {
     return EXIT_SUCCESS;
   }
 
-  if (vm.count("pressure") && vm.count("temperature")) {
-    std::cout << "Pressure and temperature specified at the same time. This "
-                 "program can only export one data type at a time."
+  if (vm.count("milliseconds") && vm.count("microseconds")) {
+    std::cout << "You can only specify millisecond or microsecond timestamps."
               << std::endl;
     return EXIT_FAILURE;
   }
 
-  if (vm.count("milliseconds") && vm.count("microseconds")) {
-    std::cout << "You can only specify millisecond or microsecond timestamps."
+  if (!vm.count("input-file")) {
+    std::cout << "Specify the telemetry file to extract data from."
               << std::endl;
     return EXIT_FAILURE;
   }
 
-  const std::string fname = vm["input-file"].as<std::string>();
-  const int fd = open(fname.c_str(), O_RDONLY);
-  if(fd < 0) {
-    std::cout << "Could not open file '" << fname << "': " << strerror(errno)
-              << " (" << errno << ")." << std::endl;
-    return EXIT_FAILURE;
+  std::vector<Selection> selection;
+  if (vm.count("temperature")) {
+    for (const auto t : vm["temperature"].as<std::vector<temperature>>())
+      selection.push_back(Selection{channel(t), label(t)});
+  }
+  if (vm.count("pressure")) {
+    for (const auto p : vm["pressure"].as<std::vector<pressure>>())
+      selection.push_back(Selection{channel(p), label(p)});
   }
+  if (selection.empty()) {
+    for (const auto t : {temperature::CPU, temperature::VNA,
+                         temperature::INNER_HEATER, temperature::OUTER_HEATER,
+                         temperature::ATMOSPHERE, temperature::HUB_PCB})
+      selection.push_back(Selection{channel(t), label(t)});
+    for (const auto p :
+         {pressure::TANK, pressure::ATMOSPHERE, pressure::ANTENNA})
+      selection.push_back(Selection{channel(p), label(p)});
+  }
+
+  /* column of every telemetry channel, or -1 if it is not exported */
+  std::array<int, intex::telemetry_channels> column;
+  column.fill(-1);
+  for (size_t i = 0; i < selection.size(); ++i)
+    column[intex::channel_index(selection[i].channel)] = static_cast<int>(i);
 
-  std::cout << "# time[";
+  std::string unit = "ns";
   if (vm.count("microseconds")) {
     divisor *= 1'000;
-    std::cout << "us";
+    unit = "us";
   } else if (vm.count("milliseconds")) {
     divisor *= 1'000'000;
-    std::cout << "ms";
-  } else {
-    std::cout << "ns";
-  }
-  std::cout << "] ";
-
-  if (vm.count("pressure"))
-    std::cout << vm["pressure"].as<pressure>();
-  if (vm.count("temperature"))
-    std::cout << vm["temperature"].as<temperature>();
-  std::cout << std::endl;
-
-  for (;;) {
-    capnp::StreamFdMessageReader reader(fd);
-    auto telemetry = reader.getRoot<Telemetry>();
-
-    if (vm.count("pressure")) {
-      switch (vm["pressure"].as<pressure>()) {
-      case pressure::TANK:
-        std::cout << telemetry.getTankPressure();
-        break;
-      case pressure::ATMOSPHERE:
-        std::cout << telemetry.getAtmosphericPressure();
-        break;
-      case pressure::ANTENNA:
-        std::cout << telemetry.getAntennaPressure();
-        break;
+    unit = "ms";
+  }
+
+  const bool from = vm.count("from") > 0;
+  const bool to = vm.count("to") > 0;
+  const int64_t first = from ? vm["from"].as<int64_t>() : 0;
+  const int64_t last = to ? vm["to"].as<int64_t>() : 0;
+
+  const std::string fname = vm["input-file"].as<std::string>();
+  std::unique_ptr<intex::TelemetryArchive> archive;
+  try {
+    archive = std::make_unique<intex::TelemetryArchive>(fname);
+  } catch (const std::exception &e) {
+    std::cout << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::ofstream file;
+  if (vm.count("output")) {
+    const auto mode = vm.count("binary") ? std::ios::out | std::ios::binary
+                                         : std::ios::out;
+    file.open(vm["output"].as<std::string>(), mode);
+    if (!file) {
+      std::cout << "Could not open file '" << vm["output"].as<std::string>()
+                << "' for writing." << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  std::ostream &out = vm.count("output") ? file : std::cout;
+
+  const bool binary = vm.count("binary") > 0;
+  ColumnWriter columns(selection.size());
+  if (!binary)
+    out << "time[" << unit << "],channel,value,stddev,min,max,error\n";
+
+  intex::TelemetryDecoder decoder;
+  const auto export_samples = [&] {
+    for (const auto &reading : decoder.samples()) {
+      const auto col = column[intex::channel_index(reading.channel)];
+      if (col < 0)
+        continue;
+      const auto &value = reading.value;
+      const int64_t time = value.timestamp / divisor - base_time;
+      if ((from && time < first) || (to && time > last))
+        continue;
+
+      const double nan = std::numeric_limits<double>::quiet_NaN();
+      if (binary) {
+        columns.add(static_cast<size_t>(col), time,
+                    value.valid ? value.value : nan);
+      } else if (value.valid) {
+        out << time << "," << selection[static_cast<size_t>(col)].label << ","
+            << value.value << "," << value.stddev << "," << value.min << ","
+            << value.max << ",\n";
+      } else {
+        out << time << "," << selection[static_cast<size_t>(col)].label
+            << ",nan,nan,nan,nan," << csv_quote(value.reason) << "\n";
       }
     }
+  };
 
-    if (vm.count("temperature")) {
-      switch (vm["temperature"].as<temperature>()) {
-      case temperature::CPU:
-        std::cout << telemetry.getCpuTemperature();
-        break;
-      case temperature::VNA:
-        std::cout << telemetry.getVnaTemperature();
-        break;
-      case temperature::INNER_HEATER:
-        std::cout << telemetry.getAntennaInnerTemperature();
-        break;
-      case temperature::OUTER_HEATER:
-        std::cout << telemetry.getAntennaOuterTemperature();
-        break;
-      case temperature::ATMOSPHERE:
-        std::cout << telemetry.getAtmosphereTemperature();
-        break;
-      case temperature::HUB_PCB:
-        std::cout << telemetry.getBoxTemperature();
-        break;
+  try {
+    if (archive->legacy()) {
+      /* files from before the archive format: plain Telemetry messages and
+       * compact frames back to back, no index */
+      kj::ArrayInputStream in(archive->data());
+      while (decoder.decode(in))
+        export_samples();
+    } else {
+      /* a record holds the readings taken up to its timestamp, so the first
+       * record at or after the start time is the first one needed */
+      size_t offset = from ? archive->seek((first + base_time) * divisor)
+                           : archive->begin();
+      intex::TelemetryArchive::Record record;
+      while (archive->next(offset, record)) {
+        kj::ArrayInputStream in(record.frame);
+        decoder.decode(in);
+        export_samples();
+        if (to && record.timestamp / divisor - base_time > last)
+          break;
       }
     }
+  } catch (const kj::Exception &e) {
+    std::cerr << "Stopped at invalid record: " << e.getDescription().cStr()
+              << std::endl;
+  } catch (const std::exception &e) {
+    std::cerr << "Stopped at invalid record: " << e.what() << std::endl;
   }
+
+  if (binary)
+    columns.write(out, selection);
+  out.flush();
+
+  return EXIT_SUCCESS;
 }
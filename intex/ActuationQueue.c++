@@ -0,0 +1,114 @@
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include <QDebug>
+
+#include "ActuationQueue.h"
+
+using namespace std::chrono;
+
+namespace intex {
+
+namespace {
+struct Job {
+  std::function<void()> run;
+  ActuationQueue::Done done;
+  steady_clock::time_point submitted;
+  uint32_t depth;
+};
+
+struct Worker {
+  std::deque<Job> queue;
+  bool busy = false;
+  std::condition_variable wakeup;
+  std::thread thread;
+};
+}
+
+struct ActuationQueue::Impl {
+  mutable std::mutex mutex;
+  std::map<unsigned, std::unique_ptr<Worker>> workers;
+  bool stopping = false;
+
+  ~Impl() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    for (auto &worker : workers) {
+      worker.second->wakeup.notify_all();
+      worker.second->thread.join();
+    }
+  }
+
+  void run(Worker &worker) {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      worker.wakeup.wait(lock,
+                         [&] { return stopping || !worker.queue.empty(); });
+      if (worker.queue.empty())
+        return;
+
+      auto job = std::move(worker.queue.front());
+      worker.queue.pop_front();
+      worker.busy = true;
+      lock.unlock();
+
+      const auto start = steady_clock::now();
+      std::string error;
+      try {
+        job.run();
+      } catch (const std::exception &e) {
+        error = e.what();
+      } catch (...) {
+        error = "Unknown error";
+      }
+      const auto end = steady_clock::now();
+
+      const Report report{job.depth,
+                          duration_cast<microseconds>(start - job.submitted),
+                          duration_cast<microseconds>(end - start)};
+      try {
+        job.done(report, error);
+      } catch (const std::exception &e) {
+        qCritical() << e.what();
+      }
+
+      lock.lock();
+      worker.busy = false;
+    }
+  }
+};
+
+ActuationQueue::ActuationQueue() : d(std::make_unique<Impl>()) {}
+ActuationQueue::~ActuationQueue() = default;
+
+void ActuationQueue::submit(const unsigned device,
+                            std::function<void()> command, Done done) {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  auto &worker = d->workers[device];
+  if (!worker) {
+    worker = std::make_unique<Worker>();
+    auto &w = *worker;
+    w.thread = std::thread([this, &w] { d->run(w); });
+  }
+
+  const auto depth = worker->queue.size() + (worker->busy ? 1 : 0);
+  worker->queue.push_back({std::move(command), std::move(done),
+                           steady_clock::now(), static_cast<uint32_t>(depth)});
+  worker->wakeup.notify_one();
+}
+
+size_t ActuationQueue::depth(const unsigned device) const {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  auto it = d->workers.find(device);
+  if (it == d->workers.end())
+    return 0;
+  return it->second->queue.size() + (it->second->busy ? 1 : 0);
+}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace intex {
+
+/* Runs hardware commands on worker threads, off the RPC and Qt event loops.
+ * Every device has a worker of its own, started with its first command:
+ * commands to one device run one after another in the order they were
+ * submitted, commands to different devices run concurrently.
+ */
+class ActuationQueue {
+  struct Impl;
+  std::unique_ptr<Impl> d;
+
+public:
+  struct Report {
+    uint32_t depth;                     /* commands ahead when submitted */
+    std::chrono::microseconds wait;     /* queued */
+    std::chrono::microseconds duration; /* executing */
+  };
+  /* Called on the worker once the command ran; error is empty on success */
+  using Done = std::function<void(const Report &, const std::string &error)>;
+
+  ActuationQueue();
+  /* Runs the commands queued so far before returning */
+  ~ActuationQueue();
+  ActuationQueue(const ActuationQueue &) = delete;
+  ActuationQueue &operator=(const ActuationQueue &) = delete;
+
+  /* Thread-safe */
+  void submit(const unsigned device, std::function<void()> command,
+              Done done);
+  /* Commands queued or running for device */
+  size_t depth(const unsigned device) const;
+};
+}
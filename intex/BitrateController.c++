@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#include <QDebug>
+
+#include "BitrateController.h"
+
+namespace intex {
+
+BitrateController::BitrateController(const Limits &limits_,
+                                     const uint64_t initial, Apply apply_)
+    : limits(limits_), apply(std::move(apply_)) {
+  if (limits.min > limits.max || limits.min * feeds > limits.budget)
+    throw std::runtime_error("Bitrate limits exceed the link budget");
+
+  for (auto &feed : state)
+    feed = Feed{std::min(std::max(initial, limits.min), limits.max),
+                limits.max, 0.0};
+}
+
+uint64_t BitrateController::clamp(const size_t feed,
+                                  const double bitrate) const {
+  uint64_t others = 0;
+  for (size_t i = 0; i < feeds; ++i) {
+    if (i != feed)
+      others += state[i].bitrate;
+  }
+
+  /* a feed may always grow to its fair share; the others give way on their
+   * next report */
+  const uint64_t left = limits.budget > others ? limits.budget - others : 0;
+  const auto share = std::max(left, limits.budget / feeds);
+  const auto upper = std::min(state[feed].ceiling, share);
+  const auto value = static_cast<uint64_t>(std::max(bitrate, 0.0));
+  return std::max(limits.min, std::min(value, upper));
+}
+
+void BitrateController::report(const size_t feed, const ReceiverReport &rr) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &f = state.at(feed);
+
+  if (rr.round_trip > 0.0 && (f.min_rtt == 0.0 || rr.round_trip < f.min_rtt))
+    f.min_rtt = rr.round_trip;
+
+  const bool queueing = f.min_rtt > 0.0 &&
+                        rr.round_trip > f.min_rtt + queue_delay;
+  double target = static_cast<double>(f.bitrate);
+  if (rr.fraction_lost > loss_high) {
+    target *= 1.0 - rr.fraction_lost / 2.0;
+  } else if (queueing || rr.jitter > max_jitter) {
+    target *= decrease;
+  } else if (rr.fraction_lost < loss_low) {
+    target *= increase;
+  }
+
+  const auto next = clamp(feed, target);
+  if (next == f.bitrate)
+    return;
+  f.bitrate = next;
+
+  qDebug() << "Feed" << feed << "loss" << rr.fraction_lost << "jitter"
+           << rr.jitter << "rtt" << rr.round_trip << "-> bitrate" << next;
+  apply(feed, next);
+}
+
+void BitrateController::setCeiling(const size_t feed, const uint64_t bitrate) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &f = state.at(feed);
+  f.ceiling = bitrate == 0
+                  ? limits.max
+                  : std::min(std::max(bitrate, limits.min), limits.max);
+  const auto next = std::min(f.bitrate, f.ceiling);
+  if (next == f.bitrate)
+    return;
+  f.bitrate = next;
+  apply(feed, next);
+}
+
+uint64_t BitrateController::bitrate(const size_t feed) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return state.at(feed).bitrate;
+}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <mutex>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace intex {
+
+/* One RTCP receiver report block, as seen by the sender */
+struct ReceiverReport {
+  double fraction_lost; /* 0 … 1, since the previous report */
+  double jitter;        /* s */
+  double round_trip;    /* s, 0 if unknown */
+};
+
+/* Loss- and delay-based congestion control for the video downlinks. Every
+ * receiver report steps the bitrate of its feed down on loss or queueing
+ * delay and up while the link is clean. All feeds share one link budget.
+ * Thread-safe; reports arrive on GStreamer's RTCP threads. Apply runs under
+ * the controller's lock, so changes reach it in the order they were made;
+ * it must not call back into the controller.
+ */
+class BitrateController {
+public:
+  static constexpr size_t feeds = 2;
+
+  struct Limits {
+    uint64_t min;    /* per feed, bit/s */
+    uint64_t max;    /* per feed, bit/s */
+    uint64_t budget; /* sum of all feeds, bit/s */
+  };
+
+  using Apply = std::function<void(size_t feed, uint64_t bitrate)>;
+
+  BitrateController(const Limits &limits, const uint64_t initial,
+                    Apply apply);
+  /* Operator limit of one feed; 0 restores the configured maximum */
+  void setCeiling(const size_t feed, const uint64_t bitrate);
+  void report(const size_t feed, const ReceiverReport &report);
+  uint64_t bitrate(const size_t feed) const;
+
+private:
+  static constexpr double loss_high = 0.10;
+  static constexpr double loss_low = 0.02;
+  static constexpr double queue_delay = 0.1; /* s above the minimum RTT */
+  static constexpr double max_jitter = 0.05; /* s */
+  static constexpr double increase = 1.08;
+  static constexpr double decrease = 0.85;
+
+  struct Feed {
+    uint64_t bitrate;
+    uint64_t ceiling;
+    double min_rtt;
+  };
+
+  const Limits limits;
+  const Apply apply;
+  mutable std::mutex mutex;
+  std::array<Feed, feeds> state;
+
+  uint64_t clamp(const size_t feed, const double bitrate) const;
+};
+}
@@ -1,6 +1,8 @@
+#include <algorithm>
+#include <array>
+#include <deque>
 #include <iostream>
 #include <stdexcept>
-#include <thread>
 #include <chrono>
 
 #include <QDateTime>
@@ -10,18 +12,173 @@
 #include <QSettings>
 #include <QTime>
 #include <QObject>
+#include <QThread>
+#include <QCoreApplication>
 
 #include "CommandInterface.h"
+#include "TelemetryFeed.h"
 #include "VideoStreamSourceControl.h"
 #include "intex.h"
 
 InTexServer *server_instance = nullptr;
 
-InTexServer::InTexServer(QString host)
-    : client("127.0.0.1"), control(host, 54431) {
+/* frames held back for a slow subscriber, and sent with one push */
+static constexpr size_t max_backlog = 4096;
+static constexpr size_t max_push = 64;
+
+/* Frames of one subscriber on their way to its sink, one push at a time.
+ * Lives on the RPC event loop; the feed posts frames to it by id. */
+class InTexServer::Subscription final : public TelemetrySubscription::Server,
+                                        public kj::TaskSet::ErrorHandler {
+  using Frame = intex::TelemetryFeed::Frame;
+  using FramePtr = intex::TelemetryFeed::FramePtr;
+
+  InTexServer &server;
+  const uint64_t id;
+  uint64_t feed_id = 0; /* none */
+  TelemetrySink::Client sink;
+  std::array<bool, intex::telemetry_channels> channels;
+  const std::chrono::milliseconds interval;
+
+  std::deque<FramePtr> backlog;
+  /* live frames wait behind the missed ones until those are read */
+  bool replaying = true;
+  uint32_t dropped = 0;
+  size_t in_flight = 0;
+  std::chrono::steady_clock::time_point last_push;
+  /* a flush is due once the interval has passed */
+  bool throttled = false;
+  intex::TelemetryEncoder encoder;
+  kj::TaskSet tasks;
+
+  /* Key frame of the subscribed channels, all readings sent as a batch */
+  kj::Array<capnp::byte> encode(const Frame &frame) {
+    std::vector<intex::TelemetryReading> readings;
+    for (const auto &reading : frame.readings) {
+      const auto channel = intex::channel_index(reading.channel);
+      if (channel < channels.size() && channels[channel])
+        readings.push_back(reading);
+    }
+    return encoder.encode(intex::TelemetryState{}, frame.timestamp,
+                          kj::arrayPtr(readings.data(), readings.size()),
+                          kj::arrayPtr(frame.cameras.data(),
+                                       frame.cameras.size()));
+  }
+
+  void flush() {
+    using namespace std::chrono;
+    if (replaying || in_flight || backlog.empty())
+      return;
+    /* missed frames go out as fast as the sink takes them */
+    const auto now = steady_clock::now();
+    if (!backlog.front()->replayed && now - last_push < interval) {
+      if (!throttled) {
+        throttled = true;
+        const auto wait =
+            duration_cast<milliseconds>(last_push + interval - now) + 1ms;
+        tasks.add(server.after(wait).then([this] {
+          throttled = false;
+          flush();
+        }));
+      }
+      return;
+    }
+
+    const auto count = std::min(backlog.size(), max_push);
+    auto request = sink.pushRequest();
+    auto frames = request.initFrames(static_cast<unsigned>(count));
+    for (unsigned i = 0; i < frames.size(); ++i) {
+      const auto &frame = *backlog[i];
+      const auto bytes = encode(frame);
+      frames[i].setTimestamp(frame.timestamp);
+      frames[i].setFrame(bytes);
+      frames[i].setReplayed(frame.replayed);
+    }
+    request.setDropped(dropped);
+    dropped = 0;
+    backlog.erase(backlog.begin(),
+                  backlog.begin() + static_cast<std::ptrdiff_t>(count));
+
+    in_flight = count;
+    last_push = now;
+    tasks.add(request.send().then([this](auto &&) {
+      in_flight = 0;
+      flush();
+    }));
+  }
+
+  void taskFailed(kj::Exception &&exception) override {
+    qCritical() << "Telemetry push failed:"
+                << exception.getDescription().cStr();
+    dropped += static_cast<uint32_t>(in_flight);
+    in_flight = 0;
+    throttled = false;
+  }
+
+public:
+  Subscription(InTexServer &server_, const uint64_t id_,
+               TelemetrySink::Client sink_,
+               const std::array<bool, intex::telemetry_channels> &channels_,
+               const std::chrono::milliseconds interval_)
+      : server(server_), id(id_), sink(kj::mv(sink_)), channels(channels_),
+        interval(interval_), tasks(*this) {
+    server.subscriptions[id] = this;
+  }
+
+  ~Subscription() {
+    server.control.telemetry().unsubscribe(feed_id);
+    server.subscriptions.erase(id);
+  }
+
+  void start(const int64_t since) {
+    feed_id = server.control.telemetry().subscribe(
+        since, max_backlog,
+        [server = &server, id = id](const FramePtr &frame) {
+          server->post([server, id, frame] {
+            auto it = server->subscriptions.find(id);
+            if (it != server->subscriptions.end())
+              it->second->add(frame);
+          });
+        },
+        [server = &server, id = id](std::vector<FramePtr> missed) {
+          server->post([server, id, missed] {
+            auto it = server->subscriptions.find(id);
+            if (it != server->subscriptions.end())
+              it->second->replayed(missed);
+          });
+        });
+  }
+
+  void replayed(const std::vector<FramePtr> &missed) {
+    qDebug() << "Telemetry subscription" << id << "replays" << missed.size()
+             << "frames";
+    backlog.insert(backlog.begin(), missed.begin(), missed.end());
+    /* the oldest missed frames give way to the live ones */
+    if (backlog.size() > max_backlog)
+      backlog.erase(backlog.begin(),
+                    backlog.end() - static_cast<std::ptrdiff_t>(max_backlog));
+    replaying = false;
+    flush();
+  }
+
+  void add(FramePtr frame) {
+    backlog.push_back(std::move(frame));
+    if (backlog.size() > max_backlog) {
+      backlog.pop_front();
+      ++dropped;
+    }
+    flush();
+  }
+};
+
+InTexServer::InTexServer(QString host, intex::rpc::EzRpcThread *rpc)
+    : client("127.0.0.1"), rpc(rpc), control(host) {
   QObject::connect(&syslog_socket, &QAbstractSocket::connected, [this] {
     logs.push_back(std::make_unique<QTextStream>(&syslog_socket));
   });
+  QObject::connect(&pending_timer, &QTimer::timeout,
+                   [this] { flushPendingLogs(); });
+  pending_timer.start(100);
   setupLogStream(4005);
   setupLogFiles();
 }
@@ -45,89 +202,214 @@ void InTexServer::syslog(QtMsgType type, const QString &msg) {
     break;
   }
 
+  if (log_storage) {
+    const auto line = (prefix + msg + '\n').toUtf8();
+    log_storage->write(line.constData(), static_cast<size_t>(line.size()));
+  }
+
+  /* sockets belong to the main thread */
+  if (QThread::currentThread() != QCoreApplication::instance()->thread()) {
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    pending_logs.push_back(prefix + msg);
+    return;
+  }
+
+  flushPendingLogs();
+  writeLog(prefix + msg);
+}
+
+void InTexServer::writeLog(const QString &line) {
   for (const auto &log : logs) {
-    *log << prefix << msg << endl;
+    *log << line << endl;
+  }
+}
+
+void InTexServer::flushPendingLogs() {
+  std::vector<QString> lines;
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    lines.swap(pending_logs);
+  }
+
+  for (const auto &line : lines) {
+    writeLog(line);
   }
 }
 
+kj::Promise<void> InTexServer::dispatch(std::function<void()> function) {
+  if (!rpc) {
+    function();
+    return kj::READY_NOW;
+  }
+  return rpc->callOnQt(std::move(function));
+}
+
+void InTexServer::post(std::function<void()> function) {
+  if (rpc)
+    rpc->post(std::move(function));
+  else
+    executor.post(std::move(function));
+}
+
+kj::Promise<void> InTexServer::after(const std::chrono::milliseconds delay) {
+  if (rpc)
+    return rpc->afterDelay(delay.count() * kj::MILLISECONDS);
+  /* kj has no timers on the Qt event loop */
+  auto paf = kj::newPromiseAndFulfiller<void>();
+  auto fulfiller = std::make_shared<kj::Own<kj::PromiseFulfiller<void>>>(
+      kj::mv(paf.fulfiller));
+  QTimer::singleShot(static_cast<int>(delay.count()), &executor,
+                     [fulfiller] { (*fulfiller)->fulfill(); });
+  return kj::mv(paf.promise);
+}
+
+kj::Promise<intex::ActuationQueue::Report>
+InTexServer::actuate(const InTexHW device, std::function<void()> command) {
+  using Report = intex::ActuationQueue::Report;
+  auto paf = kj::newPromiseAndFulfiller<Report>();
+  auto fulfiller = std::make_shared<kj::Own<kj::PromiseFulfiller<Report>>>(
+      kj::mv(paf.fulfiller));
+
+  actuation.submit(
+      static_cast<unsigned>(device), std::move(command),
+      [this, fulfiller](const Report &report, const std::string &error) {
+        post([fulfiller, report, error] {
+          /* the fulfiller belongs to the event loop's thread */
+          auto done = kj::mv(*fulfiller);
+          if (error.empty()) {
+            done->fulfill(Report(report));
+          } else {
+            done->reject(kj::Exception(kj::Exception::Type::FAILED, __FILE__,
+                                       __LINE__, kj::heapString(error)));
+          }
+        });
+      });
+  return kj::mv(paf.promise);
+}
+
 kj::Promise<void> InTexServer::setPort(SetPortContext context) {
   std::cout << __PRETTY_FUNCTION__ << " "
             << static_cast<int>(context.getParams().getService()) << " "
             << context.getParams().getPort() << std::endl;
   auto params = context.getParams();
+  const auto service = params.getService();
   const auto port = params.getPort();
-  switch (params.getService()) {
-  case InTexService::LOG:
-    setupLogStream(port);
-  }
-  throw std::runtime_error("Port not implemented.");
+  return dispatch([this, service, port] {
+    switch (service) {
+    case InTexService::LOG:
+      setupLogStream(port);
+    }
+    throw std::runtime_error("Port not implemented.");
+  });
 }
 
-kj::Promise<void> InTexServer::setGPIO(SetGPIOContext context) {
-  using namespace std::literals::chrono_literals;
-  std::cout << __PRETTY_FUNCTION__ << std::endl;
-  std::this_thread::sleep_for(0.1s);
-  auto params = context.getParams();
-  switch (params.getPort()) {
+/* Runs on the device's actuation worker, including the GPIO retries */
+static void set_gpio(const InTexHW hw, const bool on) {
+  switch (hw) {
   case InTexHW::VALVE0:
-    intex::hw::Valve::pressureTankValve().set(params.getOn());
-    return kj::READY_NOW;
+    intex::hw::Valve::pressureTankValve().set(on);
+    return;
   case InTexHW::VALVE1:
-    intex::hw::Valve::outletValve().set(params.getOn());
-    return kj::READY_NOW;
+    intex::hw::Valve::outletValve().set(on);
+    return;
   case InTexHW::HEATER0:
-    intex::hw::Heater::innerHeater().set(params.getOn());
-    return kj::READY_NOW;
+    intex::hw::Heater::innerHeater().set(on);
+    return;
   case InTexHW::HEATER1:
-    intex::hw::Heater::outerHeater().set(params.getOn());
-    return kj::READY_NOW;
+    intex::hw::Heater::outerHeater().set(on);
+    return;
   case InTexHW::BURNWIRE:
-    intex::hw::Burnwire::burnwire().set(params.getOn());
-    return kj::READY_NOW;
+    intex::hw::Burnwire::burnwire().set(on);
+    return;
   case InTexHW::MINIVNA:
-    intex::hw::MiniVNA::miniVNA().set(params.getOn());
-    return kj::READY_NOW;
+    intex::hw::MiniVNA::miniVNA().set(on);
+    return;
   case InTexHW::USBHUB:
-    intex::hw::USBHub::usbHub().set(params.getOn());
-    return kj::READY_NOW;
+    intex::hw::USBHub::usbHub().set(on);
+    return;
   }
   throw std::runtime_error("GPIO not implemented.");
 }
 
+kj::Promise<void> InTexServer::setGPIO(SetGPIOContext context) {
+  std::cout << __PRETTY_FUNCTION__ << std::endl;
+  auto params = context.getParams();
+  const auto hw = params.getPort();
+  const auto on = params.getOn();
+  return actuate(hw, [hw, on] { set_gpio(hw, on); })
+      .then([context](const intex::ActuationQueue::Report &report) mutable {
+        auto actuation = context.getResults().initActuation();
+        actuation.setQueueDepth(report.depth);
+        actuation.setWaitTime(static_cast<uint32_t>(report.wait.count()));
+        actuation.setExecTime(static_cast<uint32_t>(report.duration.count()));
+      });
+}
+
 kj::Promise<void> InTexServer::start(StartContext context) {
-  control.videoStart(context.getParams().getFeed());
-  return kj::READY_NOW;
+  const auto feed = context.getParams().getFeed();
+  return dispatch([this, feed] { control.videoStart(feed); });
 }
 
 kj::Promise<void> InTexServer::stop(StopContext context) {
-  control.videoStop(context.getParams().getFeed());
-  return kj::READY_NOW;
+  const auto feed = context.getParams().getFeed();
+  return dispatch([this, feed] { control.videoStop(feed); });
 }
 
 kj::Promise<void> InTexServer::next(NextContext context) {
-  control.videoNext(context.getParams().getFeed());
-  return kj::READY_NOW;
+  const auto feed = context.getParams().getFeed();
+  return dispatch([this, feed] { control.videoNext(feed); });
 }
 
 kj::Promise<void> InTexServer::setVolume(SetVolumeContext context) {
   auto params = context.getParams();
-  control.setVolume(params.getFeed(), params.getVolume());
-  return kj::READY_NOW;
+  const auto feed = params.getFeed();
+  const auto volume = params.getVolume();
+  return dispatch([this, feed, volume] { control.setVolume(feed, volume); });
 }
 
 kj::Promise<void> InTexServer::setBitrate(SetBitrateContext context) {
   auto params = context.getParams();
-  control.setBitrate(params.getFeed(), params.getBitrate());
+  const auto feed = params.getFeed();
+  const auto bitrate = params.getBitrate();
+  /* thread-safe; the controller hands the encoder change to the Qt thread */
+  control.setBitrate(feed, bitrate);
   return kj::READY_NOW;
 }
 
+kj::Promise<void>
+InTexServer::setFecOverhead(SetFecOverheadContext context) {
+  auto params = context.getParams();
+  const auto feed = params.getFeed();
+  const auto percentage = params.getPercentage();
+  return dispatch([this, feed, percentage] {
+    control.setFecOverhead(feed, percentage);
+  });
+}
+
 kj::Promise<void> InTexServer::launch(LaunchContext) {
-  control.launched();
-  return kj::READY_NOW;
+  return dispatch([this] { control.launched(); });
 }
 
 kj::Promise<void> InTexServer::nva(NvaContext) {
-  control.measureAntenna();
+  return dispatch([this] { control.measureAntenna(); });
+}
+
+kj::Promise<void>
+InTexServer::subscribeTelemetry(SubscribeTelemetryContext context) {
+  auto params = context.getParams();
+  std::array<bool, intex::telemetry_channels> channels;
+  channels.fill(params.getChannels().size() == 0);
+  for (const auto channel : params.getChannels()) {
+    const auto index = intex::channel_index(channel);
+    if (index < channels.size())
+      channels[index] = true;
+  }
+
+  auto subscription = kj::heap<Subscription>(
+      *this, next_subscription++, params.getSink(), channels,
+      std::chrono::milliseconds(params.getInterval()));
+  subscription->start(params.getSince());
+  context.getResults().setSubscription(kj::mv(subscription));
   return kj::READY_NOW;
 }
 
@@ -139,31 +421,7 @@ void InTexServer::setupLogStream(const uint16_t port) {
 void InTexServer::setupLogFiles() {
   auto date = QDateTime::currentDateTime().toString(Qt::ISODate);
 
-  try {
-    auto file = std::make_unique<QFile>(storageLocation(intex::Subsystem::Log));
-    if (file == nullptr) {
-      throw std::runtime_error("Could not create QFile object.");
-    }
-
-    if (!file->open(QIODevice::WriteOnly | QIODevice::Append |
-                    QIODevice::Text)) {
-      throw std::runtime_error("Could not open log file " +
-                               file->fileName().toStdString() +
-                               " for writing.");
-    }
-
-    auto stream = std::make_unique<QTextStream>(file.get());
-    if (stream == nullptr) {
-      throw std::runtime_error(
-          "Could not create QTextStream object for log file " +
-          file->fileName().toStdString() + ".");
-    }
-
-    files.push_back(std::move(file));
-    logs.push_back(std::move(stream));
-
-    *logs.back() << "Log created at " << date << endl;
-  } catch (const std::runtime_error &e) {
-    qCritical() << QString::fromStdString(e.what());
-  }
+  log_storage = std::make_unique<intex::StorageWriter>(intex::Subsystem::Log);
+  const auto line = ("Log created at " + date + '\n').toUtf8();
+  log_storage->write(line.constData(), static_cast<size_t>(line.size()));
 }
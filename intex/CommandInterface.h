@@ -1,14 +1,18 @@
 #pragma once
+#include <chrono>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <vector>
 #include <string>
 
-#include <QFile>
 #include <QObject>
 #include <QString>
 #include <QtGlobal>
 #include <QUdpSocket>
 #include <QTextStream>
+#include <QTimer>
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wnon-virtual-dtor"
@@ -16,35 +20,70 @@
 #include "rpc/intex.capnp.h"
 #pragma clang diagnostic pop
 
+#include "rpc/ez-rpc.h"
+#include "ActuationQueue.h"
 #include "IntexHardware.h"
 #include "ExperimentControl.h"
+#include "StorageWriter.h"
 
 class InTexServer final : public Command::Server {
   static constexpr int max_logfiles = 10000;
   std::string client;
 
   QUdpSocket syslog_socket;
-  std::vector<std::unique_ptr<QFile>> files;
   std::vector<std::unique_ptr<QTextStream>> logs;
+  /* written behind by its own thread, from any thread */
+  std::unique_ptr<intex::StorageWriter> log_storage;
+  /* messages logged from worker threads, sent by the main thread */
+  std::mutex pending_mutex;
+  std::vector<QString> pending_logs;
+  QTimer pending_timer;
 
+  /* serving from, if not from the Qt event loop */
+  intex::rpc::EzRpcThread *rpc;
+  intex::rpc::QtExecutor executor;
+  /* its telemetry replay thread posts through the above */
   intex::ExperimentControl control;
+  /* destroyed first; its workers post their results through the above */
+  intex::ActuationQueue actuation;
 
+  class Subscription;
+  /* owned by their capabilities; only touched on the RPC event loop */
+  std::map<uint64_t, Subscription *> subscriptions;
+  uint64_t next_subscription = 0;
+
+  /* Runs function on the Qt thread, which owns the control and sockets.
+   * Handlers that are thread-safe run where they are called instead. */
+  kj::Promise<void> dispatch(std::function<void()> function);
+  /* Runs function on the thread of the RPC event loop; thread-safe */
+  void post(std::function<void()> function);
+  /* Called on the RPC event loop: resolves on it after delay */
+  kj::Promise<void> after(const std::chrono::milliseconds delay);
+  /* Runs command on the device's actuation worker */
+  kj::Promise<intex::ActuationQueue::Report>
+  actuate(const InTexHW device, std::function<void()> command);
   void setupLogStream(const uint16_t port);
   void setupLogFiles();
+  void writeLog(const QString &line);
+  void flushPendingLogs();
 
 public:
-  InTexServer(QString host);
+  /* Created on the Qt thread; rpc is the thread serving it, if any */
+  explicit InTexServer(QString host, intex::rpc::EzRpcThread *rpc = nullptr);
   ~InTexServer();
   void syslog(QtMsgType type, const QString &msg);
   kj::Promise<void> setPort(SetPortContext context) override;
   kj::Promise<void> setBitrate(SetBitrateContext context) override;
   kj::Promise<void> setVolume(SetVolumeContext context) override;
+  kj::Promise<void> setFecOverhead(SetFecOverheadContext context) override;
   kj::Promise<void> setGPIO(SetGPIOContext context) override;
   kj::Promise<void> start(StartContext context) override;
   kj::Promise<void> stop(StopContext context) override;
   kj::Promise<void> next(NextContext context) override;
   kj::Promise<void> launch(LaunchContext context) override;
   kj::Promise<void> nva(NvaContext context) override;
+  kj::Promise<void>
+  subscribeTelemetry(SubscribeTelemetryContext context) override;
 };
 
 extern InTexServer *server_instance;
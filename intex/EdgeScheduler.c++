@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <QDebug>
+#include <QtGlobal>
+
+#include "EdgeScheduler.h"
+
+using namespace std::chrono;
+
+namespace intex {
+namespace hw {
+
+static int rt_priority() {
+  if (qEnvironmentVariableIsSet("INTEX_RT_PRIORITY"))
+    return qgetenv("INTEX_RT_PRIORITY").toInt();
+#ifdef BUILD_ON_RASPBERRY
+  return 50;
+#else
+  return 0;
+#endif
+}
+
+struct EdgeScheduler::Impl {
+  /* deadline first; the id keeps edges with equal deadlines apart */
+  using Key = std::tuple<clock::time_point, uint64_t>;
+  struct Timer {
+    Priority priority;
+    Edge edge;
+  };
+  struct Due {
+    uint64_t id;
+    clock::time_point deadline;
+    Priority priority;
+    Edge edge;
+  };
+
+  std::mutex mutex;
+  std::map<Key, Timer> timers;
+  uint64_t next_id = 1;
+  bool stopping = false;
+  /* taken out of timers, but not started yet */
+  std::vector<uint64_t> collected;
+  /* the edge on the scheduler thread, 0 between edges */
+  uint64_t running = 0;
+  std::condition_variable finished;
+
+  /* lateness since the last jitter(), in ms */
+  uint64_t edges = 0;
+  double sum = 0.0;
+  double squares = 0.0;
+  double max = 0.0;
+
+  int fd = -1;
+  std::thread thread;
+
+  Impl() {
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (fd < 0)
+      throw std::runtime_error(std::string("Could not create timerfd: ") +
+                               strerror(errno));
+    thread = std::thread([this] { run(); });
+  }
+
+  ~Impl() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+      wake(clock::now());
+    }
+    thread.join();
+    close(fd);
+  }
+
+  /* steady_clock is CLOCK_MONOTONIC; a zero expiry would disarm the timer */
+  void wake(const clock::time_point deadline) {
+    const auto ns = std::max<int64_t>(
+        duration_cast<nanoseconds>(deadline.time_since_epoch()).count(), 1);
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = static_cast<time_t>(ns / 1000000000);
+    spec.it_value.tv_nsec = static_cast<long>(ns % 1000000000);
+    if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
+      qCritical() << "Could not arm edge timer:" << strerror(errno);
+  }
+
+  /* with the mutex held */
+  void arm() {
+    if (stopping)
+      return;
+    if (timers.empty()) {
+      struct itimerspec spec;
+      memset(&spec, 0, sizeof(spec));
+      timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+      return;
+    }
+    wake(std::get<0>(timers.begin()->first));
+  }
+
+  static void set_realtime() {
+    const auto priority = rt_priority();
+    if (priority <= 0)
+      return;
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    const auto err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err) {
+      qWarning() << "Running actuation edges without real-time priority:"
+                 << strerror(err);
+    }
+  }
+
+  /* false if the edge was cancelled after it had been collected */
+  bool begin(const uint64_t id, const double lateness) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = std::find(collected.begin(), collected.end(), id);
+    if (it == collected.end())
+      return false;
+    collected.erase(it);
+    running = id;
+    ++edges;
+    sum += lateness;
+    squares += lateness * lateness;
+    max = std::max(max, lateness);
+    return true;
+  }
+
+  void end() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = 0;
+    }
+    finished.notify_all();
+  }
+
+  /* with the mutex held; true if the edge was still waiting to run */
+  bool remove(const uint64_t id) {
+    auto it = std::find_if(timers.begin(), timers.end(),
+                           [id](const auto &timer) {
+                             return std::get<1>(timer.first) == id;
+                           });
+    if (it != timers.end()) {
+      timers.erase(it);
+      arm();
+      return true;
+    }
+    auto due = std::find(collected.begin(), collected.end(), id);
+    if (due == collected.end())
+      return false;
+    collected.erase(due);
+    return true;
+  }
+
+  void run() {
+    set_realtime();
+    std::vector<Due> due;
+    for (;;) {
+      uint64_t expirations;
+      if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EINTR)
+        qCritical() << "Reading edge timer failed:" << strerror(errno);
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping)
+          return;
+        const auto now = clock::now();
+        while (!timers.empty() && std::get<0>(timers.begin()->first) <= now) {
+          auto it = timers.begin();
+          due.push_back({std::get<1>(it->first), std::get<0>(it->first),
+                         it->second.priority, std::move(it->second.edge)});
+          collected.push_back(std::get<1>(it->first));
+          timers.erase(it);
+        }
+      }
+
+      /* a late wakeup may find several edges due; safety ones go first */
+      std::stable_sort(due.begin(), due.end(),
+                       [](const Due &lhs, const Due &rhs) {
+                         return lhs.priority < rhs.priority;
+                       });
+      for (auto &edge : due) {
+        const auto late = clock::now() - edge.deadline;
+        if (!begin(edge.id,
+                   duration_cast<duration<double, std::milli>>(late).count()))
+          continue;
+        try {
+          edge.edge(edge.deadline);
+        } catch (const std::exception &e) {
+          qCritical() << "Actuation edge failed:" << e.what();
+        }
+        end();
+      }
+      due.clear();
+
+      std::lock_guard<std::mutex> lock(mutex);
+      arm();
+    }
+  }
+};
+
+EdgeScheduler::EdgeScheduler() : d(std::make_unique<Impl>()) {}
+EdgeScheduler::~EdgeScheduler() = default;
+
+uint64_t EdgeScheduler::at(const clock::time_point deadline,
+                           const Priority priority, Edge edge) {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  const auto id = d->next_id++;
+  d->timers.emplace(Impl::Key{deadline, id},
+                    Impl::Timer{priority, std::move(edge)});
+  d->arm();
+  return id;
+}
+
+void EdgeScheduler::cancel(const uint64_t id) {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  d->remove(id);
+}
+
+void EdgeScheduler::cancelAndWait(const uint64_t id) {
+  std::unique_lock<std::mutex> lock(d->mutex);
+  /* 0 is never an edge, e.g. a timer that was never scheduled */
+  if (!id || d->remove(id))
+    return;
+  if (std::this_thread::get_id() == d->thread.get_id())
+    throw std::runtime_error("Edge waits for itself");
+  d->finished.wait(lock, [this, id] { return d->running != id; });
+}
+
+EdgeScheduler::Jitter EdgeScheduler::jitter() {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  Jitter jitter{d->edges, 0.0, 0.0, d->max};
+  if (d->edges) {
+    const auto n = static_cast<double>(d->edges);
+    jitter.mean = d->sum / n;
+    jitter.stddev =
+        std::sqrt(std::max(0.0, d->squares / n - jitter.mean * jitter.mean));
+  }
+  d->edges = 0;
+  d->sum = d->squares = d->max = 0.0;
+  return jitter;
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wexit-time-destructors"
+EdgeScheduler &EdgeScheduler::scheduler() {
+  static std::unique_ptr<EdgeScheduler> instance{new EdgeScheduler()};
+  return *instance;
+}
+#pragma clang diagnostic pop
+}
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#include <cstdint>
+
+namespace intex {
+namespace hw {
+
+/* Runs timed GPIO edges on a thread of its own, woken by a timerfd at the
+ * edge's deadline and scheduled SCHED_FIFO where permitted, so a busy Qt or
+ * RPC event loop does not stretch valve pulses or starve the watchdog.
+ * INTEX_RT_PRIORITY sets the SCHED_FIFO priority; 0 keeps the default
+ * scheduling policy.
+ */
+class EdgeScheduler {
+  struct Impl;
+  std::unique_ptr<Impl> d;
+
+  EdgeScheduler();
+
+public:
+  using clock = std::chrono::steady_clock;
+  /* Edges that are due together run in this order */
+  enum class Priority : uint8_t { Safety, Watchdog, Actuation };
+  /* Called on the scheduler thread with the deadline it was scheduled for;
+   * must not block */
+  using Edge = std::function<void(const clock::time_point deadline)>;
+
+  /* Lateness of the edges run since the previous call, in ms */
+  struct Jitter {
+    uint64_t edges;
+    double mean;
+    double stddev;
+    double max;
+  };
+
+  ~EdgeScheduler();
+  EdgeScheduler(const EdgeScheduler &) = delete;
+  EdgeScheduler &operator=(const EdgeScheduler &) = delete;
+
+  /* Thread-safe, also from within an edge. Returns an id for cancel. */
+  uint64_t at(const clock::time_point deadline, const Priority priority,
+              Edge edge);
+  template <class Rep, class Period>
+  uint64_t after(const std::chrono::duration<Rep, Period> delay,
+                 const Priority priority, Edge edge) {
+    return at(clock::now() + std::chrono::duration_cast<clock::duration>(delay),
+              priority, std::move(edge));
+  }
+  /* An edge that is already running is not waited for */
+  void cancel(const uint64_t id);
+  /* Like cancel, but returns only after a running edge has finished, so
+   * that what it refers to may be destroyed. Must not be called from an
+   * edge, nor with a lock held that the edge takes. */
+  void cancelAndWait(const uint64_t id);
+  Jitter jitter();
+
+  static EdgeScheduler &scheduler();
+};
+}
+}
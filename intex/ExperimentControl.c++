@@ -1,7 +1,11 @@
+#include <array>
 #include <chrono>
 #include <atomic>
 #include <string>
 #include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include <cmath>
 
@@ -11,10 +15,12 @@
 #include <QUdpSocket>
 #include <QDebug>
 #include <QtGlobal>
-#include <QtSerialPort/QtSerialPort>
 #include <QTimerEvent>
 #include <QAbstractSocket>
 #include <QProcess>
+#include <QDir>
+#include <QTimer>
+#include <QStringList>
 
 #include <capnp/message.h>
 #include <capnp/serialize.h>
@@ -23,10 +29,21 @@
 #pragma clang diagnostic ignored "-Wweak-vtables"
 #include "rpc/intex.capnp.h"
 #pragma clang diagnostic pop
+#include "rpc/telemetry-archive.h"
+#include "rpc/telemetry-codec.h"
+#include "rpc/ez-rpc.h"
 
 #include "ExperimentControl.h"
 #include "VideoStreamSourceControl.h"
 #include "IntexHardware.h"
+#include "EdgeScheduler.h"
+#include "HeaterControl.h"
+#include "SensorAcquisition.h"
+#include "StorageWriter.h"
+#include "TelemetryFeed.h"
+#include "VnaDriver.h"
+#include "RecordingManager.h"
+#include "BitrateController.h"
 #include "intex.h"
 #include "sysfs.h"
 
@@ -35,95 +52,6 @@ using namespace std::chrono;
 
 namespace intex {
 
-static float cpu_temperature() {
-  QFile file("/sys/class/thermal/thermal_zone0/temp");
-  int temperature;
-
-  if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-    QTextStream in(&file);
-    in >> temperature;
-
-    return static_cast<float>(temperature) / 1000.0f;
-  }
-
-  throw std::runtime_error(
-      qPrintable("Could not open file " + file.fileName()));
-}
-
-static float vna_temperature() {
-  static constexpr qint32 baudrate = 921600;
-  static const char read_temperature_command[] = "10\r";
-  char buf[2];
-
-  QSerialPort vna("/dev/ttyUSB0");
-  if (!vna.open(QIODevice::ReadWrite)) {
-    throw std::runtime_error(
-        qPrintable("Could not open serial port " + vna.portName()));
-  }
-
-  if (!vna.setBaudRate(baudrate)) {
-    throw std::runtime_error("Could not set baudrate to " +
-                             std::to_string(baudrate));
-  }
-
-  if (!vna.setRequestToSend(true)) {
-    throw std::runtime_error("Enabling request to send failed.");
-  }
-
-  if (vna.write(read_temperature_command) < 0) {
-    throw std::runtime_error("Could not send read temperature command.");
-  }
-
-  for (size_t i = 0; i < sizeof(buf);) {
-    if (vna.waitForReadyRead(100)) {
-      auto ret = vna.read(&buf[i], static_cast<qint64>(sizeof(buf) - i));
-      if (ret < 0) {
-        throw std::runtime_error(qPrintable("Error reading " + vna.portName() +
-                                            ": " + vna.errorString()));
-      }
-      i += static_cast<size_t>(ret);
-    } else {
-      throw std::runtime_error(
-          qPrintable("Reading from " + vna.portName() + " timed out."));
-    }
-  }
-
-  uint16_t tmp;
-  memcpy(&tmp, buf, sizeof(buf));
-  return static_cast<float>(tmp) / 10.0f;
-}
-
-static double hub_temperature() {
-  QRegularExpression temp_pattern("t=(\\d+)");
-  QDir sysfs("/sys/bus/w1/devices");
-  for (const auto &entry :
-       sysfs.entryList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::System)) {
-    if (!sysfs.cd(entry)) {
-      qCritical() << "Could not enter directory" << entry;
-      continue;
-    }
-
-    QFile data(sysfs.absoluteFilePath("w1_slave"));
-    if (!data.open(QIODevice::ReadOnly)) {
-      qCritical() << "Could not open file" << data.fileName() << "for reading";
-      sysfs.cdUp();
-      continue;
-    }
-
-    for (; !data.atEnd();) {
-      const QString line{data.readLine()};
-      auto match = temp_pattern.match(line);
-      if (match.hasMatch()) {
-        QString temp = match.captured(match.lastCapturedIndex());
-        return temp.toDouble() / 1000.0;
-      }
-    }
-    sysfs.cdUp();
-  }
-
-  throw std::runtime_error("DS18S20 not found.");
-}
-
 static kj::Array<capnp::word> build_announce(const AutoAction action,
                                              const unsigned timeout) {
   ::capnp::MallocMessageBuilder message;
@@ -150,6 +78,21 @@ static constexpr auto open = true;
 static constexpr auto closed = false;
 static constexpr auto On = true;
 static constexpr auto Off = false;
+/* edge lateness worth a warning, ms */
+static constexpr double max_edge_jitter = 5.0;
+
+#ifdef INTEX_VNA_SWEEP
+static constexpr VnaDriver::Sweep antenna_sweep{370000000, 500000000, 261};
+static constexpr auto vna_startup = 3s;
+static constexpr const char *vna_calibration =
+    "/media/usb-raid/vna/calibration.txt";
+#endif
+
+static std::string vna_device() {
+  if (qEnvironmentVariableIsSet("INTEX_VNA_DEVICE"))
+    return qgetenv("INTEX_VNA_DEVICE").toStdString();
+  return "/dev/ttyUSB0";
+}
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wweak-vtables"
@@ -167,6 +110,14 @@ class ExperimentControl::Impl : public QObject {
   static constexpr auto cure_timeout = 6s;
   static constexpr auto equalization_timeout = 3s;
 #endif
+  /* on the link, protection included; per camera: 100 kbit/s … 1.5 Mbit/s,
+   * both: 1.6 Mbit/s */
+  static constexpr BitrateController::Limits video_bitrate{100000, 1500000,
+                                                           1600000};
+  static constexpr uint64_t initial_bitrate = 400000;
+  /* 5 min segments; 192 MiB hold one at the camera's 5 Mbit/s peak rate */
+  static constexpr RecordingManager::Policy recording_policy{
+      5min, 0, 192 << 20, uint64_t{1} << 30};
 
   /*
    * Heizung an (35,40 °C), fail-on
@@ -223,19 +174,30 @@ class ExperimentControl::Impl : public QObject {
   }
 
   QString host;
-  quint16 port;
   enum state flight_state;
   QTimer timeout;
   int heartbeat_id;
-  QUdpSocket telemetry_socket;
   QUdpSocket announce_socket;
   bool announce_reply_outstanding = false;
   std::function<void(void)> auto_callback;
   QTimer telemetry_timer;
-  QString telemetry_filename;
-  QFile telemetry_file;
+  StorageWriter telemetry_storage;
+  TelemetryFeed telemetry_feed;
+  /* runs the VNA driver's results on this thread */
+  rpc::QtExecutor executor;
+  /* measurements and temperature reads share its serial session */
+  VnaDriver vna;
+  bool measuring = false;
   QProcess nva;
-
+  SensorAcquisition sensors;
+  HeaterControl heaters;
+  /* the archive keeps what the downlink leaves out */
+  TelemetryEncoder archive_encoder{true};
+
+  /* declared before the sources, which record into its segments */
+  RecordingManager recordings;
+  /* declared before the sources, whose RTCP threads report to it */
+  BitrateController bitrate_control;
   std::unique_ptr<VideoStreamSourceControl> source0;
   std::unique_ptr<VideoStreamSourceControl> source1;
 
@@ -261,7 +223,7 @@ class ExperimentControl::Impl : public QObject {
     QDir nvram;
     return false;
 #else
-    QDir nvram("/Volumes/Intex");
+    QDir nvram(stateDirectory());
 
     if (!nvram.exists())
       return false;
@@ -325,45 +287,109 @@ class ExperimentControl::Impl : public QObject {
     file.write(chars.begin(), static_cast<qint64>(chars.size()));
   }
 
-  void timerEvent(QTimerEvent *event) Q_DECL_OVERRIDE {
-    if (event->timerId() == heartbeat_id) {
-      run();
+  static TelemetryValue convert(const Sample &sample) {
+    TelemetryValue value;
+    value.updated = true;
+    value.timestamp = sample.timestamp;
+    value.valid = sample.valid;
+    value.value = sample.value;
+    value.min = sample.min;
+    value.max = sample.max;
+    value.stddev = sample.stddev;
+    if (!sample.valid)
+      value.reason = sample.error;
+    switch (sample.fault) {
+    case Fault::None:
+      value.error = TelemetryError::NONE;
+      break;
+    case Fault::NotSampled:
+      value.error = TelemetryError::NOT_SAMPLED;
+      break;
+    case Fault::Busy:
+      value.error = TelemetryError::BUSY;
+      break;
+    case Fault::ReadFailed:
+      value.error = TelemetryError::READ_FAILED;
+      break;
     }
+    return value;
   }
 
-  void send_telemetry(kj::ArrayPtr<char> &buffer) {
-    auto ret = telemetry_socket.write(buffer.begin(),
-                                      static_cast<qint64>(buffer.size()));
-    if (ret < 0) {
-      qCritical() << "Sending telemetry datagram failed:"
-                  << telemetry_socket.error() << "Reconnecting.";
-      telemetry_socket.connectToHost(host, port);
-    } else {
-#if 0
-      qDebug().nospace() << "Telemetry datagram of size " << buffer.size()
-                         << " (" << ret << ") sent successfully.";
-#endif
+  /* Sampling period of every channel and telemetry interval per flight
+   * state. Pressure is sampled fast while the antenna inflates and cures;
+   * fewer reads per pressure sample keep the SPI bus within budget. The
+   * ring temperatures feed the heater control, which steps once a second. */
+  struct profile {
+    milliseconds telemetry;
+    unsigned pressure_reads;
+    std::array<milliseconds, channel_count> period; /* indexed by Channel */
+  };
+
+  static const profile &sampling_profile(const enum state state) {
+    /* cpu, vna, box, inner ring, outer ring, atmosphere,
+     * tank, antenna, atmospheric pressure */
+    static constexpr profile normal{
+        5s, 10, {{1s, 5s, 5s, 500ms, 500ms, 1s, 1s, 1s, 1s}}};
+    static constexpr profile high_rate_pressure{
+        1s, 4, {{10s, 10s, 10s, 1s, 1s, 5s, 100ms, 100ms, 100ms}}};
+
+    switch (state) {
+    case state::inflating:
+    case state::curing:
+      return high_rate_pressure;
+    default:
+      return normal;
     }
   }
 
-  void save_telemetry(kj::ArrayPtr<char> &buffer) {
-    auto ret = telemetry_file.write(buffer.begin(),
-                                    static_cast<qint64>(buffer.size()));
+  /* Recordings of the antenna deployment are kept longest */
+  static RecordingManager::Priority recording_priority(const enum state state) {
+    switch (state) {
+    case state::burnwire:
+    case state::inflating:
+    case state::measuring2:
+    case state::curing:
+    case state::equalizing:
+    case state::measuring3:
+      return RecordingManager::Priority::High;
+    default:
+      return RecordingManager::Priority::Low;
+    }
+  }
 
-    if (ret < 0) {
-      qCritical() << "Writing telemetry datagram failed:"
-                  << telemetry_file.error() << "Opening new file.";
-      telemetry_filename = storageLocation(Subsystem::Telemetry);
-      telemetry_file.setFileName(telemetry_filename);
-      telemetry_file.open(QIODevice::WriteOnly);
-    } else {
-#if 0
-      qDebug().nospace() << "Telemetry datagram of size " << buffer.size()
-                         << " (" << ret << ") saved successfully.";
-#endif
+  void apply_profile(const enum state state) {
+    const auto &p = sampling_profile(state);
+    for (size_t i = 0; i < channel_count; ++i) {
+      sensors.setPeriod(static_cast<Channel>(i), p.period[i]);
     }
 
-    telemetry_file.flush();
+    /* the sensors' worker may be in the middle of a read */
+    const hw::PressureSensor::Filter filter{p.pressure_reads, true, 1.0};
+    sensors.configure(SensorAcquisition::Bus::SPI, [filter] {
+      for (auto sensor :
+           {&hw::PressureSensor::tank, &hw::PressureSensor::antenna,
+            &hw::PressureSensor::atmosphere}) {
+        sensor().setFilter(filter);
+      }
+    });
+
+    telemetry_timer.setInterval(static_cast<int>(p.telemetry.count()));
+    recordings.setPriority(recording_priority(state));
+  }
+
+  void timerEvent(QTimerEvent *event) Q_DECL_OVERRIDE {
+    if (event->timerId() == heartbeat_id) {
+      run();
+    }
+  }
+
+  void save_telemetry(const int64_t timestamp,
+                      kj::ArrayPtr<const capnp::byte> frame) {
+    auto record = telemetry_archive_record(timestamp, frame);
+    if (!telemetry_storage.write(record.begin(), record.size())) {
+      qCritical() << "Telemetry storage queue full, dropped record"
+                  << telemetry_storage.dropped();
+    }
   }
 
   void handle_auto_timeout() {
@@ -418,99 +444,188 @@ class ExperimentControl::Impl : public QObject {
         [this] { handle_auto_timeout(); });
   }
 
-  void build_telemetry(::capnp::MallocMessageBuilder &message) {
-    Telemetry::Builder telemetry = message.initRoot<Telemetry>();
-
-    auto cpu_temp = telemetry.initCpuTemperature();
-    cpu_temp.setTimestamp(system_clock::now().time_since_epoch().count());
-    try {
-      cpu_temp.initReading().setValue(cpu_temperature());
-    } catch (const std::runtime_error &e) {
-      cpu_temp.initError().setReason(e.what());
+  /* Encode every sample taken since the last frame for the archive at full
+   * fidelity, and publish them to the RPC subscribers */
+  kj::Array<capnp::byte> build_frame(const int64_t now) {
+    static constexpr std::pair<TelemetryChannel, Channel> channels[] = {
+        {TelemetryChannel::CPU_TEMPERATURE, Channel::CpuTemperature},
+        {TelemetryChannel::VNA_TEMPERATURE, Channel::VnaTemperature},
+        {TelemetryChannel::BOX_TEMPERATURE, Channel::BoxTemperature},
+        {TelemetryChannel::ANTENNA_INNER_TEMPERATURE,
+         Channel::AntennaInnerTemperature},
+        {TelemetryChannel::ANTENNA_OUTER_TEMPERATURE,
+         Channel::AntennaOuterTemperature},
+        {TelemetryChannel::ATMOSPHERE_TEMPERATURE,
+         Channel::AtmosphereTemperature},
+        {TelemetryChannel::TANK_PRESSURE, Channel::TankPressure},
+        {TelemetryChannel::ANTENNA_PRESSURE, Channel::AntennaPressure},
+        {TelemetryChannel::ATMOSPHERIC_PRESSURE, Channel::AtmosphericPressure},
+    };
+
+    TelemetryState state;
+    std::vector<TelemetryReading> batch;
+    std::array<Sample, SensorAcquisition::backlog_depth> samples;
+
+    for (const auto &channel : channels) {
+      auto &value = state[channel_index(channel.first)];
+      const auto n =
+          sensors.drain(channel.second, samples.data(), samples.size());
+      if (n == 0) {
+        value = convert(sensors.latest(channel.second));
+        continue;
+      }
+      for (size_t i = 0; i + 1 < n; ++i) {
+        batch.push_back(TelemetryReading{channel.first, convert(samples[i])});
+      }
+      value = convert(samples[n - 1]);
     }
 
-    auto vna_temp = telemetry.initVnaTemperature();
-    vna_temp.setTimestamp(system_clock::now().time_since_epoch().count());
-    try {
-      if (nva.state() != QProcess::ProcessState::NotRunning)
-        throw std::runtime_error("NVA measurement running");
-      vna_temp.initReading().setValue(vna_temperature());
-    } catch (const std::runtime_error &e) {
-      vna_temp.initError().setReason(e.what());
+    if (nva.state() != QProcess::ProcessState::NotRunning) {
+      auto &vna_temp = state[channel_index(TelemetryChannel::VNA_TEMPERATURE)];
+      vna_temp.timestamp = now;
+      vna_temp.valid = false;
+      vna_temp.error = TelemetryError::BUSY;
     }
+    edge_jitter(now, state[channel_index(TelemetryChannel::ACTUATION_JITTER)]);
+    heater_status(HeaterControl::Ring::Inner, TelemetryChannel::INNER_HEATER,
+                  TelemetryChannel::INNER_HEATER_ERROR,
+                  TelemetryChannel::INNER_HEATER_INTEGRAL, state);
+    heater_status(HeaterControl::Ring::Outer, TelemetryChannel::OUTER_HEATER,
+                  TelemetryChannel::OUTER_HEATER_ERROR,
+                  TelemetryChannel::OUTER_HEATER_INTEGRAL, state);
+
+    const auto cameras = camera_health();
+    const auto readings = kj::arrayPtr(batch.data(), batch.size());
+    const auto health = kj::arrayPtr(cameras.data(), cameras.size());
+    auto archive = archive_encoder.encode(state, now, readings, health);
+    publish_frame(now, state, std::move(batch), cameras);
+    return archive;
+  }
 
-    auto hub_temp = telemetry.initBoxTemperature();
-    hub_temp.setTimestamp(system_clock::now().time_since_epoch().count());
-    try {
-      hub_temp.initReading().setValue(hub_temperature());
-    } catch (const std::runtime_error &e) {
-      hub_temp.initError().setReason(e.what());
+  /* Mean and spread of the edges' lateness since the previous frame */
+  static void edge_jitter(const int64_t now, TelemetryValue &value) {
+    const auto jitter = hw::EdgeScheduler::scheduler().jitter();
+    if (!jitter.edges)
+      return;
+    if (jitter.max > max_edge_jitter) {
+      qWarning() << "Actuation edge ran" << jitter.max << "ms late";
     }
+    value.updated = true;
+    value.valid = true;
+    value.timestamp = now;
+    value.value = jitter.mean;
+    value.stddev = jitter.stddev;
+    value.error = TelemetryError::NONE;
+  }
 
-#if 0
-    auto atmosphere_temp = telemetry.initAtmosphereTemperature();
-    atmosphere_temp.setTimestamp(
-        system_clock::now().time_since_epoch().count());
-    try {
-      const auto t1 = hw::TemperatureSensor::temperatureSensor().temperature(
-          hw::TemperatureSensor::Sensor::InnerRing);
-      const auto temp = hw::ADS1248::sensor().selftest(0);
-      qDebug() << "Atmospheric temperature:" << temp << t1;
-      atmosphere_temp.initReading().setValue(temp);
-    } catch (const std::runtime_error &e) {
-      atmosphere_temp.initError().setReason(e.what());
-    }
+  /* Controller state of a heater as of its last step. The error is only
+   * valid while the controller has a recent temperature. */
+  void heater_status(const HeaterControl::Ring ring,
+                     const TelemetryChannel duty, const TelemetryChannel error,
+                     const TelemetryChannel integral, TelemetryState &state) {
+    const auto status = heaters.status(ring);
+    if (!status.timestamp)
+      return;
+    auto set = [&state, &status](const TelemetryChannel channel,
+                                 const double value, const bool valid) {
+      auto &entry = state[channel_index(channel)];
+      entry.updated = true;
+      entry.valid = valid;
+      entry.timestamp = status.timestamp;
+      entry.value = value;
+      entry.stddev = 0.0;
+      entry.error = valid ? TelemetryError::NONE : TelemetryError::NOT_SAMPLED;
+    };
+    set(duty, status.duty, true);
+    set(error, status.error, status.measured);
+    set(integral, status.integral, true);
+  }
 
-    auto inner_temp = telemetry.initAntennaInnerTemperature();
-    inner_temp.setTimestamp(system_clock::now().time_since_epoch().count());
-    try {
-      const auto temp = hw::ADS1248::sensor().selftest(1);
-      inner_temp.initReading().setValue(temp);
-      intex::hw::Heater::innerHeater().temperatureChanged(
-          static_cast<int>(temp));
-      qDebug() << "Inner temperature:" << temp;
-    } catch (const std::runtime_error &e) {
-      inner_temp.initError().setReason(e.what());
+  /* Hands the frame to RPC subscribers, readings in the order encoded */
+  void publish_frame(const int64_t now, const TelemetryState &state,
+                     std::vector<TelemetryReading> batch,
+                     std::vector<CameraHealth> cameras) {
+    auto frame = std::make_shared<TelemetryFeed::Frame>();
+    frame->timestamp = now;
+    frame->readings = std::move(batch);
+    for (size_t i = 0; i < telemetry_channels; ++i) {
+      if (state[i].updated) {
+        frame->readings.push_back(
+            TelemetryReading{static_cast<TelemetryChannel>(i), state[i]});
+      }
     }
+    frame->cameras = std::move(cameras);
+    frame->replayed = false;
+    telemetry_feed.publish(std::move(frame));
+  }
 
-    auto outer_temp = telemetry.initAntennaOuterTemperature();
-    outer_temp.setTimestamp(system_clock::now().time_since_epoch().count());
-    try {
-      const auto temp = hw::ADS1248::sensor().selftest(2);
-      outer_temp.initReading().setValue(temp);
-      qDebug() << "Outer temperature:" << temp;
-      intex::hw::Heater::outerHeater().temperatureChanged(
-          static_cast<int>(temp));
-    } catch (const std::runtime_error &e) {
-      outer_temp.initError().setReason(e.what());
+  /* Camera pipeline instrumentation since the previous frame */
+  std::vector<CameraHealth> camera_health() {
+    std::vector<CameraHealth> cameras;
+    VideoStreamSourceControl *sources[] = {source0.get(), source1.get()};
+    for (size_t i = 0; i < 2; ++i) {
+      if (!sources[i])
+        continue;
+      cameras.push_back(sources[i]->health());
+      cameras.back().feed = to_feed(i);
     }
-#endif
+    return cameras;
+  }
 
-    auto tank = telemetry.initTankPressure();
-    tank.setTimestamp(system_clock::now().time_since_epoch().count());
+  /* Rebuilds the pipeline of a camera that came or went */
+  void reconnect_camera(const int camera) {
+    if (camera > 1)
+      return;
+    auto &source = camera == 0 ? source0 : source1;
+    if (!source)
+      return;
     try {
-      auto pressure = hw::PressureSensor::tank().pressure();
-      tank.initReading().setValue(pressure);
-    } catch (const std::runtime_error &e) {
-      tank.initError().setReason(e.what());
+      source->reconnect();
+    } catch (const std::exception &e) {
+      qCritical() << "Rebuilding the pipeline of camera" << camera
+                  << "failed:" << e.what();
+      /* the source keeps its settings, the next change retries */
     }
+  }
 
-    auto antenna = telemetry.initAntennaPressure();
-    antenna.setTimestamp(system_clock::now().time_since_epoch().count());
-    try {
-      auto pressure = hw::PressureSensor::antenna().pressure();
-      antenna.initReading().setValue(pressure);
-    } catch (const std::runtime_error &e) {
-      antenna.initError().setReason(e.what());
-    }
+  /* INTEX_SHARED_ENCODE lists the cameras, e.g. "01", whose own H.264
+   * stream is reused for the downlink instead of encoding a second one. */
+  static VideoStreamSourceControl::Encoding video_encoding(const char camera) {
+    const auto shared = qgetenv("INTEX_SHARED_ENCODE");
+    return shared.contains(camera)
+               ? VideoStreamSourceControl::Encoding::Shared
+               : VideoStreamSourceControl::Encoding::Reencode;
+  }
+
+  /* INTEX_FEC_OVERHEAD is the FEC overhead of the downlinks in percent
+   * until the ground station changes it; INTEX_RTX turns on
+   * retransmissions, which only arrive in time if the ground station's
+   * jitter buffer (--latency) is longer than the round trip. */
+  static Protection video_protection() {
+    return {qgetenv("INTEX_FEC_OVERHEAD").toUInt(),
+            qEnvironmentVariableIsSet("INTEX_RTX")};
+  }
 
-    auto atmosphere = telemetry.initAtmosphericPressure();
-    atmosphere.setTimestamp(system_clock::now().time_since_epoch().count());
+  static InTexFeed to_feed(const size_t index) {
+    return index == 0 ? InTexFeed::FEED0 : InTexFeed::FEED1;
+  }
+
+  static size_t to_index(const InTexFeed feed) {
+    return feed == InTexFeed::FEED0 ? 0 : 1;
+  }
+
+  /* Runs on this thread, which owns the sources, for changes the RTCP
+   * threads made; a change superseded by a later one still queued is
+   * skipped, so the encoder never ends up at a stale rate. */
+  void apply_bitrate(const size_t feed, const uint64_t bitrate) {
+    auto &source = feed == 0 ? source0 : source1;
+    if (!source || bitrate != bitrate_control.bitrate(feed))
+      return;
     try {
-      auto pressure = hw::PressureSensor::atmosphere().pressure();
-      atmosphere.initReading().setValue(pressure);
-    } catch (const std::runtime_error &e) {
-      atmosphere.initError().setReason(e.what());
+      source->setBitrate(bitrate);
+    } catch (const std::exception &e) {
+      /* the pipeline is rebuilt with its last rate on the next uevent */
+      qCritical() << "Setting bitrate of feed" << feed << "failed:" << e.what();
     }
   }
 
@@ -531,11 +646,19 @@ class ExperimentControl::Impl : public QObject {
   }
 
 public:
-  Impl(QString host_, quint16 port_)
-      : host(std::move(host_)), port(port_), flight_state(loadState()),
+  explicit Impl(QString host_)
+      : host(std::move(host_)), flight_state(loadState()),
         heartbeat_id(startTimer((1000ms).count())),
-        telemetry_filename(storageLocation(Subsystem::Telemetry)),
-        telemetry_file(telemetry_filename) {
+        telemetry_storage(Subsystem::Telemetry, archive_header()),
+        telemetry_feed(telemetry_storage), vna(vna_device()), sensors(vna),
+        heaters(sensors),
+        recordings(recording_policy),
+        bitrate_control(video_bitrate, initial_bitrate,
+                        [this](const size_t feed, const uint64_t bitrate) {
+                          executor.post([this, feed, bitrate] {
+                            apply_bitrate(feed, bitrate);
+                          });
+                        }) {
     setUSBHub(On);
     setMiniVNA(Off);
     setBurnwire(Off);
@@ -544,25 +667,14 @@ public:
     setTankValve(Off);
     setOutletValve(Off);
     intex::hw::Watchdog::watchdog();
-    telemetry_file.open(QIODevice::WriteOnly);
-    telemetry_timer.setInterval(duration_cast<milliseconds>(5s).count());
     telemetry_timer.setSingleShot(false);
+    apply_profile(flight_state);
     connect(&telemetry_timer, &QTimer::timeout, [this] {
-      ::capnp::MallocMessageBuilder message;
-      build_telemetry(message);
-      auto data = messageToFlatArray(message);
-      auto chars = data.asChars();
-      send_telemetry(chars);
-      save_telemetry(chars);
-    });
-    connect(&telemetry_socket, &QAbstractSocket::connected, [this] {
-      qDebug().nospace() << "Sending telemetry data to "
-                         << telemetry_socket.peerName() << ":"
-                         << telemetry_socket.peerPort();
-      telemetry_timer.start();
+      const int64_t now = system_clock::now().time_since_epoch().count();
+      save_telemetry(now, build_frame(now));
     });
+    telemetry_timer.start();
 
-    telemetry_socket.connectToHost(host, port);
     if (heartbeat_id == 0) {
       qDebug() << "Could not allocate heartbeat timer. Automatic experiment "
                   "control disabled.";
@@ -579,14 +691,28 @@ public:
     announce_socket.connectToHost(host, intex_auto_request_port());
 
     source0 = std::make_unique<VideoStreamSourceControl>(
-        intex::Subsystem::Video0, intex::Subsystem::Audio0, host, 5000);
+        intex::Subsystem::Video0, intex::Subsystem::Audio0, recordings,
+        host, 5000, initial_bitrate, debug_default(), video_encoding('0'),
+        video_protection());
     source1 = std::make_unique<VideoStreamSourceControl>(
-        intex::Subsystem::Video1, intex::Subsystem::Audio1, host, 5010);
+        intex::Subsystem::Video1, intex::Subsystem::Audio1, recordings,
+        host, 5010, initial_bitrate, debug_default(), video_encoding('1'),
+        video_protection());
+    source0->onReceiverReport([this](const ReceiverReport &report) {
+      bitrate_control.report(0, report);
+    });
+    source1->onReceiverReport([this](const ReceiverReport &report) {
+      bitrate_control.report(1, report);
+    });
+    CameraRegistry::registry().onChange([this](const int camera) {
+      executor.post([this, camera] { reconnect_camera(camera); });
+    });
     qDebug() << "Ascend timeout:" << ascend_timeout.count() << "s";
   }
-  ~Impl() noexcept {}
+  ~Impl() noexcept { CameraRegistry::registry().onChange(nullptr); }
 
   void launched() { change_state(state::ascending); }
+  TelemetryFeed &telemetry() { return telemetry_feed; }
   void ascending_timedout() { change_state(state::floating); }
   void burnwire_timedout() { change_state(state::inflating); }
   void inflating_timedout() { change_state(state::measuring2); }
@@ -629,17 +755,43 @@ public:
         feed, [volume](auto &&source) { source->setVolume(volume); });
   }
 
+  /* The operator sets the upper bound, the controller picks the rate */
   void setBitrate(const InTexFeed feed, const uint64_t bitrate) {
-    dispatch_video_controls(
-        feed, [bitrate](auto &&source) { source->setBitrate(bitrate); });
+    qDebug() << "Limiting bitrate of feed" << static_cast<int>(feed) << "to"
+             << bitrate;
+    bitrate_control.setCeiling(to_index(feed), bitrate);
+  }
+
+  void setFecOverhead(const InTexFeed feed, const unsigned percentage) {
+    dispatch_video_controls(feed, [percentage](auto &&source) {
+      source->setFecOverhead(percentage);
+    });
   }
 
+  /* Sweeps the antenna's reflection into a Touchstone file, in vnaJ or,
+   * built with INTEX_VNA_SWEEP, in-process getting every point as it
+   * arrives */
   void start_measurement(std::function<void(void)> done) {
-    if (nva.state() != QProcess::ProcessState::NotRunning) {
+    if (measuring) {
       qCritical() << "VNA measurement already running";
       return;
     }
+    measuring = true;
     intex::hw::MiniVNA::miniVNA().set(On);
+#ifdef INTEX_VNA_SWEEP
+    /* the device only shows up on USB once powered */
+    QTimer::singleShot(
+        static_cast<int>(duration_cast<milliseconds>(vna_startup).count()),
+        this, [this, done] { sweep_antenna(done); });
+#else
+    run_vnaj(done);
+#endif
+  }
+
+  void run_vnaj(std::function<void(void)> done) {
+    /* vnaJ needs exclusive access to the serial port */
+    sensors.suspend(SensorAcquisition::Bus::Serial, true);
+    vna.release();
     nva.setProcessChannelMode(QProcess::MergedChannels);
     nva.setProgram("java");
     QStringList args;
@@ -654,17 +806,75 @@ public:
     args << "/home/intex/vnaJ-hl.3.1.5.jar";
     nva.setArguments(args);
 
+    auto finish = [this, done] {
+      intex::hw::MiniVNA::miniVNA().set(Off);
+      sensors.suspend(SensorAcquisition::Bus::Serial, false);
+      measuring = false;
+      done();
+    };
+    disconnect(&nva, nullptr, this, nullptr);
     connect(&nva, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(
                       &QProcess::finished),
-            [this, done](const int exit_code,
-                         const QProcess::ExitStatus exit_status) {
+            this, [this, finish](const int exit_code,
+                                 const QProcess::ExitStatus exit_status) {
               qDebug() << "Measurement done" << exit_code << exit_status << ":";
               qDebug() << nva.readAllStandardOutput();
-              intex::hw::MiniVNA::miniVNA().set(Off);
-              done();
+              finish();
+            });
+    /* finished is not emitted for a process that never ran */
+    connect(&nva, &QProcess::errorOccurred, this,
+            [this, finish](const QProcess::ProcessError error) {
+              if (error != QProcess::FailedToStart)
+                return;
+              qCritical() << "Could not start vnaJ:" << nva.errorString();
+              finish();
             });
     nva.start();
   }
+
+#ifdef INTEX_VNA_SWEEP
+  void sweep_antenna(std::function<void(void)> done) {
+    VnaCalibration calibration;
+    try {
+      calibration = VnaCalibration::load(vna_calibration);
+    } catch (const std::exception &e) {
+      qCritical() << e.what() << "- sweeping uncalibrated";
+    }
+
+    const auto path = storageLocation(Subsystem::Vna).toStdString();
+    std::shared_ptr<TouchstoneWriter> file;
+    try {
+      file = std::make_shared<TouchstoneWriter>(
+          path, "InTex antenna reflection, flight state " +
+                    std::to_string(static_cast<int>(flight_state)));
+    } catch (const std::exception &e) {
+      qCritical() << e.what();
+    }
+
+    const auto start = steady_clock::now();
+    vna.sweep(
+        antenna_sweep, std::move(calibration),
+        [file](const VnaDriver::Point &point) {
+          if (file)
+            file->write(point);
+        },
+        [this, done, path, start](const std::string &error) {
+          const auto elapsed =
+              duration_cast<milliseconds>(steady_clock::now() - start);
+          executor.post([this, done, path, error, elapsed] {
+            if (error.empty()) {
+              qDebug() << "Measurement done in" << elapsed.count()
+                       << "ms:" << path.c_str();
+            } else {
+              qCritical() << "Measurement failed:" << error.c_str();
+            }
+            intex::hw::MiniVNA::miniVNA().set(Off);
+            measuring = false;
+            done();
+          });
+        });
+  }
+#endif
 };
 
 void ExperimentControl::Impl::change_state(enum state next_state) {
@@ -727,6 +937,8 @@ void ExperimentControl::Impl::change_state(enum state next_state) {
     break;
   }
 
+  apply_profile(next_state);
+
   if (next_state != flight_state) {
     flight_state = next_state;
     saveState(flight_state);
@@ -768,9 +980,10 @@ constexpr seconds ExperimentControl::Impl::burnwire_timeout;
 constexpr seconds ExperimentControl::Impl::inflation_timeout;
 constexpr seconds ExperimentControl::Impl::cure_timeout;
 constexpr seconds ExperimentControl::Impl::equalization_timeout;
+constexpr BitrateController::Limits ExperimentControl::Impl::video_bitrate;
 
-ExperimentControl::ExperimentControl(QString host, quint16 port)
-    : d_(std::make_unique<Impl>(std::move(host), port)) {}
+ExperimentControl::ExperimentControl(QString host)
+    : d_(std::make_unique<Impl>(std::move(host))) {}
 ExperimentControl::~ExperimentControl() = default;
 ExperimentControl::ExperimentControl(ExperimentControl &&) = default;
 ExperimentControl &ExperimentControl::operator=(ExperimentControl &&) = default;
@@ -803,10 +1016,16 @@ void ExperimentControl::setBitrate(const InTexFeed feed,
                                    const uint64_t bitrate) {
   d_->setBitrate(feed, bitrate);
 }
+void ExperimentControl::setFecOverhead(const InTexFeed feed,
+                                       const unsigned percentage) {
+  d_->setFecOverhead(feed, percentage);
+}
 
 void ExperimentControl::measureAntenna() {
   d_->start_measurement([] {});
 };
+
+TelemetryFeed &ExperimentControl::telemetry() { return d_->telemetry(); }
 }
 
 #include "ExperimentControl.moc"
@@ -6,6 +6,8 @@
 
 namespace intex {
 
+class TelemetryFeed;
+
 struct telemetry {
   /* in °C */
   float cpu_temperature;
@@ -30,7 +32,8 @@ class ExperimentControl {
   std::unique_ptr<Impl> d_;
 
 public:
-  ExperimentControl(QString host, quint16 port);
+  /* host is the ground station, which gets the video and auto requests */
+  explicit ExperimentControl(QString host);
   ~ExperimentControl();
   ExperimentControl(const ExperimentControl &) = delete;
   ExperimentControl(ExperimentControl &&);
@@ -50,6 +53,10 @@ public:
   void videoStop(const InTexFeed Sservice);
   void videoNext(const InTexFeed Sservice);
   void setVolume(const InTexFeed Sservice, float volume);
+  /* Thread-safe */
   void setBitrate(const InTexFeed service, uint64_t bitrate);
+  void setFecOverhead(const InTexFeed feed, const unsigned percentage);
+  /* Frames of the telemetry timer, for RPC subscribers */
+  TelemetryFeed &telemetry();
 };
 }
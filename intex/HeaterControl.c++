@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <mutex>
+
+#include <QDebug>
+
+#include "HeaterControl.h"
+#include "EdgeScheduler.h"
+#include "IntexHardware.h"
+#include "SensorAcquisition.h"
+
+using namespace std::literals::chrono_literals;
+using namespace std::chrono;
+
+namespace intex {
+
+static constexpr auto control_period = 1s;
+/* a ring temperature older than this is not controlled on */
+static constexpr auto stale_after = 3s;
+static constexpr double setpoint = 37.5; /* °C */
+/* combined duty of both heaters, i.e. at most one heater's worth of power */
+static constexpr double power_budget = 1.0;
+static constexpr double fallback_duty = 1.0;
+
+/* duty per K, per K and second, and the anti-windup tracking gain per s */
+static constexpr double kp = 0.2;
+static constexpr double ki = 0.01;
+static constexpr double kt = 0.1;
+
+namespace {
+struct Loop {
+  Channel channel;
+  hw::Heater &(*heater)();
+  HeaterControl::Status status;
+  bool warned = false;
+};
+}
+
+struct HeaterControl::Impl {
+  using clock = hw::EdgeScheduler::clock;
+
+  const SensorAcquisition &sensors;
+  mutable std::mutex mutex;
+  std::array<Loop, 2> loops;
+  uint64_t timer = 0;
+  bool stopped = false;
+
+  explicit Impl(const SensorAcquisition &sensors_)
+      : sensors(sensors_),
+        loops{{Loop{Channel::AntennaInnerTemperature,
+                    &hw::Heater::innerHeater, HeaterControl::Status{}},
+               Loop{Channel::AntennaOuterTemperature,
+                    &hw::Heater::outerHeater, HeaterControl::Status{}}}} {}
+
+  /* Runs on the scheduler thread; the edge only holds the control weakly */
+  static void schedule(const std::shared_ptr<Impl> &self,
+                       const clock::time_point deadline) {
+    std::weak_ptr<Impl> weak = self;
+    self->timer = hw::EdgeScheduler::scheduler().at(
+        deadline, hw::EdgeScheduler::Priority::Actuation,
+        [weak](const clock::time_point now) {
+          if (auto self = weak.lock()) {
+            self->step();
+            std::lock_guard<std::mutex> lock(self->mutex);
+            if (!self->stopped)
+              schedule(self, now + control_period);
+          }
+        });
+  }
+
+  void step() {
+    const auto now = system_clock::now();
+    const auto timestamp = now.time_since_epoch().count();
+    const auto dt = duration_cast<duration<double>>(control_period).count();
+
+    std::array<double, 2> request{{0.0, 0.0}};
+    std::array<double, 2> unsaturated{{0.0, 0.0}};
+    std::array<bool, 2> enabled{{false, false}};
+    std::array<bool, 2> measured{{false, false}};
+    std::array<double, 2> error{{0.0, 0.0}};
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stopped)
+      return;
+    for (size_t i = 0; i < loops.size(); ++i) {
+      auto &loop = loops[i];
+      enabled[i] = loop.heater().enabled();
+      if (!enabled[i])
+        continue;
+
+      const auto sample = sensors.latest(loop.channel);
+      const auto age = now - system_clock::time_point(
+                                 system_clock::duration(sample.timestamp));
+      measured[i] = sample.valid && age < stale_after;
+      if (!measured[i]) {
+        if (!loop.warned) {
+          qWarning() << "No recent temperature for heater" << i
+                     << ", heating at fallback duty";
+          loop.warned = true;
+        }
+        request[i] = fallback_duty;
+        continue;
+      }
+      loop.warned = false;
+
+      error[i] = setpoint - sample.value;
+      unsaturated[i] = kp * error[i] + loop.status.integral;
+      request[i] = std::min(std::max(unsaturated[i], 0.0), 1.0);
+    }
+
+    const auto total = request[0] + request[1];
+    const auto scale = total > power_budget ? power_budget / total : 1.0;
+
+    for (size_t i = 0; i < loops.size(); ++i) {
+      auto &status = loops[i].status;
+      const auto duty = request[i] * scale;
+      if (!enabled[i]) {
+        status.integral = 0.0;
+      } else if (measured[i]) {
+        /* back-calculation: the integral follows the duty applied */
+        status.integral += dt * (ki * error[i] + kt * (duty - unsaturated[i]));
+      }
+      status.timestamp = timestamp;
+      status.measured = measured[i];
+      status.error = error[i];
+      status.duty = duty;
+      loops[i].heater().setDuty(static_cast<float>(duty));
+    }
+  }
+};
+
+HeaterControl::HeaterControl(const SensorAcquisition &sensors)
+    : d(std::make_shared<Impl>(sensors)) {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  Impl::schedule(d, Impl::clock::now());
+}
+
+/* Waits for a running step, which may still hold d */
+HeaterControl::~HeaterControl() {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  d->stopped = true;
+  hw::EdgeScheduler::scheduler().cancel(d->timer);
+}
+
+HeaterControl::Status HeaterControl::status(const Ring ring) const {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  return d->loops[static_cast<size_t>(ring)].status;
+}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <memory>
+
+#include <cstdint>
+
+namespace intex {
+
+class SensorAcquisition;
+
+/* Closed loop temperature control of the antenna ring heaters. A PI
+ * controller per ring sets the duty cycle of its heater once a second, from
+ * the latest ring temperature. The integral tracks the duty actually
+ * applied, so it does not wind up while a heater is saturated, disabled or
+ * held back by the power budget the two heaters share. Without a recent
+ * temperature a heater falls back to the duty it is allowed at most.
+ */
+class HeaterControl {
+  struct Impl;
+  std::shared_ptr<Impl> d;
+
+public:
+  enum class Ring : uint8_t { Inner, Outer };
+
+  struct Status {
+    int64_t timestamp; /* of the last step, 0 before the first */
+    bool measured;     /* false while running on the fallback duty */
+    double error;      /* setpoint less temperature, K */
+    double integral;   /* duty */
+    double duty;       /* applied */
+  };
+
+  /* sensors provides the ring temperatures and must outlive the control */
+  explicit HeaterControl(const SensorAcquisition &sensors);
+  ~HeaterControl();
+  HeaterControl(const HeaterControl &) = delete;
+  HeaterControl &operator=(const HeaterControl &) = delete;
+
+  /* Thread-safe */
+  Status status(const Ring ring) const;
+};
+}
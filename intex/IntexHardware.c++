@@ -1,6 +1,10 @@
+#include <algorithm>
+#include <array>
 #include <chrono>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -13,6 +17,9 @@
 #include <assert.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/gpio.h>
+#endif
 #ifdef BUILD_ON_RASPBERRY
 #include <linux/types.h>
 extern "C" {
@@ -21,12 +28,12 @@ extern "C" {
 #endif
 
 #include <QDebug>
-#include <QTimer>
 #include <QString>
 #include <QFileInfo>
 #include <QByteArray>
 
 #include "IntexHardware.h"
+#include "EdgeScheduler.h"
 
 using namespace std::chrono;
 using namespace std::literals::chrono_literals;
@@ -41,6 +48,7 @@ namespace config {
  * GPIO15 AUX1_24V_CTRL BURNWIRE-NEW
  * GPIO18 ADS1248_CS0
  * GPIO23 ADS1248_CS1
+ * GPIO22 ADS1248_DRDY
  * GPIO24 RTC_CS
  * GPIO21 WD_INPUT
  * GPIO04 PRESSURE_CS0
@@ -102,6 +110,9 @@ static constexpr gpio ads1248_cs{18, "Temperatur Sensor CS",
                                  gpio::direction::out, true};
 static constexpr gpio ads1248_reset{23, "Temperatur Sensor Reset",
                                     gpio::direction::out, true};
+/* low while a conversion result is ready */
+static constexpr gpio ads1248_drdy{22, "Temperatur Sensor DRDY",
+                                   gpio::direction::in, false};
 
 static constexpr gpio pressure_atmospheric_cs{4, "Atmospheric Pressure CS",
                                               gpio::direction::out, true};
@@ -232,22 +243,28 @@ static constexpr spi pressure_tank{7629,
 
 static constexpr int retries = 3;
 
+/* sysfs GPIO backend. The value file is opened once and then accessed with
+ * pwrite/pread, so toggling a pin costs a single syscall. */
 class gpio {
   void configure();
+  void open_value();
+  void reopen();
 
 public:
   enum class attribute { active_low, direction, edge, value };
   gpio(const config::gpio &config);
+  ~gpio();
   gpio(const gpio &) = delete;
-  gpio(gpio &&) = default;
+  gpio(gpio &&other) noexcept;
   gpio &operator=(const gpio &) = delete;
-  gpio &operator=(gpio &&) = default;
+  gpio &operator=(gpio &&) = delete;
 
   void set(const bool on);
   bool isOn() const;
 
 private:
   config::gpio config_;
+  int fd = -1;
 };
 
 static const char *to_string(const enum gpio::attribute &attribute) {
@@ -282,8 +299,21 @@ static QDebug operator<<(QDebug os, const gpio::attribute attribute) {
   return os << to_string(attribute);
 }
 
+/* Setting INTEX_SYSFS_ROOT redirects all GPIO sysfs accesses to a stand-in
+ * directory tree, e.g. for running off-target. */
+static QString sysfs_root() {
+  static const QString root = qEnvironmentVariableIsSet("INTEX_SYSFS_ROOT")
+                                  ? qgetenv("INTEX_SYSFS_ROOT")
+                                  : QString("/sys");
+  return root;
+}
+
+static std::string gpio_path(const char *file) {
+  return (sysfs_root() + "/class/gpio/" + file).toStdString();
+}
+
 static void export_pin(int pin, const bool do_export = true) {
-  QFileInfo gpiodir(QString("/sys/class/gpio/gpio%1").arg(pin));
+  QFileInfo gpiodir(QString("%1/class/gpio/gpio%2").arg(sysfs_root()).arg(pin));
   /* export but exists or unexport but doesn't exist */
   if (do_export == gpiodir.exists())
     return;
@@ -293,9 +323,9 @@ static void export_pin(int pin, const bool do_export = true) {
   export_.clear();
 
   if (do_export) {
-    export_.open("/sys/class/gpio/export");
+    export_.open(gpio_path("export"));
   } else {
-    export_.open("/sys/class/gpio/unexport");
+    export_.open(gpio_path("unexport"));
   }
   export_ << pin << std::endl;
   export_.close();
@@ -306,7 +336,7 @@ static void export_pin(int pin, const bool do_export = true) {
 static void sysfs_file(std::fstream &file, const gpio::attribute attr,
                        const int pin, const std::ios_base::openmode mode) {
   std::ostringstream fname;
-  fname << "/sys/class/gpio/gpio" << pin << "/" << attr;
+  fname << gpio_path("gpio") << pin << "/" << attr;
 
   file.open(fname.str().c_str(), mode);
 }
@@ -321,25 +351,6 @@ static void set_attribute(const gpio::attribute attr, const int pin,
   file << to_string(value) << std::endl;
 }
 
-template <typename T>
-static T get_attribute(const gpio::attribute attr, const int pin) {
-  T value;
-  std::fstream file;
-  sysfs_file(file, attr, pin, std::ios_base::in);
-  file >> value;
-  return value;
-}
-
-template <>
-std::string get_attribute<std::string>(const gpio::attribute attr,
-                                       const int pin) {
-  char value[8] = {0};
-  std::fstream file;
-  sysfs_file(file, attr, pin, std::ios_base::in);
-  file.getline(value, sizeof(value));
-  return std::string(value);
-}
-
 void gpio::configure() {
   qDebug() << config_;
   export_pin(config_.pinno);
@@ -347,21 +358,61 @@ void gpio::configure() {
   set_attribute(attribute::active_low, config_.pinno, config_.active_low);
 }
 
-gpio::gpio(const config::gpio &config) : config_(config) { configure(); }
+void gpio::open_value() {
+  std::ostringstream fname;
+  fname << gpio_path("gpio") << config_.pinno << "/" << attribute::value;
+
+  const int flags =
+      (config_.direction == config::gpio::direction::out) ? O_RDWR : O_RDONLY;
+  fd = ::open(fname.str().c_str(), flags | O_CLOEXEC);
+}
+
+/* The pin may have been unexported behind our back */
+void gpio::reopen() {
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+  export_pin(config_.pinno, false);
+  configure();
+  open_value();
+}
+
+gpio::gpio(const config::gpio &config) : config_(config) {
+  configure();
+  open_value();
+  if (fd < 0) {
+    throw_errno(QString("Could not open value of pin %1")
+                    .arg(config_.pinno)
+                    .toStdString());
+  }
+}
+
+gpio::gpio(gpio &&other) noexcept : config_(other.config_), fd(other.fd) {
+  other.fd = -1;
+}
+
+gpio::~gpio() {
+  if (fd >= 0)
+    close(fd);
+}
 
 bool gpio::isOn() const {
-  return get_attribute<int>(attribute::value, config_.pinno);
+  char value;
+  if (pread(fd, &value, sizeof(value), 0) != sizeof(value)) {
+    throw_errno(
+        QString("Could not read pin %1").arg(config_.pinno).toStdString());
+  }
+  return value == '1';
 }
 
 void gpio::set(const bool on) {
+  const char value = on ? '1' : '0';
+
   for (int retry = 0; retry < retries; ++retry) {
-    set_attribute(attribute::value, config_.pinno, static_cast<int>(on));
-    if (isOn() == on)
+    if (fd >= 0 && pwrite(fd, &value, sizeof(value), 0) == sizeof(value))
       return;
-    {
-      export_pin(config_.pinno, false);
-      configure();
-    }
+    reopen();
     std::this_thread::sleep_for(10ms);
   }
 
@@ -371,6 +422,81 @@ void gpio::set(const bool on) {
                   .toStdString());
 }
 
+#ifdef __linux__
+/* GPIO character device backend (/dev/gpiochipN line handles). The line is
+ * requested once; set and isOn are a single ioctl each. */
+class cdev_gpio {
+public:
+  cdev_gpio(const config::gpio &config, const char *chip = "/dev/gpiochip0")
+      : config_(config) {
+    const int chipfd = ::open(chip, O_RDONLY | O_CLOEXEC);
+    if (chipfd < 0)
+      throw_errno(std::string("Could not open ") + chip);
+
+    struct gpiohandle_request request;
+    memset(&request, 0, sizeof(request));
+    request.lineoffsets[0] = static_cast<__u32>(config_.pinno);
+    request.lines = 1;
+    if (config_.direction == config::gpio::direction::out) {
+      request.flags = GPIOHANDLE_REQUEST_OUTPUT;
+    } else {
+      request.flags = GPIOHANDLE_REQUEST_INPUT;
+    }
+    if (config_.active_low)
+      request.flags |= GPIOHANDLE_REQUEST_ACTIVE_LOW;
+    strncpy(request.consumer_label, "intex",
+            sizeof(request.consumer_label) - 1);
+
+    const int ret = ioctl(chipfd, GPIO_GET_LINEHANDLE_IOCTL, &request);
+    close(chipfd);
+    if (ret < 0) {
+      throw_errno(QString("Could not request line %1 (%2)")
+                      .arg(config_.pinno)
+                      .arg(config_.name)
+                      .toStdString());
+    }
+    fd = request.fd;
+    qDebug() << config_;
+  }
+  ~cdev_gpio() {
+    if (fd >= 0)
+      close(fd);
+  }
+  cdev_gpio(const cdev_gpio &) = delete;
+  cdev_gpio(cdev_gpio &&other) noexcept : config_(other.config_), fd(other.fd) {
+    other.fd = -1;
+  }
+  cdev_gpio &operator=(const cdev_gpio &) = delete;
+  cdev_gpio &operator=(cdev_gpio &&) = delete;
+
+  void set(const bool on) {
+    struct gpiohandle_data data;
+    memset(&data, 0, sizeof(data));
+    data.values[0] = on ? 1 : 0;
+    if (ioctl(fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data) < 0) {
+      throw_errno(QString("Could not set pin %1 %2")
+                      .arg(config_.pinno)
+                      .arg(on)
+                      .toStdString());
+    }
+  }
+
+  bool isOn() const {
+    struct gpiohandle_data data;
+    memset(&data, 0, sizeof(data));
+    if (ioctl(fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0) {
+      throw_errno(
+          QString("Could not read pin %1").arg(config_.pinno).toStdString());
+    }
+    return data.values[0] != 0;
+  }
+
+private:
+  config::gpio config_;
+  int fd = -1;
+};
+#endif
+
 class debug_gpio {
 public:
   debug_gpio(const config::gpio &config)
@@ -403,61 +529,98 @@ private:
 
 #pragma clang diagnostic ignored "-Wweak-vtables"
 
-class PWM : public QObject {
-  Q_OBJECT
+/* Edges are timed from the previous deadline, so a late edge does not
+ * shift the ones after it. Thread-safe. */
+class PWM {
+  using clock = EdgeScheduler::clock;
 
+  EdgeScheduler &scheduler;
   milliseconds period_;
   float duty_;
-  QTimer timer;
-  bool state_;
-
-  void cycle() {
-    Q_EMIT set(state_);
-    const auto factor = state_ ? duty_ : 1.0 - duty_;
-    const auto timeout = period_ * factor;
+  std::function<void(bool)> set_;
+  std::mutex mutex;
+  bool running = false;
+  bool state_ = true;
+  uint64_t timer = 0;
+
+  /* with the mutex held; a duty of 0 or 1 holds the pin */
+  void cycle(const clock::time_point now) {
+    const bool hold = duty_ <= 0.0f || duty_ >= 1.0f;
+    if (hold)
+      state_ = duty_ > 0.0f;
+    set_(state_);
+    const auto factor = hold ? 1.0f : state_ ? duty_ : 1.0f - duty_;
+    const auto next =
+        now + duration_cast<clock::duration>(period_ * double{factor});
     state_ = !state_;
-    timer.setInterval(static_cast<int>(timeout.count()));
+    timer = scheduler.at(next, EdgeScheduler::Priority::Actuation,
+                         [this](const clock::time_point deadline) {
+                           std::lock_guard<std::mutex> lock(mutex);
+                           if (running)
+                             cycle(deadline);
+                         });
   }
 
 public:
   template <class Rep, class Period>
-  PWM(duration<Rep, Period> period, float duty)
-      : period_(duration_cast<milliseconds>(period)), duty_(duty),
-        state_(true) {
-    connect(&timer, &QTimer::timeout, this, &PWM::cycle);
+  PWM(duration<Rep, Period> period, float duty, std::function<void(bool)> set)
+      : scheduler(EdgeScheduler::scheduler()),
+        period_(duration_cast<milliseconds>(period)), duty_(duty),
+        set_(std::move(set)) {}
+  /* the edge reschedules itself until it sees running cleared */
+  ~PWM() {
+    uint64_t last;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = false;
+      last = timer;
+    }
+    scheduler.cancelAndWait(last);
+  }
+
+  /* Takes effect with the next edge */
+  void setDuty(float duty) {
+    std::lock_guard<std::mutex> lock(mutex);
+    duty_ = duty;
   }
 
-  void setDuty(float duty) { duty_ = duty; }
   void start() {
-    if (!timer.isActive()) {
-      Q_EMIT set(true);
-      timer.start();
-    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (running)
+      return;
+    running = true;
+    state_ = true;
+    cycle(clock::now());
   }
   void stop() {
-    timer.stop();
-    timer.setInterval(0);
-    Q_EMIT set(false);
+    std::lock_guard<std::mutex> lock(mutex);
+    running = false;
+    scheduler.cancel(timer);
+    set_(false);
   }
-
-  // clang-format off
-Q_SIGNALS:
-  void set(const bool);
-  // clang-format on
 };
 
 class GPIO : public QObject {
   Q_OBJECT
 
 public:
+  /* Board default backend, see make_model */
+  explicit GPIO(const config::gpio &config);
   template <typename T>
   GPIO(T &&backend)
      try : model_(std::make_unique<gpio_model<T>>(std::move(backend))) {
   } catch (const std::exception &e) {
     qCritical() << e.what();
   }
-  void set(const bool on) { model_->set(on); }
-  bool state() const { return model_->state(); }
+  /* Thread-safe; actuation commands run on worker threads */
+  void set(const bool on) {
+    std::lock_guard<std::mutex> lock(mutex);
+    model_->set(on);
+  }
+  bool state() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return model_->state();
+  }
 
 private:
   struct gpio_concept {
@@ -473,38 +636,62 @@ private:
     bool state() const override { return backend_.isOn(); }
   };
 
+  static std::unique_ptr<gpio_concept> make_model(const config::gpio &config);
+
   std::unique_ptr<gpio_concept> model_;
+  mutable std::mutex mutex;
 };
 
+std::unique_ptr<GPIO::gpio_concept>
+GPIO::make_model(const config::gpio &config) {
+#ifdef BUILD_ON_RASPBERRY
+#ifdef INTEX_GPIO_CDEV
+  return std::make_unique<gpio_model<cdev_gpio>>(cdev_gpio(config));
+#else
+  return std::make_unique<gpio_model<gpio>>(gpio(config));
+#endif
+#else
+  if (qEnvironmentVariableIsSet("INTEX_SYSFS_ROOT"))
+    return std::make_unique<gpio_model<gpio>>(gpio(config));
+  return std::make_unique<gpio_model<debug_gpio>>(debug_gpio(config));
+#endif
+}
+
+GPIO::GPIO(const config::gpio &config) try : model_(make_model(config)) {
+} catch (const std::exception &e) {
+  qCritical() << e.what();
+}
+
 struct Valve::Impl {
-  PWM pwm;
+  /* the edges of pwm set pin_, which outlives them */
   GPIO pin_;
+  PWM pwm;
+  std::mutex mutex;
   bool enabled = false;
-  QTimer timer;
+  /* switches from fully open to holding the valve open */
+  uint64_t hold = 0;
 
   Impl(const config::gpio &config)
-      : pwm(10s, 0.1f),
-#ifdef BUILD_ON_RASPBERRY
-        pin_(::intex::hw::gpio(config))
-#else
-        pin_(::intex::hw::debug_gpio(config))
-#endif
-  {
-    timer.setInterval(duration_cast<milliseconds>(45s).count());
-    timer.setSingleShot(true);
-    QObject::connect(&timer, &QTimer::timeout, [this] { pwm.start(); });
-    QObject::connect(&pwm, &PWM::set, &pin_, &GPIO::set);
-  }
+      : pin_(config),
+        pwm(10s, 0.1f, [this](const bool on) { pin_.set(on); }) {}
+  ~Impl() { EdgeScheduler::scheduler().cancelAndWait(hold); }
 
   void set(const bool on) {
+    std::lock_guard<std::mutex> lock(mutex);
     if (on == enabled) {
       return;
     }
 
+    auto &scheduler = EdgeScheduler::scheduler();
     if (on) {
-      timer.start();
+      hold = scheduler.after(45s, EdgeScheduler::Priority::Actuation,
+                             [this](auto) {
+                               std::lock_guard<std::mutex> lock(mutex);
+                               if (enabled)
+                                 pwm.start();
+                             });
     } else {
-      timer.stop();
+      scheduler.cancel(hold);
       pwm.stop();
     }
 
@@ -534,102 +721,86 @@ Valve &Valve::outletValve() {
 
 class Heater::Impl {
   GPIO pin;
-  QTimer timer;
-  int low_;
-  int high_;
-  bool enabled = true;
-
-  void setpin(const bool on) {
-    /* don't restart timer, if it's running */
-    if (!on && !timer.isActive()) {
-      timer.start();
-    } else if (on) {
-      timer.stop();
-    }
-    pin.set(on);
+  PWM pwm;
+  mutable std::mutex mutex;
+  bool enabled_ = true;
+  float duty = 0.0f;
+  bool heating = false;
+
+  /* with the mutex held */
+  void apply() {
+    const bool heat = enabled_ && duty > 0.0f;
+    if (heat && !heating)
+      pwm.start();
+    else if (!heat && heating)
+      pwm.stop();
+    heating = heat;
   }
 
 public:
   template <class Rep, class Period>
-  Impl(const config::gpio &config, int low, int high,
-       duration<Rep, Period> timeout)
-      :
-#ifdef BUILD_ON_RASPBERRY
-        pin(::intex::hw::gpio(config)),
-#else
-        pin(::intex::hw::debug_gpio(config)),
-#endif
-        low_(low), high_(high) {
-    timer.setInterval(
-        static_cast<int>(duration_cast<milliseconds>(timeout).count()));
-    QObject::connect(&timer, &QTimer::timeout, [this]() {
-      qDebug() << "Temperature changed timeout reached. Resetting Heater.";
-      setpin(true);
-    });
+  Impl(const config::gpio &config, duration<Rep, Period> period)
+      : pin(config), pwm(period, 0.0f, [this](const bool on) { pin.set(on); }) {
+    pin.set(false);
   }
 
   void set(const bool on) {
-    enabled = on;
-    setpin(on);
+    std::lock_guard<std::mutex> lock(mutex);
+    enabled_ = on;
+    apply();
   }
 
-  void temperatureChanged(int temperature) {
-    if (!enabled)
-      return;
+  bool enabled() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return enabled_;
+  }
 
-    if (temperature < low_) {
-      qDebug() << "Low setpoint (" << low_ << ") reached (" << temperature
-               << ").";
-      setpin(true);
-    } else if (temperature > high_) {
-      qDebug() << "High setpoint (" << high_ << ") reached (" << temperature
-               << ").";
-      setpin(false);
-    }
+  void setDuty(const float duty_) {
+    std::lock_guard<std::mutex> lock(mutex);
+    duty = std::min(std::max(duty_, 0.0f), 1.0f);
+    pwm.setDuty(duty);
+    apply();
   }
 };
 
-Heater::Heater(const config::gpio &config, int low, int high)
-    : d(std::make_unique<Impl>(config, low, high, 10s)) {}
+Heater::Heater(const config::gpio &config)
+    : d(std::make_unique<Impl>(config, 2s)) {}
 Heater::~Heater() = default;
 void Heater::set(const bool state) { d->set(state); }
-
-void Heater::temperatureChanged(int temperature) {
-  d->temperatureChanged(temperature);
-}
+bool Heater::enabled() const { return d->enabled(); }
+void Heater::setDuty(const float duty) { d->setDuty(duty); }
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wexit-time-destructors"
 Heater &Heater::innerHeater() {
   static std::unique_ptr<Heater> instance{
-      new Heater(intex::hw::config::heater0, 35, 40)};
+      new Heater(intex::hw::config::heater0)};
   return *instance;
 }
 
 Heater &Heater::outerHeater() {
   static std::unique_ptr<Heater> instance{
-      new Heater(intex::hw::config::heater1, 35, 40)};
+      new Heater(intex::hw::config::heater1)};
   return *instance;
 }
 #pragma clang diagnostic pop
 
 struct Burnwire::Impl {
   GPIO pin;
+  std::mutex mutex;
+  /* safety cut-off */
+  uint64_t off = 0;
 
-  Impl(const config::gpio &config)
-      :
-#ifdef BUILD_ON_RASPBERRY
-        pin(::intex::hw::gpio(config))
-#else
-        pin(::intex::hw::debug_gpio(config))
-#endif
-  {
-  }
+  Impl(const config::gpio &config) : pin(config) {}
+  ~Impl() { EdgeScheduler::scheduler().cancelAndWait(off); }
 
   void set(const bool on) {
+    std::lock_guard<std::mutex> lock(mutex);
     if (on) {
-      QTimer::singleShot(duration_cast<milliseconds>(30s).count(),
-                         [this] { pin.set(false); });
+      auto &scheduler = EdgeScheduler::scheduler();
+      scheduler.cancel(off);
+      off = scheduler.after(30s, EdgeScheduler::Priority::Safety,
+                            [this](auto) { pin.set(false); });
     }
 
     pin.set(on);
@@ -651,30 +822,48 @@ Burnwire &Burnwire::burnwire() {
 #pragma clang diagnostic pop
 
 struct Watchdog::Impl {
+  static constexpr auto interval = 10s;
+
   GPIO pin;
-  QTimer timer;
+  std::mutex mutex;
+  bool stopping = false;
+  uint64_t timer = 0;
 
-  Impl(const config::gpio &config)
-      :
-#ifdef BUILD_ON_RASPBERRY
-        pin(::intex::hw::gpio(config))
-#else
-        pin(::intex::hw::debug_gpio(config))
-#endif
-  {
-    QObject::connect(&timer, &QTimer::timeout, [=] {
-      try {
-        pin.set(!pin.state());
-      } catch (const std::exception &e) {
-        qCritical() << e.what();
-      }
-    });
-    timer.setInterval(duration_cast<milliseconds>(10s).count());
-    timer.setSingleShot(false);
-    timer.start();
+  Impl(const config::gpio &config) : pin(config) {
+    std::lock_guard<std::mutex> lock(mutex);
+    schedule(EdgeScheduler::clock::now() + interval);
+  }
+  /* the edge reschedules itself until it sees stopping */
+  ~Impl() {
+    uint64_t last;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+      last = timer;
+    }
+    EdgeScheduler::scheduler().cancelAndWait(last);
+  }
+
+  /* with the mutex held */
+  void schedule(const EdgeScheduler::clock::time_point deadline) {
+    timer = EdgeScheduler::scheduler().at(
+        deadline, EdgeScheduler::Priority::Watchdog,
+        [this](const EdgeScheduler::clock::time_point now) {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (stopping)
+            return;
+          try {
+            pin.set(!pin.state());
+          } catch (const std::exception &e) {
+            qCritical() << e.what();
+          }
+          schedule(now + interval);
+        });
   }
 };
 
+constexpr seconds Watchdog::Impl::interval;
+
 Watchdog::Watchdog(const config::gpio &config)
     : d(std::make_unique<Impl>(config)) {}
 Watchdog::~Watchdog() = default;
@@ -691,15 +880,7 @@ Watchdog &Watchdog::watchdog() {
 
 struct MiniVNA::Impl {
   GPIO pin;
-  Impl(const config::gpio &config)
-      :
-#ifdef BUILD_ON_RASPBERRY
-        pin(::intex::hw::gpio(config))
-#else
-        pin(::intex::hw::debug_gpio(config))
-#endif
-  {
-  }
+  Impl(const config::gpio &config) : pin(config) {}
 
   void set(const bool on) { pin.set(on); }
 };
@@ -721,15 +902,7 @@ MiniVNA &MiniVNA::miniVNA() {
 
 struct USBHub::Impl {
   GPIO pin;
-  Impl(const config::gpio &config)
-      :
-#ifdef BUILD_ON_RASPBERRY
-        pin(::intex::hw::gpio(config))
-#else
-        pin(::intex::hw::debug_gpio(config))
-#endif
-  {
-  }
+  Impl(const config::gpio &config) : pin(config) {}
 
   void set(const bool on) { pin.set(on); }
 };
@@ -750,12 +923,17 @@ USBHub &USBHub::usbHub() {
 #pragma clang diagnostic pop
 
 class spi {
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wexit-time-destructors"
-  static spi spidev00;
-#pragma clang diagnostic pop
-
   int fd = -1;
+  /* the pressure sensors and the ADS1248 are sampled on different threads */
+  std::mutex mutex;
+
+  /* Bus settings last written to the device. The kernel keeps them per file
+   * descriptor, so they are only rewritten when a differently configured
+   * device is addressed. */
+  bool configured = false;
+  uint32_t active_mode = 0;
+  uint8_t active_bpw = 0;
+  uint32_t active_speed = 0;
 
   spi(const char *device) {
     fd = open(device, O_RDWR);
@@ -778,8 +956,34 @@ class spi {
       close(fd);
   }
 
+#ifdef BUILD_ON_RASPBERRY
+  /* SPI_IOC_MESSAGE(n) for a runtime n */
+  static unsigned long message_request(const size_t count) {
+    return _IOC(_IOC_WRITE, SPI_IOC_MAGIC, 0,
+                count * sizeof(struct spi_ioc_transfer));
+  }
+#endif
+
 public:
+  /* One segment of a transaction. All segments of a transaction are clocked
+   * out in a single SPI_IOC_MESSAGE while CS stays asserted. */
+  struct segment {
+    const uint8_t *tx;
+    uint8_t *rx;
+    uint32_t len;
+    uint16_t delay_usecs;
+  };
+  static constexpr size_t max_segments = 8;
+
+  /* Opened on first use. Setting INTEX_SPIDEV opens another device instead
+   * of /dev/spidev0.0, e.g. a mock. */
   static spi &bus(unsigned bus) {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wexit-time-destructors"
+    static spi spidev00(qEnvironmentVariableIsSet("INTEX_SPIDEV")
+                            ? qgetenv("INTEX_SPIDEV").constData()
+                            : "/dev/spidev0.0");
+#pragma clang diagnostic pop
     if (bus == 0)
       return spidev00;
 
@@ -791,9 +995,15 @@ public:
       return;
     }
 #ifdef BUILD_ON_RASPBERRY
+    const uint32_t mode = config.mode();
+    if (configured && active_mode == mode && active_bpw == config.bpw &&
+        active_speed == config.speed)
+      return;
+
+    configured = false;
+
     int ret;
 
-    uint32_t mode = config.mode();
     ret = ioctl(fd, SPI_IOC_WR_MODE32, &mode);
     if (ret == -1) {
       throw_errno("Could not set SPI mode");
@@ -826,125 +1036,136 @@ public:
     ret = ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, &speed);
     if (ret == -1)
       throw_errno("Could not get SPI speed");
+
+    active_mode = mode;
+    active_bpw = config.bpw;
+    active_speed = config.speed;
+    configured = true;
 #endif
   }
 
-  /* Perform one transfer, deasserting CS */
-  void transfer(QByteArray tx, QByteArray &rx, const config::spi &config,
-                GPIO &cs_pin) {
+  /* Perform all segments in one ioctl, deasserting CS afterwards */
+  void transfer(const segment *segments, const size_t count,
+                const config::spi &config, GPIO &cs_pin) {
+    if (count == 0 || count > max_segments)
+      throw std::runtime_error("Invalid SPI transaction length " +
+                               std::to_string(count));
 #ifdef BUILD_ON_RASPBERRY
-    int ret;
-
-    rx.resize(static_cast<int>(tx.size()));
-
-    struct spi_ioc_transfer tr;
-    tr.tx_buf = reinterpret_cast<uint64_t>(tx.constData());
-    tr.rx_buf = reinterpret_cast<uint64_t>(rx.data());
-    tr.len = static_cast<uint32_t>(tx.size());
-    tr.delay_usecs = config.delay;
-    tr.speed_hz = config.speed;
-    tr.bits_per_word = config.bpw;
+    std::lock_guard<std::mutex> lock(mutex);
+    configure(config);
+
+    struct spi_ioc_transfer tr[max_segments];
+    memset(tr, 0, sizeof(tr));
+
+    for (size_t i = 0; i < count; ++i) {
+      tr[i].tx_buf = reinterpret_cast<uint64_t>(segments[i].tx);
+      tr[i].rx_buf = reinterpret_cast<uint64_t>(segments[i].rx);
+      tr[i].len = segments[i].len;
+      tr[i].delay_usecs = std::max(segments[i].delay_usecs, config.delay);
+      tr[i].speed_hz = config.speed;
+      tr[i].bits_per_word = config.bpw;
+    }
 
     if (config.no_cs) {
       cs_pin.set(false);
     } else {
-      /* one transfer shall be completed with a deasserted CS */
-      tr.cs_change = 1;
+      /* the transaction shall be completed with a deasserted CS */
+      tr[count - 1].cs_change = 1;
     }
 
-    /* one transfer transfers without a CS deassert */
-    tr.tx_nbits = tr.rx_nbits = config.bpw;
-
     if (config.no_cs) {
       cs_pin.set(true);
       std::this_thread::sleep_for(2ms);
     }
 
-    ret = ioctl(fd, SPI_IOC_MESSAGE(1), &tr);
-    if (ret < 1)
-      throw_errno("Could not transfer SPI data");
+    const int ret = ioctl(fd, message_request(count), tr);
+    const int error = errno;
 
     if (config.no_cs)
       cs_pin.set(false);
+
+    if (ret < 1) {
+      errno = error;
+      throw_errno("Could not transfer SPI data");
+    }
+#else
+    (void)segments;
+    (void)config;
+    (void)cs_pin;
 #endif
   }
 
+  void transfer(QByteArray tx, QByteArray &rx, const config::spi &config,
+                GPIO &cs_pin) {
+    rx.resize(static_cast<int>(tx.size()));
+    const segment s{reinterpret_cast<const uint8_t *>(tx.constData()),
+                    reinterpret_cast<uint8_t *>(rx.data()),
+                    static_cast<uint32_t>(tx.size()), 0};
+    transfer(&s, 1, config, cs_pin);
+  }
+
   void transfer(uint8_t *tx, uint8_t *rx, uint32_t len,
                 const config::spi &config, GPIO &cs_pin) {
-
-#ifdef BUILD_ON_RASPBERRY
-    int ret;
-
-    struct spi_ioc_transfer tr;
-    tr.tx_buf = reinterpret_cast<uint64_t>(tx);
-    tr.rx_buf = reinterpret_cast<uint64_t>(rx);
-    tr.len = static_cast<uint32_t>(len);
-    tr.delay_usecs = config.delay;
-    tr.speed_hz = config.speed;
-    tr.bits_per_word = config.bpw;
-
-    if (config.no_cs) {
-      cs_pin.set(false);
-    } else {
-      /* one transfer shall be completed with a deasserted CS */
-      tr.cs_change = 1;
-    }
-
-    /* one transfer transfers without a CS deassert */
-    tr.tx_nbits = tr.rx_nbits = config.bpw;
-
-    if (config.no_cs) {
-      cs_pin.set(true);
-      std::this_thread::sleep_for(2ms);
-    }
-
-    ret = ioctl(fd, SPI_IOC_MESSAGE(1), &tr);
-    if (ret < 1)
-      throw_errno("Could not transfer SPI data");
-
-    if (config.no_cs)
-      cs_pin.set(false);
-#endif
+    const segment s{tx, rx, len, 0};
+    transfer(&s, 1, config, cs_pin);
   }
 };
 
-spi spi::spidev00("/dev/spidev0.0");
-
 struct spi_device {
   spi &bus;
   const config::spi &config;
   GPIO cs;
 
+  /* Collects segments and submits them under one CS assertion */
+  class transaction {
+    spi_device &device;
+    spi::segment segments[spi::max_segments];
+    size_t count = 0;
+
+  public:
+    explicit transaction(spi_device &device_) : device(device_) {}
+
+    transaction &add(const uint8_t *tx, uint8_t *rx, const uint32_t len,
+                     const uint16_t delay_usecs = 0) {
+      if (count == spi::max_segments)
+        throw std::runtime_error("Too many segments in SPI transaction");
+      segments[count++] = spi::segment{tx, rx, len, delay_usecs};
+      return *this;
+    }
+
+    void submit() {
+      device.bus.transfer(segments, count, device.config, device.cs);
+    }
+  };
+
   spi_device(spi &bus_, const config::spi &config_)
-      : bus(bus_), config(config_),
-#ifdef BUILD_ON_RASPBERRY
-        cs(::intex::hw::gpio(config_.cs_pin))
-#else
-        cs(::intex::hw::debug_gpio(config_.cs_pin))
-#endif
-  {
+      : bus(bus_), config(config_), cs(config_.cs_pin) {
     if (config.no_cs) {
       cs.set(false);
     };
   }
 
+  transaction begin() { return transaction(*this); }
+
   void transfer(QByteArray tx, QByteArray &rx) {
-    bus.configure(config);
     bus.transfer(tx, rx, config, cs);
   }
 
   void transfer(uint8_t *tx, uint8_t *rx, uint32_t len) {
-    bus.configure(config);
     bus.transfer(tx, rx, len, config, cs);
   }
 };
 
-#if 1
-struct TemperatureSensor::Impl {
-  static constexpr uint8_t zero = 0;
+/* ADS1248 in continuous conversion mode. A shadow copy of the register file
+ * is kept, so selecting a sensor only writes the registers that differ. After
+ * a sample has been read the next sensor is selected right away and settles
+ * while the bus serves other devices. */
+class ads1248_driver {
   enum class Command : uint8_t {
     Reset = 0x06,
     ReadOnce = 0x12,
+    ReadContinuous = 0x14,
+    StopContinuous = 0x16,
     SelfOCal = 0x62,
     RegRead = 0x20,
     RegWrite = 0x40,
@@ -971,22 +1192,10 @@ struct TemperatureSensor::Impl {
     AIN7 = 7,
   };
 
-  static const char *to_string(const enum Command cmd) {
-    switch (cmd) {
-    case Command::Reset:
-      return "Reset";
-    case Command::ReadOnce:
-      return "ReadOnce";
-    case Command::SelfOCal:
-      return "SelfOCal";
-    case Command::RegRead:
-      return "RegRead";
-    case Command::RegWrite:
-      return "RegWrite";
-    case Command::NOP:
-      return "NOP";
-    }
-  }
+  using Sensor = TemperatureSensor::Sensor;
+  /* registers 0x0 - 0xe */
+  static constexpr uint8_t register_count = 15;
+  using Registers = std::array<uint8_t, register_count>;
 
   static const char *to_string(const enum Register reg) {
     switch (reg) {
@@ -1003,6 +1212,11 @@ struct TemperatureSensor::Impl {
     case Register::IDAC1:
       return "IDAC1";
     }
+    return "REG";
+  }
+
+  friend QDebug operator<<(QDebug os, const enum Register reg) {
+    return os << to_string(reg);
   }
 
   static uint8_t channel2mux(const Sensor sensor) {
@@ -1033,56 +1247,75 @@ struct TemperatureSensor::Impl {
     }
   }
 
-  GPIO reset_pin;
-  spi_device device;
-
-  uint8_t read_register(const enum Register reg) {
-    QByteArray tx;
-    QByteArray rx;
-
-    tx.append(static_cast<char>(static_cast<uint8_t>(Command::RegRead) +
-                                static_cast<uint8_t>(reg)));
-    // single byte read + dummy data
-    tx.append(zero);
-    tx.append(zero);
-
-    device.transfer(tx, rx);
-
-    qDebug() << "Read register" << reg << QString::number(rx.at(2), 16);
-    return static_cast<uint8_t>(rx.at(2));
+  static Sensor next(const Sensor sensor) {
+    switch (sensor) {
+    case Sensor::InnerRing:
+      return Sensor::OuterRing;
+    case Sensor::OuterRing:
+      return Sensor::Atmosphere;
+    case Sensor::Atmosphere:
+      return Sensor::InnerRing;
+    }
   }
 
-  void write_register(const enum Register reg, const uint8_t value) {
-    QByteArray tx;
-    QByteArray rx;
-    uint8_t mask = 0;
-
-    tx.append(static_cast<char>(static_cast<uint8_t>(Command::RegWrite) +
-                                static_cast<uint8_t>(reg)));
-    // single byte read + data
-    tx.append(zero);
-    tx.append(static_cast<char>(value));
-
-    qDebug() << "Write register" << reg << tx;
-
-    device.transfer(tx, rx);
-
-    /* id is fixed */
-    if (reg == Register::IDAC0)
-      mask = 0xf0;
+  /* read-only bits: IDAC0 id, MUX1 clkstat */
+  static uint8_t fixed_bits(const uint8_t reg) {
+    switch (static_cast<enum Register>(reg)) {
+    case Register::IDAC0:
+      return 0xf0;
+    case Register::MUX1:
+      return 0x80;
+    default:
+      return 0;
+    }
+  }
 
-    /* clkstat is fixed */
-    if (reg == Register::MUX1)
-      mask = 0x80;
+  /* Register image measuring one RTD */
+  static Registers configuration(const Registers &current,
+                                 const Sensor sensor) {
+    Registers regs(current);
+    regs[static_cast<uint8_t>(Register::MUX0)] = channel2mux(sensor);
+    regs[static_cast<uint8_t>(Register::VBIAS)] = 0x0;
+    /* internal reference on */
+    regs[static_cast<uint8_t>(Register::MUX1)] = 0x20;
+    /* PGA 128, 5 SPS */
+    regs[static_cast<uint8_t>(Register::SYS0)] = 0x70;
+    regs[static_cast<uint8_t>(Register::IDAC0)] = 0x4;
+    regs[static_cast<uint8_t>(Register::IDAC1)] = channel2idac(sensor);
+    return regs;
+  }
 
-    std::this_thread::sleep_for(30ms);
+  std::mutex mutex;
+  GPIO reset_pin;
+  GPIO drdy_pin;
+  spi_device device;
+  Registers shadow;
+  bool initialized = false;
+  bool selected = false;
+  Sensor current = Sensor::InnerRing;
+  steady_clock::time_point conversion_start;
+
+  /* First conversion after a register write is settled; its latency is one
+   * data rate period (datasheet table 13). */
+  microseconds settle_time() const {
+    static constexpr unsigned rates[] = {5,   10,  20,   40,   80,   160,
+                                         320, 640, 1000, 2000, 2000, 2000,
+                                         2000, 2000, 2000, 2000};
+    const auto dr = shadow[static_cast<uint8_t>(Register::SYS0)] & 0xf;
+    return microseconds(1000000 / rates[dr]);
+  }
 
-    if ((value | mask) != (read_register(reg) | mask)) {
-      std::ostringstream os;
-      os << "Error writing register " << reg << " (" << std::hex
-         << static_cast<uint32_t>(value) << "/"
-         << static_cast<uint32_t>(read_register(reg)) << ")";
-      throw std::runtime_error(os.str());
+  /* Sleeps through the settle time, then polls DRDY; the settle time only
+   * predicts when the result is ready. Gives up after another period. The
+   * bus is free meanwhile; the ADS1248 is sampled on its own thread. */
+  void wait_ready() {
+    const auto period = settle_time();
+    const auto expected = conversion_start + period;
+    std::this_thread::sleep_until(expected);
+    for (const auto deadline = expected + period; drdy_pin.state();) {
+      if (steady_clock::now() > deadline)
+        throw std::runtime_error("ADS1248 conversion timed out");
+      std::this_thread::sleep_for(1ms);
     }
   }
 
@@ -1092,126 +1325,199 @@ struct TemperatureSensor::Impl {
     reset_pin.set(false);
     std::this_thread::sleep_for(1ms);
 
-    QByteArray tx;
-    QByteArray rx;
-    tx.append(static_cast<uint8_t>(Command::Reset));
-
-    device.transfer(tx, rx);
+    const uint8_t tx = static_cast<uint8_t>(Command::Reset);
+    uint8_t rx;
+    device.begin().add(&tx, &rx, 1).submit();
     std::this_thread::sleep_for(200ms);
   }
 
-  void self_offset_calibration() {
-    QByteArray tx;
-    QByteArray rx;
-    tx.append(static_cast<uint8_t>(Command::SelfOCal));
-    device.transfer(tx, rx);
-    /* datasheet table 10 */
-    std::this_thread::sleep_for(100ms);
+  /* Read the whole register file. Continuous mode blocks RREG, so it is
+   * stopped and restarted around the read. */
+  Registers read_registers() {
+    const uint8_t stop = static_cast<uint8_t>(Command::StopContinuous);
+    const uint8_t start = static_cast<uint8_t>(Command::ReadContinuous);
+    uint8_t tx[2 + register_count] = {
+        static_cast<uint8_t>(Command::RegRead), register_count - 1};
+    uint8_t rx[2 + register_count] = {};
+    uint8_t ignored[2];
+
+    device.begin()
+        .add(&stop, &ignored[0], 1)
+        .add(tx, rx, sizeof(tx))
+        .add(&start, &ignored[1], 1)
+        .submit();
+
+    Registers regs;
+    std::copy(&rx[2], &rx[2] + register_count, regs.begin());
+    return regs;
   }
 
-  void init() {
-    reset();
+  /* Write the registers that differ from the shadow copy, in runs of
+   * consecutive registers, each followed by a verifying read. */
+  void apply(const Registers &regs) {
+    struct run {
+      uint8_t first;
+      uint8_t count;
+    };
+    std::array<run, register_count> runs;
+    size_t nruns = 0;
+
+    for (uint8_t reg = 0; reg < register_count; ++reg) {
+      const uint8_t mask = fixed_bits(reg);
+      if ((regs[reg] | mask) == (shadow[reg] | mask))
+        continue;
+      if (nruns && runs[nruns - 1].first + runs[nruns - 1].count == reg)
+        runs[nruns - 1].count++;
+      else
+        runs[nruns++] = run{reg, 1};
+    }
 
-    {
-      for (; read_register(Register::IDAC1) != 0xff;) {
-        qDebug() << "Waiting for reset";
-        std::this_thread::sleep_for(20ms);
+    if (nruns == 0)
+      return;
+
+    /* stop + (write, read back) per run + restart */
+    static constexpr size_t runs_per_transaction = (spi::max_segments - 2) / 2;
+    const uint8_t stop = static_cast<uint8_t>(Command::StopContinuous);
+    const uint8_t start = static_cast<uint8_t>(Command::ReadContinuous);
+    uint8_t ignored[2];
+
+    for (size_t i = 0; i < nruns; i += runs_per_transaction) {
+      const size_t n = std::min(runs_per_transaction, nruns - i);
+      uint8_t write[runs_per_transaction][2 + register_count] = {};
+      uint8_t read[runs_per_transaction][2 + register_count] = {};
+      uint8_t discard[runs_per_transaction][2 + register_count];
+      uint8_t readback[runs_per_transaction][2 + register_count] = {};
+
+      auto transaction = device.begin();
+      transaction.add(&stop, &ignored[0], 1);
+      for (size_t j = 0; j < n; ++j) {
+        const auto &r = runs[i + j];
+        const uint32_t len = 2u + r.count;
+        write[j][0] = static_cast<uint8_t>(
+            static_cast<uint8_t>(Command::RegWrite) + r.first);
+        write[j][1] = static_cast<uint8_t>(r.count - 1);
+        std::copy(&regs[r.first], &regs[r.first] + r.count, &write[j][2]);
+        read[j][0] = static_cast<uint8_t>(
+            static_cast<uint8_t>(Command::RegRead) + r.first);
+        read[j][1] = static_cast<uint8_t>(r.count - 1);
+        transaction.add(write[j], discard[j], len)
+            .add(read[j], readback[j], len);
+      }
+      transaction.add(&start, &ignored[1], 1).submit();
+
+      for (size_t j = 0; j < n; ++j) {
+        const auto &r = runs[i + j];
+        for (uint8_t k = 0; k < r.count; ++k) {
+          const uint8_t reg = static_cast<uint8_t>(r.first + k);
+          const uint8_t mask = fixed_bits(reg);
+          shadow[reg] = readback[j][2 + k];
+          if ((regs[reg] | mask) != (readback[j][2 + k] | mask)) {
+            std::ostringstream os;
+            os << "Error writing register " << static_cast<uint32_t>(reg)
+               << " (" << std::hex << static_cast<uint32_t>(regs[reg]) << "/"
+               << static_cast<uint32_t>(readback[j][2 + k]) << ")";
+            throw std::runtime_error(os.str());
+          }
+        }
       }
     }
 
-    write_register(Register::IDAC0, 0x0);
+    conversion_start = steady_clock::now();
   }
 
-  void select_sensor(const enum Sensor sensor) {
-    write_register(Register::MUX0, channel2mux(sensor));
-    write_register(Register::VBIAS, 0x0);
-    write_register(Register::MUX1, 0x20);
-    write_register(Register::SYS0, 0x70);
-    write_register(Register::IDAC1, channel2idac(sensor));
-    write_register(Register::IDAC0, 0x4);
-    std::this_thread::sleep_for(300ms);
-  }
+  void init() {
+    initialized = false;
+    selected = false;
+    reset();
 
-public:
-  friend std::ostream &operator<<(std::ostream &os, const enum Command cmd) {
-    return os << to_string(cmd);
-  }
+    for (int retries = 50; read_registers()[static_cast<uint8_t>(
+                               Register::IDAC1)] != 0xff;
+         --retries) {
+      if (!retries)
+        throw std::runtime_error("ADS1248 did not come out of reset");
+      qDebug() << "Waiting for reset";
+      std::this_thread::sleep_for(20ms);
+    }
 
-  friend QDebug operator<<(QDebug os, const enum Command cmd) {
-    return os << to_string(cmd);
+    shadow = read_registers();
+    initialized = true;
   }
 
-  friend std::ostream &operator<<(std::ostream &os, const enum Register reg) {
-    return os << to_string(reg);
+  void select(const Sensor sensor) {
+    if (selected && current == sensor)
+      return;
+    selected = false;
+    apply(configuration(shadow, sensor));
+    current = sensor;
+    selected = true;
   }
 
-  friend QDebug operator<<(QDebug os, const enum Register reg) {
-    return os << to_string(reg);
-  }
+  double read_data() {
+    const uint8_t nop[3] = {static_cast<uint8_t>(Command::NOP),
+                            static_cast<uint8_t>(Command::NOP),
+                            static_cast<uint8_t>(Command::NOP)};
+    uint8_t rx[3] = {};
+    device.begin().add(nop, rx, sizeof(nop)).submit();
 
-  Impl()
-      :
-#ifdef BUILD_ON_RASPBERRY
-        reset_pin(::intex::hw::gpio(config::ads1248_reset)),
-#else
-        reset_pin(::intex::hw::debug_gpio(config::ads1248_reset)),
-#endif
-        device(spi::bus(0), config::ads1248) {
-    init();
-  }
+    double rbin = rx[0] * std::pow(2, 16) + rx[1] * std::pow(2, 8) + rx[2];
+    if (rbin > std::pow(2, 23)) {
+      rbin = rbin - std::pow(2, 24);
+    }
 
-  double temperature(const enum Sensor sensor) {
-    init();
-    select_sensor(sensor);
+    // Umrechnung
+    double T = rbin * 2.02097 * std::pow(10, -9);
+    T = T / (0.0005 * 0.385);
+    return T;
+  }
 
-    {
-      /* init measurement */
-      QByteArray tx;
-      QByteArray rx;
+  ads1248_driver(const config::gpio &reset, const config::gpio &drdy,
+                 const config::spi &config)
+      : reset_pin(reset), drdy_pin(drdy), device(spi::bus(0), config),
+        shadow() {}
 
-      tx.append(static_cast<char>(Command::ReadOnce));
-      device.transfer(tx, rx);
-    }
+public:
+  static ads1248_driver &instance();
 
-    std::this_thread::sleep_for(7ms);
-    QByteArray rx;
-    {
-      /* read data */
-      QByteArray tx;
+  /* Force a reset and full reconfiguration on the next read */
+  void reinit() {
+    std::lock_guard<std::mutex> lock(mutex);
+    initialized = false;
+  }
 
-      tx.append(static_cast<char>(Command::NOP));
-      tx.append(static_cast<char>(Command::NOP));
-      tx.append(static_cast<char>(Command::NOP));
-      device.transfer(tx, rx);
+  double temperature(const Sensor sensor) {
+    std::lock_guard<std::mutex> lock(mutex);
+    try {
+      if (!initialized)
+        init();
+      select(sensor);
+      wait_ready();
+      const double T = read_data();
+      select(next(sensor));
+      return T;
+    } catch (...) {
+      initialized = false;
+      throw;
     }
+  }
+};
 
-#if 0
-    uint32_t code = 0;
-    for (int i = 0; i < rx.size(); ++i) {
-      code |=
-          (static_cast<uint32_t>(rx.at(i)) << ((rx.size() - i - 1) * CHAR_BIT));
-    }
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wexit-time-destructors"
+ads1248_driver &ads1248_driver::instance() {
+  static std::unique_ptr<ads1248_driver> instance{
+      new ads1248_driver(config::ads1248_reset, config::ads1248_drdy,
+                         config::ads1248)};
+  return *instance;
+}
+#pragma clang diagnostic pop
 
-    qDebug() << "Temp code:" << code;
-    if (code >= 0x800000) {
-      code |= 0xff000000;
-    }
-    double temp = static_cast<double>(static_cast<int32_t>(code));
+struct TemperatureSensor::Impl {
+  ads1248_driver &driver;
 
-    temp = temp * 2.02097 * 10e-9;
-    temp = temp / (0.0005 * 0.385);
-    return temp;
-#else
-    double rbin = rx[0] * std::pow(2, 16) + rx[1] * std::pow(2, 8) + rx[2];
-    if (rbin > std::pow(2, 23)) {
-      rbin = rbin - std::pow(2, 24);
-    }
+  Impl() : driver(ads1248_driver::instance()) {}
 
-    // Umrechnung
-    double T = rbin * 2.02097 * std::pow(10, -9);
-    T = T / (0.0005 * 0.385);
-    return T;
-#endif
+  double temperature(const enum Sensor sensor) {
+    return driver.temperature(sensor);
   }
 };
 
@@ -1230,366 +1536,176 @@ TemperatureSensor &TemperatureSensor::temperatureSensor() {
 }
 #pragma clang diagnostic pop
 
-#endif
-
+/* Former bring-up interface, sharing the driver with TemperatureSensor */
 struct ADS1248::Impl {
-  GPIO reset_pin;
-  GPIO *cs_pin;
-  spi_device device;
-  config::spi _config;
-
-public:
-  Impl(const config::spi &config, const config::gpio &reset)
-      : reset_pin(::intex::hw::gpio(reset)),
-        device(spi::bus(0), config::ads1248), _config(config) {
-
-    if (config.no_cs) {
-      cs_pin = new GPIO(::intex::hw::gpio(config.cs_pin));
-      cs_pin->set(false);
-    };
-  }
-
-  void reset() {
-    reset_pin.set(true);
-#ifdef SPIDEBUG
-    std::cout << "Reset active (low)" << std::endl;
-    // std::cin.get();
-
-    std::cout << "Reset deactivated (high)" << std::endl;
-#endif
-    reset_pin.set(false);
-    // std::cin.get();
+  using Sensor = TemperatureSensor::Sensor;
+  ads1248_driver &driver;
 
-    uint8_t tx[] = {0x06};
-    uint8_t rx[1];
+  Impl() : driver(ads1248_driver::instance()) {}
 
-    device.transfer(&tx[0], &rx[0], 1);
-    std::this_thread::sleep_for(200ms);
-  }
-
-  void selfOff() { // perform selfoffset calibration
-    uint8_t tx[3] = {0x62};
-    uint8_t rx[3] = {0x0};
-    device.transfer(&tx[0], &rx[0], 1);
-    std::this_thread::sleep_for(5ms);
-  }
-
-  /*return true if device is present, false if communication is not possible*/
-  void _init() {
-    reset();
-    // device.configure();
-    // std::this_thread::sleep_for(5ms);
-
-    bool ADP_ready = false;
-    // hier schicke ich solange die Anfrage ein Register auszulesen 0x02B dessen
-    // Inhalt nach Reset bekannt ist
-    // bis ich das Richtige Ergebnis zurückkriege 0xFF
-
-    uint8_t tx_ready[3] = {0x2B, 0x0, 0x0};
-    uint8_t rx_ready[3] = {0, 0, 0x0};
-
-    while (!ADP_ready) {
-      device.transfer(&tx_ready[0], &rx_ready[0], 3);
-#ifdef SPIDEBUG
-      std::cout << "Lese Register 0x0B -->"
-                << static_cast<unsigned int>(rx_ready[2]) << std::endl;
-#endif
-      if (static_cast<unsigned int>(rx_ready[2]) == 0xFF) {
-        ADP_ready = true;
-#ifdef SPIDEBUG
-        std::cout << "Register 0x0B korrekt ausgelesen" << std::endl;
-#endif
-      }
-    }
-
-    // Dann schreibe ich in Register 0x0A ,0x08 rein um DRDY & DOUT
-    // Funktionalität zu setzen
-    // mit anschließender Kontrolle ob es richtig gesetzt ist
-    uint8_t tx_drdydout_write[3] = {0x4A, 0x0, 0x00};
-    uint8_t rx_drdydout_write[3] = {0, 0, 0x0};
-    uint8_t chip_id;
-
-    // auf reset-werte setzen
-    uint8_t tx_drdydout_rewrite[3] = {0x4A, 0x0, 0x00};
-    device.transfer(&tx_drdydout_rewrite[0], &rx_drdydout_write[0], 3);
-
-    // chip_id auslesen
-    uint8_t tx_drdydout_read[3] = {0x2A, 0x0, 0x00};
-    uint8_t rx_drdydout_read[3] = {0, 0, 0x0};
-    device.transfer(&tx_drdydout_read[0], &rx_drdydout_read[0], 3);
-    chip_id = static_cast<uint8_t>(rx_drdydout_read[2]);
-
-    // solange register beschreiben bis korrekter Wert drinne ist
-    ADP_ready = false;
-    while (!ADP_ready) {
-
-      // schreibe in Register 0x0A
-      device.transfer(&tx_drdydout_write[0], &rx_drdydout_write[0], 3);
-      // lese aus Register 0x0A
-      device.transfer(&tx_drdydout_read[0], &rx_drdydout_read[0], 3);
-#ifdef SPIDEBUG
-      std::cout << "Lese Register 0x0A --> "
-                << static_cast<unsigned int>(rx_drdydout_read[2]) << std::endl;
-#endif
-      if (static_cast<unsigned int>(rx_drdydout_read[2]) - chip_id == 0) {
-        ADP_ready = true;
-#ifdef SPIDEBUG
-        std::cout << "Register 0x0A korrekt ausgelesen" << std::endl;
-#endif
-      }
-    }
-
-    // selfOff();
-  }
-
-  double binToTemp(uint8_t rx[3]) { // rechnet binäres Ergebnis in Temperatur um
-    // zusammenfügen
-    // zweier komplement bilden
-    // Umrechnen über näherungsformel (Cbin*LSB)/(I*TR)
-    // zusammenfügen
-    double rbin = rx[0] * std::pow(2, 16) + rx[1] * std::pow(2, 8) + rx[2];
-    qDebug() << "Temp code T:" << rbin;
-    // zweierkomplement weg rechnen
-    // std::cout<< static_cast<unsigned int>(rx[0])<<static_cast<unsigned
-    // int>(rx[1])<<static_cast<unsigned int>(rx[2])<<std::endl;
-    if (rbin > std::pow(2, 23)) {
-      rbin = rbin - std::pow(2, 23);
-      std::cout << "negativ" << std::endl;
-    }
-
-    // Umrechnung
-    double T = rbin * 2.02097 * std::pow(10, -9);
-    T = T / (0.0005 * 0.385);
-    return T;
-  }
-
-  double binToTemp_intern(uint8_t rx[3]) {
-    double rbin = rx[0] * std::pow(2, 16) + rx[1] * std::pow(2, 8) + rx[2];
-
-    return rbin;
-  }
-
-  int wrReg(uint8_t reg, uint8_t val) {
-    if ((reg > 0xE) || (val > 0xFF)) {
-      std::cout << "#### register or val to high, see IntexHardware::WRREG()"
-                << std::endl;
-      return -1;
-    }
-
-    uint8_t tx[3] = {0x0, 0x0, val};
-    tx[0] = 0x40 + reg;
-    // std::cout<< static_cast<unsigned int>(tx[0])<<"+++"<<static_cast<unsigned
-    // int>(tx[1])<<"+++"<<static_cast<unsigned int>(tx[2])<<std::endl;
-    uint8_t rx[3] = {0, 0, 0};
-    device.transfer(tx, rx, 3);
-    // control if new value in reg
-    uint8_t txc[3] = {0x0, 0x0, 0x0};
-    txc[0] = 0x20 + reg;
-    // std::cout<< static_cast<unsigned
-    // int>(txc[0])<<"+++"<<static_cast<unsigned
-    // int>(txc[1])<<"+++"<<static_cast<unsigned int>(txc[2])<<std::endl;
-    uint8_t rxc[3] = {0x0, 0x0, 0x0};
-    // lese aus
-    std::this_thread::sleep_for(30ms);
-    device.transfer(txc, rxc, 3);
-    // std::cout<< std::hex<<std::hex<<static_cast<unsigned
-    // int>(rxc[2])<<std::endl;
-    uint8_t val_regA = val + 128;
-    if ((reg == 0xA) && (rxc[2] = val_regA)) {
-      return 1;
-    }
-    if (rxc[2] != val) {
-      std::cout << static_cast<unsigned int>(reg) << std::endl;
-      std::cout << "#### Writing to register fails, see IntexHardware::WRREG() "
-                << std::endl;
-      return -1;
-    }
-    return 1;
-  }
   /*sensor_num - starting at sensor 0*/
-  void sensor_modus(uint8_t sensor_num) {
-    // schalte auf pt100 1 um
-    uint32_t error_array[6] = {0, 0, 0, 0, 0, 0};
-    // std::cout<<"##### Start sensor modus #####"<<std::endl;
-    // std::cout<<"##### sensor nummer : "<<std::dec<<static_cast<unsigned
-    // int>(sensor_num)<<std::endl;
-    uint8_t parameter = ((2 * sensor_num) + 1) | (2 * sensor_num) << 3;
-    // std::cout<<"##### first byte = "<<std::hex<<static_cast<unsigned
-    // int>(parameter)<<std::endl;
-
-    // Eingänge für PGA setzen und SPS auf 160
-    while (wrReg(0x0, ((2 * sensor_num) + 1) | (2 * sensor_num) << 3) < 0) {
-      error_array[0]++;
-    }
-    // VBIAS setzen
-    while (wrReg(0x1, 0x00) < 0) {
-      error_array[1]++;
-    }
-    // i=wrReg(0x1,0x0);
-    // internal reference on for IDAC
-    while (wrReg(0x2, 0x20) < 0) {
-      error_array[2]++;
-    }
-    // sys control 0, PGAwert setzen und SPS
-    while (wrReg(0x03, 0x70) < 0) {
-      error_array[3]++;
-    }
-    // IDAC reg1
-    while (wrReg(0x0B, ((2 * sensor_num) + 1) | (2 * sensor_num) << 4) < 0) {
-      error_array[4]++;
-    }
-    // IDAC reg0
-    // while(wrReg(0x0A,0x0C)<0){
-    while (wrReg(0x0A, 0x04) < 0) {
-      error_array[5]++;
-    }
-    // std::cout<<"### ERROR ARRAY-->" <<
-    // error_array[5]<<"---"<<error_array[4]<<"---"<<error_array[3]<<"---"<<error_array[2]<<"---"<<error_array[1]<<"---"<<error_array[0]<<std::endl;
-    // selfOffset calibration
-    std::this_thread::sleep_for(300ms);
-    // see manual page 35 for SPS 40 settling time < 8ms
-    // std::cout<<"##### End sensor modus #####"<<std::endl;
-  }
-
-  void spi_loop() {
-
-    uint16_t modus = 1; // 0 interne Diode, 1 RTD1
-
-    while (modus == 1) {
-
-      uint8_t tx3[1] = {0x12};
-      uint8_t rx3[1] = {0x0};
-      device.transfer(tx3, rx3, 1);
-      std::this_thread::sleep_for(5ms);
-      uint8_t tx4[3] = {0xFF, 0xFF, 0xFF};
-      uint8_t rx4[3] = {0x0, 0x0, 0x0};
-      device.transfer(tx4, rx4, 3);
-      std::cout << "conversion result-->" << static_cast<unsigned int>(rx4[0])
-                << "---" << static_cast<unsigned int>(rx4[1]) << "---"
-                << static_cast<unsigned int>(rx4[2]) << std::endl;
-      double temperature = binToTemp(rx4);
-      std::cout << "temperature -->" << std::dec << temperature << "°C"
-                << std::endl;
-    }
-    ////////############ interne Dioden Messung #############
-
-    // wenn nein schreibe in register
-    uint8_t tx2[3] = {0x42, 0x0, 0x33};
-    uint8_t rx2[3] = {0, 0, 0};
-    device.transfer(tx2, rx2, 3);
-    std::cout << "Auf interne Dioden umgeschalten --> " << std::endl;
-
-    while (modus == 0) {
-      uint8_t tx3[1] = {0x12};
-      uint8_t rx3[1] = {0};
-      device.transfer(tx3, rx3, 1);
-      std::this_thread::sleep_for(5ms);
-      uint8_t tx4[3] = {0xFF, 0xFF, 0xFF};
-      uint8_t rx4[3] = {0, 0, 0};
-      device.transfer(tx4, rx4, 3);
-      std::cout << "interne Diodenmessung" << std::endl;
-      double temperature = binToTemp_intern(rx4);
-      std::cout << "temperature -->" << temperature << "°C, Diode" << std::endl;
+  static Sensor sensor(const uint8_t sensor_num) {
+    switch (sensor_num) {
+    case 0:
+      return Sensor::Atmosphere;
+    case 1:
+      return Sensor::InnerRing;
+    case 2:
+      return Sensor::OuterRing;
+    default:
+      throw std::runtime_error("Invalid ADS1248 sensor " +
+                               std::to_string(sensor_num));
     }
   }
 
-  double messung_extern() {
-    uint8_t tx3[1] = {0x12};
-    uint8_t rx3[1] = {0x0};
-    device.transfer(tx3, rx3, 1);
-    std::this_thread::sleep_for(5ms);
-    uint8_t tx4[3] = {0xFF, 0xFF, 0xFF};
-    uint8_t rx4[3] = {0x0, 0x0, 0x0};
-    device.transfer(tx4, rx4, 3);
-    // std::cout<<"conversion result-->" << static_cast<unsigned
-    // int>(rx4[0])<<"---"<<static_cast<unsigned
-    // int>(rx4[1])<<"---"<<static_cast<unsigned int>(rx4[2])<<std::endl;
-    double temperature = binToTemp(rx4);
-    return temperature;
-  }
-
-  double manual_calibration(
-      uint8_t sensor_select) { // 100 Messungen zur Mittelwertbestimmung
-    double mittelwert;
-    _init();
-    sensor_modus(sensor_select);
-    // for(int i=0;i<20;i++)
-    /*
-        while(1)
-        {
-        mittelwert=messung_extern();
-        std::this_thread::sleep_for(30ms);
-        }
-        return mittelwert;
-    */
-    //    for(int i=0;i<100;i++){
-    mittelwert = messung_extern();
-    //            std::this_thread::sleep_for(200ms);
-
-    //}
-    // std::cout<<"##############################################"<<std::endl;
-    return mittelwert;
+  double selftest(const uint8_t sensor_num) {
+    driver.reinit();
+    return driver.temperature(sensor(sensor_num));
   }
-
-private:
 };
 
-ADS1248::ADS1248(const config::spi &config, const config::gpio &reset) {
-  /*Why can I not use the std::make_unique<Impl> way here?*/
-  d = new Impl(config, reset);
-  d->reset();
-}
+ADS1248::ADS1248() : d(std::make_unique<Impl>()) {}
+ADS1248::~ADS1248() = default;
 
 double ADS1248::selftest(uint8_t sensor_select) {
-  double x = 0;
-  d->_init();
-  return d->manual_calibration(sensor_select);
+  return d->selftest(sensor_select);
 }
 
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wexit-time-destructors"
 ADS1248 &ADS1248::sensor() {
-  static std::unique_ptr<ADS1248> instance{
-      new ADS1248(config::ads1248, config::ads1248_cs)};
+  static std::unique_ptr<ADS1248> instance{new ADS1248()};
   return *instance;
 }
+#pragma clang diagnostic pop
+
+/* Honeywell HSC transfer function: 10% to 90% of 2^14 counts span the
+ * pressure range. Result in bar. */
+struct hsc_range {
+  double pmin;
+  double pmax;
+  double to_bar;
+};
+
+static constexpr hsc_range hsc_150psi{0.0, 150.0, 1.0 / 14.504};
+static constexpr hsc_range hsc_1600mbar{0.0, 1.6, 1.0};
+
+template <const hsc_range &range>
+static constexpr double hsc_pressure(const uint16_t counts) {
+  return ((static_cast<double>(counts) - 1638.4) * (range.pmax - range.pmin) /
+              13107.2 +
+          range.pmin) *
+         range.to_bar;
+}
 
 struct PressureSensor::Impl {
+  enum status : uint8_t { normal = 0, command = 1, stale = 2, diagnostic = 3 };
+
   spi_device device;
   const config::spi &config;
-  const bool high_pressure;
-
-  Impl(spi &bus, const config::spi &config_, const bool high_pressure_)
-      : device(bus, config_), config(config_), high_pressure(high_pressure_) {}
-  double pressure() {
-    double pressure = 0.0;
-    for (int i = 0; i < 10; ++i) {
-      QByteArray tx;
-      QByteArray rx;
-      tx.append(static_cast<char>(0));
-      tx.append(static_cast<char>(0));
-      tx.append(static_cast<char>(0));
-      device.transfer(tx, rx);
-
-      uint16_t status = (rx[0] >> 6) & 3;
-      if (status) {
+  double (*const convert)(uint16_t);
+
+  std::mutex mutex;
+  Filter filter{10, true, 1.0};
+  bool have_average = false;
+  double average = 0.0;
+
+  Impl(spi &bus, const config::spi &config_, const bool high_pressure)
+      : device(bus, config_), config(config_),
+        convert(high_pressure ? hsc_pressure<hsc_150psi>
+                              : hsc_pressure<hsc_1600mbar>) {}
+
+  void setFilter(const Filter &filter_) {
+    if (filter_.samples == 0 || filter_.samples > max_samples)
+      throw std::runtime_error("Invalid number of pressure samples " +
+                               std::to_string(filter_.samples));
+    if (!(filter_.alpha > 0.0 && filter_.alpha <= 1.0))
+      throw std::runtime_error("Invalid pressure filter weight " +
+                               std::to_string(filter_.alpha));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    filter = filter_;
+    have_average = false;
+  }
+
+  /* Drop reads further than 3 scaled MADs from the median */
+  static size_t reject_outliers(double *values, const size_t count) {
+    std::array<double, max_samples> sorted;
+    std::copy(values, values + count, sorted.begin());
+    const auto mid = sorted.begin() + count / 2;
+    std::nth_element(sorted.begin(), mid, sorted.begin() + count);
+    const double median = *mid;
+
+    for (size_t i = 0; i < count; ++i)
+      sorted[i] = std::abs(values[i] - median);
+    std::nth_element(sorted.begin(), mid, sorted.begin() + count);
+    const double limit = 3.0 * 1.4826 * *mid;
+
+    if (limit <= 0.0)
+      return count;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i) {
+      if (std::abs(values[i] - median) <= limit)
+        values[kept++] = values[i];
+    }
+    return kept;
+  }
+
+  Measurement measure() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::array<double, max_samples> values;
+    size_t count = 0;
+
+    for (unsigned i = 0; i < filter.samples; ++i) {
+      uint8_t tx[3] = {0, 0, 0};
+      uint8_t rx[3] = {0, 0, 0};
+      device.transfer(tx, rx, sizeof(tx));
+
+      const uint8_t status = (rx[0] >> 6) & 3;
+      /* no new conversion since the last read */
+      if (status == stale)
+        continue;
+      if (status != normal) {
         throw std::runtime_error("Error reading pressure sensor: " +
                                  std::to_string(status));
       }
 
-      const uint32_t bin = (static_cast<uint16_t>(rx.at(0) & 0x3f) << 8) |
-                           static_cast<uint16_t>(rx.at(1));
-      pressure = static_cast<double>(bin) - 1638.4;
-      if (high_pressure) {
-        pressure = pressure * 150.0 / 13107.2;
-        pressure = pressure / 14.504;
-      } else {
-        pressure = pressure * 1.6 / 13107.2;
-      }
+      const uint16_t bin = static_cast<uint16_t>((rx[0] & 0x3f) << 8) | rx[1];
+      values[count++] = convert(bin);
 #if 0
       double t1 = double(uint16_t(rx[2]) << 3);
       std::cout << "Temperatur :  " << bin_to_temp(t1) << std::endl;
 #endif
     }
-    return pressure;
+
+    if (count == 0)
+      throw std::runtime_error("No fresh pressure sample");
+
+    if (filter.reject_outliers && count > 2)
+      count = reject_outliers(values.data(), count);
+
+    Measurement m{0.0, values[0], values[0], 0.0};
+    double mean = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+      mean += values[i];
+      m.min = std::min(m.min, values[i]);
+      m.max = std::max(m.max, values[i]);
+    }
+    mean /= static_cast<double>(count);
+
+    double variance = 0.0;
+    for (size_t i = 0; i < count; ++i)
+      variance += (values[i] - mean) * (values[i] - mean);
+    if (count > 1)
+      m.stddev = std::sqrt(variance / static_cast<double>(count - 1));
+
+    average = have_average
+                  ? filter.alpha * mean + (1.0 - filter.alpha) * average
+                  : mean;
+    have_average = true;
+    m.value = average;
+    return m;
   }
 };
 
@@ -1597,7 +1713,9 @@ PressureSensor::PressureSensor(spi &bus, const config::spi &config,
                                const bool high_pressure)
     : d(std::make_unique<Impl>(bus, config, high_pressure)) {}
 
-double PressureSensor::pressure() { return d->pressure(); }
+PressureSensor::Measurement PressureSensor::measure() { return d->measure(); }
+double PressureSensor::pressure() { return d->measure().value; }
+void PressureSensor::setFilter(const Filter &filter) { d->setFilter(filter); }
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wexit-time-destructors"
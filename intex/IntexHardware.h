@@ -27,14 +27,16 @@ class Heater {
   class Impl;
   std::unique_ptr<Impl> d;
 
-  /* add timeout on temperatureChanged */
-  Heater(const config::gpio &config, int low, int high);
+  Heater(const config::gpio &config);
 
 public:
   ~Heater();
 
+  /* Enables heating at the duty set last; thread-safe */
   void set(const bool on);
-  void temperatureChanged(int temperature);
+  bool enabled() const;
+  /* Share of every PWM period the heater is on, 0 to 1; thread-safe */
+  void setDuty(const float duty);
 
   static Heater &innerHeater();
   static Heater &outerHeater();
@@ -105,12 +107,13 @@ public:
 };
 
 class ADS1248 {
-
   struct Impl;
-  Impl *d;
+  std::unique_ptr<Impl> d;
+
+  ADS1248();
 
 public:
-  ADS1248(const config::spi &config, const config::gpio &reset);
+  ~ADS1248();
   double selftest(uint8_t sensor_select);
   static ADS1248 &sensor();
 };
@@ -124,8 +127,27 @@ class PressureSensor {
   PressureSensor(spi &bus, const config::spi &config, const bool high = false);
 
 public:
+  static constexpr unsigned max_samples = 32;
+
+  /* Oversampling applied to every reading */
+  struct Filter {
+    unsigned samples;     /* SPI reads averaged, at most max_samples */
+    bool reject_outliers; /* drop reads far off the median */
+    double alpha;         /* EMA weight of a new reading, 1 disables it */
+  };
+
+  /* Filtered value and spread of the reads it was computed from */
+  struct Measurement {
+    double value;
+    double min;
+    double max;
+    double stddev;
+  };
+
+  Measurement measure();
   double pressure();
   double temperature();
+  void setFilter(const Filter &filter);
 
   static PressureSensor &atmosphere();
   static PressureSensor &antenna();
@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+
+#include "RecordingManager.h"
+
+namespace intex {
+
+namespace {
+struct Segment {
+  QString path;
+  RecordingManager::Priority priority;
+};
+
+struct Stream {
+  QString current;
+  RecordingManager::Priority priority = RecordingManager::Priority::Low;
+  QString prepared; /* created by the storage thread */
+  bool scanned = false;
+};
+}
+
+/* Creates an empty segment with its space reserved behind the end of the
+ * file; the appending filesink fills it without fragmenting it */
+static void preallocate(const QString &path, const uint64_t size) {
+  const auto name = QFile::encodeName(path);
+  const int fd = ::open(name.constData(),
+                        O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    qCritical() << "Could not create" << path << ":" << strerror(errno);
+    return;
+  }
+#ifdef BUILD_ON_RASPBERRY
+  /* not every file system supports it; the segment grows as usual then */
+  if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size)) < 0)
+    qDebug() << "Could not preallocate" << path << ":" << strerror(errno);
+#else
+  static_cast<void>(size);
+#endif
+  ::close(fd);
+}
+
+/* Frees the space reserved behind the end of a closed segment. Punching a
+ * hole is clipped at the end of the file, truncating to its own size drops
+ * the blocks behind it. */
+static void release(const QString &path, const uint64_t size) {
+#ifdef BUILD_ON_RASPBERRY
+  const auto name = QFile::encodeName(path);
+  const int fd = ::open(name.constData(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && static_cast<uint64_t>(st.st_size) < size) {
+    if (ftruncate(fd, st.st_size) < 0) {
+      qDebug() << "Could not release preallocation of" << path << ":"
+               << strerror(errno);
+    } else if (fstat(fd, &st) == 0) {
+      const auto used = static_cast<uint64_t>(st.st_blocks) * 512;
+      const auto length = static_cast<uint64_t>(st.st_size);
+      if (used >= length + 2 * static_cast<uint64_t>(st.st_blksize))
+        qDebug() << "Preallocation of" << path << "kept:" << used
+                 << "bytes used for" << length;
+    }
+  }
+  ::close(fd);
+#else
+  static_cast<void>(path);
+  static_cast<void>(size);
+#endif
+}
+
+static uint64_t free_space(const QString &directory) {
+  struct statvfs fs;
+  if (statvfs(QFile::encodeName(directory).constData(), &fs) < 0)
+    return std::numeric_limits<uint64_t>::max();
+  return static_cast<uint64_t>(fs.f_bavail) * fs.f_frsize;
+}
+
+static uint64_t disk_usage(const QString &path) {
+  struct stat st;
+  if (stat(QFile::encodeName(path).constData(), &st) < 0)
+    return 0;
+  return static_cast<uint64_t>(st.st_blocks) * 512;
+}
+
+struct RecordingManager::Impl {
+  const Policy policy;
+  std::atomic<Priority> priority{Priority::Low};
+
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  bool pending = false;
+  bool stopping = false;
+  std::map<Subsystem, Stream> streams;
+  std::vector<Segment> closing;
+
+  /* owned by the storage thread; oldest first */
+  std::deque<Segment> closed;
+  QString directory;
+
+  std::thread thread;
+
+  explicit Impl(const Policy &policy_) : policy(policy_) {
+    thread = std::thread([this] { run(); });
+  }
+
+  ~Impl() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto &entry : streams) {
+        auto &stream = entry.second;
+        if (!stream.current.isEmpty())
+          closing.push_back({stream.current, stream.priority});
+      }
+      stopping = true;
+    }
+    wakeup.notify_all();
+    thread.join();
+  }
+
+  /* Segments left by earlier runs. Their priority is unknown, so they are
+   * kept as long as segments known to be of low priority exist. */
+  void scan(const enum Subsystem subsys, const QString &current) {
+    const QFileInfo info(current);
+    directory = info.absolutePath();
+    const QDir dir(directory);
+    std::deque<Segment> found;
+    for (const auto &entry :
+         dir.entryList(QStringList(deviceName(subsys) + "-*"), QDir::Files,
+                       QDir::Name)) {
+      if (entry != info.fileName())
+        found.push_back({dir.filePath(entry), Priority::High});
+    }
+    closed.insert(closed.begin(), found.begin(), found.end());
+  }
+
+  void prepare(const std::vector<Subsystem> &unprepared,
+               std::vector<std::pair<Subsystem, QString>> &ready) {
+    for (const auto subsys : unprepared) {
+      try {
+        const auto path = storageLocation(subsys);
+        preallocate(path, policy.preallocate);
+        ready.emplace_back(subsys, path);
+      } catch (const std::exception &e) {
+        /* retried with the next segment */
+        qCritical() << e.what();
+      }
+    }
+  }
+
+  /* Deletes closed segments until the file system has room for the reserve
+   * and the segments about to be preallocated; the space of those prepared
+   * earlier is already taken */
+  void enforce_budget(const size_t unprepared) {
+    if (directory.isEmpty())
+      return;
+    const auto required = policy.reserve + policy.preallocate * unprepared;
+    auto available = free_space(directory);
+    while (available < required && !closed.empty()) {
+      auto victim = std::find_if(closed.begin(), closed.end(),
+                                 [](const Segment &segment) {
+                                   return segment.priority == Priority::Low;
+                                 });
+      if (victim == closed.end())
+        victim = closed.begin();
+
+      const auto size = disk_usage(victim->path);
+      if (QFile::remove(victim->path)) {
+        qWarning() << "Storage low, deleted" << victim->path;
+        available += size;
+      } else {
+        qCritical() << "Could not delete" << victim->path;
+      }
+      closed.erase(victim);
+    }
+    if (available < required)
+      qCritical() << "Storage low, no recording left to delete";
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      wakeup.wait(lock, [this] { return pending || stopping; });
+      pending = false;
+
+      auto segments = std::move(closing);
+      closing.clear();
+      std::vector<std::pair<Subsystem, QString>> scans;
+      std::vector<Subsystem> unprepared;
+      for (auto &entry : streams) {
+        auto &stream = entry.second;
+        if (!stream.scanned && !stream.current.isEmpty()) {
+          scans.emplace_back(entry.first, stream.current);
+          stream.scanned = true;
+        }
+        if (stream.prepared.isEmpty())
+          unprepared.push_back(entry.first);
+      }
+      const bool stop = stopping;
+      lock.unlock();
+
+      for (const auto &segment : segments)
+        release(segment.path, policy.preallocate);
+      closed.insert(closed.end(), segments.begin(), segments.end());
+
+      std::vector<std::pair<Subsystem, QString>> ready;
+      if (!stop) {
+        for (const auto &entry : scans)
+          scan(entry.first, entry.second);
+        enforce_budget(unprepared.size());
+        prepare(unprepared, ready);
+      }
+
+      lock.lock();
+      if (stop) {
+        /* prepared segments are still empty */
+        for (auto &entry : streams) {
+          if (!entry.second.prepared.isEmpty())
+            QFile::remove(entry.second.prepared);
+        }
+        break;
+      }
+      for (auto &entry : ready)
+        streams[entry.first].prepared = std::move(entry.second);
+    }
+  }
+};
+
+RecordingManager::RecordingManager(const Policy &policy)
+    : d(std::make_unique<Impl>(policy)) {}
+
+RecordingManager::~RecordingManager() = default;
+
+const RecordingManager::Policy &RecordingManager::policy() const {
+  return d->policy;
+}
+
+void RecordingManager::setPriority(const Priority priority) {
+  d->priority = priority;
+}
+
+QString RecordingManager::nextSegment(const enum Subsystem subsys) {
+  QString path;
+  {
+    std::lock_guard<std::mutex> lock(d->mutex);
+    auto &stream = d->streams[subsys];
+    if (!stream.current.isEmpty())
+      d->closing.push_back({stream.current, stream.priority});
+    stream.current.clear();
+    std::swap(path, stream.prepared);
+  }
+
+  /* the storage thread has not caught up, or this is the first segment */
+  if (path.isEmpty())
+    path = storageLocation(subsys);
+
+  {
+    std::lock_guard<std::mutex> lock(d->mutex);
+    auto &stream = d->streams[subsys];
+    stream.current = path;
+    stream.priority = d->priority;
+    d->pending = true;
+  }
+  d->wakeup.notify_one();
+  qDebug() << "Recording" << deviceName(subsys) << "to" << path;
+  return path;
+}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+
+#include <cstdint>
+
+#include <QString>
+
+#include "intex.h"
+
+namespace intex {
+
+/* Segment files of the camera recordings. A storage thread creates and
+ * preallocates the next segment of every stream ahead of time, releases the
+ * unused preallocation of closed segments and keeps a free-space budget by
+ * deleting closed segments, the oldest low-priority ones first. The streaming
+ * threads never wait for the file system. All recordings are expected on one
+ * file system.
+ */
+class RecordingManager {
+  struct Impl;
+  std::unique_ptr<Impl> d;
+
+public:
+  enum class Priority : uint8_t { Low, High };
+
+  struct Policy {
+    std::chrono::seconds duration; /* cut at the first keyframe after this */
+    uint64_t bytes;                /* segment size limit, 0 for none */
+    uint64_t preallocate;          /* space reserved for a new segment */
+    uint64_t reserve;              /* free space kept on the file system */
+  };
+
+  explicit RecordingManager(const Policy &policy);
+  /* Releases the preallocation of the current segments; destroy after the
+   * pipelines writing them */
+  ~RecordingManager();
+  RecordingManager(const RecordingManager &) = delete;
+  RecordingManager &operator=(const RecordingManager &) = delete;
+
+  const Policy &policy() const;
+  /* Priority of the segments started from now on */
+  void setPriority(const Priority priority);
+  /* Thread-safe. Closes the current segment of subsys and returns the file
+   * of the next one. */
+  QString nextSegment(const enum Subsystem subsys);
+};
+}
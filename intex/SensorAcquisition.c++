@@ -0,0 +1,391 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstring>
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QRegularExpression>
+#include <QTextStream>
+
+#include "SensorAcquisition.h"
+#include "IntexHardware.h"
+#include "VnaDriver.h"
+#include "snapshot.h"
+
+using namespace std::literals::chrono_literals;
+using namespace std::chrono;
+
+namespace intex {
+
+static float cpu_temperature() {
+  QFile file("/sys/class/thermal/thermal_zone0/temp");
+  int temperature;
+
+  if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+    QTextStream in(&file);
+    in >> temperature;
+
+    return static_cast<float>(temperature) / 1000.0f;
+  }
+
+  throw std::runtime_error(
+      qPrintable("Could not open file " + file.fileName()));
+}
+
+static double hub_temperature() {
+  QRegularExpression temp_pattern("t=(\\d+)");
+  QDir sysfs("/sys/bus/w1/devices");
+  for (const auto &entry :
+       sysfs.entryList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::System)) {
+    if (!sysfs.cd(entry)) {
+      qCritical() << "Could not enter directory" << entry;
+      continue;
+    }
+
+    QFile data(sysfs.absoluteFilePath("w1_slave"));
+    if (!data.open(QIODevice::ReadOnly)) {
+      qCritical() << "Could not open file" << data.fileName() << "for reading";
+      sysfs.cdUp();
+      continue;
+    }
+
+    for (; !data.atEnd();) {
+      const QString line{data.readLine()};
+      auto match = temp_pattern.match(line);
+      if (match.hasMatch()) {
+        QString temp = match.captured(match.lastCapturedIndex());
+        return temp.toDouble() / 1000.0;
+      }
+    }
+    sysfs.cdUp();
+  }
+
+  throw std::runtime_error("DS18S20 not found.");
+}
+
+static Sample make_error(const char *reason,
+                         const Fault fault = Fault::ReadFailed) {
+  Sample sample;
+  sample.timestamp = system_clock::now().time_since_epoch().count();
+  sample.value = sample.min = sample.max = sample.stddev = 0.0;
+  sample.valid = false;
+  sample.fault = fault;
+  strncpy(sample.error, reason, sizeof(sample.error) - 1);
+  sample.error[sizeof(sample.error) - 1] = '\0';
+  return sample;
+}
+
+static Sample make_sample(const double value) {
+  Sample sample;
+  sample.timestamp = system_clock::now().time_since_epoch().count();
+  sample.value = sample.min = sample.max = value;
+  sample.stddev = 0.0;
+  sample.valid = true;
+  sample.fault = Fault::None;
+  sample.error[0] = '\0';
+  return sample;
+}
+
+static Sample make_sample(const hw::PressureSensor::Measurement &measurement) {
+  Sample sample = make_sample(measurement.value);
+  sample.min = measurement.min;
+  sample.max = measurement.max;
+  sample.stddev = measurement.stddev;
+  return sample;
+}
+
+/* Latest sample of a channel for readers that only want the current value,
+ * plus a bounded backlog of every sample for batched telemetry. */
+class ChannelStore {
+  Snapshot<Sample> latest;
+  std::mutex mutex;
+  std::array<Sample, SensorAcquisition::backlog_depth> backlog;
+  size_t first = 0;
+  size_t count = 0;
+
+public:
+  void reset(const Sample &sample) { latest.store(sample); }
+
+  void store(const Sample &sample) {
+    latest.store(sample);
+    std::lock_guard<std::mutex> lock(mutex);
+    backlog[(first + count) % backlog.size()] = sample;
+    if (count < backlog.size())
+      ++count;
+    else
+      first = (first + 1) % backlog.size();
+  }
+
+  Sample load() const { return latest.load(); }
+
+  size_t drain(Sample *out, const size_t max) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const size_t n = std::min(max, count);
+    for (size_t i = 0; i < n; ++i)
+      out[i] = backlog[(first + i) % backlog.size()];
+    first = (first + n) % backlog.size();
+    count -= n;
+    return n;
+  }
+};
+
+using Snapshots = std::array<ChannelStore, channel_count>;
+
+/* One thread per bus. Transactions on a bus are serialized by construction,
+ * channels on different buses are sampled concurrently. The ADS1248 waits
+ * for its conversions on a thread of its own; the SPI bus serializes its
+ * transfers with those of the pressure sensors. */
+class BusWorker {
+  struct Task {
+    Channel channel;
+    std::function<Sample(void)> sample;
+    milliseconds period;
+    steady_clock::time_point due;
+    std::string last_error;
+  };
+
+  const char *name;
+  Snapshots &snapshots;
+  std::vector<Task> tasks;
+
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  bool stopping = false;
+  bool suspended = false;
+  /* device settings, applied between two samples */
+  std::vector<std::function<void()>> changes;
+  /* held while a bus transaction is in progress */
+  std::mutex busy;
+  std::thread thread;
+
+  void run() {
+    std::vector<size_t> due;
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (!stopping) {
+      const auto now = steady_clock::now();
+      auto next = now + 1h;
+      due.clear();
+
+      for (size_t i = 0; i < tasks.size(); ++i) {
+        if (tasks[i].due <= now) {
+          due.push_back(i);
+          tasks[i].due = now + tasks[i].period;
+        }
+        next = std::min(next, tasks[i].due);
+      }
+
+      if (!suspended && (!due.empty() || !changes.empty())) {
+        std::lock_guard<std::mutex> transaction(busy);
+        auto pending = std::move(changes);
+        changes.clear();
+        lock.unlock();
+        for (const auto &change : pending) {
+          try {
+            change();
+          } catch (const std::exception &e) {
+            qCritical() << "Configuring" << name << "sensors failed:"
+                        << e.what();
+          }
+        }
+        for (const auto i : due) {
+          auto &snapshot = snapshots[static_cast<size_t>(tasks[i].channel)];
+          try {
+            snapshot.store(tasks[i].sample());
+            tasks[i].last_error.clear();
+          } catch (const std::exception &e) {
+            snapshot.store(make_error(e.what()));
+            /* the downlink only carries an error code, log the reason once */
+            if (tasks[i].last_error != e.what()) {
+              tasks[i].last_error = e.what();
+              qCritical() << "Sampling" << name << "channel"
+                          << static_cast<int>(tasks[i].channel)
+                          << "failed:" << e.what();
+            }
+          }
+        }
+        lock.lock();
+        continue;
+      }
+
+      wakeup.wait_until(lock, next);
+    }
+  }
+
+public:
+  BusWorker(const char *name_, Snapshots &snapshots_)
+      : name(name_), snapshots(snapshots_) {}
+  BusWorker(const BusWorker &) = delete;
+  BusWorker &operator=(const BusWorker &) = delete;
+
+  ~BusWorker() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wakeup.notify_all();
+    if (thread.joinable())
+      thread.join();
+  }
+
+  template <typename Callable>
+  void add(const Channel channel, Callable &&sample,
+           const milliseconds period) {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push_back(Task{channel,
+                         [sample = std::forward<Callable>(sample)] {
+                           return make_sample(sample());
+                         },
+                         period, steady_clock::now(), std::string()});
+  }
+
+  void setPeriod(const Channel channel, const milliseconds period) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto &task : tasks) {
+        if (task.channel != channel)
+          continue;
+        /* pull the next sample in if the new period is shorter */
+        task.due = std::min(task.due, steady_clock::now() + period);
+        task.period = period;
+      }
+    }
+    wakeup.notify_all();
+  }
+
+  void configure(std::function<void()> change) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      changes.push_back(std::move(change));
+    }
+    wakeup.notify_all();
+  }
+
+  void suspend(const bool suspend) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      suspended = suspend;
+    }
+    wakeup.notify_all();
+    /* wait for an ongoing transaction to finish */
+    std::lock_guard<std::mutex> transaction(busy);
+  }
+
+  void start() {
+    qDebug() << "Starting" << name << "acquisition worker";
+    thread = std::thread([this] { run(); });
+  }
+};
+
+struct SensorAcquisition::Impl {
+  Snapshots snapshots;
+  BusWorker spi;
+  BusWorker adc; /* ADS1248 on the SPI bus */
+  BusWorker serial;
+  BusWorker onewire;
+  BusWorker sysfs;
+
+  explicit Impl(VnaDriver &vna)
+      : spi("SPI", snapshots), adc("ADS1248", snapshots),
+        serial("serial", snapshots), onewire("1-Wire", snapshots),
+        sysfs("sysfs", snapshots) {
+    for (auto &snapshot : snapshots)
+      snapshot.reset(make_error("No sample acquired yet", Fault::NotSampled));
+
+    spi.add(Channel::TankPressure,
+            [] { return hw::PressureSensor::tank().measure(); }, 1s);
+    spi.add(Channel::AntennaPressure,
+            [] { return hw::PressureSensor::antenna().measure(); }, 1s);
+    spi.add(Channel::AtmosphericPressure,
+            [] { return hw::PressureSensor::atmosphere().measure(); }, 1s);
+#ifdef BUILD_ON_RASPBERRY
+    using Sensor = hw::TemperatureSensor::Sensor;
+    adc.add(Channel::AntennaInnerTemperature,
+            [] {
+              return hw::TemperatureSensor::temperatureSensor().temperature(
+                  Sensor::InnerRing);
+            },
+            1s);
+    adc.add(Channel::AntennaOuterTemperature,
+            [] {
+              return hw::TemperatureSensor::temperatureSensor().temperature(
+                  Sensor::OuterRing);
+            },
+            1s);
+    adc.add(Channel::AtmosphereTemperature,
+            [] {
+              return hw::TemperatureSensor::temperatureSensor().temperature(
+                  Sensor::Atmosphere);
+            },
+            1s);
+#endif
+    serial.add(Channel::VnaTemperature, [&vna] { return vna.temperature(); },
+               5s);
+    onewire.add(Channel::BoxTemperature, hub_temperature, 5s);
+    sysfs.add(Channel::CpuTemperature, cpu_temperature, 1s);
+
+    spi.start();
+#ifdef BUILD_ON_RASPBERRY
+    adc.start();
+#endif
+    serial.start();
+    onewire.start();
+    sysfs.start();
+  }
+
+  BusWorker &worker(const Bus bus) {
+    switch (bus) {
+    case Bus::SPI:
+      return spi;
+    case Bus::Serial:
+      return serial;
+    case Bus::OneWire:
+      return onewire;
+    case Bus::Sysfs:
+      return sysfs;
+    }
+  }
+};
+
+SensorAcquisition::SensorAcquisition(VnaDriver &vna)
+    : d(std::make_unique<Impl>(vna)) {}
+SensorAcquisition::~SensorAcquisition() = default;
+
+Sample SensorAcquisition::latest(const Channel channel) const {
+  return d->snapshots[static_cast<size_t>(channel)].load();
+}
+
+size_t SensorAcquisition::drain(const Channel channel, Sample *samples,
+                                const size_t max) {
+  return d->snapshots[static_cast<size_t>(channel)].drain(samples, max);
+}
+
+void SensorAcquisition::setPeriod(const Channel channel,
+                                  const milliseconds period) {
+  for (auto bus : {Bus::SPI, Bus::Serial, Bus::OneWire, Bus::Sysfs}) {
+    d->worker(bus).setPeriod(channel, period);
+  }
+  d->adc.setPeriod(channel, period);
+}
+
+void SensorAcquisition::configure(const Bus bus,
+                                  std::function<void()> change) {
+  d->worker(bus).configure(std::move(change));
+}
+
+void SensorAcquisition::suspend(const Bus bus, const bool suspended) {
+  d->worker(bus).suspend(suspended);
+  if (bus == Bus::SPI)
+    d->adc.suspend(suspended);
+}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace intex {
+
+class VnaDriver;
+
+enum class Channel : uint8_t {
+  CpuTemperature,
+  VnaTemperature,
+  BoxTemperature,
+  AntennaInnerTemperature,
+  AntennaOuterTemperature,
+  AtmosphereTemperature,
+  TankPressure,
+  AntennaPressure,
+  AtmosphericPressure,
+};
+static constexpr size_t channel_count = 9;
+
+enum class Fault : uint8_t { None, NotSampled, Busy, ReadFailed };
+
+/* Latest value of one channel. Trivially copyable, so it can be published
+ * through a Snapshot. min/max/stddev describe the oversampled reads behind
+ * value; for single-read channels they equal value and 0. */
+struct Sample {
+  int64_t timestamp;
+  double value;
+  double min;
+  double max;
+  double stddev;
+  bool valid;
+  Fault fault;
+  char error[96];
+};
+
+/* Samples every sensor on a dedicated worker thread per bus, so that slow
+ * bus transactions never run on the Qt event loop. Readers only copy the
+ * most recent Sample of a channel.
+ */
+class SensorAcquisition {
+  struct Impl;
+  std::unique_ptr<Impl> d;
+
+public:
+  enum class Bus : uint8_t { SPI, Serial, OneWire, Sysfs };
+  static constexpr size_t backlog_depth = 128;
+
+  /* vna reads the VNA temperature and must outlive the acquisition */
+  explicit SensorAcquisition(VnaDriver &vna);
+  ~SensorAcquisition();
+  SensorAcquisition(const SensorAcquisition &) = delete;
+  SensorAcquisition &operator=(const SensorAcquisition &) = delete;
+
+  Sample latest(const Channel channel) const;
+  /* Move up to max samples taken since the last call into samples, oldest
+   * first. Returns the number of samples. At most backlog_depth samples are
+   * kept per channel; older ones are dropped. */
+  size_t drain(const Channel channel, Sample *samples, const size_t max);
+  void setPeriod(const Channel channel, const std::chrono::milliseconds period);
+  /* Run change on the bus's worker before its next sample, so settings of
+   * the devices on it never wait for a transaction. Returns at once; a
+   * change that throws is logged. */
+  void configure(const Bus bus, std::function<void()> change);
+  /* Stop sampling a bus, e.g. while another process owns the device. Returns
+   * after an ongoing transaction on that bus has finished. */
+  void suspend(const Bus bus, const bool suspended);
+};
+}
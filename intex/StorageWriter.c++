@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <QDebug>
+#include <QString>
+
+#include "StorageWriter.h"
+
+using namespace std::chrono;
+
+namespace intex {
+
+struct StorageWriter::Impl {
+  const enum Subsystem subsys;
+  const std::string header;
+  const milliseconds sync_interval;
+
+  /* Ring of records, each stored as a uint32_t length and its bytes */
+  std::vector<char> ring;
+  size_t head = 0;
+  size_t used = 0;
+  std::atomic<uint64_t> dropped{0};
+
+  mutable std::mutex mutex;
+  std::condition_variable wakeup;
+  bool stopping = false;
+  std::vector<std::string> paths;
+
+  /* owned by the storage thread */
+  int fd = -1;
+  bool dirty = false;
+  bool open_failed = false;
+
+  std::thread thread;
+
+  Impl(const enum Subsystem subsys_, std::string header_,
+       const milliseconds sync_interval_, const size_t capacity)
+      : subsys(subsys_), header(std::move(header_)),
+        sync_interval(sync_interval_), ring(capacity) {
+    thread = std::thread([this] { run(); });
+  }
+
+  ~Impl() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wakeup.notify_all();
+    thread.join();
+    close_file();
+  }
+
+  void copy_in(const void *data, const size_t size) {
+    const auto tail = (head + used) % ring.size();
+    const auto first = std::min(size, ring.size() - tail);
+    memcpy(&ring[tail], data, first);
+    memcpy(&ring[0], static_cast<const char *>(data) + first, size - first);
+    used += size;
+  }
+
+  void copy_out(void *data, const size_t size) {
+    const auto first = std::min(size, ring.size() - head);
+    memcpy(data, &ring[head], first);
+    memcpy(static_cast<char *>(data) + first, &ring[0], size - first);
+    head = (head + size) % ring.size();
+    used -= size;
+  }
+
+  bool push(const void *data, const size_t size) {
+    const uint32_t length = static_cast<uint32_t>(size);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (ring.size() - used < sizeof(length) + size) {
+        ++dropped;
+        return false;
+      }
+      copy_in(&length, sizeof(length));
+      copy_in(data, size);
+    }
+    wakeup.notify_one();
+    return true;
+  }
+
+  void pop(std::vector<char> &record) {
+    uint32_t length;
+    copy_out(&length, sizeof(length));
+    record.resize(length);
+    copy_out(record.data(), length);
+  }
+
+  void close_file() {
+    if (fd < 0)
+      return;
+    if (dirty)
+      sync();
+    ::close(fd);
+    fd = -1;
+  }
+
+  bool open_file() {
+    std::string path;
+    try {
+      path = storageLocation(subsys).toStdString();
+      fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND |
+                                    O_CLOEXEC,
+                  0644);
+      if (fd < 0) {
+        throw std::runtime_error("Could not open file " + path + ": " +
+                                 strerror(errno));
+      }
+    } catch (const std::exception &e) {
+      /* log once, retry with the next record */
+      if (!open_failed)
+        qCritical() << e.what();
+      open_failed = true;
+      return false;
+    }
+
+    open_failed = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      paths.push_back(path);
+    }
+    if (!header.empty() && !write_all(header.data(), header.size())) {
+      ::close(fd);
+      fd = -1;
+      return false;
+    }
+    return true;
+  }
+
+  bool write_all(const char *data, size_t size) {
+    while (size > 0) {
+      const auto ret = ::write(fd, data, size);
+      if (ret < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      data += ret;
+      size -= static_cast<size_t>(ret);
+    }
+    dirty = true;
+    return true;
+  }
+
+  void store(const std::vector<char> &record) {
+    for (int attempt = 0; attempt < 2; ++attempt) {
+      if (fd < 0 && !open_file())
+        return;
+      if (write_all(record.data(), record.size()))
+        return;
+
+      qCritical() << "Writing" << deviceName(subsys) << "record failed:"
+                  << strerror(errno) << "Opening new file.";
+      /* the torn record is detected when the file is read back */
+      ::close(fd);
+      fd = -1;
+      dirty = false;
+    }
+  }
+
+  void sync() {
+    if (fdatasync(fd) < 0) {
+      qCritical() << "Syncing" << deviceName(subsys)
+                  << "file failed:" << strerror(errno);
+    }
+    /* written data is not read back; keep the page cache small */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    dirty = false;
+  }
+
+  void run() {
+    std::vector<char> record;
+    auto next_sync = steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;) {
+      if (used == 0 && !stopping) {
+        if (dirty)
+          wakeup.wait_until(lock, next_sync);
+        else
+          wakeup.wait(lock);
+      }
+
+      const bool was_dirty = dirty;
+      while (used > 0) {
+        pop(record);
+        lock.unlock();
+        store(record);
+        lock.lock();
+      }
+
+      const auto now = steady_clock::now();
+      /* the first write after a sync starts a new group */
+      if (!was_dirty && dirty)
+        next_sync = now + sync_interval;
+
+      if (dirty && (now >= next_sync || stopping)) {
+        lock.unlock();
+        sync();
+        lock.lock();
+      }
+
+      if (stopping && used == 0)
+        break;
+    }
+  }
+};
+
+StorageWriter::StorageWriter(const enum Subsystem subsys, std::string header,
+                             const milliseconds sync_interval,
+                             const size_t capacity)
+    : d(std::make_unique<Impl>(subsys, std::move(header), sync_interval,
+                               capacity)) {}
+
+StorageWriter::~StorageWriter() = default;
+
+bool StorageWriter::write(const void *data, const size_t size) {
+  return d->push(data, size);
+}
+
+uint64_t StorageWriter::dropped() const { return d->dropped; }
+
+std::vector<std::string> StorageWriter::files() const {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  return d->paths;
+}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "intex.h"
+
+namespace intex {
+
+/* Write-behind storage for one subsystem. write() only copies a record into a
+ * bounded ring buffer; a dedicated thread appends records to the current file
+ * and commits them with one fdatasync per sync_interval. When the buffer is
+ * full, records are dropped rather than blocking the caller. On a write error
+ * the thread rotates to the next file and writes the record there. Every new
+ * file starts with header.
+ */
+class StorageWriter {
+  struct Impl;
+  std::unique_ptr<Impl> d;
+
+public:
+  StorageWriter(const enum Subsystem subsys, std::string header = {},
+                const std::chrono::milliseconds sync_interval =
+                    std::chrono::seconds(1),
+                const size_t capacity = 1 << 20);
+  /* Flushes and syncs everything queued before returning */
+  ~StorageWriter();
+  StorageWriter(const StorageWriter &) = delete;
+  StorageWriter &operator=(const StorageWriter &) = delete;
+
+  /* Thread-safe. Returns false if the record was dropped. */
+  bool write(const void *data, const size_t size);
+  /* Records dropped so far because the buffer was full */
+  uint64_t dropped() const;
+  /* Files opened so far, oldest first. Thread-safe. */
+  std::vector<std::string> files() const;
+};
+}
@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <QDebug>
+
+#include "rpc/telemetry-archive.h"
+#include "StorageWriter.h"
+#include "TelemetryFeed.h"
+
+namespace intex {
+
+/* covers the frames the storage thread may not have written yet */
+static constexpr size_t recent_frames = 64;
+
+struct TelemetryFeed::Impl {
+  const StorageWriter &archive;
+
+  std::mutex mutex;
+  std::deque<FramePtr> recent;
+  std::map<uint64_t, Subscriber> subscribers;
+  uint64_t next_id = 1; /* 0 is never a subscriber */
+
+  /* replays wait their turn on the replay thread; reading the archive
+   * takes too long for the RPC event loop */
+  std::condition_variable wakeup;
+  std::deque<std::function<void()>> replays;
+  bool stopping = false;
+  std::thread thread;
+
+  explicit Impl(const StorageWriter &archive_) : archive(archive_) {
+    thread = std::thread([this] { run(); });
+  }
+
+  ~Impl() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+      replays.clear();
+    }
+    wakeup.notify_all();
+    thread.join();
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      wakeup.wait(lock, [this] { return stopping || !replays.empty(); });
+      if (stopping)
+        return;
+      auto replay = std::move(replays.front());
+      replays.pop_front();
+      lock.unlock();
+      replay();
+      lock.lock();
+    }
+  }
+
+  /* Archived frames with since < timestamp < until, at most the newest
+   * limit of them */
+  std::vector<FramePtr> replay(const int64_t since, const int64_t until,
+                               const size_t limit) const {
+    std::vector<std::unique_ptr<TelemetryArchive>> files;
+    std::vector<TelemetryArchive::Record> records;
+    for (const auto &path : archive.files()) {
+      try {
+        auto file = std::make_unique<TelemetryArchive>(path);
+        if (file->legacy())
+          continue;
+        TelemetryArchive::Record record;
+        for (auto offset = file->seek(since + 1);
+             file->next(offset, record) && record.timestamp < until;) {
+          records.push_back(record);
+        }
+        files.push_back(std::move(file));
+      } catch (const std::exception &e) {
+        qCritical() << "Could not replay telemetry from" << path.c_str()
+                    << ":" << e.what();
+      }
+    }
+
+    if (records.size() > limit)
+      records.erase(records.begin(),
+                    records.end() - static_cast<std::ptrdiff_t>(limit));
+
+    std::vector<FramePtr> frames;
+    /* archived frames are key frames; any decoder reads them */
+    TelemetryDecoder decoder;
+    for (const auto &record : records) {
+      kj::ArrayInputStream in(record.frame);
+      try {
+        if (!decoder.decode(in))
+          continue;
+      } catch (const kj::Exception &e) {
+        qCritical() << "Invalid archived telemetry frame:"
+                    << e.getDescription().cStr();
+        continue;
+      } catch (const std::exception &e) {
+        qCritical() << "Invalid archived telemetry frame:" << e.what();
+        continue;
+      }
+      frames.push_back(std::make_shared<const Frame>(
+          Frame{record.timestamp, decoder.samples(), decoder.cameras(), true}));
+    }
+    return frames;
+  }
+};
+
+TelemetryFeed::TelemetryFeed(const StorageWriter &archive)
+    : d(std::make_unique<Impl>(archive)) {}
+
+TelemetryFeed::~TelemetryFeed() = default;
+
+void TelemetryFeed::publish(FramePtr frame) {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  d->recent.push_back(frame);
+  if (d->recent.size() > recent_frames)
+    d->recent.pop_front();
+  for (auto &subscriber : d->subscribers)
+    subscriber.second(frame);
+}
+
+uint64_t TelemetryFeed::subscribe(const int64_t since, const size_t limit,
+                                  Subscriber subscriber, Replayed replayed) {
+  std::vector<FramePtr> recent;
+  auto until = std::numeric_limits<int64_t>::max();
+  uint64_t id;
+  {
+    std::lock_guard<std::mutex> lock(d->mutex);
+    if (since > 0) {
+      for (const auto &frame : d->recent) {
+        if (frame->timestamp <= since)
+          continue;
+        auto copy = std::make_shared<Frame>(*frame);
+        copy->replayed = true;
+        recent.push_back(std::move(copy));
+      }
+      if (!d->recent.empty())
+        until = d->recent.front()->timestamp;
+    }
+    id = d->next_id++;
+    d->subscribers.emplace(id, std::move(subscriber));
+  }
+
+  if (since <= 0) {
+    replayed({});
+    return id;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(d->mutex);
+    d->replays.push_back([ d = d.get(), since, until, limit, recent,
+                           replayed = std::move(replayed) ] {
+      auto missed = d->replay(since, until, limit);
+      missed.insert(missed.end(), recent.begin(), recent.end());
+      if (missed.size() > limit)
+        missed.erase(missed.begin(),
+                     missed.end() - static_cast<std::ptrdiff_t>(limit));
+      replayed(std::move(missed));
+    });
+  }
+  d->wakeup.notify_all();
+  return id;
+}
+
+void TelemetryFeed::unsubscribe(const uint64_t id) {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  d->subscribers.erase(id);
+}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "rpc/telemetry-codec.h"
+
+namespace intex {
+
+class StorageWriter;
+
+/* Telemetry frames for RPC subscribers. Every published frame is handed to
+ * the subscribers on the publishing thread. A new subscriber also gets the
+ * frames it missed, from the on-board archive and from the frames that may
+ * still be on their way into it; the archive is read on a replay thread of
+ * the feed.
+ */
+class TelemetryFeed {
+  struct Impl;
+  std::unique_ptr<Impl> d;
+
+public:
+  struct Frame {
+    int64_t timestamp;
+    /* in the order they were taken; the last one of a channel is current */
+    std::vector<TelemetryReading> readings;
+    std::vector<CameraHealth> cameras;
+    bool replayed;
+  };
+  using FramePtr = std::shared_ptr<const Frame>;
+  /* Called with the feed locked; must not subscribe or unsubscribe */
+  using Subscriber = std::function<void(const FramePtr &)>;
+  /* Called on the replay thread with the missed frames, oldest first */
+  using Replayed = std::function<void(std::vector<FramePtr> missed)>;
+
+  /* archive stores the published frames and must outlive the feed */
+  explicit TelemetryFeed(const StorageWriter &archive);
+  /* Drops replays that have not started; waits for a running one */
+  ~TelemetryFeed();
+  TelemetryFeed(const TelemetryFeed &) = delete;
+  TelemetryFeed &operator=(const TelemetryFeed &) = delete;
+
+  /* Thread-safe */
+  void publish(FramePtr frame);
+  /* Every frame published from now on goes to subscriber. The frames
+   * after since, at most the newest limit of them, go to replayed, which
+   * is called once even if there are none; frames published meanwhile
+   * reach subscriber first and belong behind the missed ones. A since of 0
+   * replays nothing. Thread-safe. */
+  uint64_t subscribe(const int64_t since, const size_t limit,
+                     Subscriber subscriber, Replayed replayed);
+  void unsubscribe(const uint64_t id);
+};
+}
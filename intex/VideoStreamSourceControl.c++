@@ -1,15 +1,16 @@
+#include <chrono>
 #include <sstream>
 #include <stdexcept>
-#include <iostream>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 #include <cstring>
 
 #include <QDebug>
-#include <QDir>
-#include <QFile>
 #include <QObject>
 #include <QString>
-#include <QTextStream>
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wdocumentation"
@@ -23,31 +24,28 @@
 #pragma clang diagnostic pop
 
 #include "VideoStreamSourceControl.h"
+#include "pipeline-builder.h"
+#include "pipeline-monitor.h"
+#include "rtp-latency.h"
+#include "rtp-protection.h"
 #include "sysfs.h"
 
-static constexpr char encoderName[] = "encoder";
-static constexpr char sinkName[] = "udpsink";
-
-static QString make_udpsink(const QString &host, const uint16_t port) {
-  QString buf;
-  QTextStream udpsink(&buf);
-
-  udpsink << " ! queue ! udpsink host=" << host << " port=" << port
-          << " sync=false async=false";
-  return buf;
-}
-
-static QString make_encode() {
-  QString buf;
-  QTextStream downlink(&buf);
-  downlink << " ! omxh264enc name=" << encoderName
-           << " target_bitrate=400000 control-rate=variable inline-header=true"
-           << " periodicty-idr=250 interval-intraframes=250"
-           << " ! video/x-h264,profile=baseline"
-           << " ! h264parse"
-           << " ! rtph264pay config-interval=1";
-  return buf;
-}
+using intex::PipelineBuilder;
+using intex::QueueLimits;
+using intex::RecordingManager;
+using namespace std::chrono_literals;
+
+/* Recording must not lose data; absorb storage stalls */
+static constexpr QueueLimits record_queue{0, 32 << 20, 0ms,
+                                          QueueLimits::Leaky::No};
+/* Encoders and the network want the latest frame, not every frame */
+static constexpr QueueLimits live_queue{2, 0, 0ms,
+                                        QueueLimits::Leaky::Downstream};
+static constexpr QueueLimits downlink_queue{30, 0, 0ms,
+                                            QueueLimits::Leaky::Downstream};
+/* Thread boundary in front of the camera and network sinks */
+static constexpr QueueLimits thread_queue{200, 10 << 20, 1000ms,
+                                          QueueLimits::Leaky::No};
 
 #define check_nonnull(x) check_nonnull_impl(x, __LINE__, __func__)
 
@@ -64,25 +62,108 @@ decltype(auto) check_nonnull_impl(T &&t, int lineno, const char *func) {
 }
 
 static auto toVideoDevice(const enum intex::Subsystem subsys) {
+  const auto &cameras = intex::CameraRegistry::registry();
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wswitch-enum"
   switch (subsys) {
   case intex::Subsystem::Video0:
-    return findDevice(0);
+    return cameras.find(0);
   case intex::Subsystem::Video1:
-    return findDevice(1);
+    return cameras.find(1);
   default:
     throw std::runtime_error("Subsystem not supported.");
   }
 #pragma clang diagnostic pop
 }
 
-static QGst::PipelinePtr make_pipeline(const enum intex::Subsystem subsys,
-                                       const QString &host, const uint16_t port,
-                                       const bool debug) {
-  const QString devName(/*deviceName(subsys)*/"cam");
-  QString buf;
-  QTextStream pipeline(&buf);
+/* Handles to the elements that are controlled while the pipeline runs */
+struct Graph {
+  QGst::PipelinePtr pipeline;
+  QGst::ElementPtr cam;     /* uvch264src, or videotestsrc in debug mode */
+  QGst::ElementPtr micro;   /* alsasrc of the camera, if any */
+  QGst::ElementPtr encoder; /* downlink encoder; none with Shared encoding */
+  QGst::ElementPtr payloader;
+  QGst::ElementPtr rtpbin;
+  QGst::ElementPtr fec;     /* ULP FEC encoder, if available */
+  QGst::ElementPtr udpsink;   /* video RTP, on the port */
+  QGst::ElementPtr rtcpsink;  /* video RTCP, port + 1 */
+  QGst::ElementPtr audiosink; /* audio RTP, port + 2, if any */
+  QGst::ElementPtr rtcpsrc;   /* receiver reports, port + 5 */
+  QGst::ElementPtr volume;
+  QGst::ElementPtr videomux;
+  QGst::ElementPtr audiomux;
+  QGst::ElementPtr audioselector;
+  /* instrumented */
+  QGst::ElementPtr videoqueue;
+  QGst::ElementPtr audioqueue;
+  QGst::ElementPtr downlinkqueue;
+  QGst::ElementPtr videofile; /* filesink of the video recording */
+};
+
+/* Returns the queue in front of the sink */
+static QGst::ElementPtr make_udpsink(PipelineBuilder &builder,
+                                     const QString &host, const uint16_t port,
+                                     QGst::ElementPtr *udpsink = nullptr) {
+  auto queue = builder.queue(thread_queue);
+  auto sink = builder.make("udpsink", {{"host", host},
+                                       {"port", QString::number(port)},
+                                       {"sync", "false"},
+                                       {"async", "false"}});
+  builder.chain({queue, sink});
+  if (udpsink)
+    *udpsink = sink;
+  return queue;
+}
+
+/* Encodes and payloads raw video; returns the payloader */
+static QGst::ElementPtr make_encode(PipelineBuilder &builder, Graph &graph,
+                                    const QGst::ElementPtr &raw,
+                                    const unsigned bitrate) {
+  graph.encoder = builder.make(
+      "omxh264enc", "encoder",
+      {{"target-bitrate", QString::number(bitrate)},
+       {"control-rate", "variable"},
+       {"inline-header", "true"},
+       {"periodicty-idr", "250"},
+       {"interval-intraframes", "250"}});
+  return builder.chain(
+      {raw, graph.encoder, builder.capsfilter("video/x-h264,profile=baseline"),
+       builder.make("h264parse"),
+       builder.make("rtph264pay", {{"config-interval", "1"}})});
+}
+
+/* splitmuxsink only cuts segments at keyframes */
+static QGst::ElementPtr make_muxer(PipelineBuilder &builder, const char *name,
+                                   const QString &location,
+                                   const RecordingManager::Policy &policy,
+                                   QGst::ElementPtr *filesink = nullptr) {
+  const auto duration = std::chrono::nanoseconds(policy.duration).count();
+  auto mux = builder.make("splitmuxsink", name,
+                          {{"location", location},
+                           {"max-size-time", QString::number(duration)},
+                           {"max-size-bytes", QString::number(policy.bytes)}});
+  /* the cut does not wait for the encoder's next periodic keyframe */
+  if (policy.bytes == 0 && mux->findProperty("send-keyframe-requests"))
+    mux->setProperty("send-keyframe-requests", true);
+  mux->setProperty("muxer", QGst::ElementFactory::make("mpegtsmux"));
+  /* segments are preallocated, truncating them would drop the reservation */
+  auto sink = QGst::ElementFactory::make("filesink");
+  sink->setProperty("append", true);
+  mux->setProperty("sink", sink);
+  if (filesink)
+    *filesink = sink;
+  return mux;
+}
+
+static Graph make_pipeline(const enum intex::Subsystem subsys,
+                           const QString &host, const uint16_t port,
+                           const unsigned bitrate, const bool debug,
+                           const VideoStreamSourceControl::Encoding encoding,
+                           const intex::Protection &protection,
+                           const RecordingManager::Policy &policy) {
+  const bool shared = encoding == VideoStreamSourceControl::Encoding::Shared;
+  PipelineBuilder builder;
+  Graph graph;
   QPair<QString, QString> device;
   QString error;
 
@@ -93,108 +174,151 @@ static QGst::PipelinePtr make_pipeline(const enum intex::Subsystem subsys,
   }
 
   bool have_device = !debug && error.isEmpty();
-#ifdef RTPBIN
-  pipeline << " rtpbin name=rtpbin";
-#endif
+  /* RTCP receiver reports of the video session drive the bitrate control */
+  graph.rtpbin = builder.make("rtpbin", "rtpbin");
+  graph.fec = intex::protectSender(builder, graph.rtpbin, protection);
+  auto &payloader = graph.payloader;
 
   if (have_device) {
-    /* uvch264src */
-    pipeline << " uvch264src name=" << devName;
-    pipeline << " num-buffers=-1 device=" << device.first;
-    pipeline << " enable-sei=true";
-    pipeline << " fixed-framerate=true";
-    pipeline << " async-handling=true";
-    pipeline << " message-forward=true";
-    pipeline << " auto-start=true";
-    pipeline << " initial-bitrate=5000000 peak-bitrate=5000000";
-    pipeline << " average-bitrate=3000000 rate-control=vbr";
-    pipeline << " mode=mode-video iframe-period=2000 ";
+    /* the downlink rate applies to the recording as well with Shared */
+    const auto peak = QString::number(shared ? bitrate : 5000000);
+    const auto average = QString::number(shared ? bitrate : 3000000);
+    graph.cam = builder.make("uvch264src", "cam",
+                             {{"num-buffers", "-1"},
+                              {"device", device.first},
+                              {"enable-sei", "true"},
+                              {"fixed-framerate", "true"},
+                              {"async-handling", "true"},
+                              {"message-forward", "true"},
+                              {"auto-start", "true"},
+                              {"initial-bitrate", peak},
+                              {"peak-bitrate", peak},
+                              {"average-bitrate", average},
+                              {"rate-control", shared ? "cbr" : "vbr"},
+                              {"mode", "mode-video"},
+                              {"iframe-period", "2000"}});
 
     /* vidsrc */
-    pipeline << " " << devName << ".vidsrc ! queue ! "
-             << "video/x-h264,width=1280,height=720,stream-format=byte-stream"
-             << " ! h264parse ! queue name=videoqueue ";
-    pipeline << " ! splitmuxsink name=videomux muxer=mpegtsmux";
-    pipeline << " location=/media/usb-raid/video/fallback-video" << port
-             << "-%05d.mpeg";
-    pipeline << " max-size-time=0 max-size-bytes=0 sync=false async=false";
+    auto vidqueue = builder.queue(thread_queue);
+    builder.link(graph.cam, "vidsrc", vidqueue);
+    auto h264 = builder.chain(
+        {vidqueue,
+         builder.capsfilter("video/x-h264,width=1280,height=720,"
+                            "stream-format=byte-stream"),
+         builder.make("h264parse")});
+    if (shared)
+      h264 = builder.chain({h264, builder.make("tee", "h264tee")});
+    graph.videomux = make_muxer(
+        builder, "videomux",
+        "/media/usb-raid/video/fallback-video" + QString::number(port) +
+            "-%05d.mpeg",
+        policy, &graph.videofile);
+    graph.videoqueue = builder.queue(record_queue, "videoqueue");
+    builder.chain({h264, graph.videoqueue, graph.videomux});
 
     /* vfsrc */
-    pipeline << " " << devName << ".vfsrc ! queue ! "
-             << "video/x-raw,format=I420,width=640,height=360 ! videoconvert"
-             << make_encode();
+    auto vfqueue = builder.queue(live_queue);
+    builder.link(graph.cam, "vfsrc", vfqueue);
+    if (shared) {
+      /* tee hands the camera's buffers to both branches by reference; the
+       * viewfinder is not used */
+      builder.chain({vfqueue, builder.make("fakesink", {{"sync", "false"},
+                                                        {"async", "false"}})});
+      payloader = builder.chain(
+          {h264, builder.queue(downlink_queue),
+           builder.make("rtph264pay", {{"config-interval", "1"}})});
+    } else {
+      auto raw = builder.chain(
+          {vfqueue,
+           builder.capsfilter("video/x-raw,format=I420,width=640,height=360"),
+           builder.make("videoconvert")});
+      payloader = make_encode(builder, graph, raw, bitrate);
+    }
   } else {
-    pipeline << " videotestsrc name=" << devName << " pattern=smpte100";
-    pipeline
-        << " ! video/x-raw,format=I420,framerate=24/1,width=640,height=360";
+    graph.cam = builder.make("videotestsrc", "cam", {{"pattern", "smpte100"}});
+    auto raw = builder.chain(
+        {graph.cam, builder.capsfilter("video/x-raw,format=I420,"
+                                       "framerate=24/1,width=640,height=360")});
 #ifdef BUILD_ON_RASPBERRY
-    pipeline << " ! textoverlay font-desc=\"Sans 50\" shaded-background=true";
-    pipeline << " text=\"";
-    if (debug)
-      pipeline << "Debug mode";
-    else
-      pipeline << error;
-    pipeline << "\" ! videoconvert name=video" << make_encode();
+    auto overlay = builder.make("textoverlay",
+                                {{"font-desc", "Sans 50"},
+                                 {"shaded-background", "true"},
+                                 {"text", debug ? "Debug mode" : error}});
+    raw = builder.chain({raw, overlay, builder.make("videoconvert", "video")});
+    payloader = make_encode(builder, graph, raw, bitrate);
+#else
+    payloader = builder.chain({raw, builder.make("rtpvrawpay")});
 #endif
   }
 
-#ifdef RTPBIN
-  pipeline << " ! rtpbin.send_rtp_sink_0 rtpbin.send_rtp_src_0 ! ";
-#endif
-  pipeline << make_udpsink(host, port);
-#ifdef RTPBIN
-  pipeline << " rtpbin.send_rtcp_src_0 ! " << make_udpsink(host, port + 1);
-  pipeline << " udpsrc port=" << port + 5 << " ! rtpbin.recv_rtcp_sink_0";
-#endif
+  builder.link(graph.fec ? builder.chain({payloader, graph.fec}) : payloader,
+               "src", graph.rtpbin, "send_rtp_sink_0");
+  graph.downlinkqueue = make_udpsink(builder, host, port, &graph.udpsink);
+  builder.link(graph.rtpbin, "send_rtp_src_0", graph.downlinkqueue);
+  builder.link(graph.rtpbin, "send_rtcp_src_0",
+               make_udpsink(builder, host, port + 1, &graph.rtcpsink));
+  graph.rtcpsrc =
+      builder.make("udpsrc", {{"port", QString::number(port + 5)}});
+  builder.link(graph.rtcpsrc, "src", graph.rtpbin, "recv_rtcp_sink_0");
 
 #ifdef BUILD_ON_RASPBERRY
+  QGst::ElementPtr audio;
   if (have_device) {
     /* alsasrc */
-    pipeline << " alsasrc name=micro device=" << device.second;
-    pipeline << " provide-clock=true";
-    pipeline << " do-timestamp=true";
-    pipeline << " ! audio/x-raw,rate=32000 ! queue ! tee name=camaudio";
+    graph.micro = builder.make("alsasrc", "micro",
+                               {{"device", device.second},
+                                {"provide-clock", "true"},
+                                {"do-timestamp", "true"}});
+    auto camaudio = builder.chain(
+        {graph.micro, builder.capsfilter("audio/x-raw,rate=32000"),
+         builder.queue(thread_queue), builder.make("tee", "camaudio")});
 
     /* recording */
-    pipeline << " camaudio. ! queue ! volume volume=2.0"
-             << " ! audioconvert ! avenc_ac3 bitrate=128000"
-             << " ! queue name=audioqueue";
-    pipeline << " ! output-selector name=audio-selector "
-                "pad-negotiation-mode=active";
-    pipeline << " ! splitmuxsink name=audiomux muxer=mpegtsmux"
-             << " max-size-time=0 max-size-bytes=0 sync=false async=false"
-             << " location=/media/usb-raid/audio/fallback-audio" << port
-             << "%05d.mp4";
-    pipeline << " audio-selector.";
-    pipeline << " ! fakesink name=audiofakesink sync=false async=false";
+    graph.audioselector = builder.make("output-selector", "audio-selector",
+                                       {{"pad-negotiation-mode", "active"}});
+    graph.audioqueue = builder.queue(record_queue, "audioqueue");
+    builder.chain({camaudio, builder.queue(record_queue),
+                   builder.make("volume", {{"volume", "2.0"}}),
+                   builder.make("audioconvert"),
+                   builder.make("avenc_ac3", {{"bitrate", "128000"}}),
+                   graph.audioqueue, graph.audioselector});
+    graph.audiomux = make_muxer(
+        builder, "audiomux",
+        "/media/usb-raid/audio/fallback-audio" + QString::number(port) +
+            "%05d.mp4",
+        policy);
+    builder.link(graph.audioselector, "src_0", graph.audiomux);
+    builder.link(graph.audioselector, "src_1",
+                 builder.make("fakesink", "audiofakesink",
+                              {{"sync", "false"}, {"async", "false"}}),
+                 "sink");
 
     /* stream */
-    pipeline << " camaudio.";
+    audio = camaudio;
   } else {
-    pipeline << " audiotestsrc ! audio/x-raw,rate=32000";
+    audio = builder.chain({builder.make("audiotestsrc"),
+                           builder.capsfilter("audio/x-raw,rate=32000")});
   }
 
   /* encoder */
-  pipeline << " ! queue ! deinterleave ! volume name=volume volume=2.0";
-  pipeline << " ! audioresample ! audio/x-raw,rate=8000";
-  pipeline << " ! opusenc max-payload-size=500 bitrate=8000"
-           << " bandwidth=narrowband";
-  pipeline << " ! rtpopuspay"
-           << " ! application/x-rtp,encoding-name=X-GST-OPUS-DRAFT-SPITTKA-00";
-#ifdef RTPBIN
-  pipeline << " ! rtpbin.send_rtp_sink_1 rtpbin.send_rtp_src_1";
+  auto deinterleave = builder.make("deinterleave");
+  builder.chain({audio, builder.queue(live_queue), deinterleave});
+  graph.volume = builder.make("volume", "volume", {{"volume", "2.0"}});
+  builder.linkDynamic(deinterleave, "src_0", graph.volume);
+  builder.chain(
+      {graph.volume, builder.make("audioresample"),
+       builder.capsfilter("audio/x-raw,rate=8000"),
+       builder.make("opusenc", {{"max-payload-size", "500"},
+                                {"bitrate", "8000"},
+                                {"bandwidth", "narrowband"}}),
+       builder.make("rtpopuspay"),
+       builder.capsfilter("application/x-rtp,"
+                          "encoding-name=X-GST-OPUS-DRAFT-SPITTKA-00"),
+       make_udpsink(builder, host, port + 2, &graph.audiosink)});
 #endif
-  pipeline << make_udpsink(host, port + 2);
-#ifdef RTPBIN
-  pipeline << " rtpbin.send_rtcp_src_1 ! " << make_udpsink(host, port + 3);
-  pipeline << " udpsrc port=" << port + 7 << " ! rtpbin.recv_rtcp_sink_1";
-#endif
-#endif
-
-  qDebug() << buf;
 
-  return QGst::Parse::launch(buf.toLatin1().data())
-      .dynamicCast<QGst::Pipeline>();
+  graph.pipeline = builder.pipeline();
+  return graph;
 }
 
 #pragma clang diagnostic push
@@ -218,8 +342,71 @@ static GstPadProbeReturn fix_buffer_timestamp_probe(GstPad *,
 }
 #pragma clang diagnostic pop
 
-/* Encapsulates two MultiFileSinks with an output-selector element in front of
- * them, to change files dynamically, without halting the pipeline.
+static bool make_report(const GstStructure *stats,
+                        intex::ReceiverReport &report) {
+  gboolean have_rb = FALSE;
+  guint fraction_lost = 0;
+  guint jitter = 0;
+  guint round_trip = 0;
+
+  gst_structure_get_boolean(stats, "have-rb", &have_rb);
+  /* sender reports and reports about other SSRCs carry no report block */
+  if (!have_rb)
+    return false;
+
+  gst_structure_get_uint(stats, "rb-fractionlost", &fraction_lost);
+  gst_structure_get_uint(stats, "rb-jitter", &jitter);
+  gst_structure_get_uint(stats, "rb-round-trip", &round_trip);
+
+  /* fraction lost is 8 bit fixed point, jitter in units of the 90 kHz RTP
+   * clock, round trip time in NTP short format (16.16 fixed point) */
+  report.fraction_lost = fraction_lost / 256.0;
+  report.jitter = jitter / 90000.0;
+  report.round_trip = round_trip / 65536.0;
+  return true;
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wold-style-cast"
+/* Latest report block a remote SSRC of a session sent about our stream */
+static bool receiver_report(GstElement *rtpbin, guint session, guint ssrc,
+                            intex::ReceiverReport &report) {
+  GObject *rtpsession = nullptr;
+  g_signal_emit_by_name(rtpbin, "get-internal-session", session, &rtpsession);
+  if (rtpsession == nullptr)
+    return false;
+
+  GObject *source = nullptr;
+  g_signal_emit_by_name(rtpsession, "get-source-by-ssrc", ssrc, &source);
+  g_object_unref(rtpsession);
+  if (source == nullptr)
+    return false;
+
+  GstStructure *stats = nullptr;
+  g_object_get(source, "stats", &stats, NULL);
+  g_object_unref(source);
+  if (stats == nullptr)
+    return false;
+
+  const bool valid = make_report(stats, report);
+  gst_structure_free(stats);
+  return valid;
+}
+#pragma clang diagnostic pop
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wold-style-cast"
+/* Whether a source element is a camera that starts and stops recording */
+static bool records(const QGst::ElementPtr &cam) {
+  return g_signal_lookup("start-capture",
+                         G_OBJECT_TYPE(static_cast<GstElement *>(cam))) != 0;
+}
+#pragma clang diagnostic pop
+
+/* Names the segments of the video and audio splitmuxsinks, and starts and
+ * stops recording with an output-selector in front of the audio muxer.
+ * Pipelines on the test source have nothing to record; the recording starts
+ * with the pipeline of the camera that comes back.
  */
 class StreamFileSink : public QObject {
   Q_OBJECT
@@ -227,14 +414,13 @@ class StreamFileSink : public QObject {
   std::function<QString(void)> videoStorageLocation;
   std::function<QString(void)> audioStorageLocation;
 
-  QGst::PipelinePtr pipeline;
+  QGst::ElementPtr cam;
   QGst::ElementPtr audioselector;
   QGst::ElementPtr audiomux;
   QGst::ElementPtr videomux;
-  QGst::ElementPtr videofakesink;
-  QGst::ElementPtr audiofakesink;
   QGst::PadPtr audiofakesinkpad;
   QGst::PadPtr audiofilesinkpad;
+  const bool capture; /* the camera records, uvch264src */
 
   const char *videoLocation(const guint &) {
     return strdup(videoStorageLocation().toLocal8Bit().constData());
@@ -247,28 +433,27 @@ class StreamFileSink : public QObject {
 public:
   StreamFileSink(const enum intex::Subsystem vsubsys,
                  const enum intex::Subsystem asubsys,
-                 QGst::PipelinePtr pipeline_)
-      : videoStorageLocation(
-            [vsubsys] { return intex::storageLocation(vsubsys); }),
-        audioStorageLocation(
-            [asubsys] { return intex::storageLocation(asubsys); }),
-        pipeline(pipeline_),
-        audioselector(pipeline->getElementByName("audio-selector")),
-        audiomux(pipeline->getElementByName("audiomux")),
-        videomux(pipeline->getElementByName("videomux")),
-        videofakesink(pipeline->getElementByName("videofakesink")),
-        audiofakesink(pipeline->getElementByName("audiofakesink")),
+                 RecordingManager &recordings, const Graph &graph)
+      : videoStorageLocation([vsubsys, &recordings] {
+          return recordings.nextSegment(vsubsys);
+        }),
+        audioStorageLocation([asubsys, &recordings] {
+          return recordings.nextSegment(asubsys);
+        }),
+        cam(graph.cam), audioselector(graph.audioselector),
+        audiomux(graph.audiomux), videomux(graph.videomux),
         audiofakesinkpad(
             audioselector ? check_nonnull(audioselector->getStaticPad("src_1"))
                           : QGst::PadPtr{}),
         audiofilesinkpad(
             audioselector ? check_nonnull(audioselector->getStaticPad("src_0"))
-                          : QGst::PadPtr{}) {
-    auto src = pipeline->getElementByName("cam");
-    if (src) {
-      gst_pad_add_probe(src->getStaticPad("vidsrc"), GST_PAD_PROBE_TYPE_BUFFER,
+                          : QGst::PadPtr{}),
+        capture(records(cam)) {
+    auto vidsrc = cam->getStaticPad("vidsrc");
+    if (vidsrc) {
+      gst_pad_add_probe(vidsrc, GST_PAD_PROBE_TYPE_BUFFER,
                         fix_buffer_timestamp_probe,
-                        pipeline->getElementByName("micro"), NULL);
+                        static_cast<GstElement *>(graph.micro), NULL);
     }
     if (videomux) {
       QGlib::connect(videomux, "format-location", this,
@@ -281,108 +466,329 @@ public:
   }
 
   void start() {
+    if (!capture) {
+      qDebug() << "No camera to record from";
+      return;
+    }
     next();
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wold-style-cast"
-    g_signal_emit_by_name(
-        G_OBJECT(static_cast<GstElement *>(pipeline->getElementByName("cam"))),
-        "start-capture", NULL);
-    audioselector->setProperty("active-pad", audiofilesinkpad);
-    qDebug() << "Started";
+    g_signal_emit_by_name(G_OBJECT(static_cast<GstElement *>(cam)),
+                          "start-capture", NULL);
 #pragma clang diagnostic pop
+    if (audioselector)
+      audioselector->setProperty("active-pad", audiofilesinkpad);
+    qDebug() << "Started";
   }
 
   void stop() {
+    if (!capture)
+      return;
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wold-style-cast"
-    g_signal_emit_by_name(
-        G_OBJECT(static_cast<GstElement *>(pipeline->getElementByName("cam"))),
-        "stop-capture", NULL);
-    audioselector->setProperty("active-pad", audiofakesinkpad);
+    g_signal_emit_by_name(G_OBJECT(static_cast<GstElement *>(cam)),
+                          "stop-capture", NULL);
 #pragma clang diagnostic pop
+    if (audioselector)
+      audioselector->setProperty("active-pad", audiofakesinkpad);
   }
 
   void next() {
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wold-style-cast"
+    /* the segments end at the next keyframe */
     if (videomux) {
       g_signal_emit_by_name(G_OBJECT(static_cast<GstElement *>(videomux)),
-                            "next-file", NULL);
+                            "split-now", NULL);
     }
     if (audiomux) {
       g_signal_emit_by_name(G_OBJECT(static_cast<GstElement *>(audiomux)),
-                            "next-file", NULL);
+                            "split-now", NULL);
     }
 #pragma clang diagnostic pop
   }
 };
 
+/* Watches of the instrumented elements of a pipeline */
+class HealthMonitor {
+  static constexpr size_t unwatched = static_cast<size_t>(-1);
+
+  intex::PipelineMonitor monitor;
+  std::vector<std::pair<PipelineQueue, size_t>> queues;
+  bool encoder = false;
+  size_t record = unwatched;
+  size_t downlink = unwatched;
+
+  static float ms(const std::chrono::microseconds us) {
+    return static_cast<float>(us.count()) / 1000.0f;
+  }
+
+public:
+  explicit HealthMonitor(const Graph &graph) {
+    auto queue = [this](const QGst::ElementPtr &element,
+                        const PipelineQueue which) {
+      if (element)
+        queues.emplace_back(which, monitor.watchQueue(element));
+    };
+    queue(graph.videoqueue, PipelineQueue::VIDEO_RECORD);
+    queue(graph.audioqueue, PipelineQueue::AUDIO_RECORD);
+    queue(graph.downlinkqueue, PipelineQueue::DOWNLINK);
+
+    if (graph.encoder) {
+      monitor.watchEncoder(graph.encoder);
+      encoder = true;
+    }
+    if (graph.videofile)
+      record = monitor.watchRate(graph.videofile->getStaticPad("sink"));
+    downlink = monitor.watchRate(graph.udpsink->getStaticPad("sink"));
+  }
+
+  intex::CameraHealth sample() {
+    const auto sample = monitor.sample();
+    intex::CameraHealth health;
+    for (const auto &queue : queues) {
+      const auto &counters = sample.queues[queue.second];
+      health.queues.push_back({queue.first,
+                               static_cast<float>(counters.level),
+                               static_cast<uint32_t>(counters.overruns)});
+    }
+    if (encoder) {
+      const auto &timing = sample.encoders.front();
+      health.encoded_frames = static_cast<uint32_t>(timing.frames);
+      health.encode_time = ms(timing.mean);
+      health.max_encode_time = ms(timing.max);
+    }
+    if (record != unwatched)
+      health.record_rate = static_cast<float>(sample.rates[record]);
+    if (downlink != unwatched)
+      health.downlink_rate = static_cast<float>(sample.rates[downlink]);
+    return health;
+  }
+};
+
+/* Retransmissions resend what is lost, which the bitrate controller lets
+ * grow to about this many packets per 100 before it backs off */
+static constexpr unsigned rtx_reserve = 5;
+
+/* Of bitrate on the link, what is left to the encoder by FEC and
+ * retransmissions */
+static unsigned media_bitrate(const uint64_t bitrate,
+                              const intex::Protection &protection) {
+  const uint64_t overhead = 100 + protection.fec_overhead +
+                            (protection.retransmission ? rtx_reserve : 0);
+  return static_cast<unsigned>(bitrate * 100 / overhead);
+}
+
+/* What a pipeline is built from: the parameters of the source with the
+ * later changes applied, so a rebuilt pipeline carries on where the old one
+ * stopped */
+struct Settings {
+  intex::Subsystem vsubsystem;
+  intex::Subsystem asubsystem;
+  RecordingManager &recordings;
+  QString host;
+  uint16_t port;
+  unsigned bitrate; /* on the link, protection included */
+  bool debug;
+  VideoStreamSourceControl::Encoding encoding;
+  intex::Protection protection;
+  float volume;
+  bool recording;
+};
+
 /* Manages a single camera with its two replicated streams */
 struct VideoStreamSourceControl::Impl {
-  QGst::PipelinePtr pipeline;
+  Settings settings;
+  Graph graph;
   StreamFileSink filesink;
+  HealthMonitor health;
+  std::mutex report_mutex;
+  std::function<void(const intex::ReceiverReport &)> report_callback;
+
+  /* Called on the RTCP thread whenever an RTCP packet of a remote SSRC
+   * arrived */
+  static void on_ssrc_active(GstElement *rtpbin, guint session, guint ssrc,
+                             gpointer user_data) {
+    /* session 0 carries the video */
+    intex::ReceiverReport report;
+    if (session != 0 || !receiver_report(rtpbin, session, ssrc, report))
+      return;
+
+    auto self = static_cast<Impl *>(user_data);
+    std::lock_guard<std::mutex> lock(self->report_mutex);
+    if (!self->report_callback)
+      return;
+    /* there is no one to catch exceptions on the RTCP thread */
+    try {
+      self->report_callback(report);
+    } catch (const std::exception &e) {
+      qWarning() << "Handling receiver report failed:" << e.what();
+    }
+  }
 
-  Impl(const enum intex::Subsystem vsubsystem,
-       const enum intex::Subsystem asubsystem, const QString &host,
-       const uint16_t port, unsigned bitrate, const bool debug)
-      : pipeline(make_pipeline(vsubsystem, host, port, debug)),
-        filesink(vsubsystem, asubsystem, pipeline) {
+  explicit Impl(const Settings &settings_)
+      : settings(settings_),
+        graph(make_pipeline(settings.vsubsystem, settings.host, settings.port,
+                            media_bitrate(settings.bitrate,
+                                          settings.protection),
+                            settings.debug,
+                            settings.encoding, settings.protection,
+                            settings.recordings.policy())),
+        filesink(settings.vsubsystem, settings.asubsystem,
+                 settings.recordings, graph),
+        health(graph) {
+    const auto vsubsystem = settings.vsubsystem;
     if (vsubsystem != intex::Subsystem::Video0 &&
         vsubsystem != intex::Subsystem::Video1) {
       throw std::runtime_error(
           "FileSinkManager requires subsystem to be Video0 or Video1");
     }
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wold-style-cast"
+    g_signal_connect(static_cast<GstElement *>(graph.rtpbin), "on-ssrc-active",
+                     G_CALLBACK(on_ssrc_active), this);
+#pragma clang diagnostic pop
+    /* lets the ground station measure the glass-to-glass latency */
+    intex::stampCaptureTime(graph.payloader->getStaticPad("src"));
 #ifdef BUILD_ON_RASPBERRY
-    pipeline->setState(QGst::StatePlaying);
+    graph.pipeline->setState(QGst::StatePlaying);
 #endif
     std::string filename("pipeline" +
                          std::to_string(static_cast<int>(vsubsystem)));
-    GST_DEBUG_BIN_TO_DOT_FILE(pipeline.staticCast<QGst::Bin>(),
+    GST_DEBUG_BIN_TO_DOT_FILE(graph.pipeline.staticCast<QGst::Bin>(),
                               GST_DEBUG_GRAPH_SHOW_ALL, filename.c_str());
   }
-  ~Impl() noexcept { pipeline->setState(QGst::StateNull); }
+  ~Impl() noexcept { graph.pipeline->setState(QGst::StateNull); }
 };
 
 VideoStreamSourceControl::VideoStreamSourceControl(
     const enum intex::Subsystem vsubsystem,
-    const enum intex::Subsystem asubsystem, const QString &host,
-    const uint16_t port, unsigned bitrate, bool debug)
-    : d(std::make_unique<Impl>(vsubsystem, asubsystem, host, port, bitrate,
-                               debug)) {}
+    const enum intex::Subsystem asubsystem, RecordingManager &recordings,
+    const QString &host, const uint16_t port, unsigned bitrate, bool debug,
+    Encoding encoding, const intex::Protection &protection)
+    : d(std::make_unique<Impl>(Settings{vsubsystem, asubsystem, recordings,
+                                        host, port, bitrate, debug, encoding,
+                                        protection, 2.0f, false})) {}
+
+struct VideoStreamSourceControl::Detached {
+  Settings settings;
+  std::function<void(const intex::ReceiverReport &)> report_callback;
+};
 
 VideoStreamSourceControl::~VideoStreamSourceControl() = default;
 
-QGst::ElementPtr VideoStreamSourceControl::getElementByName(const char *name) {
-  auto elem = d->pipeline->getElementByName(name);
+VideoStreamSourceControl::Impl &VideoStreamSourceControl::pipeline() {
+  if (!d)
+    throw std::runtime_error(
+        "Camera " +
+        std::to_string(static_cast<int>(detached->settings.vsubsystem)) +
+        " has no pipeline");
+  return *d;
+}
 
-  if (!elem) {
-    std::ostringstream os;
-    os << "Pipeline " << d->pipeline->name().toStdString() << " element '"
-       << name << "' not found.";
-    qDebug() << "Element " << name << " not found";
-    throw std::runtime_error(os.str());
+void VideoStreamSourceControl::reconnect() {
+  if (d) {
+    std::function<void(const intex::ReceiverReport &)> callback;
+    {
+      /* waits for a running report; without reports the bitrate controller
+       * does not set the bitrate while the pipeline is rebuilt */
+      std::lock_guard<std::mutex> lock(d->report_mutex);
+      callback = std::move(d->report_callback);
+      d->report_callback = nullptr;
+    }
+    detached = std::make_unique<Detached>(
+        Detached{d->settings, std::move(callback)});
+    /* the camera can only be opened by one pipeline at a time */
+    d.reset();
   }
 
-  return elem;
+  const auto &settings = detached->settings;
+  qDebug() << "Rebuilding pipeline" << static_cast<int>(settings.vsubsystem);
+  /* on failure, the next call tries again from the same settings */
+  d = std::make_unique<Impl>(settings);
+  if (d->graph.volume)
+    d->graph.volume->setProperty("volume", settings.volume);
+  if (settings.recording)
+    d->filesink.start();
+  auto callback = std::move(detached->report_callback);
+  detached.reset();
+  onReceiverReport(std::move(callback));
 }
 
 void VideoStreamSourceControl::setVolume(const float volume) {
   qDebug() << "Setting volume:" << volume;
-  getElementByName("volume")->setProperty("volume", volume);
+  auto &p = pipeline();
+  check_nonnull(p.graph.volume)->setProperty("volume", volume);
+  p.settings.volume = volume;
 }
 
 void VideoStreamSourceControl::setBitrate(const uint64_t bitrate) {
-  std::cout << "Setting bitrate: " << bitrate << std::endl;
-  getElementByName(encoderName)->setProperty("target-bitrate", bitrate);
+  auto &p = pipeline();
+  auto &cam = p.graph.cam;
+  /* the bitrate controller sets it on every report */
+  if (bitrate != p.settings.bitrate)
+    qDebug() << "Setting bitrate:" << bitrate;
+  p.settings.bitrate = static_cast<unsigned>(bitrate);
+  const auto rate = media_bitrate(bitrate, p.settings.protection);
+  if (p.settings.encoding == Encoding::Shared &&
+      cam->findProperty("average-bitrate")) {
+    /* there is no second encoder, the camera encodes at the downlink rate */
+    cam->setProperty("average-bitrate", rate);
+    cam->setProperty("peak-bitrate", rate);
+    return;
+  }
+  check_nonnull(p.graph.encoder)->setProperty("target-bitrate", rate);
+}
+
+void VideoStreamSourceControl::setFecOverhead(const unsigned percentage) {
+  qDebug() << "Setting FEC overhead:" << percentage << "%";
+  auto &p = pipeline();
+  check_nonnull(p.graph.fec)->setProperty("percentage", percentage);
+  p.settings.protection.fec_overhead = percentage;
+  /* the FEC packets come out of the same link budget */
+  setBitrate(p.settings.bitrate);
+}
+
+void VideoStreamSourceControl::onReceiverReport(
+    std::function<void(const intex::ReceiverReport &)> callback) {
+  if (!d) {
+    detached->report_callback = std::move(callback);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(d->report_mutex);
+  d->report_callback = std::move(callback);
 }
 
 void VideoStreamSourceControl::setPort(const uint16_t port) {
-  std::cout << "Setting port: " << port << std::endl;
-  getElementByName(sinkName)->setProperty("port", static_cast<gint>(port));
+  qDebug() << "Setting port:" << port;
+  auto &p = pipeline();
+  p.graph.udpsink->setProperty("port", static_cast<gint>(port));
+  p.graph.rtcpsink->setProperty("port", static_cast<gint>(port + 1));
+  if (p.graph.audiosink)
+    p.graph.audiosink->setProperty("port", static_cast<gint>(port + 2));
+  /* a udpsrc binds its socket when it starts */
+  p.graph.rtcpsrc->setState(QGst::StateNull);
+  p.graph.rtcpsrc->setProperty("port", static_cast<gint>(port + 5));
+  p.graph.rtcpsrc->syncStateWithParent();
+  p.settings.port = port;
+}
+
+intex::CameraHealth VideoStreamSourceControl::health() {
+  return d ? d->health.sample() : intex::CameraHealth{};
+}
+
+void VideoStreamSourceControl::start() {
+  auto &p = pipeline();
+  p.filesink.start();
+  p.settings.recording = true;
+}
+
+void VideoStreamSourceControl::stop() {
+  auto &p = pipeline();
+  p.filesink.stop();
+  p.settings.recording = false;
 }
 
-void VideoStreamSourceControl::start() { d->filesink.start(); }
-void VideoStreamSourceControl::stop() { d->filesink.stop(); }
-void VideoStreamSourceControl::next() { d->filesink.next(); }
+void VideoStreamSourceControl::next() { pipeline().filesink.next(); }
 
 #include "VideoStreamSourceControl.moc"
@@ -1,10 +1,15 @@
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <string>
 
 #include "qgst.h"
 #include "intex.h"
+#include "BitrateController.h"
+#include "RecordingManager.h"
+#include "rtp-protection.h"
+#include "rpc/telemetry-codec.h"
 
 #ifdef BUILD_ON_RASPBERRY
 static constexpr bool debug_default() { return false; }
@@ -15,17 +20,46 @@ static constexpr bool debug_default() { return true; }
 class VideoStreamSourceControl {
   struct Impl;
   std::unique_ptr<Impl> d;
+  /* what the pipeline is rebuilt from after a rebuild failed */
+  struct Detached;
+  std::unique_ptr<Detached> detached;
 
-  QGst::ElementPtr getElementByName(const char *name);
+  /* Throws while there is no pipeline */
+  Impl &pipeline();
 
 public:
+  /* Reencode streams the camera's viewfinder through a second H.264 encoder;
+   * Shared tees the camera's own H.264 stream to recording and downlink,
+   * saving the second encode at the cost of recording at the downlink rate.
+   */
+  enum class Encoding : uint8_t { Reencode, Shared };
+
+  /* recordings names the segment files and must outlive the source */
   VideoStreamSourceControl(const enum intex::Subsystem vsubsystem,
                            const enum intex::Subsystem asubsystem,
+                           intex::RecordingManager &recordings,
                            const QString &host, const uint16_t port,
                            unsigned bitrate = 400000,
-                           bool debug = debug_default());
+                           bool debug = debug_default(),
+                           Encoding encoding = Encoding::Reencode,
+                           const intex::Protection &protection = {0, false});
   ~VideoStreamSourceControl();
+  /* Rebuilds the pipeline for the camera that is connected now, or the test
+   * source if there is none, keeping port, bitrate, volume, recording and
+   * the receiver report callback. Throws if the pipeline can not be built;
+   * the source is left without one, its controls throw and its health is
+   * empty, until a later call succeeds. */
+  void reconnect();
+  /* Rate on the link; the encoder gets what FEC and retransmissions leave */
   void setBitrate(const uint64_t bitrate);
+  /* FEC packets per 100 media packets; throws without an FEC encoder */
+  void setFecOverhead(const unsigned percentage);
+  /* Called on an RTCP thread for every receiver report of the video stream */
+  void onReceiverReport(
+      std::function<void(const intex::ReceiverReport &)> callback);
+  /* Queue levels, encoder timing and data rates since the previous call;
+   * the feed is left to the caller */
+  intex::CameraHealth health();
   void setVolume(const float volume);
   void setPort(const uint16_t port);
   void next();
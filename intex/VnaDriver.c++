@@ -0,0 +1,391 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "VnaDriver.h"
+
+using namespace std::chrono;
+using namespace std::literals::chrono_literals;
+
+namespace intex {
+
+/* The session speaks the miniVNA's serial protocol: commands and their
+ * arguments are decimal ASCII, each terminated by '\r'.
+ *   10                              temperature, 2 bytes LE in 0.1 °C
+ *   7, start, 0, points, step       reflection scan, frequencies in Hz;
+ *                                   4 bytes per point, phase then
+ *                                   magnitude, both 16 bit LE
+ */
+static constexpr char temperature_command[] = "10\r";
+static constexpr unsigned reflection_scan = 7;
+static constexpr size_t point_size = 4;
+/* points per scan command; temperature reads wait at most one chunk */
+static constexpr unsigned chunk_points = 16;
+static constexpr auto reply_timeout = 2s;
+static constexpr auto temperature_timeout = 5s;
+
+/* magnitude in 0.001 dB of return loss, phase over the full circle */
+static constexpr double counts_per_db = 1000.0;
+static constexpr double counts_per_turn = 65536.0;
+
+std::complex<double> VnaDriver::decode(const uint16_t phase,
+                                       const uint16_t magnitude) {
+  const auto db = -static_cast<double>(magnitude) / counts_per_db;
+  const auto angle = 2.0 * M_PI * static_cast<double>(phase) / counts_per_turn;
+  return std::polar(std::pow(10.0, db / 20.0), angle);
+}
+
+void VnaDriver::encode(const std::complex<double> reflection, uint16_t &phase,
+                       uint16_t &magnitude) {
+  const auto db = 20.0 * std::log10(std::max(std::abs(reflection), 1e-6));
+  const auto counts = std::min(-db * counts_per_db, 65535.0);
+  magnitude = static_cast<uint16_t>(std::max(counts, 0.0) + 0.5);
+  auto angle = std::arg(reflection);
+  if (angle < 0)
+    angle += 2.0 * M_PI;
+  phase = static_cast<uint16_t>(
+      static_cast<uint32_t>(angle / (2.0 * M_PI) * counts_per_turn + 0.5) %
+      65536);
+}
+
+VnaCalibration VnaCalibration::load(const std::string &path) {
+  std::ifstream in(path);
+  if (!in)
+    throw std::runtime_error("Could not open calibration " + path);
+
+  VnaCalibration calibration;
+  std::string line;
+  while (std::getline(in, line)) {
+    const auto comment = line.find('#');
+    if (comment != std::string::npos)
+      line.erase(comment);
+    std::istringstream fields(line);
+    Terms terms;
+    double re[3], im[3];
+    if (!(fields >> terms.frequency))
+      continue;
+    for (size_t i = 0; i < 3; ++i) {
+      if (!(fields >> re[i] >> im[i]))
+        throw std::runtime_error("Invalid calibration line in " + path +
+                                 ": " + line);
+    }
+    terms.directivity = {re[0], im[0]};
+    terms.match = {re[1], im[1]};
+    terms.tracking = {re[2], im[2]};
+    if (!calibration.terms.empty() &&
+        calibration.terms.back().frequency >= terms.frequency)
+      throw std::runtime_error("Calibration frequencies in " + path +
+                               " are not ascending");
+    calibration.terms.push_back(terms);
+  }
+  return calibration;
+}
+
+std::complex<double>
+VnaCalibration::correct(const uint64_t frequency,
+                        const std::complex<double> measured) const {
+  if (terms.empty())
+    return measured;
+
+  auto upper = std::lower_bound(
+      terms.begin(), terms.end(), frequency,
+      [](const Terms &t, const uint64_t f) { return t.frequency < f; });
+  Terms at;
+  if (upper == terms.begin()) {
+    at = terms.front();
+  } else if (upper == terms.end()) {
+    at = terms.back();
+  } else {
+    const auto &lower = *(upper - 1);
+    const auto t = static_cast<double>(frequency - lower.frequency) /
+                   static_cast<double>(upper->frequency - lower.frequency);
+    at.directivity = lower.directivity + t * (upper->directivity -
+                                              lower.directivity);
+    at.match = lower.match + t * (upper->match - lower.match);
+    at.tracking = lower.tracking + t * (upper->tracking - lower.tracking);
+  }
+
+  const auto m = measured - at.directivity;
+  return m / (at.tracking + at.match * m);
+}
+
+namespace {
+struct Active {
+  VnaDriver::Sweep sweep;
+  VnaCalibration calibration;
+  VnaDriver::Receiver receiver;
+  VnaDriver::Done done;
+  unsigned next = 0;
+};
+}
+
+struct VnaDriver::Impl {
+  const std::string device;
+  int fd = -1;
+
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  std::deque<std::shared_ptr<std::promise<double>>> temperatures;
+  std::deque<std::unique_ptr<Active>> sweeps;
+  std::deque<std::promise<void>> releases;
+  bool stopping = false;
+  std::thread thread;
+
+  explicit Impl(std::string device_) : device(std::move(device_)) {
+    thread = std::thread([this] { run(); });
+  }
+
+  ~Impl() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wakeup.notify_all();
+    thread.join();
+    if (fd >= 0)
+      close(fd);
+  }
+
+  void error(const std::string &what) {
+    const auto reason = what + ": " + strerror(errno);
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+    throw std::runtime_error(reason);
+  }
+
+  void open_port() {
+    if (fd >= 0)
+      return;
+    fd = open(device.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0)
+      error("Could not open " + device);
+
+    struct termios tio;
+    if (tcgetattr(fd, &tio) < 0)
+      error("Could not read the settings of " + device);
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, B921600);
+    cfsetospeed(&tio, B921600);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    if (tcsetattr(fd, TCSANOW, &tio) < 0)
+      error("Could not configure " + device);
+    /* the device only answers with request to send; a pty has no RTS */
+    int rts = TIOCM_RTS;
+    ioctl(fd, TIOCMBIS, &rts);
+    tcflush(fd, TCIOFLUSH);
+  }
+
+  void send(const std::string &command) {
+    for (size_t written = 0; written < command.size();) {
+      const auto ret =
+          write(fd, command.data() + written, command.size() - written);
+      if (ret < 0) {
+        if (errno == EINTR)
+          continue;
+        error("Writing to " + device + " failed");
+      }
+      written += static_cast<size_t>(ret);
+    }
+  }
+
+  void receive(uint8_t *buffer, const size_t size) {
+    const auto deadline = steady_clock::now() + reply_timeout;
+    for (size_t received = 0; received < size;) {
+      const auto left =
+          duration_cast<milliseconds>(deadline - steady_clock::now());
+      struct pollfd pfd = {fd, POLLIN, 0};
+      const auto ready =
+          left.count() > 0 ? poll(&pfd, 1, static_cast<int>(left.count())) : 0;
+      if (ready < 0 && errno == EINTR)
+        continue;
+      if (ready <= 0) {
+        errno = ready ? errno : ETIMEDOUT;
+        error("Reading from " + device + " failed");
+      }
+      const auto ret = read(fd, buffer + received, size - received);
+      if (ret < 0 && (errno == EINTR || errno == EAGAIN))
+        continue;
+      if (ret <= 0) {
+        errno = ret ? errno : EIO;
+        error("Reading from " + device + " failed");
+      }
+      received += static_cast<size_t>(ret);
+    }
+  }
+
+  double read_temperature() {
+    open_port();
+    send(temperature_command);
+    std::array<uint8_t, 2> buffer;
+    receive(buffer.data(), buffer.size());
+    const auto raw = static_cast<uint16_t>(buffer[0] | buffer[1] << 8);
+    return static_cast<double>(raw) / 10.0;
+  }
+
+  /* Scans points first to first + count - 1 of the sweep */
+  void scan(Active &active, const unsigned first, const unsigned count) {
+    const auto &sweep = active.sweep;
+    const auto step =
+        sweep.points > 1 ? (sweep.stop - sweep.start) / (sweep.points - 1) : 0;
+    const auto start = sweep.start + first * step;
+
+    open_port();
+    std::ostringstream command;
+    command << reflection_scan << '\r' << start << "\r0\r" << count << '\r'
+            << step << '\r';
+    send(command.str());
+
+    std::array<uint8_t, point_size> buffer;
+    for (unsigned i = 0; i < count; ++i) {
+      receive(buffer.data(), buffer.size());
+      const auto phase = static_cast<uint16_t>(buffer[0] | buffer[1] << 8);
+      const auto magnitude = static_cast<uint16_t>(buffer[2] | buffer[3] << 8);
+      const auto frequency = start + i * step;
+      active.receiver(Point{
+          first + i, frequency,
+          active.calibration.correct(frequency, decode(phase, magnitude))});
+    }
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      wakeup.wait(lock, [this] {
+        return stopping || !temperatures.empty() || !sweeps.empty() ||
+               !releases.empty();
+      });
+      if (stopping)
+        return;
+
+      if (temperatures.empty() && sweeps.empty()) {
+        if (fd >= 0) {
+          close(fd);
+          fd = -1;
+        }
+        for (auto &released : releases)
+          released.set_value();
+        releases.clear();
+        continue;
+      }
+
+      if (!temperatures.empty()) {
+        auto promise = std::move(temperatures.front());
+        temperatures.pop_front();
+        lock.unlock();
+        try {
+          promise->set_value(read_temperature());
+        } catch (...) {
+          promise->set_exception(std::current_exception());
+        }
+        lock.lock();
+        continue;
+      }
+
+      auto &active = *sweeps.front();
+      const auto first = active.next;
+      const auto count = std::min(chunk_points, active.sweep.points - first);
+      lock.unlock();
+
+      std::string failure;
+      try {
+        scan(active, first, count);
+      } catch (const std::exception &e) {
+        failure = e.what();
+      }
+
+      lock.lock();
+      active.next += count;
+      if (failure.empty() && active.next < active.sweep.points)
+        continue;
+      auto finished = std::move(sweeps.front());
+      sweeps.pop_front();
+      lock.unlock();
+      finished->done(failure);
+      lock.lock();
+    }
+  }
+};
+
+VnaDriver::VnaDriver(std::string device)
+    : d(std::make_unique<Impl>(std::move(device))) {}
+VnaDriver::~VnaDriver() = default;
+
+double VnaDriver::temperature() {
+  auto promise = std::make_shared<std::promise<double>>();
+  auto future = promise->get_future();
+  {
+    std::lock_guard<std::mutex> lock(d->mutex);
+    d->temperatures.push_back(std::move(promise));
+  }
+  d->wakeup.notify_all();
+  if (future.wait_for(temperature_timeout) != std::future_status::ready)
+    throw std::runtime_error("VNA temperature read timed out");
+  return future.get();
+}
+
+void VnaDriver::sweep(const Sweep &sweep, VnaCalibration calibration,
+                      Receiver receiver, Done done) {
+  if (sweep.points == 0 || sweep.stop < sweep.start)
+    throw std::invalid_argument("Invalid VNA sweep");
+  auto active = std::make_unique<Active>();
+  active->sweep = sweep;
+  active->calibration = std::move(calibration);
+  active->receiver = std::move(receiver);
+  active->done = std::move(done);
+  {
+    std::lock_guard<std::mutex> lock(d->mutex);
+    d->sweeps.push_back(std::move(active));
+  }
+  d->wakeup.notify_all();
+}
+
+void VnaDriver::release() {
+  std::future<void> released;
+  {
+    std::lock_guard<std::mutex> lock(d->mutex);
+    d->releases.emplace_back();
+    released = d->releases.back().get_future();
+  }
+  d->wakeup.notify_all();
+  released.wait();
+}
+
+TouchstoneWriter::TouchstoneWriter(const std::string &path,
+                                   const std::string &comment)
+    : out(path) {
+  if (!out)
+    throw std::runtime_error("Could not create " + path);
+  out << "! " << comment << "\n# HZ S RI R 50\n";
+  out << std::setprecision(9);
+  out.flush();
+}
+
+void TouchstoneWriter::write(const VnaDriver::Point &point) {
+  out << point.frequency << ' ' << point.reflection.real() << ' '
+      << point.reflection.imag() << '\n';
+  out.flush();
+}
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <complex>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+namespace intex {
+
+/* One-port error terms of a calibration, read from a text file with a line
+ *   frequency[Hz] e00.re e00.im e11.re e11.im e10e01.re e10e01.im
+ * per calibration frequency, in ascending order; # starts a comment. Terms
+ * between calibration frequencies are interpolated linearly. Without terms
+ * readings pass unchanged.
+ */
+class VnaCalibration {
+  struct Terms {
+    uint64_t frequency;
+    std::complex<double> directivity; /* e00 */
+    std::complex<double> match;       /* e11 */
+    std::complex<double> tracking;    /* e10e01 */
+  };
+  std::vector<Terms> terms;
+
+public:
+  /* Throws if the file can not be read */
+  static VnaCalibration load(const std::string &path);
+  std::complex<double> correct(const uint64_t frequency,
+                               const std::complex<double> measured) const;
+};
+
+/* In-process driver for the miniVNA. A single serial session serves
+ * temperature reads and sweeps: sweeps are run in chunks of a few points,
+ * and temperature reads are answered in between. The device is opened on
+ * first use and reopened after an error, so it may come and go with its
+ * supply. The scan framing of decode() has not been checked against the
+ * flight unit, and VnaCalibration does not read vnaJ's calibration files;
+ * until then, the experiment sweeps in vnaJ unless built with
+ * INTEX_VNA_SWEEP, and the driver only reads the temperature.
+ */
+class VnaDriver {
+  struct Impl;
+  std::unique_ptr<Impl> d;
+
+public:
+  struct Sweep {
+    uint64_t start; /* Hz */
+    uint64_t stop;  /* Hz */
+    unsigned points;
+  };
+  struct Point {
+    unsigned index;
+    uint64_t frequency; /* Hz */
+    std::complex<double> reflection;
+  };
+  /* Called on the driver thread as points arrive, calibrated */
+  using Receiver = std::function<void(const Point &)>;
+  /* Called on the driver thread after the last point; error is empty on
+   * success */
+  using Done = std::function<void(const std::string &error)>;
+
+  explicit VnaDriver(std::string device);
+  /* Abandons queued sweeps without calling done */
+  ~VnaDriver();
+  VnaDriver(const VnaDriver &) = delete;
+  VnaDriver &operator=(const VnaDriver &) = delete;
+
+  /* °C; blocks for the next gap between sweep chunks. Throws on errors.
+   * Thread-safe. */
+  double temperature();
+  /* Queues a sweep after the ones already queued. Thread-safe. */
+  void sweep(const Sweep &sweep, VnaCalibration calibration,
+             Receiver receiver, Done done);
+  /* Closes the serial session once the reads and sweeps queued so far are
+   * done, so another program can open the device; the next read or sweep
+   * opens it again. Thread-safe. */
+  void release();
+
+  /* Scan reply of one point, as the device sends it */
+  static std::complex<double> decode(const uint16_t phase,
+                                     const uint16_t magnitude);
+  static void encode(const std::complex<double> reflection, uint16_t &phase,
+                     uint16_t &magnitude);
+};
+
+/* Touchstone 1.1 file of a one-port sweep, written point by point so a
+ * sweep cut short still leaves the points measured so far */
+class TouchstoneWriter {
+  std::ofstream out;
+
+public:
+  /* Throws if the file can not be created */
+  TouchstoneWriter(const std::string &path, const std::string &comment);
+  void write(const VnaDriver::Point &point);
+};
+}
@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <cstdlib>
+
+#include <boost/program_options.hpp>
+
+#include "BitrateController.h"
+
+/* Loopback run of the bitrate controller against a simulated downlink. One
+ * thread per feed plays its RTCP thread: it sends at the rate the controller
+ * last applied through a bottleneck of fixed capacity, which queues and then
+ * drops what exceeds it on top of random loss, and reports back. A third
+ * thread moves the operator ceilings meanwhile. At the end, the rate applied
+ * last must be the controller's, or changes were applied out of order.
+ */
+
+using namespace std::chrono;
+
+using intex::BitrateController;
+using intex::ReceiverReport;
+
+/* bits */
+static constexpr double packet_size = 1200 * 8;
+static constexpr double queue_limit = 64 * packet_size;
+
+/* The bottleneck as seen by one feed over one report interval */
+class Link {
+  const double capacity; /* bit/s */
+  const double loss;     /* 0 … 1 */
+  const double base_rtt; /* s */
+  std::mt19937 random;
+
+public:
+  Link(const double capacity_, const double loss_, const double base_rtt_,
+       const unsigned seed)
+      : capacity(capacity_), loss(loss_), base_rtt(base_rtt_), random(seed) {}
+
+  ReceiverReport report(const double own, const double total,
+                        const double interval) {
+    /* a full bottleneck queue adds its drain time to the round trip */
+    const double excess = std::max(total - capacity, 0.0) * interval;
+    const double queued = std::min(excess, queue_limit);
+    const double overflow = total > 0.0 ? (excess - queued) / total : 0.0;
+
+    const auto packets =
+        std::max(1.0, std::round(own * interval / packet_size));
+    std::binomial_distribution<unsigned> lost(static_cast<unsigned>(packets),
+                                              std::min(loss + overflow, 1.0));
+    std::uniform_real_distribution<double> jitter(0.0, 0.005);
+    return {lost(random) / packets, jitter(random),
+            base_rtt + queued / capacity};
+  }
+};
+
+int main(int argc, char *argv[]) {
+  namespace po = boost::program_options;
+  po::options_description desc("Bitrate controller loopback options");
+  // clang-format off
+  desc.add_options()
+    ("help", "print this help message")
+    ("reports,n", po::value<unsigned>()->default_value(600),
+     "Receiver reports per feed")
+    ("interval", po::value<double>()->default_value(1.0),
+     "Simulated time between receiver reports [s]")
+    ("pace", po::value<unsigned>()->default_value(1),
+     "Real time between receiver reports [ms]")
+    ("capacity,c", po::value<unsigned>()->default_value(1200),
+     "Bottleneck capacity [kbit/s]")
+    ("loss", po::value<double>()->default_value(1.0),
+     "Random packet loss [%]")
+    ("rtt", po::value<unsigned>()->default_value(60),
+     "Round trip time of the empty link [ms]")
+    ("ceilings", "Move the operator ceilings at random meanwhile")
+    ("trace", "Print the rates at every report");
+  // clang-format on
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  const auto reports = vm["reports"].as<unsigned>();
+  const auto interval = vm["interval"].as<double>();
+  const milliseconds pace(vm["pace"].as<unsigned>());
+  const double capacity = vm["capacity"].as<unsigned>() * 1000.0;
+  const bool trace = vm.count("trace") > 0;
+
+  /* the experiment's limits */
+  static constexpr BitrateController::Limits limits{100000, 1500000, 1600000};
+  std::array<std::atomic<uint64_t>, BitrateController::feeds> encoder;
+  for (auto &rate : encoder)
+    rate = 400000;
+  std::atomic<unsigned> changes{0};
+  BitrateController controller(
+      limits, 400000,
+      [&encoder, &changes](const size_t feed, const uint64_t rate) {
+        encoder[feed] = rate;
+        ++changes;
+      });
+
+  /* rates after the first half of the run, when it should have settled */
+  std::array<std::vector<double>, BitrateController::feeds> settled;
+  std::array<std::vector<double>, BitrateController::feeds> losses;
+  std::atomic<bool> running{true};
+
+  std::vector<std::thread> threads;
+  for (size_t feed = 0; feed < BitrateController::feeds; ++feed) {
+    threads.emplace_back([&, feed] {
+      Link link(capacity, vm["loss"].as<double>() / 100.0,
+                vm["rtt"].as<unsigned>() / 1000.0,
+                static_cast<unsigned>(feed + 1));
+      for (unsigned i = 0; i < reports; ++i) {
+        const double own = encoder[feed];
+        const double total = static_cast<double>(encoder[0] + encoder[1]);
+        const auto report = link.report(own, total, interval);
+        controller.report(feed, report);
+        if (i >= reports / 2) {
+          settled[feed].push_back(own);
+          losses[feed].push_back(report.fraction_lost);
+        }
+        if (trace)
+          std::cout << feed << " " << i << " " << own / 1000.0 << " kbit/s, "
+                    << report.fraction_lost * 100.0 << " % lost, "
+                    << report.round_trip * 1000.0 << " ms RTT\n";
+        std::this_thread::sleep_for(pace);
+      }
+    });
+  }
+
+  std::thread operator_([&] {
+    if (!vm.count("ceilings"))
+      return;
+    std::mt19937 random(0);
+    std::uniform_int_distribution<uint64_t> ceiling(0, limits.max);
+    while (running) {
+      for (size_t feed = 0; feed < BitrateController::feeds; ++feed)
+        controller.setCeiling(feed, ceiling(random));
+      std::this_thread::sleep_for(pace * 10);
+    }
+    for (size_t feed = 0; feed < BitrateController::feeds; ++feed)
+      controller.setCeiling(feed, 0);
+  });
+
+  for (auto &thread : threads)
+    thread.join();
+  running = false;
+  operator_.join();
+
+  auto mean = [](const std::vector<double> &values) {
+    double sum = 0.0;
+    for (const auto value : values)
+      sum += value;
+    return values.empty() ? 0.0 : sum / values.size();
+  };
+
+  bool ordered = true;
+  double total = 0.0;
+  for (size_t feed = 0; feed < BitrateController::feeds; ++feed) {
+    const auto rate = mean(settled[feed]);
+    total += rate;
+    std::cout << "Feed " << feed << ": " << rate / 1000.0 << " kbit/s, "
+              << mean(losses[feed]) * 100.0 << " % lost" << std::endl;
+    if (encoder[feed] != controller.bitrate(feed)) {
+      std::cerr << "Feed " << feed << " was left at " << encoder[feed]
+                << " bit/s instead of " << controller.bitrate(feed)
+                << std::endl;
+      ordered = false;
+    }
+  }
+  std::cout << changes << " rate changes; second half uses "
+            << total / capacity * 100.0 << " % of the link" << std::endl;
+  return ordered ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -59,6 +59,7 @@
 #include <gperftools/profiler.h>
 
 #include "intex.capnp.h"
+#include "pipeline-monitor.h"
 
 using boost::asio::ip::tcp;
 
@@ -66,11 +67,16 @@ const char pipeline_fmt[] =
     "v4l2src device=/dev/video%1 name=src ! h264parse ! omxh264dec ! "
     "videoscale ! video/x-raw,width=768,height=432,framerate=30/1 ! "
     "omxh264enc name=encoder target_bitrate=%4 control-rate=variable ! "
-    "rtph264pay config-interval=1 ! udpsink host=%2 port=%3 sync=false";
+    "rtph264pay config-interval=1 ! "
+    "udpsink name=udpsink host=%2 port=%3 sync=false";
 
 class stream : public QObject {
   Q_OBJECT
   QGst::PipelinePtr pipeline;
+  intex::PipelineMonitor monitor;
+  size_t downlink;
+  /* buffers dropped for QoS, as last logged */
+  guint64 dropped = 0;
 
 public:
   stream(QString device, QString host, QString port,
@@ -79,6 +85,9 @@ public:
         QString(pipeline_fmt).arg(device, host, port, QString::number(bitrate));
     qCritical() << fmt;
     pipeline = QGst::Parse::launch(fmt).dynamicCast<QGst::Pipeline>();
+    monitor.watchEncoder(pipeline->getElementByName("encoder"));
+    downlink = monitor.watchRate(
+        pipeline->getElementByName("udpsink")->getStaticPad("sink"));
   }
 
   ~stream() { pipeline->setState(QGst::StateNull); }
@@ -90,79 +99,53 @@ public:
     QGlib::connect(pipeline->bus(), "message", this, &stream::onBusMessage);
   }
 
+  /* Also reports how the previous bitrate fared */
   void set_stream_bitrate(unsigned bitrate) {
+    const auto sample = monitor.sample();
+    const auto &encoder = sample.encoders.front();
+    std::cout << "Encoded " << encoder.frames << " frames in "
+              << encoder.mean.count() / 1000.0 << " ms (max "
+              << encoder.max.count() / 1000.0 << " ms), sent "
+              << sample.rates[downlink] / 1000.0 << " kB/s" << std::endl;
     std::cout << "Setting bitrate: " << bitrate << std::endl;
     pipeline->getElementByName("encoder")
         ->setProperty("target-bitrate", bitrate);
   }
 
 private Q_SLOTS:
+  /* Only what needs attention: errors, warnings and dropped frames */
   void onBusMessage(const QGst::MessagePtr &message) {
-    bool run = message->type() != QGst::MessageError &&
-               message->type() != QGst::MessageEos;
-    qCritical() << message->typeName();
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wswitch-enum"
     switch (message->type()) {
-    case QGst::MessageUnknown:
-      break;
     case QGst::MessageEos:
+      qCritical() << "End of stream";
       break;
     case QGst::MessageError:
       qCritical() << message.dynamicCast<QGst::ErrorMessage>()->debugMessage();
       break;
     case QGst::MessageWarning:
-      qCritical()
+      qWarning()
           << message.dynamicCast<QGst::WarningMessage>()->debugMessage();
       break;
-    case QGst::MessageInfo:
-      qCritical() << message.dynamicCast<QGst::InfoMessage>()->debugMessage();
-      break;
-    case QGst::MessageTag:
-      break;
-    case QGst::MessageBuffering:
-      break;
-    case QGst::MessageStateChanged:
-      break;
-    case QGst::MessageStateDirty:
-      break;
-    case QGst::MessageStepDone:
-      break;
-    case QGst::MessageClockProvide:
-      break;
-    case QGst::MessageClockLost:
-      break;
-    case QGst::MessageNewClock:
-      break;
-    case QGst::MessageStructureChange:
-      break;
-    case QGst::MessageStreamStatus:
-      break;
-    case QGst::MessageApplication:
+    case QGst::MessageQos: {
+      GstFormat format;
+      guint64 processed = 0, total = 0;
+      gst_message_parse_qos_stats(static_cast<GstMessage *>(message), &format,
+                                  &processed, &total);
+      if (format != GST_FORMAT_BUFFERS || total <= dropped)
+        break;
+      qWarning() << message->source()->name() << "dropped" << total - dropped
+                 << "buffers," << total << "of" << processed + total
+                 << "so far";
+      dropped = total;
       break;
-    case QGst::MessageElement:
-      break;
-    case QGst::MessageSegmentStart:
-      break;
-    case QGst::MessageSegmentDone:
-      break;
-    case QGst::MessageDurationChanged:
-      break;
-    case QGst::MessageLatency:
-      break;
-    case QGst::MessageAsyncStart:
-      break;
-    case QGst::MessageAsyncDone:
-      break;
-    case QGst::MessageRequestState:
-      break;
-    case QGst::MessageStepStart:
-      break;
-    case QGst::MessageQos:
-      break;
-    case QGst::MessageAny:
+    }
+    default:
       break;
     }
+#pragma clang diagnostic pop
   }
-
 };
 
 static std::tuple<QString, QString> read_start(tcp::socket &socket) {
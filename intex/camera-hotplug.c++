@@ -0,0 +1,273 @@
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <cstdlib>
+
+#include <QDir>
+#include <QFile>
+#include <QString>
+#include <QTemporaryDir>
+
+#include "sysfs.h"
+
+/* Replays a camera dropping off the USB bus and coming back against a fake
+ * sysfs tree, feeding the camera registry the uevents the kernel would send,
+ * and checks the cameras it reports and how soon it reports them.
+ */
+
+using namespace std::chrono;
+using namespace std::literals::chrono_literals;
+
+static constexpr char usb_path[] =
+    "/devices/platform/soc/3f980000.usb/usb1/1-1";
+
+namespace {
+struct Camera {
+  QString port;
+  int video;
+  int card;
+};
+
+class Bus {
+  const QString devices;
+
+  QString path(const QString &port) const { return devices + "/" + port; }
+
+  static void touch(const QString &file, const QString &content) {
+    QFile out(file);
+    if (!out.open(QIODevice::WriteOnly))
+      throw std::runtime_error("Could not create " + file.toStdString());
+    out.write(content.toLatin1());
+  }
+
+public:
+  explicit Bus(const QString &root) : devices(root + "/bus/usb/devices") {
+    QDir().mkpath(devices);
+  }
+
+  void device(const QString &port, const QString &product) {
+    QDir().mkpath(path(port));
+    touch(path(port) + "/product", product + "\n");
+  }
+  void interfaces(const Camera &camera) {
+    QDir().mkpath(path(camera.port) + "/" + camera.port + ":1.0");
+    QDir().mkpath(path(camera.port) + "/" + camera.port + ":1.2");
+  }
+  void video(const Camera &camera) {
+    QDir().mkpath(path(camera.port) + "/" + camera.port +
+                  ":1.0/video4linux/video" + QString::number(camera.video));
+  }
+  void sound(const Camera &camera) {
+    QDir().mkpath(path(camera.port) + "/" + camera.port + ":1.2/sound/card" +
+                  QString::number(camera.card));
+  }
+  void plug(const Camera &camera) {
+    device(camera.port, "HD Pro Webcam C920");
+    interfaces(camera);
+    video(camera);
+    sound(camera);
+  }
+  void unplug(const Camera &camera) {
+    QDir(path(camera.port)).removeRecursively();
+  }
+};
+
+/* Sends the uevents of the camera's devices, children last on add and first
+ * on remove, as the kernel does */
+class Kernel {
+  intex::CameraRegistry &registry;
+  unsigned seqnum = 1000;
+
+  void send(const std::string &action, const std::string &devpath,
+            const std::string &subsystem) {
+    std::string message = action + "@" + devpath;
+    message.push_back('\0');
+    for (const auto &field :
+         {"ACTION=" + action, "DEVPATH=" + devpath, "SUBSYSTEM=" + subsystem,
+          "SEQNUM=" + std::to_string(seqnum++)}) {
+      message += field;
+      message.push_back('\0');
+    }
+    registry.uevent(message.data(), message.size());
+  }
+
+public:
+  explicit Kernel(intex::CameraRegistry &registry_) : registry(registry_) {}
+
+  void device(const std::string &action, const Camera &camera) {
+    send(action, usb_path + std::string("/") + camera.port.toStdString(),
+         "usb");
+  }
+  void interfaces(const std::string &action, const Camera &camera) {
+    const auto port = camera.port.toStdString();
+    for (const auto &interface : {":1.0", ":1.2"})
+      send(action, usb_path + ("/" + port) + "/" + port + interface, "usb");
+  }
+  void video(const std::string &action, const Camera &camera) {
+    const auto port = camera.port.toStdString();
+    send(action,
+         usb_path + ("/" + port) + "/" + port + ":1.0/video4linux/video" +
+             std::to_string(camera.video),
+         "video4linux");
+  }
+  void sound(const std::string &action, const Camera &camera) {
+    const auto port = camera.port.toStdString();
+    send(action,
+         usb_path + ("/" + port) + "/" + port + ":1.2/sound/card" +
+             std::to_string(camera.card),
+         "sound");
+  }
+  void remove(const Camera &camera) {
+    sound("remove", camera);
+    video("remove", camera);
+    interfaces("remove", camera);
+    device("remove", camera);
+  }
+};
+
+class Changes {
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<std::pair<int, steady_clock::time_point>> changes;
+
+public:
+  void push(const int camera) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      changes.emplace_back(camera, steady_clock::now());
+    }
+    changed.notify_all();
+  }
+
+  /* Returns the camera, or -1 if there was no change within timeout */
+  int next(const steady_clock::duration timeout,
+           steady_clock::time_point &when) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!changed.wait_for(lock, timeout, [this] { return !changes.empty(); }))
+      return -1;
+    const auto change = changes.front();
+    changes.pop_front();
+    when = change.second;
+    return change.first;
+  }
+};
+}
+
+static int failures = 0;
+
+static void check(const bool ok, const std::string &what) {
+  std::cout << (ok ? "PASS " : "FAIL ") << what << std::endl;
+  if (!ok)
+    ++failures;
+}
+
+static bool has(const intex::CameraRegistry &registry, const int camera,
+                const Camera &expected) {
+  try {
+    const auto device = registry.find(camera);
+    return device.first == "/dev/video" + QString::number(expected.video) &&
+           device.second == "hw:" + QString::number(expected.card);
+  } catch (const std::runtime_error &) {
+    return false;
+  }
+}
+
+static bool missing(const intex::CameraRegistry &registry, const int camera) {
+  try {
+    registry.find(camera);
+    return false;
+  } catch (const std::runtime_error &) {
+    return true;
+  }
+}
+
+static void expect_change(Changes &changes, const int camera,
+                          const steady_clock::time_point since,
+                          const std::string &what) {
+  steady_clock::time_point when;
+  const auto changed = changes.next(2s, when);
+  const auto latency = duration_cast<milliseconds>(when - since).count();
+  check(changed == camera,
+        what + " reported for camera " + std::to_string(changed) +
+            (changed < 0 ? "" : " after " + std::to_string(latency) + " ms"));
+}
+
+static void expect_quiet(Changes &changes, const std::string &what) {
+  steady_clock::time_point when;
+  check(changes.next(500ms, when) < 0, what);
+}
+
+int main() {
+  QTemporaryDir root;
+  if (!root.isValid()) {
+    std::cerr << "Could not create the fake sysfs tree" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const Camera first{"1-1.2", 0, 1};
+  const Camera second{"1-1.3", 2, 2};
+  Bus bus(root.path());
+  bus.device("1-1.1", "USB 2.0 Hub");
+  bus.plug(first);
+  bus.plug(second);
+
+  intex::CameraRegistry registry(root.path(), false);
+  Changes changes;
+  registry.onChange([&changes](const int camera) { changes.push(camera); });
+  Kernel kernel(registry);
+
+  check(has(registry, 0, first) && has(registry, 1, second),
+        "cameras enumerated at startup");
+  check(missing(registry, 2), "no third camera");
+
+  /* the first camera drops off the bus */
+  bus.unplug(first);
+  kernel.remove(first);
+  expect_change(changes, 0, steady_clock::now(), "disconnect");
+  check(missing(registry, 0), "camera 0 gone");
+  check(has(registry, 1, second), "camera 1 keeps its index");
+
+  /* and comes back in stages, with new device numbers */
+  const Camera back{"1-1.2", 4, 3};
+  bus.device(back.port, "HD Pro Webcam C920");
+  kernel.device("add", back);
+  std::this_thread::sleep_for(50ms);
+  bus.interfaces(back);
+  kernel.interfaces("add", back);
+  bus.video(back);
+  kernel.video("add", back);
+  std::this_thread::sleep_for(100ms);
+  bus.sound(back);
+  kernel.sound("add", back);
+  expect_change(changes, 0, steady_clock::now(), "reconnect");
+  check(has(registry, 0, back), "camera 0 found again on its port");
+  expect_quiet(changes, "one change per reconnect");
+
+  /* the second camera moves to another port and takes the free index */
+  bus.unplug(second);
+  kernel.remove(second);
+  expect_change(changes, 1, steady_clock::now(), "disconnect");
+  const Camera moved{"1-1.4", 6, 4};
+  bus.plug(moved);
+  kernel.device("add", moved);
+  kernel.interfaces("add", moved);
+  kernel.video("add", moved);
+  kernel.sound("add", moved);
+  expect_change(changes, 1, steady_clock::now(), "reconnect on a new port");
+  check(has(registry, 1, moved), "camera 1 found on the new port");
+
+  /* other devices do not concern the cameras */
+  bus.device("1-1.5", "USB Flash Disk");
+  kernel.device("add", Camera{"1-1.5", 0, 0});
+  expect_quiet(changes, "other devices ignored");
+
+  registry.onChange(nullptr);
+  std::cout << (failures ? "FAILED" : "OK") << std::endl;
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
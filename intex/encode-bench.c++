@@ -0,0 +1,155 @@
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <cstdlib>
+
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include <QString>
+
+#include <boost/program_options.hpp>
+
+#include "pipeline-builder.h"
+
+/* Compares the CPU load and latency of the two downlink encodings of
+ * VideoStreamSourceControl with videotestsrc standing in for the camera.
+ * Both variants run the same camera-side encode, so the difference between
+ * them is the cost of the second encoder. */
+
+using namespace std::chrono;
+
+using intex::PipelineBuilder;
+using intex::QueueLimits;
+
+static constexpr QueueLimits thread_queue{200, 10 << 20, 1000ms,
+                                          QueueLimits::Leaky::No};
+static constexpr QueueLimits downlink_queue{30, 0, 0ms,
+                                            QueueLimits::Leaky::Downstream};
+
+static QGst::ElementPtr make_encoder(PipelineBuilder &builder,
+                                     const unsigned bitrate) {
+#ifdef BUILD_ON_RASPBERRY
+  return builder.make("omxh264enc",
+                      {{"target-bitrate", QString::number(bitrate)}});
+#else
+  /* x264enc takes kbit/s */
+  const auto kbit = QString::number(bitrate / 1000);
+  return builder.make("x264enc", {{"tune", "zerolatency"},
+                                  {"speed-preset", "ultrafast"},
+                                  {"bitrate", kbit}});
+#endif
+}
+
+static QGst::ElementPtr make_camera(PipelineBuilder &builder) {
+  return builder.chain(
+      {builder.make("videotestsrc", {{"is-live", "true"}, {"pattern", "ball"}}),
+       builder.capsfilter("video/x-raw,format=I420,width=1280,height=720,"
+                          "framerate=30/1")});
+}
+
+static QGst::ElementPtr make_fakesink(PipelineBuilder &builder) {
+  return builder.make("fakesink", {{"sync", "false"}});
+}
+
+static QGst::PipelinePtr reencode() {
+  PipelineBuilder builder("reencode");
+  auto raw = builder.chain({make_camera(builder), builder.make("tee")});
+  builder.chain({raw, builder.queue(thread_queue),
+                 make_encoder(builder, 3000000), builder.make("h264parse"),
+                 make_fakesink(builder)});
+  builder.chain({raw, builder.queue(thread_queue), builder.make("videoscale"),
+                 builder.capsfilter("video/x-raw,width=640,height=360"),
+                 make_encoder(builder, 400000), builder.make("h264parse"),
+                 builder.make("rtph264pay", {{"config-interval", "1"}}),
+                 make_fakesink(builder)});
+  return builder.pipeline();
+}
+
+static QGst::PipelinePtr shared() {
+  PipelineBuilder builder("shared");
+  auto h264 = builder.chain({make_camera(builder),
+                             make_encoder(builder, 3000000),
+                             builder.make("h264parse"), builder.make("tee")});
+  builder.chain({h264, builder.queue(thread_queue), make_fakesink(builder)});
+  builder.chain({h264, builder.queue(downlink_queue),
+                 builder.make("rtph264pay", {{"config-interval", "1"}}),
+                 make_fakesink(builder)});
+  return builder.pipeline();
+}
+
+static double cpu_seconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+         static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) /
+             1e6;
+}
+
+static void run(const char *name, QGst::PipelinePtr pipeline,
+                const seconds measure) {
+  if (pipeline->setState(QGst::StatePlaying) == QGst::StateChangeFailure)
+    throw std::runtime_error(std::string("Could not start ") + name);
+
+  /* let the encoders settle before measuring */
+  std::this_thread::sleep_for(2s);
+  const auto cpu = cpu_seconds();
+  const auto start = steady_clock::now();
+  std::this_thread::sleep_for(measure);
+  const duration<double> wall = steady_clock::now() - start;
+  const auto load = (cpu_seconds() - cpu) / wall.count();
+
+  auto query = QGst::LatencyQuery::create();
+  QString latency("unknown");
+  if (pipeline->query(query)) {
+    latency = QString::number(
+                  static_cast<double>(query->minimumLatency()) / 1e6) +
+              " ms";
+  }
+
+  pipeline->setState(QGst::StateNull);
+  std::cout << name << ": CPU " << load * 100.0 << " %, latency "
+            << latency.toStdString() << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  QGst::init(&argc, &argv);
+
+  namespace po = boost::program_options;
+  po::options_description desc("Downlink encoding benchmark options");
+  // clang-format off
+  desc.add_options()
+    ("help", "Print this help message")
+    ("seconds,s", po::value<unsigned>()->default_value(20),
+     "Measurement time per variant")
+    ("mode,m", po::value<std::string>()->default_value("both"),
+     "Variant to measure: reencode, shared or both");
+  // clang-format on
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  const seconds measure(vm["seconds"].as<unsigned>());
+  const auto mode = vm["mode"].as<std::string>();
+
+  try {
+    if (mode == "reencode" || mode == "both")
+      run("reencode", reencode(), measure);
+    if (mode == "shared" || mode == "both")
+      run("shared", shared(), measure);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <cstdlib>
+
+#include <boost/program_options.hpp>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QString>
+#include <QTemporaryDir>
+
+#include "IntexHardware.h"
+
+/* Toggles the Mini VNA supply pin through the sysfs GPIO backend against a
+ * stand-in sysfs tree (INTEX_SYSFS_ROOT), and checks that the backend opens
+ * the pin's value file once and only writes to it afterwards. Compares the
+ * cost of a toggle with opening the value file for every write.
+ */
+
+using namespace std::chrono;
+
+/* config::mini_vna */
+static constexpr int pin = 20;
+
+static int failures = 0;
+
+static void check(const bool ok, const std::string &what) {
+  std::cout << (ok ? "PASS " : "FAIL ") << what << std::endl;
+  if (!ok)
+    ++failures;
+}
+
+static void touch(const QString &file, const QByteArray &content) {
+  QFile out(file);
+  if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    throw std::runtime_error("Could not create " + file.toStdString());
+  out.write(content);
+}
+
+static QByteArray contents(const QString &file) {
+  QFile in(file);
+  if (!in.open(QIODevice::ReadOnly))
+    return QByteArray();
+  return in.readAll().trimmed();
+}
+
+/* Descriptors of this process open on file */
+static int descriptors(const QString &file) {
+  const auto target = QFileInfo(file).canonicalFilePath();
+  const QDir fds("/proc/self/fd");
+  int count = 0;
+  for (const auto &fd : fds.entryList(QDir::System | QDir::NoDotAndDotDot)) {
+    if (QFileInfo(fds.filePath(fd)).symLinkTarget() == target)
+      ++count;
+  }
+  return count;
+}
+
+static double per_toggle(const steady_clock::duration elapsed,
+                         const unsigned toggles) {
+  return duration_cast<duration<double, std::micro>>(elapsed).count() /
+         toggles;
+}
+
+int main(int argc, char *argv[]) {
+  namespace po = boost::program_options;
+  po::options_description desc("Options");
+  desc.add_options()("help", "Show this help")(
+      "toggles", po::value<unsigned>()->default_value(10000),
+      "Pin toggles per measurement");
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return EXIT_SUCCESS;
+  }
+  const auto toggles = std::max(vm["toggles"].as<unsigned>(), 2u);
+
+  QTemporaryDir root;
+  if (!root.isValid()) {
+    std::cerr << "Could not create the stand-in sysfs tree" << std::endl;
+    return EXIT_FAILURE;
+  }
+  const auto gpio = root.path() + "/class/gpio";
+  const auto pindir = gpio + "/gpio" + QString::number(pin);
+  const auto value = pindir + "/value";
+  QDir().mkpath(pindir);
+  touch(gpio + "/export", "");
+  touch(gpio + "/unexport", "");
+  touch(pindir + "/direction", "in\n");
+  touch(pindir + "/active_low", "1\n");
+  touch(value, "0\n");
+
+  /* before any pin is set up */
+  qputenv("INTEX_SYSFS_ROOT", QFile::encodeName(root.path()));
+  auto &vna = intex::hw::MiniVNA::miniVNA();
+
+  check(contents(pindir + "/direction") == "out", "configured as output");
+  check(contents(pindir + "/active_low") == "0", "configured active high");
+  check(descriptors(value) == 1, "value file opened once");
+
+  auto start = steady_clock::now();
+  for (unsigned i = 0; i < toggles; ++i)
+    vna.set(i % 2 == 0);
+  const auto cached = per_toggle(steady_clock::now() - start, toggles);
+  check(contents(value) == (toggles % 2 ? "1" : "0"), "last toggle written");
+  check(descriptors(value) == 1, "no descriptor opened while toggling");
+
+  /* what the backend did before it kept the file open */
+  const auto name = QFile::encodeName(value).toStdString();
+  start = steady_clock::now();
+  for (unsigned i = 0; i < toggles; ++i) {
+    std::ofstream file(name);
+    file << (i % 2 == 0 ? '1' : '0') << std::endl;
+  }
+  const auto reopened = per_toggle(steady_clock::now() - start, toggles);
+
+  /* a fresh value file is not seen by a backend that never reopens */
+  QFile::remove(value);
+  touch(value, "x");
+  vna.set(true);
+  check(contents(value) == "x", "toggles go to the descriptor opened first");
+
+  std::cout << "Toggle with the cached descriptor: " << cached << " us"
+            << std::endl;
+  std::cout << "Toggle opening the value file: " << reopened << " us"
+            << std::endl;
+  std::cout << (failures ? "FAILED" : "OK") << std::endl;
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,6 +1,11 @@
 #include <iostream>
 
+#include <cstdlib>
+
+#include <netinet/in.h>
+
 #include <QCoreApplication>
+#include <QDebug>
 #include <QObject>
 #include <QTimer>
 #include <QTime>
@@ -45,6 +50,15 @@ static void output(QtMsgType type, const QMessageLogContext &context,
             << ": " << msg.toStdString() << std::endl;
 }
 
+/* All local IPv4 addresses, port 1234 */
+static sockaddr_in rpc_address() {
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(1234);
+  return address;
+}
+
 int main(int argc, char *argv[]) {
   QGst::init(&argc, &argv);
   QCoreApplication application(argc, argv);
@@ -66,7 +80,8 @@ int main(int argc, char *argv[]) {
     ("help", "print this help message")
     ("debug", "Enable debug mode")
     ("host", po::value<std::string>()->default_value(intex_host()),
-     "InTex groundstation host");
+     "InTex groundstation host")
+    ("rpc-thread", "Serve RPC from its own thread instead of the Qt loop");
   // clang-format on
 
   po::variables_map vm;
@@ -77,9 +92,44 @@ int main(int argc, char *argv[]) {
             vm);
   po::notify(vm);
 
-  QTimer::singleShot(0, [&vm] {
-    auto instance = kj::heap<InTexServer>(
-        QString::fromStdString(vm["host"].as<std::string>()));
+  /* scan the data directories now, not when a video segment rolls over */
+  intex::initializeStorage();
+
+  const auto host = QString::fromStdString(vm["host"].as<std::string>());
+
+  if (vm.count("rpc-thread")) {
+    intex::rpc::EzRpcThread rpc;
+    /* the server stays on the Qt thread, capnp only borrows it */
+    InTexServer instance(host, &rpc);
+    server_instance = &instance;
+    kj::Own<intex::rpc::EzRpcServer> server;
+    try {
+      /* bound before anything is served, so a taken port ends it here */
+      rpc.call([&server, &instance] {
+        kj::Own<InTexServer> borrowed(&instance, kj::NullDisposer::instance);
+        auto address = rpc_address();
+        server = kj::heap<intex::rpc::EzRpcServer>(
+            kj::mv(borrowed), reinterpret_cast<sockaddr *>(&address),
+            sizeof(address));
+      });
+    } catch (const kj::Exception &e) {
+      qCritical() << "Could not serve RPC:" << e.getDescription().cStr();
+      server_instance = nullptr;
+      return EXIT_FAILURE;
+    } catch (const std::exception &e) {
+      qCritical() << "Could not serve RPC:" << e.what();
+      server_instance = nullptr;
+      return EXIT_FAILURE;
+    }
+    application.exec();
+    /* connections are torn down on the thread serving them */
+    rpc.post([&server] { server = nullptr; });
+    rpc.stop();
+    return 0;
+  }
+
+  QTimer::singleShot(0, [&host] {
+    auto instance = kj::heap<InTexServer>(host);
     server_instance = instance.get();
     intex::rpc::EzRpcServer server(kj::mv(instance), "*", 1234);
     auto &waitScope = server.getWaitScope();
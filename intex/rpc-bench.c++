@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include <cstdlib>
+
+#include <QCoreApplication>
+#include <QObject>
+#include <QTimer>
+
+#include <boost/program_options.hpp>
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wnon-virtual-dtor"
+#pragma clang diagnostic ignored "-Wweak-vtables"
+#include "rpc/intex.capnp.h"
+#pragma clang diagnostic pop
+
+#include "rpc/ez-rpc.h"
+
+/* Measures the round trip of Command requests while the Qt main loop is kept
+ * busy the way pipeline and hardware code keeps the experiment's, with the
+ * server either pumped by the Qt loop or on its own RPC thread. On the RPC
+ * thread, requests are answered from the Qt thread like the experiment's
+ * handlers that touch its control, or directly like its thread-safe ones.
+ * The client always runs on a thread of its own.
+ */
+
+using namespace std::chrono;
+
+/* Answers setVolume, on the RPC thread or by a hop to the Qt thread */
+class BenchServer final : public Command::Server {
+  intex::rpc::EzRpcThread *rpc;
+
+public:
+  explicit BenchServer(intex::rpc::EzRpcThread *rpc) : rpc(rpc) {}
+
+  kj::Promise<void> setVolume(SetVolumeContext) override {
+    if (!rpc)
+      return kj::READY_NOW;
+    return rpc->callOnQt([] {});
+  }
+};
+
+static kj::Promise<void> measure(Command::Client command,
+                                 std::vector<nanoseconds> &latencies,
+                                 const unsigned remaining) {
+  if (!remaining)
+    return kj::READY_NOW;
+
+  auto request = command.setVolumeRequest();
+  request.setFeed(InTexFeed::FEED0);
+  request.setVolume(1.0f);
+  const auto start = steady_clock::now();
+  return request.send().then(
+      [command, &latencies, remaining, start](auto &&) {
+        latencies.push_back(
+            duration_cast<nanoseconds>(steady_clock::now() - start));
+        return measure(command, latencies, remaining - 1);
+      });
+}
+
+static double ms(const nanoseconds ns) {
+  return static_cast<double>(ns.count()) / 1e6;
+}
+
+static void print(std::vector<nanoseconds> &latencies) {
+  if (latencies.empty()) {
+    std::cout << "no requests completed" << std::endl;
+    return;
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  auto at = [&latencies](const double p) {
+    const auto last = static_cast<double>(latencies.size() - 1);
+    return latencies[static_cast<size_t>(p * last + 0.5)];
+  };
+  nanoseconds total{0};
+  for (const auto latency : latencies)
+    total += latency;
+  const auto mean = total / static_cast<nanoseconds::rep>(latencies.size());
+
+  std::cout << latencies.size() << " requests, latency mean " << ms(mean)
+            << " ms, p50 " << ms(at(0.5)) << " ms, p99 " << ms(at(0.99))
+            << " ms, max " << ms(latencies.back()) << " ms" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  QCoreApplication application(argc, argv);
+
+  namespace po = boost::program_options;
+  po::options_description desc("RPC latency benchmark options");
+  // clang-format off
+  desc.add_options()
+    ("help", "print this help message")
+    ("requests,n", po::value<unsigned>()->default_value(1000),
+     "Number of requests")
+    ("load,l", po::value<unsigned>()->default_value(20),
+     "Time the main loop is kept busy at once [ms]")
+    ("period,p", po::value<unsigned>()->default_value(50),
+     "Time between busy spells of the main loop [ms]")
+    ("port", po::value<unsigned>()->default_value(12345), "Server port")
+    ("thread", "Serve from an RPC thread instead of the Qt loop")
+    ("direct", "With --thread, answer on the RPC thread, without the hop");
+  // clang-format on
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  const auto requests = vm["requests"].as<unsigned>();
+  const milliseconds load(vm["load"].as<unsigned>());
+  const auto port = vm["port"].as<unsigned>();
+  const bool threaded = vm.count("thread") > 0;
+
+  QTimer busy;
+  QObject::connect(&busy, &QTimer::timeout, [load] {
+    const auto until = steady_clock::now() + load;
+    while (steady_clock::now() < until) {
+    }
+  });
+  busy.start(static_cast<int>(vm["period"].as<unsigned>()));
+
+  intex::rpc::EzRpcThread server_thread;
+  kj::Own<intex::rpc::EzRpcServer> server;
+  if (threaded) {
+    auto hop = vm.count("direct") ? nullptr : &server_thread;
+    server_thread.post([&server, hop, port] {
+      server = kj::heap<intex::rpc::EzRpcServer>(kj::heap<BenchServer>(hop),
+                                                 "127.0.0.1", port);
+    });
+  } else {
+    server = kj::heap<intex::rpc::EzRpcServer>(kj::heap<BenchServer>(nullptr),
+                                               "127.0.0.1", port);
+  }
+
+  intex::rpc::EzRpcThread client_thread;
+  kj::Own<intex::rpc::EzRpcClient> client;
+  kj::Promise<void> run = nullptr;
+  std::vector<nanoseconds> latencies;
+  client_thread.post([&] {
+    client = kj::heap<intex::rpc::EzRpcClient>("127.0.0.1", port);
+    auto command = client->getMain<Command>();
+    /* the first request waits for the connection */
+    auto request = command.setVolumeRequest();
+    auto done = [&client_thread](const int code) {
+      client_thread.postToQt([code] { QCoreApplication::exit(code); });
+    };
+    run = request.send()
+              .then([command, &latencies, requests](auto &&) {
+                return measure(command, latencies, requests);
+              })
+              .then([done] { done(EXIT_SUCCESS); },
+                    [done](kj::Exception &&e) {
+                      std::cerr << e.getDescription().cStr() << std::endl;
+                      done(EXIT_FAILURE);
+                    })
+              .eagerlyEvaluate(nullptr);
+  });
+
+  const auto result = application.exec();
+  busy.stop();
+
+  client_thread.post([&] {
+    run = nullptr;
+    client = nullptr;
+  });
+  client_thread.stop();
+  if (threaded) {
+    server_thread.post([&server] { server = nullptr; });
+    server_thread.stop();
+  } else {
+    server = nullptr;
+  }
+
+  std::cout << (!threaded              ? "Qt loop"
+                : vm.count("direct") ? "RPC thread"
+                                     : "RPC thread, hop to Qt")
+            << ", main loop busy "
+            << load.count() << " ms of every " << vm["period"].as<unsigned>()
+            << " ms: ";
+  print(latencies);
+  return result;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace intex {
+
+/* Single-writer/multi-reader snapshot of a trivially copyable value
+ * (sequence lock). The writer never blocks; a reader racing with an update
+ * simply copies again.
+ */
+template <typename T> class Snapshot {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Snapshot requires a trivially copyable type");
+
+  std::atomic<uint32_t> sequence{0};
+  T value_;
+
+public:
+  Snapshot() : value_() {}
+  explicit Snapshot(const T &value) : value_(value) {}
+  Snapshot(const Snapshot &) = delete;
+  Snapshot &operator=(const Snapshot &) = delete;
+
+  void store(const T &value) {
+    const auto seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&value_, &value, sizeof(T));
+    sequence.store(seq + 2, std::memory_order_release);
+  }
+
+  T load() const {
+    T copy;
+    for (;;) {
+      const auto before = sequence.load(std::memory_order_acquire);
+      if (before & 1u)
+        continue;
+      std::memcpy(&copy, &value_, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence.load(std::memory_order_relaxed) == before)
+        return copy;
+    }
+  }
+};
+}
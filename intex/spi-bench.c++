@@ -0,0 +1,367 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <cerrno>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdlib>
+
+#include <linux/types.h>
+extern "C" {
+#include <linux/spi/spidev.h>
+}
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+
+#include <QDir>
+#include <QFile>
+#include <QString>
+#include <QTemporaryDir>
+
+#include "IntexHardware.h"
+
+/* Reads the pressure and temperature sensors against a mock spidev and a
+ * stand-in sysfs tree for their chip selects, and counts the ioctls every
+ * reading costs. The mock is a regular file opened through INTEX_SPIDEV;
+ * this program's ioctl() answers the calls made on it, emulating the
+ * ADS1248's register file and conversions and a pressure sensor at mid
+ * scale. Any other ioctl goes to the kernel. The ADS1248's DRDY pin reports
+ * a result ready, unless it is held high to let a read time out.
+ */
+
+using namespace std::chrono;
+using intex::hw::PressureSensor;
+using intex::hw::TemperatureSensor;
+
+/* Chip selects, see config::gpio */
+static constexpr int ads1248_cs = 18;
+static constexpr int ads1248_reset = 23;
+static constexpr int ads1248_drdy = 22;
+static constexpr std::array<int, 3> pressure_cs = {{4, 27, 17}};
+
+/* conversion result of a temperature, inverse of ads1248_driver::read_data */
+static uint32_t ads1248_counts(const double temperature) {
+  return static_cast<uint32_t>(
+      std::lround(temperature * 0.0005 * 0.385 / 2.02097e-9));
+}
+
+/* what the mock reports per MUX0 setting */
+static double ads1248_temperature(const uint8_t mux0) {
+  switch (mux0) {
+  case 0x13:
+    return 21.0; /* inner ring */
+  case 0x25:
+    return 22.0; /* outer ring */
+  case 0x01:
+    return 23.0; /* atmosphere */
+  default:
+    return -100.0;
+  }
+}
+
+namespace {
+class MockSpidev {
+  const QString gpio;
+  struct stat file;
+
+  uint32_t mode = 0;
+  uint8_t bpw = 0;
+  uint32_t speed = 0;
+  /* ADS1248 registers 0x0 - 0xe */
+  std::array<uint8_t, 15> registers{};
+
+  bool selected(const int pin) const {
+    QFile value(gpio + "/gpio" + QString::number(pin) + "/value");
+    char c = '0';
+    return value.open(QIODevice::ReadOnly) && value.getChar(&c) && c == '1';
+  }
+
+  void reset() {
+    registers.fill(0);
+    registers[0x0] = 0x01;
+    registers[0xa] = 0x90;
+    registers[0xb] = 0xff;
+  }
+
+  void ads1248(const uint8_t *tx, uint8_t *rx, const uint32_t len) {
+    const uint8_t command = tx[0];
+    if (command == 0x06) {
+      reset();
+    } else if ((command & 0xf0) == 0x20 && len > 2) {
+      const size_t first = command & 0xf;
+      for (size_t i = 0; i < len - 2u && first + i < registers.size(); ++i)
+        rx[2 + i] = registers[first + i];
+    } else if ((command & 0xf0) == 0x40 && len > 2) {
+      const size_t first = command & 0xf;
+      for (size_t i = 0; i < len - 2u && first + i < registers.size(); ++i)
+        registers[first + i] = tx[2 + i];
+      counters.registers += len - 2u;
+    } else if (command == 0xff && len == 3) {
+      const auto counts = ads1248_counts(ads1248_temperature(registers[0]));
+      rx[0] = static_cast<uint8_t>(counts >> 16);
+      rx[1] = static_cast<uint8_t>(counts >> 8);
+      rx[2] = static_cast<uint8_t>(counts);
+    }
+  }
+
+  int transfer(const struct spi_ioc_transfer *segments, const size_t count) {
+    ++counters.messages;
+    counters.segments += count;
+    const bool adc = selected(ads1248_cs);
+    const bool pressure =
+        std::any_of(pressure_cs.begin(), pressure_cs.end(),
+                    [this](const int pin) { return selected(pin); });
+    int transferred = 0;
+    for (size_t i = 0; i < count; ++i) {
+      const auto *tx = reinterpret_cast<const uint8_t *>(segments[i].tx_buf);
+      auto *rx = reinterpret_cast<uint8_t *>(segments[i].rx_buf);
+      const auto len = segments[i].len;
+      transferred += static_cast<int>(len);
+      if (!rx)
+        continue;
+      std::fill(rx, rx + len, 0);
+      if (adc) {
+        ads1248(tx, rx, len);
+      } else if (pressure && len >= 2) {
+        /* status normal, 8192 counts */
+        rx[0] = 0x20;
+      }
+    }
+    return transferred;
+  }
+
+public:
+  struct Counters {
+    unsigned configuration; /* mode, word size and speed set or read */
+    unsigned messages;      /* SPI_IOC_MESSAGE */
+    unsigned segments;
+    unsigned registers; /* ADS1248 registers written */
+  };
+  Counters counters{};
+
+  MockSpidev(const QString &path, const QString &gpio_) : gpio(gpio_) {
+    if (stat(QFile::encodeName(path).constData(), &file) < 0)
+      throw std::runtime_error("Could not create mock spidev");
+    reset();
+  }
+
+  bool owns(const int fd) const {
+    struct stat st;
+    return fstat(fd, &st) == 0 && st.st_dev == file.st_dev &&
+           st.st_ino == file.st_ino;
+  }
+
+  int ioctl(const unsigned long request, void *arg) {
+    switch (request) {
+    case SPI_IOC_WR_MODE32:
+      ++counters.configuration;
+      mode = *static_cast<const uint32_t *>(arg);
+      return 0;
+    case SPI_IOC_RD_MODE32:
+      ++counters.configuration;
+      *static_cast<uint32_t *>(arg) = mode;
+      return 0;
+    case SPI_IOC_WR_BITS_PER_WORD:
+      ++counters.configuration;
+      bpw = *static_cast<const uint8_t *>(arg);
+      return 0;
+    case SPI_IOC_RD_BITS_PER_WORD:
+      ++counters.configuration;
+      *static_cast<uint8_t *>(arg) = bpw;
+      return 0;
+    case SPI_IOC_WR_MAX_SPEED_HZ:
+      ++counters.configuration;
+      speed = *static_cast<const uint32_t *>(arg);
+      return 0;
+    case SPI_IOC_RD_MAX_SPEED_HZ:
+      ++counters.configuration;
+      *static_cast<uint32_t *>(arg) = speed;
+      return 0;
+    default:
+      break;
+    }
+    if (_IOC_TYPE(request) == SPI_IOC_MAGIC && _IOC_NR(request) == 0 &&
+        _IOC_DIR(request) == _IOC_WRITE) {
+      return transfer(static_cast<const struct spi_ioc_transfer *>(arg),
+                      _IOC_SIZE(request) / sizeof(struct spi_ioc_transfer));
+    }
+    errno = ENOTTY;
+    return -1;
+  }
+};
+}
+
+static MockSpidev *mock = nullptr;
+
+extern "C" int ioctl(int fd, unsigned long request, ...) __THROW {
+  va_list args;
+  va_start(args, request);
+  void *arg = va_arg(args, void *);
+  va_end(args);
+  if (mock && mock->owns(fd))
+    return mock->ioctl(request, arg);
+  return static_cast<int>(syscall(SYS_ioctl, fd, request, arg));
+}
+
+static int failures = 0;
+
+static void check(const bool ok, const std::string &what) {
+  std::cout << (ok ? "PASS " : "FAIL ") << what << std::endl;
+  if (!ok)
+    ++failures;
+}
+
+static void touch(const QString &file, const QByteArray &content) {
+  QFile out(file);
+  if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    throw std::runtime_error("Could not create " + file.toStdString());
+  out.write(content);
+}
+
+static void pin(const QString &gpio, const int number) {
+  const auto dir = gpio + "/gpio" + QString::number(number);
+  QDir().mkpath(dir);
+  touch(dir + "/direction", "in\n");
+  touch(dir + "/active_low", "0\n");
+  touch(dir + "/value", "0\n");
+}
+
+/* Counts the ioctls of read, printing them with its duration */
+static MockSpidev::Counters profile(const std::string &what,
+                                    std::function<void()> read) {
+  mock->counters = MockSpidev::Counters{};
+  const auto start = steady_clock::now();
+  read();
+  const auto elapsed = duration_cast<microseconds>(steady_clock::now() - start);
+  const auto counters = mock->counters;
+  std::cout << what << ": " << counters.configuration
+            << " configuration ioctls, " << counters.messages
+            << " messages of " << counters.segments << " segments, "
+            << counters.registers << " registers written, "
+            << elapsed.count() / 1000.0 << " ms" << std::endl;
+  return counters;
+}
+
+int main(int argc, char *argv[]) {
+  namespace po = boost::program_options;
+  po::options_description desc("Options");
+  desc.add_options()("help", "Show this help")(
+      "reads", po::value<unsigned>()->default_value(9),
+      "Temperature reads after the first, round robin over the sensors")(
+      "samples", po::value<unsigned>()->default_value(4),
+      "SPI reads per pressure reading");
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return EXIT_SUCCESS;
+  }
+  const auto samples = vm["samples"].as<unsigned>();
+
+  QTemporaryDir root;
+  if (!root.isValid()) {
+    std::cerr << "Could not create the stand-in sysfs tree" << std::endl;
+    return EXIT_FAILURE;
+  }
+  const auto gpio = root.path() + "/class/gpio";
+  QDir().mkpath(gpio);
+  touch(gpio + "/export", "");
+  touch(gpio + "/unexport", "");
+  for (const auto number : pressure_cs)
+    pin(gpio, number);
+  pin(gpio, ads1248_cs);
+  pin(gpio, ads1248_reset);
+  pin(gpio, ads1248_drdy);
+  const auto spidev = root.path() + "/spidev0.0";
+  touch(spidev, "");
+
+  /* before the bus and any pin are opened */
+  qputenv("INTEX_SYSFS_ROOT", QFile::encodeName(root.path()));
+  qputenv("INTEX_SPIDEV", QFile::encodeName(spidev));
+  MockSpidev device(spidev, gpio);
+  mock = &device;
+
+  const PressureSensor::Filter filter{samples, false, 1.0};
+  auto &tank = PressureSensor::tank();
+  auto &antenna = PressureSensor::antenna();
+  tank.setFilter(filter);
+  antenna.setFilter(filter);
+
+  auto counters = profile("First pressure read", [&] { tank.measure(); });
+  check(counters.configuration == 6, "bus configured for the first read");
+  check(counters.messages == samples, "one ioctl per pressure sample");
+  counters = profile("Second pressure read", [&] { tank.measure(); });
+  check(counters.configuration == 0, "configuration kept between reads");
+  counters = profile("Other pressure sensor", [&] { antenna.measure(); });
+  check(counters.configuration == 0, "same settings, no reconfiguration");
+
+  using Sensor = TemperatureSensor::Sensor;
+  static constexpr Sensor order[] = {Sensor::InnerRing, Sensor::OuterRing,
+                                     Sensor::Atmosphere};
+  static constexpr double expected[] = {21.0, 22.0, 23.0};
+  auto &adc = TemperatureSensor::temperatureSensor();
+  double temperature = 0.0;
+  counters = profile("First temperature read", [&] {
+    temperature = adc.temperature(order[0]);
+  });
+  check(counters.configuration == 6, "bus reconfigured for the ADS1248");
+  check(std::abs(temperature - expected[0]) < 0.01,
+        "first temperature " + std::to_string(temperature));
+
+  bool steady = true;
+  for (unsigned i = 1; i <= vm["reads"].as<unsigned>(); ++i) {
+    const auto n = i % 3;
+    counters = profile("Temperature read", [&] {
+      temperature = adc.temperature(order[n]);
+    });
+    /* the data, then the next sensor's MUX0 and IDAC1 */
+    steady = steady && counters.configuration == 0 &&
+             counters.messages == 2 && counters.registers == 2 &&
+             std::abs(temperature - expected[n]) < 0.01;
+  }
+  check(steady, "two ioctls per temperature, only changed registers written");
+
+  /* a conversion that never finishes */
+  const auto drdy = gpio + "/gpio" + QString::number(ads1248_drdy) + "/value";
+  touch(drdy, "1\n");
+  bool timed_out = false;
+  std::thread waiting([&] {
+    try {
+      adc.temperature(order[0]);
+    } catch (const std::runtime_error &e) {
+      std::cout << e.what() << std::endl;
+      timed_out = true;
+    }
+  });
+  /* the ADS1248 waits for its conversion without holding the bus */
+  std::this_thread::sleep_for(50ms);
+  const auto start = steady_clock::now();
+  tank.measure();
+  const auto blocked =
+      duration_cast<microseconds>(steady_clock::now() - start);
+  waiting.join();
+  check(timed_out, "read waits for DRDY and gives up");
+  check(blocked < 50ms, "pressure read while the ADS1248 waits, " +
+                            std::to_string(blocked.count()) + " us");
+  touch(drdy, "0\n");
+  profile("Read after DRDY came back", [&] {
+    temperature = adc.temperature(order[0]);
+  });
+  check(std::abs(temperature - expected[0]) < 0.01, "read after a timeout");
+
+  mock = nullptr;
+  std::cout << (failures ? "FAILED" : "OK") << std::endl;
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,3 +1,23 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
 #include <QDebug>
 #include <QDir>
 #include <QFile>
@@ -5,13 +25,19 @@
 #include <QRegularExpression>
 #include <QStringList>
 #include <QTextStream>
-#include <QVector>
-
-#include <stdexcept>
+#include <QtGlobal>
 
 #include "sysfs.h"
 
 using device_t = QPair<QString, QString>;
+using namespace std::chrono;
+using namespace std::literals::chrono_literals;
+
+/* A camera announces its USB device, its interfaces, its video device and
+ * its sound card in separate uevents; it is inspected once they stop */
+static constexpr auto settle_time = 100ms;
+/* kernel uevents are at most a few KiB */
+static constexpr size_t uevent_size = 8192;
 
 static bool is_webcam(QDir &directory) {
   QFileInfo file(directory, "product");
@@ -90,26 +116,307 @@ static auto each_interface(QDir& directory) {
   return devices;
 }
 
-static auto enumerate_webcams() {
-  auto dir = QDir("/sys/bus/usb/devices");
+/* Setting INTEX_SYSFS_ROOT stands in a directory tree for sysfs, e.g. for
+ * running off-target. */
+static QString sysfs_root() {
+  return qEnvironmentVariableIsSet("INTEX_SYSFS_ROOT")
+             ? QString(qgetenv("INTEX_SYSFS_ROOT"))
+             : QString("/sys");
+}
 
-  QVector<device_t> webcams;
+/* Returns whether the USB device below devices is a complete webcam */
+static bool inspect(QDir devices, const QString &port, device_t &device) {
+  if (!devices.cd(port) || !is_webcam(devices))
+    return false;
+  try {
+    device = each_interface(devices);
+    return true;
+  } catch (const std::runtime_error &) {
+    /* still enumerating, or going away */
+    return false;
+  }
+}
 
-  for (const auto &hub : dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
-    dir.cd(hub);
-    if (is_webcam(dir))
-      webcams += each_interface(dir);
-    dir.cdUp();
+/* USB device of a uevent's DEVPATH, e.g. 1-1.2 of
+ * /devices/.../usb1/1-1/1-1.2/1-1.2:1.0/video4linux/video0 */
+static QString usb_port(const QString &devpath) {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wexit-time-destructors"
+  static const QRegularExpression port_pattern("^\\d+-\\d+(\\.\\d+)*$");
+#pragma clang diagnostic pop
+  QString port;
+  for (const auto &component : devpath.split('/', QString::SkipEmptyParts)) {
+    if (port_pattern.match(component).hasMatch())
+      port = component;
   }
+  return port;
+}
+
+namespace intex {
 
-  return webcams;
+namespace {
+struct Slot {
+  QString port;
+  device_t device;
+  bool present;
+};
 }
 
-QPair<QString, QString> findDevice(int idx) {
-  auto devices = enumerate_webcams();
+struct CameraRegistry::Impl {
+  using clock = steady_clock;
+
+  const QDir devices;
+  mutable std::mutex mutex;
+  std::vector<Slot> slots;
+  /* ports with uevents that have not settled, and their latest */
+  std::map<QString, clock::time_point> pending;
+  /* held while the callback runs, so replacing it waits for it */
+  std::mutex changed_mutex;
+  Changed changed;
+  int netlink = -1;
+  int wakeup = -1;
+  bool stopping = false;
+  std::thread thread;
 
-  if (idx < devices.size())
-    return devices.at(idx);
+  Impl(const QString &root, const bool listen)
+      : devices(root + "/bus/usb/devices") {
+    for (const auto &port :
+         devices.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+      device_t device;
+      if (inspect(devices, port, device))
+        slots.push_back(Slot{port, device, true});
+    }
+
+    wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeup < 0)
+      throw std::runtime_error(std::string("Could not create eventfd: ") +
+                               strerror(errno));
+    if (listen)
+      open_netlink();
+    thread = std::thread([this] { run(); });
+  }
+
+  ~Impl() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake();
+    thread.join();
+    if (netlink >= 0)
+      close(netlink);
+    close(wakeup);
+  }
 
-  throw std::runtime_error("Webcam " + std::to_string(idx) + " not found.");
+  /* Without the socket the cameras found at startup are all there is */
+  void open_netlink() {
+    netlink = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+                     NETLINK_KOBJECT_UEVENT);
+    struct sockaddr_nl address;
+    memset(&address, 0, sizeof(address));
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = 1; /* the kernel's, not udev's */
+    if (netlink < 0 ||
+        bind(netlink, reinterpret_cast<struct sockaddr *>(&address),
+             sizeof(address)) < 0) {
+      qWarning() << "Not watching for cameras to come and go:"
+                 << strerror(errno);
+      if (netlink >= 0)
+        close(netlink);
+      netlink = -1;
+    }
+  }
+
+  void wake() {
+    const uint64_t one = 1;
+    if (write(wakeup, &one, sizeof(one)) < 0 && errno != EAGAIN)
+      qCritical() << "Could not wake the camera registry:" << strerror(errno);
+  }
+
+  void receive() {
+    std::array<char, uevent_size> buffer;
+    for (;;) {
+      const auto size = recv(netlink, buffer.data(), buffer.size(),
+                             MSG_DONTWAIT);
+      if (size >= 0) {
+        parse(buffer.data(), static_cast<size_t>(size));
+        continue;
+      }
+      if (errno == EINTR)
+        continue;
+      if (errno == ENOBUFS) {
+        qWarning() << "Missed uevents, inspecting all USB devices";
+        rescan();
+        continue;
+      }
+      if (errno != EAGAIN)
+        qCritical() << "Receiving uevents failed:" << strerror(errno);
+      return;
+    }
+  }
+
+  void parse(const char *message, const size_t size) {
+    QString action, devpath, subsystem;
+    for (size_t i = 0; i < size;) {
+      const auto length = strnlen(message + i, size - i);
+      const auto field = QString::fromLatin1(message + i,
+                                             static_cast<int>(length));
+      i += length + 1;
+      if (field.startsWith("ACTION="))
+        action = field.mid(7);
+      else if (field.startsWith("DEVPATH="))
+        devpath = field.mid(8);
+      else if (field.startsWith("SUBSYSTEM="))
+        subsystem = field.mid(10);
+    }
+
+    if (subsystem != "usb" && subsystem != "video4linux" &&
+        subsystem != "sound")
+      return;
+    if (action != "add" && action != "remove" && action != "bind" &&
+        action != "unbind")
+      return;
+    const auto port = usb_port(devpath);
+    if (port.isEmpty())
+      return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    pending[port] = clock::now();
+  }
+
+  void rescan() {
+    const auto now = clock::now();
+    const auto ports = devices.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &port : ports)
+      pending[port] = now;
+    for (const auto &slot : slots)
+      pending[slot.port] = now;
+  }
+
+  /* Returns the index of the slot that changed, or -1 */
+  int update(const QString &port, const bool found, const device_t &device) {
+    auto slot = std::find_if(slots.begin(), slots.end(),
+                             [&port](auto &&s) { return s.port == port; });
+    if (!found) {
+      if (slot == slots.end() || !slot->present)
+        return -1;
+      slot->present = false;
+      return static_cast<int>(slot - slots.begin());
+    }
+
+    if (slot != slots.end() && slot->present && slot->device == device)
+      return -1;
+    if (slot == slots.end()) {
+      slot = std::find_if(slots.begin(), slots.end(),
+                          [](auto &&s) { return !s.present; });
+    }
+    if (slot == slots.end()) {
+      slots.push_back(Slot{port, device, true});
+      return static_cast<int>(slots.size() - 1);
+    }
+    *slot = Slot{port, device, true};
+    return static_cast<int>(slot - slots.begin());
+  }
+
+  /* Inspects the ports whose uevents have settled; returns the time to
+   * the next one to settle, -1 if there is none */
+  int settle() {
+    const auto now = clock::now();
+    std::vector<QString> ports;
+    auto next = clock::time_point::max();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto it = pending.begin(); it != pending.end();) {
+        if (it->second + settle_time <= now) {
+          ports.push_back(it->first);
+          it = pending.erase(it);
+        } else {
+          next = std::min(next, it->second + settle_time);
+          ++it;
+        }
+      }
+    }
+
+    for (const auto &port : ports) {
+      device_t device;
+      const bool found = inspect(devices, port, device);
+      int camera;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        camera = update(port, found, device);
+      }
+      if (camera < 0)
+        continue;
+      qDebug() << "Camera" << camera << (found ? "connected" : "disconnected")
+               << "on port" << port << device.first << device.second;
+      std::lock_guard<std::mutex> lock(changed_mutex);
+      if (changed)
+        changed(camera);
+    }
+
+    if (next == clock::time_point::max())
+      return -1;
+    const auto left = duration_cast<milliseconds>(next - now).count() + 1;
+    return static_cast<int>(left);
+  }
+
+  void run() {
+    int timeout = -1;
+    for (;;) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping)
+          return;
+      }
+      struct pollfd fds[] = {{wakeup, POLLIN, 0}, {netlink, POLLIN, 0}};
+      const auto ready =
+          poll(fds, static_cast<nfds_t>(netlink >= 0 ? 2 : 1), timeout);
+      if (ready < 0 && errno != EINTR) {
+        qCritical() << "Camera registry failed:" << strerror(errno);
+        return;
+      }
+      if (ready > 0 && fds[0].revents) {
+        uint64_t count;
+        if (read(wakeup, &count, sizeof(count)) < 0 && errno != EAGAIN)
+          qCritical() << "Could not read eventfd:" << strerror(errno);
+      }
+      if (ready > 0 && netlink >= 0 && fds[1].revents)
+        receive();
+      timeout = settle();
+    }
+  }
+};
+
+CameraRegistry::CameraRegistry(const QString &root, const bool listen)
+    : d(std::make_unique<Impl>(root, listen)) {}
+CameraRegistry::~CameraRegistry() = default;
+
+CameraRegistry::Device CameraRegistry::find(const int camera) const {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  const auto index = static_cast<size_t>(camera);
+  if (camera >= 0 && index < d->slots.size() && d->slots[index].present)
+    return d->slots[index].device;
+  throw std::runtime_error("Webcam " + std::to_string(camera) +
+                           " not found.");
+}
+
+void CameraRegistry::onChange(Changed changed) {
+  std::lock_guard<std::mutex> lock(d->changed_mutex);
+  d->changed = std::move(changed);
+}
+
+void CameraRegistry::uevent(const char *message, const size_t size) {
+  d->parse(message, size);
+  d->wake();
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wexit-time-destructors"
+CameraRegistry &CameraRegistry::registry() {
+  static std::unique_ptr<CameraRegistry> instance{new CameraRegistry(
+      sysfs_root(), !qEnvironmentVariableIsSet("INTEX_SYSFS_ROOT"))};
+  return *instance;
+}
+#pragma clang diagnostic pop
 }
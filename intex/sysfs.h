@@ -1,4 +1,52 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+
 #include <QPair>
 #include <QString>
 
-QPair<QString, QString> findDevice(int idx);
+#include <cstddef>
+
+namespace intex {
+
+/* The webcams on the USB bus, each mapped to its video device and ALSA
+ * device, e.g. ("/dev/video0", "hw:1"). The bus is enumerated once; after
+ * that the kernel's uevents keep the map current, so a camera that drops off
+ * the bus and comes back is found again without walking sysfs on every
+ * lookup. A camera keeps its index while it is gone and is given back the
+ * index when it returns on the same port; a camera on a new port takes the
+ * first free index.
+ */
+class CameraRegistry {
+  struct Impl;
+  std::unique_ptr<Impl> d;
+
+public:
+  using Device = QPair<QString, QString>;
+  /* Called on the registry thread when a camera appears or disappears */
+  using Changed = std::function<void(int camera)>;
+
+  /* Enumerates the cameras below root, the mount point of sysfs. With
+   * listen, uevents are received from the kernel; without, only those
+   * passed to uevent() are seen. */
+  CameraRegistry(const QString &root, const bool listen);
+  ~CameraRegistry();
+  CameraRegistry(const CameraRegistry &) = delete;
+  CameraRegistry &operator=(const CameraRegistry &) = delete;
+
+  /* Throws if the camera is not connected. Thread-safe. */
+  Device find(const int camera) const;
+  /* Replaces the callback; waits for a running one, which must not call
+   * onChange. Thread-safe. */
+  void onChange(Changed changed);
+  /* Takes a uevent as the kernel sends it, "ACTION@DEVPATH" followed by
+   * KEY=VALUE fields, each terminated by NUL. Devices it touches are
+   * inspected once their events have settled. Thread-safe. */
+  void uevent(const char *message, const size_t size);
+
+  /* Of /sys, or of INTEX_SYSFS_ROOT, in which case the kernel's uevents do
+   * not apply and are not listened for */
+  static CameraRegistry &registry();
+};
+}
@@ -0,0 +1,179 @@
+#include <chrono>
+#include <complex>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+
+#include "VnaDriver.h"
+
+/* Emulates a miniVNA on a pseudo terminal, so the experiment and the VNA
+ * driver can run without the device: point INTEX_VNA_DEVICE at the
+ * terminal of an experiment built with INTEX_VNA_SWEEP. Temperature reads
+ * are answered with a fixed temperature, and reflection scans with an
+ * antenna modelled as a series resonant circuit. Replies are framed with
+ * VnaDriver::encode, so this exercises the driver's session, chunking and
+ * interleaved reads, not its idea of the device's framing.
+ */
+
+namespace {
+struct Antenna {
+  double resonance; /* Hz */
+  double q;
+  double resistance; /* Ω at resonance */
+
+  std::complex<double> reflection(const double frequency) const {
+    const auto detuning = frequency / resonance - resonance / frequency;
+    const std::complex<double> z(resistance, resistance * q * detuning);
+    return (z - 50.0) / (z + 50.0);
+  }
+};
+}
+
+static void send(const int fd, const void *data, const size_t size) {
+  auto bytes = static_cast<const char *>(data);
+  for (size_t written = 0; written < size;) {
+    const auto ret = write(fd, bytes + written, size - written);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::runtime_error(std::string("Write failed: ") +
+                               strerror(errno));
+    }
+    written += static_cast<size_t>(ret);
+  }
+}
+
+static void scan(const int fd, const Antenna &antenna,
+                 const std::vector<std::string> &args,
+                 const std::chrono::microseconds delay) {
+  const auto start = std::stoull(args[0]);
+  const auto points = std::stoul(args[2]);
+  const auto step = std::stoull(args[3]);
+  for (unsigned long i = 0; i < points; ++i) {
+    std::this_thread::sleep_for(delay);
+    const auto frequency = static_cast<double>(start + i * step);
+    uint16_t phase, magnitude;
+    intex::VnaDriver::encode(antenna.reflection(frequency), phase,
+                             magnitude);
+    const uint8_t reply[] = {
+        static_cast<uint8_t>(phase), static_cast<uint8_t>(phase >> 8),
+        static_cast<uint8_t>(magnitude), static_cast<uint8_t>(magnitude >> 8)};
+    send(fd, reply, sizeof(reply));
+  }
+}
+
+int main(int argc, char *argv[]) {
+  namespace po = boost::program_options;
+  po::options_description desc("miniVNA emulator options");
+  // clang-format off
+  desc.add_options()
+    ("help", "print this help message")
+    ("link", po::value<std::string>(),
+     "Also make the terminal available under this path")
+    ("resonance", po::value<double>()->default_value(435e6),
+     "Resonance frequency of the antenna [Hz]")
+    ("q", po::value<double>()->default_value(30.0),
+     "Quality factor of the antenna")
+    ("resistance", po::value<double>()->default_value(40.0),
+     "Resistance of the antenna at resonance [Ohm]")
+    ("temperature", po::value<double>()->default_value(31.5),
+     "Reported temperature [C]")
+    ("delay", po::value<unsigned>()->default_value(500),
+     "Time to measure a point [us]");
+  // clang-format on
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  const Antenna antenna{vm["resonance"].as<double>(), vm["q"].as<double>(),
+                        vm["resistance"].as<double>()};
+  const auto temperature =
+      static_cast<uint16_t>(vm["temperature"].as<double>() * 10.0 + 0.5);
+  const std::chrono::microseconds delay(vm["delay"].as<unsigned>());
+
+  const int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+    std::perror("Could not create pseudo terminal");
+    return EXIT_FAILURE;
+  }
+  struct termios tio;
+  tcgetattr(master, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(master, TCSANOW, &tio);
+
+  const std::string terminal = ptsname(master);
+  if (vm.count("link")) {
+    const auto link = vm["link"].as<std::string>();
+    unlink(link.c_str());
+    if (symlink(terminal.c_str(), link.c_str()) < 0) {
+      std::perror("Could not create link");
+      return EXIT_FAILURE;
+    }
+  }
+  std::cout << "miniVNA emulator on " << terminal << std::endl;
+
+  /* the driver's open of the terminal is not seen; keep it open ourselves
+   * so reads do not fail while no driver has it open */
+  const int slave = open(terminal.c_str(), O_RDWR | O_NOCTTY);
+
+  std::string token;
+  std::vector<std::string> tokens;
+  for (;;) {
+    char c;
+    const auto ret = read(master, &c, 1);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0) {
+      std::perror("Reading the terminal failed");
+      break;
+    }
+    if (c != '\r') {
+      token.push_back(c);
+      continue;
+    }
+
+    tokens.push_back(token);
+    token.clear();
+    try {
+      if (tokens[0] == "10") {
+        const uint8_t reply[] = {static_cast<uint8_t>(temperature),
+                                 static_cast<uint8_t>(temperature >> 8)};
+        send(master, reply, sizeof(reply));
+        tokens.clear();
+      } else if (tokens[0] == "7") {
+        if (tokens.size() < 5)
+          continue;
+        scan(master, antenna, {tokens.begin() + 1, tokens.end()}, delay);
+        tokens.clear();
+      } else {
+        std::cerr << "Unknown command " << tokens[0] << std::endl;
+        tokens.clear();
+      }
+    } catch (const std::exception &e) {
+      std::cerr << "Invalid command: " << e.what() << std::endl;
+      tokens.clear();
+    }
+  }
+
+  close(slave);
+  close(master);
+  return EXIT_FAILURE;
+}